@@ -0,0 +1,1754 @@
+/**
+ * @file Main_Bench.c
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Benchmarks for the local messenger. Results are printed as they come in and also written
+ * out as JSON, to the path given as the first argument or BENCH_JSON_PATH, so runs can be
+ * compared between releases with bench_compare.py. A second argument picks the groups to run.
+ */
+
+#include <local-messenger.h>
+#include <local-messenger-message-types.h>
+#include <time-out-helper.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+
+/***********************************************************************************/
+/***************************** Defines and Macros **********************************/
+/***********************************************************************************/
+
+//Macro that gets the number of elements supported by the array
+#define ARRAY_MAX_COUNT(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
+
+#define BENCH_NS_PER_SEC 1000000000ULL
+#define BENCH_NS_PER_US 1000ULL
+
+#ifndef BENCH_IDLE_WINDOW_MS
+#define BENCH_IDLE_WINDOW_MS 1000
+#endif //BENCH_IDLE_WINDOW_MS
+
+#ifndef BENCH_WAKE_SAMPLES
+#define BENCH_WAKE_SAMPLES 200
+#endif //BENCH_WAKE_SAMPLES
+
+#define BENCH_WAIT_SPIN_US 200 //!< Spin of the spin then park strategy. Covers the short gap but not the long one
+
+#define BENCH_JOURNAL_PAYLOAD 64 //!< Payload of the journal benchmark
+#define BENCH_JOURNAL_SYNC_EVERY 64 //!< Messages between waits for the disk in the synced journal benchmark
+
+#define BENCH_CONFLATION_KEYS 16 //!< Keys the state updates of the conflation benchmark are spread over
+#define BENCH_CONFLATION_WORK_NS 2000 //!< Time the callback of the conflation benchmark spends on each update
+
+#define BENCH_FANOUT_CHANNELS 4 //!< Channels each message of the fan out benchmark goes to
+
+#ifndef BENCH_SEND_COUNT
+#define BENCH_SEND_COUNT 100000
+#endif //BENCH_SEND_COUNT
+
+#define BENCH_MAX_PAYLOAD 16384
+#define BENCH_MAX_BATCH 512
+#define BENCH_DEFAULT_DISPATCH_BATCH 64
+#define BENCH_MAX_CHANNELS 8
+#define BENCH_MAX_WORKERS 8
+#define BENCH_PING_PONG_CHAINS 64
+#define BENCH_PING_PONG_HOPS 200
+#define BENCH_HANDLER_SPINS 20000
+#define BENCH_CONTROL_SAMPLES 200
+#define BENCH_BULK_PAYLOAD 64
+#define BENCH_BULK_SPINS 200
+
+#define BENCH_CROSS_PAYLOAD 64
+#define BENCH_CROSS_CHANNEL "bench-cross"
+
+#ifndef BENCH_RESTART_CYCLES
+#define BENCH_RESTART_CYCLES 200
+#endif //BENCH_RESTART_CYCLES
+
+#define BENCH_STATS_PAYLOAD 64
+#define BENCH_STATS_PRODUCERS 4
+
+#define BENCH_THROUGHPUT_PAYLOAD 16
+#define BENCH_MAX_PRODUCERS 8
+
+#ifndef BENCH_ROUND_TRIP_SAMPLES
+#define BENCH_ROUND_TRIP_SAMPLES 10000
+#endif //BENCH_ROUND_TRIP_SAMPLES
+
+#define BENCH_POLLABLE_MAX_DISPATCH 256
+#define BENCH_TYPED_TYPES 8
+#define BENCH_TYPED_PAYLOAD 16
+
+#ifndef BENCH_REQUEST_COUNT
+#define BENCH_REQUEST_COUNT 100000
+#endif //BENCH_REQUEST_COUNT
+
+#ifndef BENCH_JSON_PATH
+#define BENCH_JSON_PATH "msg-queue-bench.json" //!< Where the results go when no path is given
+#endif //BENCH_JSON_PATH
+
+#ifdef __OPTIMIZE__
+#define BENCH_OPTIMIZED "true"
+#else
+#define BENCH_OPTIMIZED "false"
+#endif //__OPTIMIZE__
+
+#ifndef BENCH_TIME_OUT_CHECKS
+#define BENCH_TIME_OUT_CHECKS 1000000
+#endif //BENCH_TIME_OUT_CHECKS
+
+/***********************************************************************************/
+/***************************** Type Defs *******************************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Function Declarations *******************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Static Variables ************************************/
+/***********************************************************************************/
+
+static uint64_t wake_samples[BENCH_WAKE_SAMPLES]; //!< Send to callback latencies in ns
+static atomic_uint wake_sample_count; //!< Number of latencies recorded
+static atomic_uint send_received; //!< Messages seen by the send cost callback
+static uint64_t control_samples[BENCH_CONTROL_SAMPLES]; //!< Control message send to callback latencies in ns
+static atomic_uint control_sample_count; //!< Number of control latencies recorded
+static atomic_bool bulk_stop; //!< Stops the bulk producer
+static atomic_uint ping_pong_done; //!< Number of ping pong chains that reached the last hop
+static messenger_t *bench_channels[BENCH_MAX_CHANNELS]; //!< The channels used by the channel scaling benchmark
+static uint64_t cross_samples[BENCH_WAKE_SAMPLES]; //!< Cross process send to callback latencies in ns
+static atomic_uint cross_sample_count; //!< Number of cross process latencies recorded
+static uint64_t round_trip_samples[BENCH_ROUND_TRIP_SAMPLES]; //!< Send to reply latencies in ns
+static atomic_uint round_trip_count; //!< Number of replies received
+static messenger_t *round_trip_reply; //!< The channel replies come back on
+static atomic_uint request_replies; //!< Number of requests answered by the request benchmark
+static atomic_uint typed_received[BENCH_TYPED_TYPES]; //!< Messages seen of each type by the typed dispatch benchmark
+static FILE *bench_json; //!< The JSON results file
+static unsigned int bench_json_results; //!< Number of results written so far
+static const char *bench_groups; //!< Comma separated benchmark groups to run. NULL for all of them
+
+/***********************************************************************************/
+/***************************** Function Definitions ********************************/
+/***********************************************************************************/
+
+/*********************************************************************
+ *************** General Utility Functions ***************************
+ ********************************************************************/
+
+/**
+ * @brief read a clock in nanoseconds
+ * @param clock the clock to read
+ * @return the clock value in ns
+ */
+static uint64_t bench_clock_ns(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return ((uint64_t)now.tv_sec * BENCH_NS_PER_SEC) + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief sleep for a number of milliseconds
+ * @param ms
+ */
+static void bench_sleep_ms(unsigned int ms)
+{
+    struct timespec time_data =
+    {
+        .tv_sec = ms / 1000,
+        .tv_nsec = (ms % 1000) * 1000000L
+    };
+    while(0 != nanosleep(&time_data, &time_data)) {}
+}
+
+/**
+ * @brief sleep for a number of microseconds
+ * @param us
+ */
+static void bench_sleep_us(unsigned int us)
+{
+    struct timespec time_data =
+    {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (us % 1000000) * 1000L
+    };
+    while(0 != nanosleep(&time_data, &time_data)) {}
+}
+
+/**
+ * @brief qsort comparison for uint64_t
+ */
+static int bench_compare_u64(const void *a, const void *b)
+{
+    uint64_t left = *(const uint64_t *)a;
+    uint64_t right = *(const uint64_t *)b;
+    return (left > right) - (left < right);
+}
+
+/**
+ * @brief get a percentile from a sorted sample set
+ * @param sorted the sorted samples
+ * @param count the number of samples
+ * @param percentile 0 to 100
+ * @return the sample value
+ */
+static uint64_t bench_percentile(const uint64_t *sorted, size_t count, unsigned int percentile)
+{
+    size_t index;
+    assert(0 < count);
+    index = (count * percentile) / 100;
+    if(index >= count)
+    {
+        index = count - 1;
+    }
+    return sorted[index];
+}
+
+/**
+ * @brief start the JSON results file
+ * @param path where to write it
+ */
+static void bench_json_open(const char *path)
+{
+    bench_json = fopen(path, "w");
+    assert(NULL != bench_json);
+    bench_json_results = 0;
+    fprintf(bench_json, "{\n  \"suite\": \"msg-queue-bench\",\n  \"timestamp\": %llu,\n", (unsigned long long)time(NULL));
+    fprintf(bench_json, "  \"config\": {\"optimized\": %s, \"stats\": %d, \"max_message_size\": %d, \"send_count\": %u},\n",
+            BENCH_OPTIMIZED, LOCAL_MESSENGER_STATS, LOCAL_MESSENGER_MAX_MESSAGE_SIZE, BENCH_SEND_COUNT);
+    fprintf(bench_json, "  \"results\": [");
+}
+
+/**
+ * @brief add a result to the JSON results file
+ * @param value the measured value
+ * @param unit the unit of the value
+ * @param format printf style format of the result name. Dotted, from general to specific
+ */
+static void bench_report(double value, const char *unit, const char *format, ...)
+{
+    char name[128];
+    va_list args;
+    assert(NULL != bench_json);
+    va_start(args, format);
+    assert(sizeof(name) > (size_t)vsnprintf(name, sizeof(name), format, args));
+    va_end(args);
+    fprintf(bench_json, "%s\n    {\"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}", (0 == bench_json_results) ? "" : ",", name, value, unit);
+    bench_json_results++;
+    //A run that dies part way still leaves the results so far
+    fflush(bench_json);
+}
+
+/**
+ * @brief finish the JSON results file
+ */
+static void bench_json_close(void)
+{
+    fprintf(bench_json, "\n  ]\n}\n");
+    fclose(bench_json);
+    bench_json = NULL;
+}
+
+/*********************************************************************
+ *************** Idle and Wake Benchmarks ****************************
+ ********************************************************************/
+
+/**
+ * @brief callback that records how long the message took to reach the callback
+ * @param msg the send timestamp
+ * @param message_size
+ */
+static void wake_latency_callback(void *msg, long message_size)
+{
+    uint64_t sent_ns;
+    unsigned int index;
+    assert(sizeof(sent_ns) == message_size);
+    memcpy(&sent_ns, msg, sizeof(sent_ns));
+    index = atomic_load(&wake_sample_count);
+    if(index < ARRAY_MAX_COUNT(wake_samples))
+    {
+        wake_samples[index] = bench_clock_ns(CLOCK_MONOTONIC) - sent_ns;
+    }
+    atomic_store(&wake_sample_count, index + 1);
+}
+
+/**
+ * @brief measure the cpu used by the process while the messenger has nothing to do
+ */
+static void bench_idle_cpu(void)
+{
+    uint64_t cpu_start;
+    uint64_t cpu_end;
+    uint64_t wall_start;
+    uint64_t wall_end;
+    double percent;
+    messenger_register_callback(wake_latency_callback);
+    cpu_start = bench_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    wall_start = bench_clock_ns(CLOCK_MONOTONIC);
+    bench_sleep_ms(BENCH_IDLE_WINDOW_MS);
+    cpu_end = bench_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    wall_end = bench_clock_ns(CLOCK_MONOTONIC);
+    percent = (100.0 * (double)(cpu_end - cpu_start)) / (double)(wall_end - wall_start);
+    printf("idle_cpu: %.3f%% of one core over %u ms\r\n", percent, BENCH_IDLE_WINDOW_MS);
+    bench_report(percent, "percent_core", "idle.cpu");
+}
+
+/**
+ * @brief measure the latency from send to callback when the messenger thread is parked
+ */
+static void bench_wake_latency(void)
+{
+    uint64_t sent_ns;
+    unsigned int expected;
+    atomic_store(&wake_sample_count, 0);
+    for(expected = 1; expected <= ARRAY_MAX_COUNT(wake_samples); expected++)
+    {
+        //Give the messenger thread time to go back to sleep
+        bench_sleep_ms(1);
+        sent_ns = bench_clock_ns(CLOCK_MONOTONIC);
+        messenger_send(&sent_ns, sizeof(sent_ns));
+        while(atomic_load(&wake_sample_count) < expected)
+        {
+            bench_sleep_ms(0);
+        }
+    }
+    qsort(wake_samples, ARRAY_MAX_COUNT(wake_samples), sizeof(wake_samples[0]), bench_compare_u64);
+    printf("wake_latency_us: min %.1f p50 %.1f p99 %.1f max %.1f (%u samples)\r\n",
+           (double)wake_samples[0] / BENCH_NS_PER_US,
+           (double)bench_percentile(wake_samples, ARRAY_MAX_COUNT(wake_samples), 50) / BENCH_NS_PER_US,
+           (double)bench_percentile(wake_samples, ARRAY_MAX_COUNT(wake_samples), 99) / BENCH_NS_PER_US,
+           (double)wake_samples[ARRAY_MAX_COUNT(wake_samples) - 1] / BENCH_NS_PER_US,
+           (unsigned int)ARRAY_MAX_COUNT(wake_samples));
+    bench_report((double)bench_percentile(wake_samples, ARRAY_MAX_COUNT(wake_samples), 50) / BENCH_NS_PER_US, "us", "idle.wake_latency.p50");
+    bench_report((double)bench_percentile(wake_samples, ARRAY_MAX_COUNT(wake_samples), 99) / BENCH_NS_PER_US, "us", "idle.wake_latency.p99");
+    bench_report((double)wake_samples[ARRAY_MAX_COUNT(wake_samples) - 1] / BENCH_NS_PER_US, "us", "idle.wake_latency.max");
+}
+
+/**
+ * @brief measure the wake latency and the cpu used by a dispatch thread waiting with a strategy,
+ * with messages spaced out by a gap
+ * @param strategy how the dispatch thread waits
+ * @param name name of the strategy in the results
+ * @param gap_us time between messages
+ */
+static void bench_wait_strategy(enum messenger_wait_strategy_e strategy, const char *name, unsigned int gap_us)
+{
+    messenger_config_t config;
+    messenger_t *messenger;
+    uint64_t sent_ns;
+    uint64_t cpu_start;
+    uint64_t wall_start;
+    double percent;
+    unsigned int expected;
+    messenger_config_init(&config);
+    config.transport = MESSENGER_TRANSPORT_RING;
+    config.wait_strategy = strategy;
+    config.spin_us = BENCH_WAIT_SPIN_US;
+    messenger = messenger_create(&config);
+    messenger_channel_register_callback(messenger, wake_latency_callback);
+    atomic_store(&wake_sample_count, 0);
+    cpu_start = bench_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    wall_start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(expected = 1; expected <= ARRAY_MAX_COUNT(wake_samples); expected++)
+    {
+        sent_ns = bench_clock_ns(CLOCK_MONOTONIC);
+        messenger_channel_send(messenger, &sent_ns, sizeof(sent_ns));
+        //Sleep rather than spin so the cpu measured is the dispatch thread's
+        bench_sleep_us(gap_us);
+        while(atomic_load(&wake_sample_count) < expected)
+        {
+            bench_sleep_us(gap_us);
+        }
+    }
+    percent = (100.0 * (double)(bench_clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start)) / (double)(bench_clock_ns(CLOCK_MONOTONIC) - wall_start);
+    messenger_destroy(messenger);
+    qsort(wake_samples, ARRAY_MAX_COUNT(wake_samples), sizeof(wake_samples[0]), bench_compare_u64);
+    printf("%s gap %u us: wake p50 %.1f us p99 %.1f us, cpu %.1f%% of one core\r\n", name, gap_us,
+           (double)bench_percentile(wake_samples, ARRAY_MAX_COUNT(wake_samples), 50) / BENCH_NS_PER_US,
+           (double)bench_percentile(wake_samples, ARRAY_MAX_COUNT(wake_samples), 99) / BENCH_NS_PER_US, percent);
+    bench_report((double)bench_percentile(wake_samples, ARRAY_MAX_COUNT(wake_samples), 50) / BENCH_NS_PER_US, "us", "wait.%s.gap_%u_us.wake_latency.p50", name, gap_us);
+    bench_report((double)bench_percentile(wake_samples, ARRAY_MAX_COUNT(wake_samples), 99) / BENCH_NS_PER_US, "us", "wait.%s.gap_%u_us.wake_latency.p99", name, gap_us);
+    bench_report(percent, "percent_core", "wait.%s.gap_%u_us.cpu", name, gap_us);
+}
+
+/*********************************************************************
+ *************** Transport Benchmarks ********************************
+ ********************************************************************/
+
+/**
+ * @brief callback that only counts messages
+ * @param msg
+ * @param message_size
+ */
+static void send_count_callback(void *msg, long message_size)
+{
+    atomic_fetch_add_explicit(&send_received, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief send a burst of messages and wait for all of them to be delivered
+ * @param payload_size the size of each message
+ * @param count the number of messages to send
+ * @param send_ns set to the time spent in messenger_send
+ * @param total_ns set to the time until the last message was delivered
+ */
+static void bench_send_burst(long payload_size, unsigned int count, uint64_t *send_ns, uint64_t *total_ns)
+{
+    static uint8_t payload[BENCH_MAX_PAYLOAD];
+    uint64_t start;
+    uint64_t sent;
+    assert(payload_size <= BENCH_MAX_PAYLOAD);
+    atomic_store(&send_received, 0);
+    messenger_register_callback(send_count_callback);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        payload[0] = (uint8_t)i;
+        messenger_send(payload, payload_size);
+    }
+    sent = bench_clock_ns(CLOCK_MONOTONIC);
+    while(count != atomic_load(&send_received))
+    {
+        bench_sleep_ms(0);
+    }
+    send_ns[0] = sent - start;
+    total_ns[0] = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    messenger_kill();
+}
+
+/**
+ * @brief measure send cost, throughput and bytes moved per message across payload sizes
+ * @param transport the transport to measure
+ * @param name the name to print
+ */
+static void bench_payload_sweep(enum messenger_transport_e transport, const char *name)
+{
+    //Either side of LOCAL_MESSENGER_MAX_MESSAGE_SIZE is where System V sends move from the stack to the heap
+    static const long payload_sizes[] = {4, 64, LOCAL_MESSENGER_MAX_MESSAGE_SIZE, LOCAL_MESSENGER_MAX_MESSAGE_SIZE + 1, 256, 4096, 16384};
+    uint64_t send_ns;
+    uint64_t total_ns;
+    long frame_size;
+    messenger_set_transport(transport);
+    for(unsigned int i = 0; i < ARRAY_MAX_COUNT(payload_sizes); i++)
+    {
+        if(payload_sizes[i] > messenger_max_message_size())
+        {
+            printf("%s payload %ld: skipped, transport max is %ld\r\n", name, payload_sizes[i], messenger_max_message_size());
+            messenger_kill();
+            continue;
+        }
+        bench_send_burst(payload_sizes[i], BENCH_SEND_COUNT, &send_ns, &total_ns);
+        frame_size = (long)sizeof(struct local_messenger_message_header_s) + payload_sizes[i];
+        printf("%s payload %ld: %ld bytes moved/msg, send %.1f ns/msg, delivered %.0f msgs/s %.1f MB/s\r\n", name,
+               payload_sizes[i], frame_size,
+               (double)send_ns / BENCH_SEND_COUNT,
+               (double)BENCH_SEND_COUNT * BENCH_NS_PER_SEC / (double)total_ns,
+               (double)BENCH_SEND_COUNT * (double)frame_size * 1000.0 / (double)total_ns);
+        bench_report((double)send_ns / BENCH_SEND_COUNT, "ns_per_msg", "payload.%s.%ld.send", name, payload_sizes[i]);
+        bench_report((double)BENCH_SEND_COUNT * BENCH_NS_PER_SEC / (double)total_ns, "msgs_per_s", "payload.%s.%ld.throughput", name, payload_sizes[i]);
+    }
+}
+
+/**
+ * @brief compare building a message and copying it in with messenger_send against
+ * building it in place with messenger_acquire and messenger_commit
+ * @param payload_size the size of each message
+ */
+static void bench_zero_copy(long payload_size)
+{
+    static uint8_t payload[BENCH_MAX_PAYLOAD];
+    uint8_t *slot;
+    uint64_t start;
+    uint64_t copy_ns;
+    uint64_t in_place_ns;
+    assert(payload_size <= BENCH_MAX_PAYLOAD);
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+    atomic_store(&send_received, 0);
+    messenger_register_callback(send_count_callback);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int i = 0; i < BENCH_SEND_COUNT; i++)
+    {
+        memset(payload, (int)i, (size_t)payload_size);
+        messenger_send(payload, payload_size);
+    }
+    while(BENCH_SEND_COUNT != atomic_load(&send_received))
+    {
+        bench_sleep_ms(0);
+    }
+    copy_ns = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    atomic_store(&send_received, 0);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int i = 0; i < BENCH_SEND_COUNT; i++)
+    {
+        slot = messenger_acquire(payload_size);
+        memset(slot, (int)i, (size_t)payload_size);
+        messenger_commit(slot);
+    }
+    while(BENCH_SEND_COUNT != atomic_load(&send_received))
+    {
+        bench_sleep_ms(0);
+    }
+    in_place_ns = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    messenger_kill();
+    printf("ring payload %ld: messenger_send %.1f ns/msg, acquire/commit %.1f ns/msg\r\n", payload_size,
+           (double)copy_ns / BENCH_SEND_COUNT, (double)in_place_ns / BENCH_SEND_COUNT);
+    bench_report((double)copy_ns / BENCH_SEND_COUNT, "ns_per_msg", "zero_copy.%ld.send", payload_size);
+    bench_report((double)in_place_ns / BENCH_SEND_COUNT, "ns_per_msg", "zero_copy.%ld.acquire_commit", payload_size);
+}
+
+/**
+ * @brief callback that counts batches of messages
+ * @param messages
+ * @param count
+ */
+static void batch_count_callback(messenger_message_s *messages, unsigned int count)
+{
+    atomic_fetch_add_explicit(&send_received, count, memory_order_relaxed);
+}
+
+/**
+ * @brief measure throughput when sending and dispatching in batches
+ * @param transport the transport to measure
+ * @param name the name to print
+ * @param batch_size messages per messenger_send_batch call and most messages per dispatch
+ */
+static void bench_batch(enum messenger_transport_e transport, const char *name, unsigned int batch_size)
+{
+    static uint32_t payloads[BENCH_MAX_BATCH][4];
+    static void *messages[BENCH_MAX_BATCH];
+    static long sizes[BENCH_MAX_BATCH];
+    unsigned int total;
+    uint64_t start;
+    uint64_t elapsed;
+    assert(batch_size <= BENCH_MAX_BATCH);
+    for(unsigned int i = 0; i < batch_size; i++)
+    {
+        payloads[i][0] = i;
+        messages[i] = payloads[i];
+        sizes[i] = sizeof(payloads[i]);
+    }
+    total = (BENCH_SEND_COUNT / batch_size) * batch_size;
+    messenger_set_transport(transport);
+    messenger_set_dispatch_batch(batch_size);
+    atomic_store(&send_received, 0);
+    messenger_register_batch_callback(batch_count_callback);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int sent = 0; sent < total; sent += batch_size)
+    {
+        messenger_send_batch(messages, sizes, batch_size);
+    }
+    while(total != atomic_load(&send_received))
+    {
+        bench_sleep_ms(0);
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    messenger_kill();
+    messenger_set_dispatch_batch(BENCH_DEFAULT_DISPATCH_BATCH);
+    printf("%s batch %u: %.0f msgs/s\r\n", name, batch_size, (double)total * BENCH_NS_PER_SEC / (double)elapsed);
+    bench_report((double)total * BENCH_NS_PER_SEC / (double)elapsed, "msgs_per_s", "batch.%s.%u", name, batch_size);
+}
+
+/**
+ * @brief producer for the channel scaling benchmark
+ * @param arg the channel to send on
+ * @return NULL
+ */
+static void *channel_producer(void *arg)
+{
+    messenger_t *channel = arg;
+    uint32_t payload[4] = {0};
+    for(unsigned int i = 0; i < BENCH_SEND_COUNT; i++)
+    {
+        payload[0] = i;
+        messenger_channel_send(channel, payload, sizeof(payload));
+    }
+    return NULL;
+}
+
+/**
+ * @brief measure aggregate throughput with one producer thread per independent channel
+ * @param channel_count the number of channels
+ */
+static void bench_channels_scaling(unsigned int channel_count)
+{
+    pthread_t producers[BENCH_MAX_CHANNELS];
+    uint64_t start;
+    uint64_t elapsed;
+    assert(channel_count <= BENCH_MAX_CHANNELS);
+    atomic_store(&send_received, 0);
+    for(unsigned int i = 0; i < channel_count; i++)
+    {
+        bench_channels[i] = messenger_create(NULL);
+        messenger_channel_register_callback(bench_channels[i], send_count_callback);
+    }
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int i = 0; i < channel_count; i++)
+    {
+        assert(0 == pthread_create(&producers[i], NULL, channel_producer, bench_channels[i]));
+    }
+    for(unsigned int i = 0; i < channel_count; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    while(channel_count * BENCH_SEND_COUNT != atomic_load(&send_received))
+    {
+        bench_sleep_ms(0);
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    for(unsigned int i = 0; i < channel_count; i++)
+    {
+        messenger_destroy(bench_channels[i]);
+    }
+    printf("ring channels %u: %.0f msgs/s\r\n", channel_count, (double)channel_count * BENCH_SEND_COUNT * BENCH_NS_PER_SEC / (double)elapsed);
+    bench_report((double)channel_count * BENCH_SEND_COUNT * BENCH_NS_PER_SEC / (double)elapsed, "msgs_per_s", "channels.ring.%u", channel_count);
+}
+
+/**
+ * @brief CPU heavy ping pong handler. Burns some cycles then sends the next hop of its chain
+ * @param msg the chain id followed by the hop count
+ * @param message_size
+ */
+static void ping_pong_callback(void *msg, long message_size)
+{
+    uint32_t hop[2];
+    volatile uint32_t work = 0;
+    memcpy(hop, msg, sizeof(hop));
+    for(unsigned int i = 0; i < BENCH_HANDLER_SPINS; i++)
+    {
+        work += i;
+    }
+    hop[1]++;
+    if(BENCH_PING_PONG_HOPS == hop[1])
+    {
+        atomic_fetch_add(&ping_pong_done, 1);
+        return;
+    }
+    messenger_send_keyed(hop[0], hop, sizeof(hop));
+}
+
+/**
+ * @brief measure ping pong throughput with a CPU heavy handler on a worker pool
+ * @param workers the number of workers. 0 runs the handler on the dispatch thread
+ */
+static void bench_workers(unsigned int workers)
+{
+    uint32_t hop[2];
+    uint64_t start;
+    uint64_t elapsed;
+    messenger_set_workers(workers);
+    atomic_store(&ping_pong_done, 0);
+    messenger_register_callback(ping_pong_callback);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(uint32_t chain = 0; chain < BENCH_PING_PONG_CHAINS; chain++)
+    {
+        hop[0] = chain;
+        hop[1] = 0;
+        messenger_send_keyed(chain, hop, sizeof(hop));
+    }
+    while(BENCH_PING_PONG_CHAINS != atomic_load(&ping_pong_done))
+    {
+        bench_sleep_ms(1);
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    messenger_kill();
+    messenger_set_workers(0);
+    printf("ping pong workers %u: %.0f msgs/s\r\n", workers,
+           (double)BENCH_PING_PONG_CHAINS * BENCH_PING_PONG_HOPS * BENCH_NS_PER_SEC / (double)elapsed);
+    bench_report((double)BENCH_PING_PONG_CHAINS * BENCH_PING_PONG_HOPS * BENCH_NS_PER_SEC / (double)elapsed, "msgs_per_s", "workers.%u", workers);
+}
+
+/**
+ * @brief callback for the control latency benchmark. Bulk messages cost some cycles,
+ * control messages record their latency
+ * @param msg a bulk payload or the control message send timestamp
+ * @param message_size
+ */
+static void control_latency_callback(void *msg, long message_size)
+{
+    uint64_t sent_ns;
+    unsigned int index;
+    volatile uint32_t work = 0;
+    if(BENCH_BULK_PAYLOAD == message_size)
+    {
+        for(unsigned int i = 0; i < BENCH_BULK_SPINS; i++)
+        {
+            work += i;
+        }
+        return;
+    }
+    memcpy(&sent_ns, msg, sizeof(sent_ns));
+    index = atomic_load(&control_sample_count);
+    if(index < ARRAY_MAX_COUNT(control_samples))
+    {
+        control_samples[index] = bench_clock_ns(CLOCK_MONOTONIC) - sent_ns;
+    }
+    atomic_store(&control_sample_count, index + 1);
+}
+
+/**
+ * @brief producer that keeps the default lane full
+ * @param arg unused
+ * @return NULL
+ */
+static void *bulk_producer(void *arg)
+{
+    uint8_t payload[BENCH_BULK_PAYLOAD] = {0};
+    while(false == atomic_load_explicit(&bulk_stop, memory_order_relaxed))
+    {
+        messenger_send(payload, sizeof(payload));
+    }
+    return NULL;
+}
+
+/**
+ * @brief measure the latency of control messages sent while a producer saturates the default lane
+ * @param transport the transport to measure
+ * @param name the name to print
+ * @param priority the lane the control messages are sent on
+ */
+static void bench_control_latency(enum messenger_transport_e transport, const char *name, unsigned int priority)
+{
+    pthread_t producer;
+    uint64_t sent_ns;
+    messenger_set_transport(transport);
+    atomic_store(&control_sample_count, 0);
+    atomic_store(&bulk_stop, false);
+    messenger_register_callback(control_latency_callback);
+    assert(0 == pthread_create(&producer, NULL, bulk_producer, NULL));
+    for(unsigned int expected = 1; expected <= ARRAY_MAX_COUNT(control_samples); expected++)
+    {
+        bench_sleep_ms(1);
+        sent_ns = bench_clock_ns(CLOCK_MONOTONIC);
+        messenger_send_priority(priority, &sent_ns, sizeof(sent_ns));
+        while(atomic_load(&control_sample_count) < expected)
+        {
+            bench_sleep_ms(0);
+        }
+    }
+    atomic_store(&bulk_stop, true);
+    pthread_join(producer, NULL);
+    messenger_kill();
+    qsort(control_samples, ARRAY_MAX_COUNT(control_samples), sizeof(control_samples[0]), bench_compare_u64);
+    printf("%s control latency on lane %u under bulk load: p50 %.1f us p99 %.1f us\r\n", name, priority,
+           (double)bench_percentile(control_samples, ARRAY_MAX_COUNT(control_samples), 50) / BENCH_NS_PER_US,
+           (double)bench_percentile(control_samples, ARRAY_MAX_COUNT(control_samples), 99) / BENCH_NS_PER_US);
+    bench_report((double)bench_percentile(control_samples, ARRAY_MAX_COUNT(control_samples), 50) / BENCH_NS_PER_US, "us", "control_latency.%s.lane%u.p50", name, priority);
+    bench_report((double)bench_percentile(control_samples, ARRAY_MAX_COUNT(control_samples), 99) / BENCH_NS_PER_US, "us", "control_latency.%s.lane%u.p99", name, priority);
+}
+
+/*********************************************************************
+ *************** Throughput and Round Trip Benchmarks ****************
+ ********************************************************************/
+
+/**
+ * @brief producer for the multi producer benchmark
+ * @param arg ptr to the number of messages to send
+ * @return NULL
+ */
+static void *throughput_producer(void *arg)
+{
+    unsigned int count = *(unsigned int *)arg;
+    uint32_t payload[BENCH_THROUGHPUT_PAYLOAD / sizeof(uint32_t)] = {0};
+    for(unsigned int i = 0; i < count; i++)
+    {
+        payload[0] = i;
+        messenger_send(payload, sizeof(payload));
+    }
+    return NULL;
+}
+
+/**
+ * @brief measure delivered throughput with several producer threads sharing the messenger
+ * @param transport the transport to measure
+ * @param name the name to print
+ * @param producer_count the number of producer threads
+ */
+static void bench_producers(enum messenger_transport_e transport, const char *name, unsigned int producer_count)
+{
+    pthread_t producers[BENCH_MAX_PRODUCERS];
+    unsigned int per_producer = BENCH_SEND_COUNT / producer_count;
+    unsigned int total = per_producer * producer_count;
+    uint64_t start;
+    uint64_t elapsed;
+    assert(producer_count <= BENCH_MAX_PRODUCERS);
+    messenger_set_transport(transport);
+    atomic_store(&send_received, 0);
+    messenger_register_callback(send_count_callback);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int i = 0; i < producer_count; i++)
+    {
+        assert(0 == pthread_create(&producers[i], NULL, throughput_producer, &per_producer));
+    }
+    for(unsigned int i = 0; i < producer_count; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    while(total != atomic_load(&send_received))
+    {
+        bench_sleep_ms(0);
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    messenger_kill();
+    printf("%s producers %u: %.0f msgs/s\r\n", name, producer_count, (double)total * BENCH_NS_PER_SEC / (double)elapsed);
+    bench_report((double)total * BENCH_NS_PER_SEC / (double)elapsed, "msgs_per_s", "producers.%s.%u", name, producer_count);
+}
+
+/**
+ * @brief measure throughput from a producer thread into the messenger, with the callbacks run either
+ * by the dispatch thread or by an event loop on the calling thread
+ * @param pollable true to start the messenger pollable and run the event loop here
+ */
+static void bench_pollable(bool pollable)
+{
+    messenger_config_t config;
+    pthread_t producer;
+    struct pollfd poll_fd;
+    unsigned int count = BENCH_SEND_COUNT;
+    uint64_t start;
+    uint64_t elapsed;
+    messenger_config_init(&config);
+    config.transport = MESSENGER_TRANSPORT_RING;
+    config.pollable = pollable;
+    messenger_init(&config);
+    atomic_store(&send_received, 0);
+    messenger_register_callback(send_count_callback);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    assert(0 == pthread_create(&producer, NULL, throughput_producer, &count));
+    if(true == pollable)
+    {
+        poll_fd.fd = messenger_fd();
+        poll_fd.events = POLLIN;
+        while(count != atomic_load(&send_received))
+        {
+            poll(&poll_fd, 1, -1);
+            messenger_dispatch_pending(BENCH_POLLABLE_MAX_DISPATCH);
+        }
+    }
+    pthread_join(producer, NULL);
+    while(count != atomic_load(&send_received))
+    {
+        bench_sleep_ms(0);
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    messenger_kill();
+    printf("%s: %.0f msgs/s\r\n", (true == pollable) ? "event loop" : "dispatch thread", (double)count * BENCH_NS_PER_SEC / (double)elapsed);
+    bench_report((double)count * BENCH_NS_PER_SEC / (double)elapsed, "msgs_per_s", "pollable.%s", (true == pollable) ? "event_loop" : "dispatch_thread");
+}
+
+/**
+ * @brief callback on the messenger that sends each message straight back on the reply channel
+ * @param msg the send timestamp
+ * @param message_size
+ */
+static void round_trip_echo_callback(void *msg, long message_size)
+{
+    messenger_channel_send(round_trip_reply, msg, message_size);
+}
+
+/**
+ * @brief callback on the reply channel that records the round trip time
+ * @param msg the send timestamp
+ * @param message_size
+ */
+static void round_trip_reply_callback(void *msg, long message_size)
+{
+    uint64_t sent_ns;
+    unsigned int index = atomic_load(&round_trip_count);
+    assert(sizeof(sent_ns) == message_size);
+    memcpy(&sent_ns, msg, sizeof(sent_ns));
+    round_trip_samples[index] = bench_clock_ns(CLOCK_MONOTONIC) - sent_ns;
+    atomic_store(&round_trip_count, index + 1);
+}
+
+/**
+ * @brief measure the time for a message to go out and a reply to come back, one message in flight at a time
+ * @param transport the transport to measure
+ * @param name the name to print
+ */
+static void bench_round_trip(enum messenger_transport_e transport, const char *name)
+{
+    messenger_config_t config;
+    uint64_t sent_ns;
+    messenger_set_transport(transport);
+    messenger_config_init(&config);
+    config.transport = transport;
+    round_trip_reply = messenger_create(&config);
+    messenger_channel_register_callback(round_trip_reply, round_trip_reply_callback);
+    atomic_store(&round_trip_count, 0);
+    messenger_register_callback(round_trip_echo_callback);
+    for(unsigned int expected = 1; expected <= ARRAY_MAX_COUNT(round_trip_samples); expected++)
+    {
+        sent_ns = bench_clock_ns(CLOCK_MONOTONIC);
+        messenger_send(&sent_ns, sizeof(sent_ns));
+        while(atomic_load(&round_trip_count) < expected)
+        {
+            bench_sleep_ms(0);
+        }
+    }
+    messenger_kill();
+    messenger_destroy(round_trip_reply);
+    qsort(round_trip_samples, ARRAY_MAX_COUNT(round_trip_samples), sizeof(round_trip_samples[0]), bench_compare_u64);
+    printf("%s round trip us: p50 %.1f p90 %.1f p99 %.1f max %.1f (%u samples)\r\n", name,
+           (double)bench_percentile(round_trip_samples, ARRAY_MAX_COUNT(round_trip_samples), 50) / BENCH_NS_PER_US,
+           (double)bench_percentile(round_trip_samples, ARRAY_MAX_COUNT(round_trip_samples), 90) / BENCH_NS_PER_US,
+           (double)bench_percentile(round_trip_samples, ARRAY_MAX_COUNT(round_trip_samples), 99) / BENCH_NS_PER_US,
+           (double)round_trip_samples[ARRAY_MAX_COUNT(round_trip_samples) - 1] / BENCH_NS_PER_US,
+           (unsigned int)ARRAY_MAX_COUNT(round_trip_samples));
+    bench_report((double)bench_percentile(round_trip_samples, ARRAY_MAX_COUNT(round_trip_samples), 50) / BENCH_NS_PER_US, "us", "round_trip.%s.p50", name);
+    bench_report((double)bench_percentile(round_trip_samples, ARRAY_MAX_COUNT(round_trip_samples), 90) / BENCH_NS_PER_US, "us", "round_trip.%s.p90", name);
+    bench_report((double)bench_percentile(round_trip_samples, ARRAY_MAX_COUNT(round_trip_samples), 99) / BENCH_NS_PER_US, "us", "round_trip.%s.p99", name);
+    bench_report((double)round_trip_samples[ARRAY_MAX_COUNT(round_trip_samples) - 1] / BENCH_NS_PER_US, "us", "round_trip.%s.max", name);
+}
+
+/**
+ * @brief request handler that answers each request with the request itself
+ * @param request the request
+ * @param msg the request data
+ * @param message_size
+ */
+static void request_echo_handler(const messenger_request_t *request, void *msg, long message_size)
+{
+    messenger_reply(request, msg, message_size);
+}
+
+/**
+ * @brief reply callback of the request benchmark
+ * @param context unused
+ * @param status how the request ended
+ * @param reply unused
+ * @param reply_size unused
+ */
+static void request_reply_callback(void *context, enum messenger_reply_status_e status, void *reply, long reply_size)
+{
+    (void)context;
+    (void)reply;
+    (void)reply_size;
+    assert(MESSENGER_REPLY_OK == status);
+    atomic_fetch_add(&request_replies, 1);
+}
+
+/**
+ * @brief channel callback that works out the type of each message from its first word, the way handlers do without a type id
+ * @param msg the message. Starts with its type
+ * @param message_size
+ */
+static void typed_parse_callback(void *msg, long message_size)
+{
+    uint32_t type;
+    memcpy(&type, msg, sizeof(type));
+    if(BENCH_TYPED_TYPES <= type || BENCH_TYPED_PAYLOAD != message_size)
+    {
+        return;
+    }
+    atomic_fetch_add_explicit(&typed_received[type], 1, memory_order_relaxed);
+}
+
+/**
+ * @brief handler of one message type
+ * @param context the counter of the type
+ * @param msg unused
+ * @param message_size unused
+ */
+static void typed_handler(void *context, void *msg, long message_size)
+{
+    (void)msg;
+    (void)message_size;
+    atomic_fetch_add_explicit((atomic_uint *)context, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief measure fanning each message out to several channels, copied into each or sent once as a pooled buffer by handle
+ * @param buffers true to send pooled buffers with messenger_multicast_buffer
+ * @param payload_size the size of each message
+ */
+static void bench_fanout(bool buffers, long payload_size)
+{
+    messenger_t *channels[BENCH_FANOUT_CHANNELS];
+    messenger_config_t config;
+    char *payload = malloc((size_t)payload_size);
+    char *buffer;
+    unsigned int count = BENCH_SEND_COUNT / 4;
+    uint64_t start;
+    uint64_t elapsed;
+    assert(NULL != payload);
+    memset(payload, 1, (size_t)payload_size);
+    messenger_config_init(&config);
+    config.transport = MESSENGER_TRANSPORT_RING;
+    config.ring_size = 1024 * 1024;
+    atomic_store(&send_received, 0);
+    for(unsigned int i = 0; i < BENCH_FANOUT_CHANNELS; i++)
+    {
+        channels[i] = messenger_create(&config);
+        messenger_channel_register_callback(channels[i], send_count_callback);
+    }
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int m = 0; m < count; m++)
+    {
+        if(true == buffers)
+        {
+            buffer = messenger_buffer_alloc(payload_size);
+            memcpy(buffer, payload, (size_t)payload_size);
+            messenger_multicast_buffer(channels, BENCH_FANOUT_CHANNELS, buffer);
+            messenger_buffer_release(buffer);
+            continue;
+        }
+        for(unsigned int i = 0; i < BENCH_FANOUT_CHANNELS; i++)
+        {
+            messenger_channel_send(channels[i], payload, payload_size);
+        }
+    }
+    while(count * BENCH_FANOUT_CHANNELS != atomic_load(&send_received))
+    {
+        bench_sleep_ms(0);
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    for(unsigned int i = 0; i < BENCH_FANOUT_CHANNELS; i++)
+    {
+        messenger_destroy(channels[i]);
+    }
+    free(payload);
+    printf("fan out %s %ld bytes: %.0f msgs/s\r\n", (true == buffers) ? "buffer" : "copy", payload_size, (double)count * BENCH_NS_PER_SEC / (double)elapsed);
+    bench_report((double)count * BENCH_NS_PER_SEC / (double)elapsed, "msgs_per_s", "fanout.%s.%ld", (true == buffers) ? "buffer" : "copy", payload_size);
+}
+
+/**
+ * @brief callback that applies a state update slowly and keeps the newest value of its key
+ * @param context the newest value of each key
+ * @param msg the key followed by the value
+ * @param message_size
+ */
+static void conflation_callback(void *context, void *msg, long message_size)
+{
+    _Atomic uint32_t *latest = context;
+    uint32_t update[2];
+    uint64_t until = bench_clock_ns(CLOCK_MONOTONIC) + BENCH_CONFLATION_WORK_NS;
+    memcpy(update, msg, sizeof(update));
+    while(bench_clock_ns(CLOCK_MONOTONIC) < until)
+    {
+    }
+    atomic_store_explicit(&latest[update[0]], update[1], memory_order_relaxed);
+    atomic_fetch_add_explicit(&send_received, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief measure how long a burst of state updates takes to be applied, queued as keyed messages or conflated
+ * @param conflated true to send the updates with messenger_channel_send_conflated
+ */
+static void bench_conflation(bool conflated)
+{
+    _Atomic uint32_t latest[BENCH_CONFLATION_KEYS];
+    messenger_config_t config;
+    messenger_t *messenger;
+    uint32_t update[2];
+    uint32_t rounds = BENCH_SEND_COUNT / BENCH_CONFLATION_KEYS;
+    uint64_t start;
+    uint64_t elapsed;
+    bool done = false;
+    for(unsigned int key = 0; key < BENCH_CONFLATION_KEYS; key++)
+    {
+        atomic_init(&latest[key], 0);
+    }
+    messenger_config_init(&config);
+    config.transport = MESSENGER_TRANSPORT_RING;
+    messenger = messenger_create(&config);
+    atomic_store(&send_received, 0);
+    messenger_channel_register_context_callback(messenger, conflation_callback, latest);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(update[1] = 1; update[1] <= rounds; update[1]++)
+    {
+        for(update[0] = 0; update[0] < BENCH_CONFLATION_KEYS; update[0]++)
+        {
+            if(true == conflated)
+            {
+                messenger_channel_send_conflated(messenger, update[0], update, sizeof(update));
+            }
+            else
+            {
+                messenger_channel_send_keyed(messenger, update[0], update, sizeof(update));
+            }
+        }
+    }
+    //Done once every key has its newest value applied
+    while(false == done)
+    {
+        done = true;
+        for(unsigned int key = 0; key < BENCH_CONFLATION_KEYS; key++)
+        {
+            done = done && (rounds == atomic_load_explicit(&latest[key], memory_order_relaxed));
+        }
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    messenger_destroy(messenger);
+    printf("%s: %.0f updates/s, %u callbacks\r\n", (true == conflated) ? "conflated" : "keyed",
+           (double)rounds * BENCH_CONFLATION_KEYS * BENCH_NS_PER_SEC / (double)elapsed, atomic_load(&send_received));
+    bench_report((double)rounds * BENCH_CONFLATION_KEYS * BENCH_NS_PER_SEC / (double)elapsed, "msgs_per_s", "conflation.%s", (true == conflated) ? "conflated" : "keyed");
+    bench_report((double)atomic_load(&send_received), "callbacks", "conflation.%s.callbacks", (true == conflated) ? "conflated" : "keyed");
+}
+
+/**
+ * @brief measure throughput into a ring channel with and without a journal
+ * @param journaled true to journal the channel
+ * @param sync_every messages between waits for them to be on disk. 0 to leave it to the sync thread
+ */
+static void bench_journal(bool journaled, unsigned int sync_every)
+{
+    char path[] = "/tmp/messenger-bench-journal-XXXXXX";
+    char file[512];
+    char payload[BENCH_JOURNAL_PAYLOAD];
+    messenger_config_t config;
+    messenger_t *messenger;
+    struct dirent *entry;
+    DIR *dir;
+    uint64_t start;
+    uint64_t elapsed;
+    assert(NULL != mkdtemp(path));
+    memset(payload, 0, sizeof(payload));
+    messenger_config_init(&config);
+    config.transport = MESSENGER_TRANSPORT_RING;
+    config.journal_path = (true == journaled) ? path : NULL;
+    messenger = messenger_create(&config);
+    atomic_store(&send_received, 0);
+    messenger_channel_register_callback(messenger, send_count_callback);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int i = 0; i < BENCH_SEND_COUNT; i++)
+    {
+        messenger_channel_send(messenger, payload, sizeof(payload));
+        if(0 != sync_every && 0 == ((i + 1) % sync_every))
+        {
+            messenger_channel_sync(messenger);
+        }
+    }
+    while(BENCH_SEND_COUNT != atomic_load(&send_received))
+    {
+        bench_sleep_ms(0);
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    messenger_destroy(messenger);
+    dir = opendir(path);
+    assert(NULL != dir);
+    while(NULL != (entry = readdir(dir)))
+    {
+        if('.' != entry->d_name[0])
+        {
+            snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+            unlink(file);
+        }
+    }
+    closedir(dir);
+    rmdir(path);
+    printf("journal %s sync every %u: %.0f msgs/s\r\n", (true == journaled) ? "on" : "off", sync_every, (double)BENCH_SEND_COUNT * BENCH_NS_PER_SEC / (double)elapsed);
+    bench_report((double)BENCH_SEND_COUNT * BENCH_NS_PER_SEC / (double)elapsed, "msgs_per_s", "journal.%s%s", (true == journaled) ? "on" : "off",
+                 (0 != sync_every) ? ".synced" : "");
+}
+
+/**
+ * @brief measure throughput of messages of several types sent round robin, routed either by the
+ * type id in the header or by a channel callback reading the type from the payload
+ * @param typed true to route with the handler table
+ */
+static void bench_typed(bool typed)
+{
+    messenger_config_t config;
+    messenger_t *messenger;
+    char payload[BENCH_TYPED_PAYLOAD] = {0};
+    unsigned int received;
+    uint64_t start;
+    uint64_t elapsed;
+    messenger_config_init(&config);
+    config.transport = MESSENGER_TRANSPORT_RING;
+    messenger = messenger_create(&config);
+    for(uint32_t type = 0; type < BENCH_TYPED_TYPES; type++)
+    {
+        atomic_store(&typed_received[type], 0);
+        if(true == typed)
+        {
+            messenger_channel_register_handler(messenger, type, sizeof(payload), sizeof(payload), typed_handler, &typed_received[type]);
+        }
+    }
+    if(false == typed)
+    {
+        messenger_channel_register_callback(messenger, typed_parse_callback);
+    }
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(uint32_t i = 0; i < BENCH_SEND_COUNT; i++)
+    {
+        uint32_t type = i % BENCH_TYPED_TYPES;
+        if(true == typed)
+        {
+            messenger_channel_send_typed(messenger, type, payload, sizeof(payload));
+        }
+        else
+        {
+            memcpy(payload, &type, sizeof(type));
+            messenger_channel_send(messenger, payload, sizeof(payload));
+        }
+    }
+    do
+    {
+        received = 0;
+        for(unsigned int type = 0; type < BENCH_TYPED_TYPES; type++)
+        {
+            received += atomic_load(&typed_received[type]);
+        }
+    } while(BENCH_SEND_COUNT != received);
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    messenger_destroy(messenger);
+    printf("%s dispatch of %u types: %.0f msgs/s\r\n", (true == typed) ? "typed" : "parsed", BENCH_TYPED_TYPES,
+           ((double)BENCH_SEND_COUNT * BENCH_NS_PER_SEC) / (double)elapsed);
+    bench_report(((double)BENCH_SEND_COUNT * BENCH_NS_PER_SEC) / (double)elapsed, "msgs_per_s", "typed.%s", (true == typed) ? "handler_table" : "parsed");
+}
+
+/**
+ * @brief measure request throughput with up to in_flight requests waiting on replies at once
+ * @param transport the transport to measure
+ * @param name the name to print
+ * @param in_flight the most requests waiting on replies at once
+ */
+static void bench_requests(enum messenger_transport_e transport, const char *name, unsigned int in_flight)
+{
+    messenger_config_t config;
+    messenger_t *server;
+    messenger_t *reply_to;
+    uint64_t start_ns;
+    uint64_t elapsed_ns;
+    uint64_t value = 0;
+    messenger_config_init(&config);
+    config.transport = transport;
+    server = messenger_create(&config);
+    reply_to = messenger_create(&config);
+    atomic_store(&request_replies, 0);
+    messenger_channel_register_request_handler(server, request_echo_handler);
+    start_ns = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int sent = 0; sent < BENCH_REQUEST_COUNT; sent++)
+    {
+        while(sent - atomic_load(&request_replies) >= in_flight)
+        {
+            bench_sleep_ms(0);
+        }
+        while(MESSENGER_SEND_OK != messenger_channel_request(server, reply_to, &value, sizeof(value), 0, request_reply_callback, NULL))
+        {
+            bench_sleep_ms(0);
+        }
+    }
+    while(atomic_load(&request_replies) < BENCH_REQUEST_COUNT)
+    {
+        bench_sleep_ms(0);
+    }
+    elapsed_ns = bench_clock_ns(CLOCK_MONOTONIC) - start_ns;
+    messenger_destroy(server);
+    messenger_destroy(reply_to);
+    printf("%s requests with %u in flight: %.0f per second\r\n", name, in_flight, ((double)BENCH_REQUEST_COUNT * BENCH_NS_PER_SEC) / (double)elapsed_ns);
+    bench_report(((double)BENCH_REQUEST_COUNT * BENCH_NS_PER_SEC) / (double)elapsed_ns, "msgs_per_s", "requests.%s.in_flight_%u", name, in_flight);
+}
+
+/*********************************************************************
+ *************** Cross Process Benchmarks ****************************
+ ********************************************************************/
+
+struct cross_message_s
+{
+    uint64_t sent_ns; //!< CLOCK_MONOTONIC time the child sent the message. 0 for throughput messages
+    char padding[BENCH_CROSS_PAYLOAD - sizeof(uint64_t)]; //!< Pads the message out to BENCH_CROSS_PAYLOAD
+};
+
+/**
+ * @brief counts throughput messages and records the latency of timed ones.
+ * CLOCK_MONOTONIC is the same in every process so the child's stamp can be compared
+ */
+static void cross_process_callback(void *msg, long message_size)
+{
+    const struct cross_message_s *message = msg;
+    unsigned int index;
+    assert(sizeof(struct cross_message_s) == message_size);
+    if(0 == message->sent_ns)
+    {
+        atomic_fetch_add(&send_received, 1);
+        return;
+    }
+    index = atomic_load(&cross_sample_count);
+    if(index < ARRAY_MAX_COUNT(cross_samples))
+    {
+        cross_samples[index] = bench_clock_ns(CLOCK_MONOTONIC) - message->sent_ns;
+        atomic_store(&cross_sample_count, index + 1);
+    }
+}
+
+/**
+ * @brief send from the child process. The System V transport can only wake producers in the process
+ * of the dispatch thread, so both transports yield and retry while full to keep the comparison even
+ * @param channel the handle to send on
+ * @param message the message to send
+ */
+static void cross_process_send(messenger_t *channel, struct cross_message_s *message)
+{
+    while(MESSENGER_SEND_OK != messenger_channel_try_send(channel, message, sizeof(struct cross_message_s)))
+    {
+        bench_sleep_ms(0);
+    }
+}
+
+/**
+ * @brief body of the child process. Sends a burst and then spaced out timed messages
+ * @param channel the handle to send on
+ */
+static void cross_process_child(messenger_t *channel)
+{
+    struct cross_message_s message;
+    memset(&message, 0, sizeof(message));
+    for(unsigned int i = 0; i < BENCH_SEND_COUNT; i++)
+    {
+        cross_process_send(channel, &message);
+    }
+    for(unsigned int i = 0; i < ARRAY_MAX_COUNT(cross_samples); i++)
+    {
+        bench_sleep_ms(1);
+        message.sent_ns = bench_clock_ns(CLOCK_MONOTONIC);
+        cross_process_send(channel, &message);
+    }
+}
+
+/**
+ * @brief measure sending from a second process. The System V child sends on the queue it inherited.
+ * The shared memory child attaches to the channel by name like an unrelated process would
+ * @param transport the transport of the channel
+ * @param name the name to print
+ */
+static void bench_cross_process(enum messenger_transport_e transport, const char *name)
+{
+    messenger_config_t config;
+    messenger_t *channel;
+    messenger_t *attached;
+    pid_t child;
+    int status;
+    uint64_t start;
+    uint64_t elapsed;
+    atomic_store(&send_received, 0);
+    atomic_store(&cross_sample_count, 0);
+    messenger_config_init(&config);
+    config.name = BENCH_CROSS_CHANNEL;
+    config.transport = transport;
+    channel = messenger_create(&config);
+    messenger_channel_register_callback(channel, cross_process_callback);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    child = fork();
+    assert(0 <= child);
+    if(0 == child)
+    {
+        attached = channel;
+        if(MESSENGER_TRANSPORT_SHM == transport)
+        {
+            attached = messenger_attach(BENCH_CROSS_CHANNEL);
+            assert(NULL != attached);
+        }
+        cross_process_child(attached);
+        if(attached != channel)
+        {
+            messenger_destroy(attached);
+        }
+        _exit(0);
+    }
+    while(BENCH_SEND_COUNT > atomic_load(&send_received))
+    {
+        bench_sleep_ms(0);
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    assert(child == waitpid(child, &status, 0));
+    assert(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    while(ARRAY_MAX_COUNT(cross_samples) > atomic_load(&cross_sample_count))
+    {
+        bench_sleep_ms(0);
+    }
+    messenger_destroy(channel);
+    qsort(cross_samples, ARRAY_MAX_COUNT(cross_samples), sizeof(cross_samples[0]), bench_compare_u64);
+    printf("%s cross process: %.0f msgs/s, latency p50 %.1f us p99 %.1f us\r\n", name,
+           (double)BENCH_SEND_COUNT * BENCH_NS_PER_SEC / elapsed,
+           (double)bench_percentile(cross_samples, ARRAY_MAX_COUNT(cross_samples), 50) / BENCH_NS_PER_US,
+           (double)bench_percentile(cross_samples, ARRAY_MAX_COUNT(cross_samples), 99) / BENCH_NS_PER_US);
+    bench_report((double)BENCH_SEND_COUNT * BENCH_NS_PER_SEC / elapsed, "msgs_per_s", "cross_process.%s.throughput", name);
+    bench_report((double)bench_percentile(cross_samples, ARRAY_MAX_COUNT(cross_samples), 50) / BENCH_NS_PER_US, "us", "cross_process.%s.p50", name);
+    bench_report((double)bench_percentile(cross_samples, ARRAY_MAX_COUNT(cross_samples), 99) / BENCH_NS_PER_US, "us", "cross_process.%s.p99", name);
+}
+
+/*********************************************************************
+ *************** Stats Benchmarks ************************************
+ ********************************************************************/
+
+/**
+ * @brief producer that sends its share of the stats benchmark messages
+ * @param arg unused
+ */
+static void *stats_producer(void *arg)
+{
+    uint8_t payload[BENCH_STATS_PAYLOAD] = {0};
+    for(unsigned int i = 0; i < BENCH_SEND_COUNT / BENCH_STATS_PRODUCERS; i++)
+    {
+        messenger_send(payload, sizeof(payload));
+    }
+    return NULL;
+}
+
+/**
+ * @brief measure send cost with several producers and print what the channel statistics saw.
+ * Build with -DLOCAL_MESSENGER_STATS=0 and compare the send cost to see what the statistics cost
+ * @param transport the transport to use
+ * @param name the name to print
+ */
+static void bench_stats(enum messenger_transport_e transport, const char *name)
+{
+    pthread_t producers[BENCH_STATS_PRODUCERS];
+    messenger_stats_s stats;
+    uint64_t start;
+    uint64_t sent;
+    unsigned int count = (BENCH_SEND_COUNT / BENCH_STATS_PRODUCERS) * BENCH_STATS_PRODUCERS;
+    messenger_set_transport(transport);
+    atomic_store(&send_received, 0);
+    messenger_register_callback(send_count_callback);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int i = 0; i < BENCH_STATS_PRODUCERS; i++)
+    {
+        assert(0 == pthread_create(&producers[i], NULL, stats_producer, NULL));
+    }
+    for(unsigned int i = 0; i < BENCH_STATS_PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    sent = bench_clock_ns(CLOCK_MONOTONIC);
+    while(count != atomic_load(&send_received))
+    {
+        bench_sleep_ms(0);
+    }
+    messenger_get_stats(&stats);
+    messenger_kill();
+    printf("%s stats %s: %u producers send %.1f ns/msg\r\n", name, (LOCAL_MESSENGER_STATS) ? "on" : "off", BENCH_STATS_PRODUCERS,
+           (double)(sent - start) / count);
+    bench_report((double)(sent - start) / count, "ns_per_msg", "stats.%s.send", name);
+    if(0 == stats.latency.count)
+    {
+        return;
+    }
+    printf("%s stats: sent %llu received %llu retries %llu peak %llu bytes, latency p50 %.1f us p99 %.1f us max %.1f us, callback p50 %.0f ns p99 %.0f ns\r\n", name,
+           (unsigned long long)stats.messages_sent, (unsigned long long)stats.messages_received,
+           (unsigned long long)stats.send_retries, (unsigned long long)stats.peak_queue_bytes,
+           (double)messenger_histogram_percentile(&stats.latency, 50) / BENCH_NS_PER_US,
+           (double)messenger_histogram_percentile(&stats.latency, 99) / BENCH_NS_PER_US,
+           (double)stats.latency.max_ns / BENCH_NS_PER_US,
+           (double)messenger_histogram_percentile(&stats.callback_duration, 50),
+           (double)messenger_histogram_percentile(&stats.callback_duration, 99));
+}
+
+/*********************************************************************
+ *************** Restart Benchmarks **********************************
+ ********************************************************************/
+
+/**
+ * @brief count the System V queues on the system
+ * @return the number of queues, 0 where they can not be listed
+ */
+static unsigned int bench_queue_count(void)
+{
+    unsigned int count = 0;
+    int c;
+    FILE *file = fopen("/proc/sysvipc/msg", "r");
+    if(NULL == file)
+    {
+        return 0;
+    }
+    while(EOF != (c = fgetc(file)))
+    {
+        count += ('\n' == c) ? 1 : 0;
+    }
+    fclose(file);
+    return (0 < count) ? count - 1 : 0;
+}
+
+/**
+ * @brief measure a start, one message and a kill of the messenger
+ * @param transport the transport to use
+ * @param name the name to print
+ * @param warm true to park the messenger between runs
+ */
+static void bench_restart(enum messenger_transport_e transport, const char *name, bool warm)
+{
+    unsigned int queues_before;
+    unsigned int queues_after;
+    uint64_t start;
+    uint64_t elapsed;
+    messenger_set_transport(transport);
+    messenger_set_warm_restart(warm);
+    queues_before = bench_queue_count();
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int i = 0; i < BENCH_RESTART_CYCLES; i++)
+    {
+        atomic_store(&send_received, 0);
+        messenger_register_callback(send_count_callback);
+        messenger_send(&i, sizeof(i));
+        while(0 == atomic_load(&send_received))
+        {
+            bench_sleep_ms(0);
+        }
+        messenger_kill();
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    messenger_set_warm_restart(false);
+    queues_after = bench_queue_count();
+    printf("%s %s restart: %.1f us per start/kill cycle, kernel queues %u -> %u\r\n", name, (true == warm) ? "warm" : "cold",
+           (double)elapsed / BENCH_RESTART_CYCLES / BENCH_NS_PER_US, queues_before, queues_after);
+    bench_report((double)elapsed / BENCH_RESTART_CYCLES / BENCH_NS_PER_US, "us", "restart.%s.%s", name, (true == warm) ? "warm" : "cold");
+}
+
+/*********************************************************************
+ *************** Time Out Helper Benchmarks **************************
+ ********************************************************************/
+
+/**
+ * @brief the time out check the helper used before it moved to a monotonic clock.
+ * Reads the wall clock and works out the elapsed milliseconds on every check
+ * @param init_time when the timeout was started
+ * @param timeout_ms the timeout in milliseconds
+ * @return true if the time has elapsed
+ */
+static bool legacy_time_out_check(const struct timeval *init_time, uint64_t timeout_ms)
+{
+    struct timeval now;
+    uint64_t elapsed_ms;
+    gettimeofday(&now, NULL);
+    assert(now.tv_sec > init_time->tv_sec || (now.tv_sec == init_time->tv_sec && now.tv_usec >= init_time->tv_usec));
+    elapsed_ms = ((uint64_t)(now.tv_sec - init_time->tv_sec) * 1000) + ((int64_t)now.tv_usec - (int64_t)init_time->tv_usec) / 1000;
+    return (elapsed_ms >= timeout_ms);
+}
+
+/**
+ * @brief measure the cost of one time out check
+ * @param clock the clock the helper measures on
+ * @param name the name to print
+ */
+static void bench_time_out_check(enum time_out_helper_clock_e clock, const char *name)
+{
+    time_out_helper_data_s helper;
+    unsigned int expired = 0;
+    uint64_t start;
+    uint64_t elapsed;
+    time_out_helper_init_ns(&helper, BENCH_NS_PER_SEC * 60, clock);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int i = 0; i < BENCH_TIME_OUT_CHECKS; i++)
+    {
+        expired += (unsigned int)time_out_helper_check(&helper);
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    assert(0 == expired);
+    printf("time_out_check %s: %.1f ns per check\r\n", name, (double)elapsed / BENCH_TIME_OUT_CHECKS);
+    bench_report((double)elapsed / BENCH_TIME_OUT_CHECKS, "ns", "time_out_check.%s", name);
+}
+
+/**
+ * @brief measure the cost of one check with the old gettimeofday helper
+ */
+static void bench_legacy_time_out_check(void)
+{
+    struct timeval init_time;
+    unsigned int expired = 0;
+    uint64_t start;
+    uint64_t elapsed;
+    gettimeofday(&init_time, NULL);
+    start = bench_clock_ns(CLOCK_MONOTONIC);
+    for(unsigned int i = 0; i < BENCH_TIME_OUT_CHECKS; i++)
+    {
+        expired += (unsigned int)legacy_time_out_check(&init_time, 60000);
+    }
+    elapsed = bench_clock_ns(CLOCK_MONOTONIC) - start;
+    assert(0 == expired);
+    printf("time_out_check legacy_gettimeofday: %.1f ns per check\r\n", (double)elapsed / BENCH_TIME_OUT_CHECKS);
+    bench_report((double)elapsed / BENCH_TIME_OUT_CHECKS, "ns", "time_out_check.legacy_gettimeofday");
+}
+
+/**
+ * @brief check if a group of benchmarks was asked for
+ * @param group the group name. It is also the first part of the result names of the group
+ * @return true if no groups were given or group is one of them
+ */
+static bool bench_selected(const char *group)
+{
+    size_t length = strlen(group);
+    const char *match = bench_groups;
+    if(NULL == bench_groups)
+    {
+        return true;
+    }
+    //Only whole entries of the comma separated list count
+    while(NULL != (match = strstr(match, group)))
+    {
+        if((match == bench_groups || ',' == match[-1]) && (',' == match[length] || 0 == match[length]))
+        {
+            return true;
+        }
+        match += length;
+    }
+    return false;
+}
+
+/**
+ * @brief the main function
+ * @param argc
+ * @param argv argv[1] is where to write the JSON results, BENCH_JSON_PATH if not given.
+ * argv[2] is an optional comma separated list of the benchmark groups to run, such as "payload,producers"
+ * @return
+ */
+int main(int argc, char **argv)
+{
+    static const unsigned int batch_sizes[] = {1, 8, 64, 512};
+    static const unsigned int wait_gaps_us[] = {50, 1000};
+    bench_json_open((1 < argc) ? argv[1] : BENCH_JSON_PATH);
+    bench_groups = (2 < argc) ? argv[2] : NULL;
+    if(true == bench_selected("time_out_check"))
+    {
+        bench_legacy_time_out_check();
+        bench_time_out_check(TIME_OUT_HELPER_CLOCK_MONOTONIC, "monotonic");
+        bench_time_out_check(TIME_OUT_HELPER_CLOCK_COARSE, "monotonic_coarse");
+        bench_time_out_check(TIME_OUT_HELPER_CLOCK_TSC, "tsc");
+    }
+    if(true == bench_selected("idle"))
+    {
+        bench_idle_cpu();
+        bench_wake_latency();
+        messenger_kill();
+    }
+    if(true == bench_selected("wait"))
+    {
+        for(unsigned int i = 0; i < ARRAY_MAX_COUNT(wait_gaps_us); i++)
+        {
+            bench_wait_strategy(MESSENGER_WAIT_PARK, "park", wait_gaps_us[i]);
+            bench_wait_strategy(MESSENGER_WAIT_SPIN_THEN_PARK, "spin_then_park", wait_gaps_us[i]);
+            bench_wait_strategy(MESSENGER_WAIT_BUSY_POLL, "busy_poll", wait_gaps_us[i]);
+        }
+    }
+    if(true == bench_selected("payload"))
+    {
+        bench_payload_sweep(MESSENGER_TRANSPORT_SYSV_QUEUE, "sysv_queue");
+        bench_payload_sweep(MESSENGER_TRANSPORT_RING, "ring");
+    }
+    if(true == bench_selected("producers"))
+    {
+        for(unsigned int producers = 1; producers <= BENCH_MAX_PRODUCERS; producers *= 2)
+        {
+            bench_producers(MESSENGER_TRANSPORT_SYSV_QUEUE, "sysv_queue", producers);
+        }
+        for(unsigned int producers = 1; producers <= BENCH_MAX_PRODUCERS; producers *= 2)
+        {
+            bench_producers(MESSENGER_TRANSPORT_RING, "ring", producers);
+        }
+    }
+    if(true == bench_selected("round_trip"))
+    {
+        bench_round_trip(MESSENGER_TRANSPORT_SYSV_QUEUE, "sysv_queue");
+        bench_round_trip(MESSENGER_TRANSPORT_RING, "ring");
+    }
+    if(true == bench_selected("requests"))
+    {
+        for(unsigned int in_flight = 1; in_flight <= 1024; in_flight *= 32)
+        {
+            bench_requests(MESSENGER_TRANSPORT_SYSV_QUEUE, "sysv_queue", in_flight);
+            bench_requests(MESSENGER_TRANSPORT_RING, "ring", in_flight);
+        }
+    }
+    if(true == bench_selected("pollable"))
+    {
+        bench_pollable(true);
+        bench_pollable(false);
+    }
+    if(true == bench_selected("journal"))
+    {
+        bench_journal(false, 0);
+        bench_journal(true, 0);
+        bench_journal(true, BENCH_JOURNAL_SYNC_EVERY);
+    }
+    if(true == bench_selected("fanout"))
+    {
+        bench_fanout(false, 64);
+        bench_fanout(true, 64);
+        bench_fanout(false, 4096);
+        bench_fanout(true, 4096);
+        bench_fanout(false, 32768);
+        bench_fanout(true, 32768);
+    }
+    if(true == bench_selected("conflation"))
+    {
+        bench_conflation(false);
+        bench_conflation(true);
+    }
+    if(true == bench_selected("typed"))
+    {
+        bench_typed(false);
+        bench_typed(true);
+    }
+    if(true == bench_selected("zero_copy"))
+    {
+        bench_zero_copy(64);
+        bench_zero_copy(4096);
+    }
+    if(true == bench_selected("batch"))
+    {
+        for(unsigned int i = 0; i < ARRAY_MAX_COUNT(batch_sizes); i++)
+        {
+            bench_batch(MESSENGER_TRANSPORT_SYSV_QUEUE, "sysv_queue", batch_sizes[i]);
+        }
+        for(unsigned int i = 0; i < ARRAY_MAX_COUNT(batch_sizes); i++)
+        {
+            bench_batch(MESSENGER_TRANSPORT_RING, "ring", batch_sizes[i]);
+        }
+    }
+    if(true == bench_selected("channels"))
+    {
+        for(unsigned int channels = 1; channels <= BENCH_MAX_CHANNELS; channels *= 2)
+        {
+            bench_channels_scaling(channels);
+        }
+    }
+    if(true == bench_selected("control_latency"))
+    {
+        bench_control_latency(MESSENGER_TRANSPORT_SYSV_QUEUE, "sysv_queue", LOCAL_MESSENGER_PRIORITY_DEFAULT);
+        bench_control_latency(MESSENGER_TRANSPORT_SYSV_QUEUE, "sysv_queue", LOCAL_MESSENGER_PRIORITY_HIGHEST);
+        bench_control_latency(MESSENGER_TRANSPORT_RING, "ring", LOCAL_MESSENGER_PRIORITY_DEFAULT);
+        bench_control_latency(MESSENGER_TRANSPORT_RING, "ring", LOCAL_MESSENGER_PRIORITY_HIGHEST);
+    }
+    if(true == bench_selected("workers"))
+    {
+        bench_workers(0);
+        for(unsigned int workers = 1; workers <= BENCH_MAX_WORKERS; workers *= 2)
+        {
+            bench_workers(workers);
+        }
+    }
+    if(true == bench_selected("cross_process"))
+    {
+        bench_cross_process(MESSENGER_TRANSPORT_SYSV_QUEUE, "sysv_queue");
+        bench_cross_process(MESSENGER_TRANSPORT_SHM, "shm");
+    }
+    if(true == bench_selected("restart"))
+    {
+        bench_restart(MESSENGER_TRANSPORT_SYSV_QUEUE, "sysv_queue", false);
+        bench_restart(MESSENGER_TRANSPORT_SYSV_QUEUE, "sysv_queue", true);
+        bench_restart(MESSENGER_TRANSPORT_RING, "ring", false);
+        bench_restart(MESSENGER_TRANSPORT_RING, "ring", true);
+    }
+    if(true == bench_selected("stats"))
+    {
+        bench_stats(MESSENGER_TRANSPORT_SYSV_QUEUE, "sysv_queue");
+        bench_stats(MESSENGER_TRANSPORT_RING, "ring");
+    }
+    bench_json_close();
+    return 0;
+}
@@ -6,7 +6,16 @@
  *
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif //__linux__
+
 #include <local-messenger.h>
+#include <local-messenger-message-types.h>
+#include <local-messenger-ring.h>
+#include <local-messenger-conflation.h>
+#include <local-messenger-shm.h>
+#include <time-out-helper.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
@@ -20,6 +29,11 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <sched.h>
+#include <dirent.h>
 
 /***********************************************************************************/
 /***************************** Defines and Macros **********************************/
@@ -150,15 +164,2339 @@ static void basic_test_message_callback(void *msg, long message_size)
     }
 }
 
-static void basic_test(void **state)
+static void run_basic_test(void)
 {
     static char finish_message[BASIC_TEST_BUFFER_SIZE];
     memset(finish_message, BASIC_TEST_FINISH_VAL, ARRAY_MAX_COUNT(finish_message));
     memset(basic_test_send_buffer, 0x00, ARRAY_MAX_COUNT(basic_test_send_buffer));
     messenger_register_callback(basic_test_message_callback);
     messenger_send(basic_test_send_buffer, ARRAY_MAX_COUNT(basic_test_send_buffer));
-    while(0 != memcmp(basic_test_send_buffer, finish_message, ARRAY_MAX_COUNT(finish_message))) {}
+    while(0 != memcmp(basic_test_send_buffer, finish_message, ARRAY_MAX_COUNT(finish_message)))
+    {
+        test_sleep_ms(1);
+    }
+    messenger_kill();
+}
+
+static void basic_test(void **state)
+{
+    run_basic_test();
+}
+
+static void basic_sysv_test(void **state)
+{
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_basic_test();
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+}
+
+/*********************************************************************
+ *************** Variable Size Test **********************************
+ ********************************************************************/
+static const long variable_size_test_sizes[] = {1, 7, 50, 100, 101, 1000, 4000}; //!< Payload sizes sent by the test
+static volatile unsigned int variable_size_test_received; //!< Number of messages received
+
+static void variable_size_test_callback(void *msg, long message_size)
+{
+    unsigned char *typed = msg;
+    assert(variable_size_test_received < ARRAY_MAX_COUNT(variable_size_test_sizes));
+    assert(variable_size_test_sizes[variable_size_test_received] == message_size);
+    for(long i = 0; i < message_size; i++)
+    {
+        assert((unsigned char)(message_size + i) == typed[i]);
+    }
+    variable_size_test_received++;
+}
+
+static void run_variable_size_test(void)
+{
+    static unsigned char buffer[4000];
+    variable_size_test_received = 0;
+    messenger_register_callback(variable_size_test_callback);
+    assert(messenger_max_message_size() >= ARRAY_MAX_COUNT(buffer));
+    for(unsigned int i = 0; i < ARRAY_MAX_COUNT(variable_size_test_sizes); i++)
+    {
+        for(long j = 0; j < variable_size_test_sizes[i]; j++)
+        {
+            buffer[j] = (unsigned char)(variable_size_test_sizes[i] + j);
+        }
+        messenger_send(buffer, variable_size_test_sizes[i]);
+    }
+    while(ARRAY_MAX_COUNT(variable_size_test_sizes) != variable_size_test_received)
+    {
+        test_sleep_ms(1);
+    }
+    messenger_kill();
+}
+
+static void variable_size_test(void **state)
+{
+    run_variable_size_test();
+}
+
+static void variable_size_sysv_test(void **state)
+{
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_variable_size_test();
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+}
+
+/*********************************************************************
+ *************** Large Burst Test ************************************
+ ********************************************************************/
+#define LARGE_BURST_TEST_MESSAGES 200
+#define LARGE_BURST_TEST_SIZE 4000
+
+static volatile unsigned int large_burst_test_received; //!< Number of messages received
+
+static void large_burst_test_callback(void *msg, long message_size)
+{
+    unsigned char *typed = msg;
+    assert(LARGE_BURST_TEST_SIZE == message_size);
+    assert((unsigned char)large_burst_test_received == typed[0]);
+    assert((unsigned char)large_burst_test_received == typed[LARGE_BURST_TEST_SIZE - 1]);
+    large_burst_test_received++;
+}
+
+static void large_burst_test(void **state)
+{
+    static unsigned char buffer[LARGE_BURST_TEST_SIZE];
+    large_burst_test_received = 0;
+    messenger_register_callback(large_burst_test_callback);
+    //Many times the ring size so the consumer holds a full ring of messages per batch
+    for(unsigned int i = 0; i < LARGE_BURST_TEST_MESSAGES; i++)
+    {
+        memset(buffer, (int)i, sizeof(buffer));
+        messenger_send(buffer, sizeof(buffer));
+    }
+    while(LARGE_BURST_TEST_MESSAGES != large_burst_test_received)
+    {
+        test_sleep_ms(1);
+    }
+    messenger_kill();
+}
+
+/*********************************************************************
+ *************** Acquire Commit Test *********************************
+ ********************************************************************/
+#define ACQUIRE_TEST_MESSAGES 100
+#define ACQUIRE_TEST_SIZE 64
+
+static void *acquire_test_slots[ACQUIRE_TEST_MESSAGES]; //!< The buffers handed out by messenger_acquire
+static void *acquire_test_delivered[ACQUIRE_TEST_MESSAGES]; //!< The buffers handed to the callback
+static volatile unsigned int acquire_test_received; //!< Number of messages received
+
+static void acquire_test_callback(void *msg, long message_size)
+{
+    unsigned char *typed = msg;
+    assert(ACQUIRE_TEST_SIZE == message_size);
+    assert(acquire_test_received < ACQUIRE_TEST_MESSAGES);
+    for(unsigned int i = 0; i < ACQUIRE_TEST_SIZE; i++)
+    {
+        assert((unsigned char)(acquire_test_received + i) == typed[i]);
+    }
+    acquire_test_delivered[acquire_test_received] = msg;
+    acquire_test_received++;
+}
+
+static void run_acquire_test(void)
+{
+    unsigned char *buffer;
+    acquire_test_received = 0;
+    messenger_register_callback(acquire_test_callback);
+    for(unsigned int i = 0; i < ACQUIRE_TEST_MESSAGES; i++)
+    {
+        buffer = messenger_acquire(ACQUIRE_TEST_SIZE);
+        assert(NULL != buffer);
+        for(unsigned int j = 0; j < ACQUIRE_TEST_SIZE; j++)
+        {
+            buffer[j] = (unsigned char)(i + j);
+        }
+        acquire_test_slots[i] = buffer;
+        messenger_commit(buffer);
+    }
+    while(ACQUIRE_TEST_MESSAGES != acquire_test_received)
+    {
+        test_sleep_ms(1);
+    }
+    messenger_kill();
+}
+
+static void acquire_commit_test(void **state)
+{
+    run_acquire_test();
+    //The ring hands the callback the same slot the message was written into
+    for(unsigned int i = 0; i < ACQUIRE_TEST_MESSAGES; i++)
+    {
+        assert(acquire_test_slots[i] == acquire_test_delivered[i]);
+    }
+}
+
+static void acquire_commit_sysv_test(void **state)
+{
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_acquire_test();
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+}
+
+/*********************************************************************
+ *************** Batch Test ******************************************
+ ********************************************************************/
+#define BATCH_TEST_MESSAGES 300
+#define BATCH_TEST_DISPATCH 8
+
+static volatile unsigned int batch_test_received; //!< Number of messages received
+
+static void batch_test_callback(messenger_message_s *messages, unsigned int count)
+{
+    unsigned int value;
+    assert(NULL != messages);
+    assert(0 < count && BATCH_TEST_DISPATCH >= count);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        //Sizes cycle so the batches mix small and large messages
+        assert((long)(sizeof(value) + (batch_test_received % 50)) == messages[i].message_size);
+        memcpy(&value, messages[i].msg, sizeof(value));
+        assert(batch_test_received == value);
+        batch_test_received++;
+    }
+}
+
+static void run_batch_test(void)
+{
+    static unsigned int values[BATCH_TEST_MESSAGES][20];
+    static void *messages[BATCH_TEST_MESSAGES];
+    static long sizes[BATCH_TEST_MESSAGES];
+    batch_test_received = 0;
+    messenger_set_dispatch_batch(BATCH_TEST_DISPATCH);
+    messenger_register_batch_callback(batch_test_callback);
+    for(unsigned int i = 0; i < BATCH_TEST_MESSAGES; i++)
+    {
+        values[i][0] = i;
+        messages[i] = values[i];
+        sizes[i] = sizeof(values[i][0]) + (i % 50);
+    }
+    messenger_send_batch(messages, sizes, 100);
+    messenger_send_batch(&messages[100], &sizes[100], BATCH_TEST_MESSAGES - 100);
+    while(BATCH_TEST_MESSAGES != batch_test_received)
+    {
+        test_sleep_ms(1);
+    }
+    messenger_kill();
+}
+
+static void batch_test(void **state)
+{
+    run_batch_test();
+}
+
+static void batch_sysv_test(void **state)
+{
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_batch_test();
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+}
+
+/*********************************************************************
+ *************** Multi Producer Test *********************************
+ ********************************************************************/
+#define MULTI_PRODUCER_THREADS 4
+#define MULTI_PRODUCER_MESSAGES 5000
+
+struct multi_producer_message_s
+{
+    unsigned int producer;
+    unsigned int sequence;
+}; //!< Message sent by each producer
+
+static unsigned int multi_producer_next[MULTI_PRODUCER_THREADS]; //!< The next sequence expected from each producer
+static volatile unsigned int multi_producer_received; //!< Number of messages received
+
+static void multi_producer_callback(void *msg, long message_size)
+{
+    struct multi_producer_message_s typed;
+    assert(sizeof(typed) == message_size);
+    memcpy(&typed, msg, sizeof(typed));
+    assert(typed.producer < MULTI_PRODUCER_THREADS);
+    //Messages from one producer must come out in the order they went in
+    assert(multi_producer_next[typed.producer] == typed.sequence);
+    multi_producer_next[typed.producer]++;
+    multi_producer_received++;
+}
+
+static void *multi_producer_worker(void *arg)
+{
+    struct multi_producer_message_s message;
+    message.producer = *(unsigned int *)arg;
+    for(message.sequence = 0; message.sequence < MULTI_PRODUCER_MESSAGES; message.sequence++)
+    {
+        messenger_send(&message, sizeof(message));
+    }
+    return NULL;
+}
+
+static void multi_producer_test(void **state)
+{
+    pthread_t threads[MULTI_PRODUCER_THREADS];
+    unsigned int ids[MULTI_PRODUCER_THREADS];
+    memset(multi_producer_next, 0, sizeof(multi_producer_next));
+    multi_producer_received = 0;
+    messenger_register_callback(multi_producer_callback);
+    for(unsigned int i = 0; i < ARRAY_MAX_COUNT(threads); i++)
+    {
+        ids[i] = i;
+        assert(0 == pthread_create(&threads[i], NULL, multi_producer_worker, &ids[i]));
+    }
+    for(unsigned int i = 0; i < ARRAY_MAX_COUNT(threads); i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    while(MULTI_PRODUCER_THREADS * MULTI_PRODUCER_MESSAGES != multi_producer_received)
+    {
+        test_sleep_ms(1);
+    }
+    messenger_kill();
+}
+
+/*********************************************************************
+ *************** Idle Kill Test **************************************
+ ********************************************************************/
+static void idle_kill_test(void **state)
+{
+    char message = 0;
+    //Start the messenger and let it go idle before killing it
+    messenger_send(&message, sizeof(message));
+    test_sleep_ms(10);
+    messenger_kill();
+}
+
+/*********************************************************************
+ *************** Channel Test ****************************************
+ ********************************************************************/
+#define CHANNEL_TEST_MESSAGES 1000
+
+static volatile unsigned int channel_test_default_received; //!< Number of messages received on the default channel
+static volatile unsigned int channel_test_named_received; //!< Number of messages received on the named channel
+
+static void channel_test_default_callback(void *msg, long message_size)
+{
+    assert_int_equal(sizeof(unsigned int), message_size);
+    assert_int_equal(channel_test_default_received, *((unsigned int *)msg));
+    channel_test_default_received++;
+}
+
+static void channel_test_named_callback(void *msg, long message_size)
+{
+    assert_int_equal(sizeof(unsigned int), message_size);
+    assert_int_equal(channel_test_named_received, *((unsigned int *)msg));
+    channel_test_named_received++;
+}
+
+static void channel_test(void **state)
+{
+    messenger_config_t config;
+    messenger_t *channel;
+    channel_test_default_received = 0;
+    channel_test_named_received = 0;
+    messenger_config_init(&config);
+    config.name = "channel-test";
+    config.transport = MESSENGER_TRANSPORT_SYSV_QUEUE;
+    channel = messenger_create(&config);
+    assert_ptr_equal(channel, messenger_lookup("channel-test"));
+    assert_null(messenger_lookup("no-such-channel"));
+    messenger_channel_register_callback(channel, channel_test_named_callback);
+    messenger_register_callback(channel_test_default_callback);
+    for(unsigned int i = 0; i < CHANNEL_TEST_MESSAGES; i++)
+    {
+        messenger_send(&i, sizeof(i));
+        messenger_channel_send(channel, &i, sizeof(i));
+    }
+    while(CHANNEL_TEST_MESSAGES != channel_test_default_received || CHANNEL_TEST_MESSAGES != channel_test_named_received)
+    {
+        test_sleep_ms(1);
+    }
+    messenger_destroy(channel);
+    assert_null(messenger_lookup("channel-test"));
+    messenger_kill();
+}
+
+/*********************************************************************
+ *************** Worker Test *****************************************
+ ********************************************************************/
+#define WORKER_TEST_WORKERS 4
+#define WORKER_TEST_KEYS 8
+#define WORKER_TEST_MESSAGES 4000
+
+static unsigned int worker_test_next[WORKER_TEST_KEYS]; //!< The next sequence expected for each key
+static atomic_uint worker_test_received; //!< Number of messages received
+
+static void worker_test_callback(void *msg, long message_size)
+{
+    unsigned int *typed = msg;
+    assert_int_equal(2 * sizeof(unsigned int), message_size);
+    if(WORKER_TEST_KEYS > typed[0])
+    {
+        //Keyed messages must arrive in order. Only one worker runs each key
+        assert_int_equal(worker_test_next[typed[0]], typed[1]);
+        worker_test_next[typed[0]]++;
+    }
+    atomic_fetch_add(&worker_test_received, 1);
+}
+
+static void worker_test(void **state)
+{
+    unsigned int message[2];
+    memset(worker_test_next, 0, sizeof(worker_test_next));
+    atomic_store(&worker_test_received, 0);
+    messenger_set_workers(WORKER_TEST_WORKERS);
+    messenger_register_callback(worker_test_callback);
+    for(unsigned int i = 0; i < WORKER_TEST_MESSAGES; i++)
+    {
+        message[0] = i % WORKER_TEST_KEYS;
+        message[1] = i / WORKER_TEST_KEYS;
+        messenger_send_keyed(message[0], message, sizeof(message));
+        message[0] = WORKER_TEST_KEYS;
+        messenger_send(message, sizeof(message));
+    }
+    while(2 * WORKER_TEST_MESSAGES != atomic_load(&worker_test_received))
+    {
+        test_sleep_ms(1);
+    }
+    messenger_kill();
+    messenger_set_workers(0);
+    for(unsigned int i = 0; i < WORKER_TEST_KEYS; i++)
+    {
+        assert_int_equal(WORKER_TEST_MESSAGES / WORKER_TEST_KEYS, worker_test_next[i]);
+    }
+}
+
+/*********************************************************************
+ *************** Topic Test ******************************************
+ ********************************************************************/
+#define TOPIC_TEST_MESSAGES 100
+#define TOPIC_TEST_A 3
+#define TOPIC_TEST_B 5
+#define TOPIC_TEST_UNUSED 7
+#define TOPIC_TEST_ORDER_LOW 2
+#define TOPIC_TEST_ORDER_HIGH 6
+#define TOPIC_TEST_ORDER_MESSAGES 6
+
+static volatile unsigned int topic_test_a_first; //!< Messages seen by the first subscriber of topic a
+static volatile unsigned int topic_test_a_second; //!< Messages seen by the second subscriber of topic a
+static volatile unsigned int topic_test_b; //!< Messages seen by the subscriber of topic b
+static atomic_bool topic_test_order_gate; //!< Holds the first message of the ordering check until the rest are queued
+static atomic_uint topic_test_order_received; //!< Messages of the ordering check received
+static unsigned int topic_test_order[TOPIC_TEST_ORDER_MESSAGES]; //!< Values of the ordering check in the order they were received
+
+static void topic_test_a_first_callback(void *msg, long message_size)
+{
+    assert_int_equal(TOPIC_TEST_A, ((unsigned int *)msg)[0]);
+    assert_int_equal(topic_test_a_first, ((unsigned int *)msg)[1]);
+    topic_test_a_first++;
+}
+
+static void topic_test_a_second_callback(void *msg, long message_size)
+{
+    assert_int_equal(TOPIC_TEST_A, ((unsigned int *)msg)[0]);
+    topic_test_a_second++;
+}
+
+static void topic_test_b_callback(void *msg, long message_size)
+{
+    assert_int_equal(TOPIC_TEST_B, ((unsigned int *)msg)[0]);
+    topic_test_b++;
+}
+
+static void topic_test_order_callback(void *msg, long message_size)
+{
+    unsigned int value = *((unsigned int *)msg);
+    while(0 == value && false == atomic_load(&topic_test_order_gate))
+    {
+        test_sleep_ms(1);
+    }
+    assert_true(TOPIC_TEST_ORDER_MESSAGES > atomic_load(&topic_test_order_received));
+    topic_test_order[atomic_load(&topic_test_order_received)] = value;
+    atomic_fetch_add(&topic_test_order_received, 1);
+}
+
+/**
+ * @brief check publishes and plain sends queued behind each other are received in the order they were sent
+ */
+static void run_topic_order_test(void)
+{
+    unsigned int value = 0;
+    atomic_store(&topic_test_order_gate, false);
+    atomic_store(&topic_test_order_received, 0);
+    messenger_register_callback(topic_test_order_callback);
+    messenger_subscribe(TOPIC_TEST_ORDER_LOW, topic_test_order_callback);
+    messenger_subscribe(TOPIC_TEST_ORDER_HIGH, topic_test_order_callback);
+    //The first message stalls the dispatch thread so the rest queue up behind it
+    messenger_send(&value, sizeof(value));
+    value = 1;
+    messenger_publish(TOPIC_TEST_ORDER_HIGH, &value, sizeof(value));
+    value = 2;
+    messenger_send(&value, sizeof(value));
+    value = 3;
+    messenger_publish(TOPIC_TEST_ORDER_LOW, &value, sizeof(value));
+    value = 4;
+    messenger_publish(TOPIC_TEST_ORDER_HIGH, &value, sizeof(value));
+    value = 5;
+    messenger_send(&value, sizeof(value));
+    atomic_store(&topic_test_order_gate, true);
+    while(TOPIC_TEST_ORDER_MESSAGES != atomic_load(&topic_test_order_received))
+    {
+        test_sleep_ms(1);
+    }
+    for(unsigned int i = 0; i < TOPIC_TEST_ORDER_MESSAGES; i++)
+    {
+        assert_int_equal(i, topic_test_order[i]);
+    }
+    messenger_unsubscribe(TOPIC_TEST_ORDER_LOW, topic_test_order_callback);
+    messenger_unsubscribe(TOPIC_TEST_ORDER_HIGH, topic_test_order_callback);
+}
+
+static void run_topic_test(void)
+{
+    unsigned int message[2];
+    topic_test_a_first = 0;
+    topic_test_a_second = 0;
+    topic_test_b = 0;
+    messenger_subscribe(TOPIC_TEST_A, topic_test_a_first_callback);
+    messenger_subscribe(TOPIC_TEST_A, topic_test_a_second_callback);
+    messenger_subscribe(TOPIC_TEST_B, topic_test_b_callback);
+    for(unsigned int i = 0; i < TOPIC_TEST_MESSAGES; i++)
+    {
+        message[1] = i;
+        message[0] = TOPIC_TEST_A;
+        messenger_publish(TOPIC_TEST_A, message, sizeof(message));
+        message[0] = TOPIC_TEST_B;
+        messenger_publish(TOPIC_TEST_B, message, sizeof(message));
+        message[0] = TOPIC_TEST_UNUSED;
+        messenger_publish(TOPIC_TEST_UNUSED, message, sizeof(message));
+    }
+    while(TOPIC_TEST_MESSAGES != topic_test_a_first || TOPIC_TEST_MESSAGES != topic_test_a_second || TOPIC_TEST_MESSAGES != topic_test_b)
+    {
+        test_sleep_ms(1);
+    }
+    //Only the remaining subscriber sees messages after an unsubscribe
+    messenger_unsubscribe(TOPIC_TEST_A, topic_test_a_second_callback);
+    message[0] = TOPIC_TEST_A;
+    message[1] = TOPIC_TEST_MESSAGES;
+    messenger_publish(TOPIC_TEST_A, message, sizeof(message));
+    while(TOPIC_TEST_MESSAGES + 1 != topic_test_a_first)
+    {
+        test_sleep_ms(1);
+    }
+    run_topic_order_test();
+    messenger_kill();
+    assert_int_equal(TOPIC_TEST_MESSAGES, topic_test_a_second);
+}
+
+static void topic_test(void **state)
+{
+    run_topic_test();
+}
+
+static void topic_sysv_test(void **state)
+{
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_topic_test();
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+}
+
+/*********************************************************************
+ *************** Priority Test ***************************************
+ ********************************************************************/
+#define PRIORITY_TEST_BULK 50
+#define PRIORITY_TEST_CONTROL 0xC0
+#define PRIORITY_TEST_TOPIC 9
+
+static atomic_bool priority_test_gate; //!< Holds the first callback until the backlog is queued
+static atomic_bool priority_test_entered; //!< Set once the first callback is running
+static volatile unsigned int priority_test_received; //!< Number of messages received
+static volatile unsigned int priority_test_control_index; //!< Position the control message was received at
+static volatile unsigned int priority_test_next; //!< The bulk message expected next
+
+static void priority_test_callback(void *msg, long message_size)
+{
+    unsigned int value = *((unsigned int *)msg);
+    if(0 == priority_test_received)
+    {
+        atomic_store(&priority_test_entered, true);
+        while(false == atomic_load(&priority_test_gate))
+        {
+            test_sleep_ms(1);
+        }
+    }
+    if(PRIORITY_TEST_CONTROL == value)
+    {
+        priority_test_control_index = priority_test_received;
+    }
+    else
+    {
+        //Publishes and plain sends share the bulk lane so they stay in send order
+        assert_int_equal(priority_test_next, value);
+        priority_test_next++;
+    }
+    priority_test_received++;
+}
+
+static void run_priority_test(void)
+{
+    unsigned int value = 0;
+    atomic_store(&priority_test_gate, false);
+    atomic_store(&priority_test_entered, false);
+    priority_test_received = 0;
+    priority_test_control_index = 0;
+    priority_test_next = 0;
+    messenger_register_callback(priority_test_callback);
+    messenger_subscribe(PRIORITY_TEST_TOPIC, priority_test_callback);
+    messenger_send(&value, sizeof(value));
+    while(false == atomic_load(&priority_test_entered))
+    {
+        test_sleep_ms(1);
+    }
+    //Queue a backlog behind the stalled callback then a control message that has to overtake it
+    for(value = 1; value < PRIORITY_TEST_BULK; value++)
+    {
+        if(0 == value % 2)
+        {
+            messenger_publish(PRIORITY_TEST_TOPIC, &value, sizeof(value));
+        }
+        else
+        {
+            messenger_send(&value, sizeof(value));
+        }
+    }
+    value = PRIORITY_TEST_CONTROL;
+    messenger_send_priority(LOCAL_MESSENGER_PRIORITY_HIGHEST, &value, sizeof(value));
+    atomic_store(&priority_test_gate, true);
+    while(PRIORITY_TEST_BULK + 1 != priority_test_received)
+    {
+        test_sleep_ms(1);
+    }
+    messenger_unsubscribe(PRIORITY_TEST_TOPIC, priority_test_callback);
     messenger_kill();
+    assert_int_equal(1, priority_test_control_index);
+}
+
+static void priority_test(void **state)
+{
+    run_priority_test();
+}
+
+static void priority_sysv_test(void **state)
+{
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_priority_test();
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+}
+
+/*********************************************************************
+ *************** Backpressure Test ***********************************
+ ********************************************************************/
+#define BACKPRESSURE_TEST_SIZE 1000
+#define BACKPRESSURE_TEST_HIGH 75
+#define BACKPRESSURE_TEST_LOW 25
+
+static atomic_bool backpressure_test_gate; //!< Holds the first callback until the transport is full
+static atomic_bool backpressure_test_entered; //!< Set once the first callback is running
+static atomic_uint backpressure_test_received; //!< Number of messages received
+static atomic_uint backpressure_test_high; //!< Number of times the high watermark was reported
+static atomic_uint backpressure_test_low; //!< Number of times the low watermark was reported
+static atomic_uint backpressure_test_dropped; //!< Requests ended because they could not be sent
+
+static void backpressure_test_reply(void *context, enum messenger_reply_status_e status, void *reply, long reply_size)
+{
+    assert_int_equal(MESSENGER_REPLY_DROPPED, status);
+    assert_null(reply);
+    atomic_fetch_add(&backpressure_test_dropped, 1);
+}
+
+/**
+ * @brief make a request while the transport is full. Runs beside the in place sends so their waits overlap
+ * @param args set to the result of the request
+ */
+static void *backpressure_test_request(void *args)
+{
+    static char request[BACKPRESSURE_TEST_SIZE];
+    enum messenger_send_result_e *rv = args;
+    //As large as the messages filling the transport so it can not squeeze into what they left. The timeout
+    //is far off so only the failed send can end the request
+    rv[0] = messenger_request(request, sizeof(request), 60000, backpressure_test_reply, NULL);
+    return NULL;
+}
+
+static void backpressure_test_callback(void *msg, long message_size)
+{
+    if(0 == atomic_load(&backpressure_test_received))
+    {
+        atomic_store(&backpressure_test_entered, true);
+        while(false == atomic_load(&backpressure_test_gate))
+        {
+            test_sleep_ms(1);
+        }
+    }
+    atomic_fetch_add(&backpressure_test_received, 1);
+}
+
+static void backpressure_test_watermark(messenger_t *messenger, bool above_high)
+{
+    if(true == above_high)
+    {
+        atomic_fetch_add(&backpressure_test_high, 1);
+    }
+    else
+    {
+        atomic_fetch_add(&backpressure_test_low, 1);
+    }
+}
+
+static void run_backpressure_test(void)
+{
+    static char message[BACKPRESSURE_TEST_SIZE];
+    void *acquired;
+    unsigned int sent = 1;
+    pthread_t request;
+    enum messenger_send_result_e request_rv = MESSENGER_SEND_OK;
+    atomic_store(&backpressure_test_dropped, 0);
+    atomic_store(&backpressure_test_gate, false);
+    atomic_store(&backpressure_test_entered, false);
+    atomic_store(&backpressure_test_received, 0);
+    atomic_store(&backpressure_test_high, 0);
+    atomic_store(&backpressure_test_low, 0);
+    messenger_register_callback(backpressure_test_callback);
+    messenger_set_watermarks(BACKPRESSURE_TEST_HIGH, BACKPRESSURE_TEST_LOW, backpressure_test_watermark);
+    messenger_send(message, sizeof(message));
+    while(false == atomic_load(&backpressure_test_entered))
+    {
+        test_sleep_ms(1);
+    }
+    //Fill the transport behind the stalled callback
+    while(MESSENGER_SEND_OK == messenger_try_send(message, sizeof(message)))
+    {
+        sent++;
+    }
+    assert_int_equal(1, atomic_load(&backpressure_test_high));
+    assert_int_equal(0, atomic_load(&backpressure_test_low));
+    assert_int_equal(MESSENGER_SEND_WOULD_BLOCK, messenger_try_send(message, sizeof(message)));
+    assert_int_equal(MESSENGER_SEND_TIMED_OUT, messenger_send_timeout(message, sizeof(message), 10));
+    //In place sends report a transport that stays full instead of aborting. The ring has no slot to hand out,
+    //System V builds the message on the heap so it is the commit that finds no room
+    assert_int_equal(0, pthread_create(&request, NULL, backpressure_test_request, &request_rv));
+    acquired = messenger_acquire(sizeof(message));
+    if(NULL != acquired)
+    {
+        assert_int_equal(MESSENGER_SEND_TIMED_OUT, messenger_commit(acquired));
+    }
+    //A request that could not be sent says so, and is ended by the dispatch thread once it gets to it
+    assert_int_equal(0, pthread_join(request, NULL));
+    assert_int_equal(MESSENGER_SEND_TIMED_OUT, request_rv);
+    atomic_store(&backpressure_test_gate, true);
+    //A sender waiting on a full transport is woken once the dispatch thread drains it
+    assert_int_equal(MESSENGER_SEND_OK, messenger_send_timeout(message, sizeof(message), 1000));
+    sent++;
+    while(sent != atomic_load(&backpressure_test_received) || 0 == atomic_load(&backpressure_test_dropped))
+    {
+        test_sleep_ms(1);
+    }
+    messenger_kill();
+    assert_int_equal(1, atomic_load(&backpressure_test_dropped));
+    assert_int_equal(1, atomic_load(&backpressure_test_high));
+    assert_int_equal(1, atomic_load(&backpressure_test_low));
+}
+
+static void backpressure_test(void **state)
+{
+    run_backpressure_test();
+}
+
+static void backpressure_sysv_test(void **state)
+{
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_backpressure_test();
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+}
+
+/*********************************************************************
+ *************** Timer Test ******************************************
+ ********************************************************************/
+#define TIMER_TEST_DELAYED 2000
+#define TIMER_TEST_MAX_DELAY_MS 50
+#define TIMER_TEST_PERIOD_MS 2
+#define TIMER_TEST_PERIODS 5
+
+enum timer_test_kind_e
+{
+    TIMER_TEST_IMMEDIATE,
+    TIMER_TEST_DELAYED_KIND,
+    TIMER_TEST_PERIODIC
+};
+
+struct timer_test_message_s
+{
+    enum timer_test_kind_e kind; //!< How the message was sent
+    uint64_t due_ns; //!< Earliest the message may arrive
+};
+
+static atomic_uint timer_test_immediate; //!< Number of plain messages received
+static atomic_uint timer_test_delayed; //!< Number of delayed messages received
+static atomic_uint timer_test_early; //!< Number of delayed messages received before they were due
+static atomic_uint timer_test_periodic; //!< Number of periodic messages received
+
+static void timer_test_callback(void *msg, long message_size)
+{
+    struct timer_test_message_s *message = msg;
+    assert_int_equal(sizeof(struct timer_test_message_s), message_size);
+    switch(message->kind)
+    {
+        case TIMER_TEST_IMMEDIATE:
+            atomic_fetch_add(&timer_test_immediate, 1);
+            break;
+        case TIMER_TEST_DELAYED_KIND:
+            if(time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC) < message->due_ns)
+            {
+                atomic_fetch_add(&timer_test_early, 1);
+            }
+            atomic_fetch_add(&timer_test_delayed, 1);
+            break;
+        default:
+            atomic_fetch_add(&timer_test_periodic, 1);
+            break;
+    }
+}
+
+/**
+ * @brief wait in real time until a counter reaches a value
+ * @param counter the counter
+ * @param expected the value to wait for
+ */
+static void timer_test_wait_for(atomic_uint *counter, unsigned int expected)
+{
+    time_out_helper_data_s timeout;
+    time_out_helper_init(&timeout, 2000);
+    while(atomic_load(counter) < expected && false == time_out_helper_check(&timeout))
+    {
+        test_sleep_ns(100000);
+    }
+    assert_true(atomic_load(counter) >= expected);
+}
+
+static void run_timer_test(void)
+{
+    struct timer_test_message_s message;
+    messenger_timer_t *timer;
+    unsigned int delay_ms;
+    unsigned int periodic;
+    atomic_store(&timer_test_immediate, 0);
+    atomic_store(&timer_test_delayed, 0);
+    atomic_store(&timer_test_early, 0);
+    atomic_store(&timer_test_periodic, 0);
+    messenger_register_callback(timer_test_callback);
+    message.kind = TIMER_TEST_DELAYED_KIND;
+    for(unsigned int i = 0; i < TIMER_TEST_DELAYED; i++)
+    {
+        delay_ms = (i % TIMER_TEST_MAX_DELAY_MS) + 1;
+        message.due_ns = time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC) + (delay_ms * TIME_OUT_HELPER_NS_PER_MS);
+        messenger_send_delayed(&message, sizeof(message), delay_ms);
+    }
+    //Pending timers do not hold up plain messages
+    message.kind = TIMER_TEST_IMMEDIATE;
+    messenger_send(&message, sizeof(message));
+    timer_test_wait_for(&timer_test_immediate, 1);
+    timer_test_wait_for(&timer_test_delayed, TIMER_TEST_DELAYED);
+    assert_int_equal(0, atomic_load(&timer_test_early));
+    message.kind = TIMER_TEST_PERIODIC;
+    timer = messenger_send_periodic(&message, sizeof(message), TIMER_TEST_PERIOD_MS);
+    timer_test_wait_for(&timer_test_periodic, TIMER_TEST_PERIODS);
+    messenger_cancel_periodic(timer);
+    //A send that was already due may still arrive after the cancel
+    test_sleep_ns(10 * TIME_OUT_HELPER_NS_PER_MS);
+    periodic = atomic_load(&timer_test_periodic);
+    test_sleep_ns(10 * TIME_OUT_HELPER_NS_PER_MS);
+    assert_int_equal(periodic, atomic_load(&timer_test_periodic));
+    //Timers still pending are dropped with the channel
+    message.kind = TIMER_TEST_DELAYED_KIND;
+    messenger_send_delayed(&message, sizeof(message), 10000);
+    messenger_send_periodic(&message, sizeof(message), 10000);
+    messenger_kill();
+    assert_int_equal(TIMER_TEST_DELAYED, atomic_load(&timer_test_delayed));
+}
+
+static void timer_test(void **state)
+{
+    run_timer_test();
+}
+
+static void timer_sysv_test(void **state)
+{
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_timer_test();
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+}
+
+static void timer_wheel_test_expired(time_out_helper_timer_s *timer, void *context)
+{
+    unsigned int *count = context;
+    count[0]++;
+}
+
+static void timer_wheel_test(void **state)
+{
+    static time_out_helper_timer_s timers[3];
+    time_out_helper_wheel_s wheel;
+    unsigned int count = 0;
+    uint64_t start;
+    time_out_helper_wheel_init(&wheel, TIME_OUT_HELPER_NS_PER_MS);
+    start = wheel.start_ns;
+    assert_true(TIME_OUT_HELPER_NEVER == time_out_helper_wheel_next_deadline(&wheel));
+    for(unsigned int i = 0; i < ARRAY_MAX_COUNT(timers); i++)
+    {
+        time_out_helper_timer_init(&timers[i], timer_wheel_test_expired, &count);
+    }
+    //One per level so the far timers have to move down the wheel before they expire
+    time_out_helper_wheel_add(&wheel, &timers[0], start + (10 * TIME_OUT_HELPER_NS_PER_MS));
+    time_out_helper_wheel_add(&wheel, &timers[1], start + (1000 * TIME_OUT_HELPER_NS_PER_MS));
+    time_out_helper_wheel_add(&wheel, &timers[2], start + (100000 * TIME_OUT_HELPER_NS_PER_MS));
+    assert_true(time_out_helper_wheel_next_deadline(&wheel) <= start + (10 * TIME_OUT_HELPER_NS_PER_MS));
+    assert_int_equal(0, time_out_helper_wheel_advance(&wheel, start + (9 * TIME_OUT_HELPER_NS_PER_MS)));
+    assert_int_equal(1, time_out_helper_wheel_advance(&wheel, start + (10 * TIME_OUT_HELPER_NS_PER_MS)));
+    assert_false(time_out_helper_timer_pending(&timers[0]));
+    assert_int_equal(0, time_out_helper_wheel_advance(&wheel, start + (999 * TIME_OUT_HELPER_NS_PER_MS)));
+    time_out_helper_wheel_cancel(&wheel, &timers[1]);
+    assert_false(time_out_helper_timer_pending(&timers[1]));
+    assert_int_equal(0, time_out_helper_wheel_advance(&wheel, start + (99999 * TIME_OUT_HELPER_NS_PER_MS)));
+    assert_true(time_out_helper_timer_pending(&timers[2]));
+    assert_int_equal(1, time_out_helper_wheel_advance(&wheel, start + (100000 * TIME_OUT_HELPER_NS_PER_MS)));
+    assert_int_equal(2, count);
+    assert_true(TIME_OUT_HELPER_NEVER == time_out_helper_wheel_next_deadline(&wheel));
+}
+
+/*********************************************************************
+ *************** Shared Memory Test **********************************
+ ********************************************************************/
+#define SHM_TEST_PRODUCERS 2
+#define SHM_TEST_MESSAGES 4000
+#define SHM_TEST_RING_SIZE 4096 //!< Small enough that the producers have to wait on the consumer
+#define SHM_TEST_TOPIC 3
+#define SHM_TEST_FORGED 7 //!< Frames shm_test_forge writes that the channel must drop
+
+struct shm_test_message_s
+{
+    unsigned int producer; //!< The child process that sent the message
+    unsigned int sequence; //!< Count of messages sent before this one by the same child
+};
+
+static unsigned int shm_test_next[SHM_TEST_PRODUCERS]; //!< The next sequence expected from each child
+static atomic_uint shm_test_received; //!< Number of messages received
+static atomic_uint shm_test_published; //!< Number of messages received on the topic
+
+static void shm_test_callback(void *msg, long message_size)
+{
+    struct shm_test_message_s *message = msg;
+    assert_int_equal(sizeof(struct shm_test_message_s), message_size);
+    assert_true(SHM_TEST_PRODUCERS > message->producer);
+    assert_int_equal(shm_test_next[message->producer], message->sequence);
+    shm_test_next[message->producer]++;
+    atomic_fetch_add(&shm_test_received, 1);
+}
+
+static void shm_test_topic_callback(void *msg, long message_size)
+{
+    assert_int_equal(sizeof(struct shm_test_message_s), message_size);
+    atomic_fetch_add(&shm_test_published, 1);
+}
+
+/**
+ * @brief write a frame straight into the shared memory of a channel, the way a faulty or hostile process could
+ * @param ring the ring of the lane to write to
+ * @param header the header of the frame
+ * @param payload the payload actually written after the header
+ * @param payload_size the size of payload. It does not have to match header->message_size
+ */
+static void shm_test_write_frame(local_messenger_ring_s *ring, const struct local_messenger_message_header_s *header, const void *payload, uint64_t payload_size)
+{
+    while(false == local_messenger_ring_write(ring, header, sizeof(struct local_messenger_message_header_s), payload, payload_size))
+    {
+        test_sleep_ms(1);
+    }
+}
+
+/**
+ * @brief write frames into the channel of the parent that the public API never builds. The parent has to
+ * drop each of them without aborting or following the ptrs in them
+ */
+static void shm_test_forge(void)
+{
+    local_messenger_shm_s shm;
+    local_messenger_ring_s rings[LOCAL_MESSENGER_PRIORITY_LEVELS];
+    local_messenger_ring_s *ring = &rings[LOCAL_MESSENGER_PRIORITY_DEFAULT];
+    struct local_messenger_message_header_s header;
+    void *pointers[2] = {(void *)&header, (void *)&header};
+    assert(true == local_messenger_shm_attach(&shm, "shm-test", rings, LOCAL_MESSENGER_PRIORITY_LEVELS));
+    //A topic past the end of the subscriber table
+    memset(&header, 0, sizeof(header));
+    header.type = LOCAL_MESSAGE_TYPE_PUBLISH;
+    header.topic = LOCAL_MESSENGER_MAX_TOPICS;
+    header.message_size = sizeof(pointers);
+    shm_test_write_frame(ring, &header, pointers, sizeof(pointers));
+    //A request whose channel to reply to is a ptr into this process
+    memset(&header, 0, sizeof(header));
+    header.type = LOCAL_MESSAGE_TYPE_REQUEST;
+    header.message_size = sizeof(pointers);
+    shm_test_write_frame(ring, &header, pointers, sizeof(pointers));
+    //A timer that is a ptr into this process
+    memset(&header, 0, sizeof(header));
+    header.type = LOCAL_MESSAGE_TYPE_INTERNAL_ACTION;
+    header.action = LOCAL_MESSENGER_ACTION_TIMER_ADD;
+    header.message_size = sizeof(pointers[0]);
+    shm_test_write_frame(ring, &header, pointers, sizeof(pointers[0]));
+    //A buffer handle that is a ptr into this process
+    memset(&header, 0, sizeof(header));
+    header.type = LOCAL_MESSAGE_TYPE_BUFFER;
+    header.message_size = sizeof(pointers[0]);
+    shm_test_write_frame(ring, &header, pointers, sizeof(pointers[0]));
+    //A type the channel does not know
+    memset(&header, 0, sizeof(header));
+    header.type = (enum local_messenger_message_type_e)(LOCAL_MESSAGE_TYPE_BUFFER + 1);
+    header.message_size = sizeof(pointers);
+    shm_test_write_frame(ring, &header, pointers, sizeof(pointers));
+    //A journal position on a channel without a journal
+    memset(&header, 0, sizeof(header));
+    header.type = LOCAL_MESSAGE_TYPE_PUBLISH;
+    header.topic = SHM_TEST_TOPIC;
+    header.journal_position = 64;
+    header.message_size = sizeof(struct shm_test_message_s);
+    shm_test_write_frame(ring, &header, pointers, sizeof(struct shm_test_message_s));
+    //A header that claims more payload than its record holds
+    memset(&header, 0, sizeof(header));
+    header.type = LOCAL_MESSAGE_TYPE_USR;
+    header.message_size = 1000;
+    shm_test_write_frame(ring, &header, pointers, sizeof(pointers));
+    local_messenger_shm_close(&shm);
+}
+
+/**
+ * @brief body of a child process sending over the channel of its parent
+ * @param producer the child's index
+ */
+static void shm_test_child(unsigned int producer)
+{
+    struct shm_test_message_s message;
+    messenger_t *channel;
+    if(0 == producer)
+    {
+        //Ahead of the messages of this child so they are all handled once its last message is
+        shm_test_forge();
+    }
+    channel = messenger_attach("shm-test");
+    assert(NULL != channel);
+    message.producer = producer;
+    for(message.sequence = 0; message.sequence < SHM_TEST_MESSAGES; message.sequence++)
+    {
+        messenger_channel_send(channel, &message, sizeof(message));
+    }
+    messenger_channel_publish(channel, SHM_TEST_TOPIC, &message, sizeof(message));
+    messenger_destroy(channel);
+    _exit(0);
+}
+
+static void shm_test(void **state)
+{
+    messenger_config_t config;
+    messenger_t *channel;
+    pid_t children[SHM_TEST_PRODUCERS];
+    int status;
+    time_out_helper_data_s timeout;
+#if LOCAL_MESSENGER_STATS
+    messenger_stats_s stats;
+#endif //LOCAL_MESSENGER_STATS
+    memset(shm_test_next, 0, sizeof(shm_test_next));
+    atomic_store(&shm_test_received, 0);
+    atomic_store(&shm_test_published, 0);
+    assert_null(messenger_attach("shm-test"));
+    messenger_config_init(&config);
+    config.name = "shm-test";
+    config.transport = MESSENGER_TRANSPORT_SHM;
+    config.ring_size = SHM_TEST_RING_SIZE;
+    channel = messenger_create(&config);
+    messenger_channel_register_callback(channel, shm_test_callback);
+    messenger_channel_subscribe(channel, SHM_TEST_TOPIC, shm_test_topic_callback);
+    for(unsigned int i = 0; i < SHM_TEST_PRODUCERS; i++)
+    {
+        children[i] = fork();
+        assert_true(0 <= children[i]);
+        if(0 == children[i])
+        {
+            shm_test_child(i);
+        }
+    }
+    for(unsigned int i = 0; i < SHM_TEST_PRODUCERS; i++)
+    {
+        assert_int_equal(children[i], waitpid(children[i], &status, 0));
+        assert_true(WIFEXITED(status));
+        assert_int_equal(0, WEXITSTATUS(status));
+    }
+    time_out_helper_init(&timeout, 2000);
+    while((SHM_TEST_PRODUCERS * SHM_TEST_MESSAGES != atomic_load(&shm_test_received) || SHM_TEST_PRODUCERS != atomic_load(&shm_test_published)) &&
+          false == time_out_helper_check(&timeout))
+    {
+        test_sleep_ns(100000);
+    }
+    assert_int_equal(SHM_TEST_PRODUCERS * SHM_TEST_MESSAGES, atomic_load(&shm_test_received));
+    assert_int_equal(SHM_TEST_PRODUCERS, atomic_load(&shm_test_published));
+#if LOCAL_MESSENGER_STATS
+    messenger_channel_get_stats(channel, &stats);
+    assert_int_equal(SHM_TEST_FORGED, stats.messages_rejected);
+#endif //LOCAL_MESSENGER_STATS
+    messenger_destroy(channel);
+    //The name goes away with the channel
+    assert_null(messenger_attach("shm-test"));
+}
+
+/*********************************************************************
+ *************** Restart Test ****************************************
+ ********************************************************************/
+#define RESTART_TEST_CYCLES 20
+
+static atomic_uint restart_test_received; //!< Number of messages received
+
+static void restart_test_callback(void *msg, long message_size)
+{
+    assert_int_equal(sizeof(unsigned int), message_size);
+    atomic_fetch_add(&restart_test_received, 1);
+}
+
+/**
+ * @brief count the System V queues on the system
+ * @return the number of queues, 0 where they can not be listed
+ */
+static unsigned int restart_test_queue_count(void)
+{
+    unsigned int count = 0;
+    int c;
+    FILE *file = fopen("/proc/sysvipc/msg", "r");
+    if(NULL == file)
+    {
+        return 0;
+    }
+    while(EOF != (c = fgetc(file)))
+    {
+        count += ('\n' == c) ? 1 : 0;
+    }
+    fclose(file);
+    //The first line is the column header
+    return (0 < count) ? count - 1 : 0;
+}
+
+/**
+ * @brief start and kill the messenger a number of times, checking it works each time
+ * @param warm true to park the messenger between runs
+ */
+static void run_restart_cycles(bool warm)
+{
+    unsigned int queues = restart_test_queue_count();
+    messenger_set_warm_restart(warm);
+    for(unsigned int cycle = 0; cycle < RESTART_TEST_CYCLES; cycle++)
+    {
+        atomic_store(&restart_test_received, 0);
+        //The previous kill reset the callback, or registering again would assert
+        messenger_register_callback(restart_test_callback);
+        messenger_send(&cycle, sizeof(cycle));
+        while(1 != atomic_load(&restart_test_received))
+        {
+            test_sleep_ms(1);
+        }
+        messenger_kill();
+        //A parked messenger keeps its one queue. Otherwise nothing is left behind
+        assert_true(restart_test_queue_count() <= queues + 1);
+    }
+    messenger_set_warm_restart(false);
+    assert_int_equal(queues, restart_test_queue_count());
+}
+
+static void restart_test(void **state)
+{
+    run_restart_cycles(false);
+    run_restart_cycles(true);
+}
+
+static void restart_sysv_test(void **state)
+{
+    unsigned int queues;
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_restart_cycles(false);
+    run_restart_cycles(true);
+    //A start with different settings releases the parked queue rather than reusing it
+    queues = restart_test_queue_count();
+    messenger_set_warm_restart(true);
+    messenger_kill();
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+    messenger_kill();
+    assert_int_equal(queues, restart_test_queue_count());
+    messenger_set_warm_restart(false);
+}
+
+/*********************************************************************
+ *************** First Send Test *************************************
+ ********************************************************************/
+#define FIRST_SEND_TEST_THREADS 8
+#define FIRST_SEND_TEST_MESSAGES 500
+#define FIRST_SEND_TEST_UNCOUNTED 0xFFFFFFFFU //!< Sent before the callback is registered
+
+static atomic_uint first_send_test_received; //!< Number of counted messages received
+static atomic_uint first_send_test_ready; //!< Number of threads waiting at the start line
+static atomic_bool first_send_test_go; //!< Releases the threads for their first send
+static atomic_bool first_send_test_counting; //!< Releases the threads once the callback is registered
+
+static void first_send_test_callback(void *msg, long message_size)
+{
+    assert_int_equal(sizeof(unsigned int), message_size);
+    if(FIRST_SEND_TEST_UNCOUNTED != *((unsigned int *)msg))
+    {
+        atomic_fetch_add(&first_send_test_received, 1);
+    }
+}
+
+/**
+ * @brief thread that races the others to the first send, then sends a counted run
+ * @param arg unused
+ */
+static void *first_send_test_thread(void *arg)
+{
+    unsigned int value = FIRST_SEND_TEST_UNCOUNTED;
+    atomic_fetch_add(&first_send_test_ready, 1);
+    while(false == atomic_load(&first_send_test_go)) {}
+    messenger_send(&value, sizeof(value));
+    while(false == atomic_load(&first_send_test_counting)) {}
+    for(value = 0; value < FIRST_SEND_TEST_MESSAGES; value++)
+    {
+        messenger_send(&value, sizeof(value));
+    }
+    return NULL;
+}
+
+/**
+ * @brief have a set of threads make the first send at the same time
+ * @param eager true to start the messenger with messenger_init first
+ */
+static void run_first_send_test(bool eager)
+{
+    pthread_t threads[FIRST_SEND_TEST_THREADS];
+    unsigned int queues = restart_test_queue_count();
+    atomic_store(&first_send_test_received, 0);
+    atomic_store(&first_send_test_ready, 0);
+    atomic_store(&first_send_test_go, false);
+    atomic_store(&first_send_test_counting, false);
+    if(true == eager)
+    {
+        messenger_init(NULL);
+    }
+    for(unsigned int i = 0; i < FIRST_SEND_TEST_THREADS; i++)
+    {
+        assert_int_equal(0, pthread_create(&threads[i], NULL, first_send_test_thread, NULL));
+    }
+    while(FIRST_SEND_TEST_THREADS != atomic_load(&first_send_test_ready)) {}
+    atomic_store(&first_send_test_go, true);
+    messenger_register_callback(first_send_test_callback);
+    atomic_store(&first_send_test_counting, true);
+    for(unsigned int i = 0; i < FIRST_SEND_TEST_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    while(FIRST_SEND_TEST_THREADS * FIRST_SEND_TEST_MESSAGES != atomic_load(&first_send_test_received))
+    {
+        test_sleep_ms(1);
+    }
+    //However many threads raced to start it, one messenger was started
+    assert_true(restart_test_queue_count() <= queues + 1);
+    messenger_kill();
+    assert_int_equal(queues, restart_test_queue_count());
+}
+
+static void first_send_test(void **state)
+{
+    run_first_send_test(false);
+    run_first_send_test(true);
+}
+
+static void first_send_sysv_test(void **state)
+{
+    messenger_config_t config;
+    unsigned int queues = restart_test_queue_count();
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_first_send_test(false);
+    run_first_send_test(true);
+    //An eager start has the queue ready before anything is sent
+    messenger_config_init(&config);
+    config.transport = MESSENGER_TRANSPORT_SYSV_QUEUE;
+    messenger_init(&config);
+    assert_int_equal(queues + 1, restart_test_queue_count());
+    messenger_kill();
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+}
+
+/*********************************************************************
+ *************** Stats Test ******************************************
+ ********************************************************************/
+#define STATS_TEST_SIZE 64
+#define STATS_TEST_TIMEOUT_MS 10
+
+static atomic_bool stats_test_gate; //!< Holds the first callback until set
+static atomic_bool stats_test_entered; //!< Set once the first callback is running
+static atomic_uint stats_test_received; //!< Number of messages received
+
+static void stats_test_callback(void *msg, long message_size)
+{
+    assert_int_equal(STATS_TEST_SIZE, message_size);
+    atomic_store(&stats_test_entered, true);
+    while(false == atomic_load(&stats_test_gate))
+    {
+        test_sleep_ms(1);
+    }
+    atomic_fetch_add(&stats_test_received, 1);
+}
+
+/**
+ * @brief stall the callback, fill the transport, then check what the counters saw
+ */
+static void run_stats_test(void)
+{
+    static char message[STATS_TEST_SIZE];
+    messenger_stats_s stats;
+    unsigned int sent = 1;
+    atomic_store(&stats_test_gate, false);
+    atomic_store(&stats_test_entered, false);
+    atomic_store(&stats_test_received, 0);
+    messenger_register_callback(stats_test_callback);
+    messenger_send(message, sizeof(message));
+    while(false == atomic_load(&stats_test_entered))
+    {
+        test_sleep_ms(1);
+    }
+    while(MESSENGER_SEND_OK == messenger_try_send(message, sizeof(message)))
+    {
+        sent++;
+    }
+    assert_int_equal(MESSENGER_SEND_TIMED_OUT, messenger_send_timeout(message, sizeof(message), STATS_TEST_TIMEOUT_MS));
+    messenger_get_stats(&stats);
+#if LOCAL_MESSENGER_STATS
+    assert_int_equal(sent, stats.messages_sent);
+    assert_int_equal(sent * STATS_TEST_SIZE, stats.bytes_sent);
+    assert_int_equal(1, stats.send_would_block);
+    assert_int_equal(1, stats.send_timeouts);
+    assert_true(0 < stats.send_retries);
+    assert_true(0 < stats.messages_received);
+    assert_int_equal(sent - stats.messages_received, stats.queue_depth);
+    assert_true(0 < stats.queue_bytes);
+    assert_true(0 < stats.peak_queue_bytes);
+#endif //LOCAL_MESSENGER_STATS
+    atomic_store(&stats_test_gate, true);
+    while(sent != atomic_load(&stats_test_received))
+    {
+        test_sleep_ms(1);
+    }
+    messenger_get_stats(&stats);
+    messenger_kill();
+#if LOCAL_MESSENGER_STATS
+    assert_int_equal(sent, stats.messages_received);
+    assert_int_equal(sent * STATS_TEST_SIZE, stats.bytes_received);
+    assert_int_equal(0, stats.queue_depth);
+    assert_int_equal(sent, stats.latency.count);
+    assert_int_equal(sent, stats.callback_duration.count);
+    //The first callback was held past the send timeout
+    assert_true(STATS_TEST_TIMEOUT_MS * TIME_OUT_HELPER_NS_PER_MS <= stats.callback_duration.max_ns);
+    assert_true(messenger_histogram_percentile(&stats.latency, 50) <= messenger_histogram_percentile(&stats.latency, 99));
+    assert_int_equal(stats.latency.max_ns, messenger_histogram_percentile(&stats.latency, 100));
+#else
+    assert_int_equal(0, stats.messages_sent);
+    assert_int_equal(0, stats.latency.count);
+#endif //LOCAL_MESSENGER_STATS
+}
+
+static void stats_test(void **state)
+{
+    messenger_histogram_s histogram = {0};
+    //Values below 2^MESSENGER_HISTOGRAM_SUB_BUCKET_BITS get a bucket each
+    histogram.count = 100;
+    histogram.max_ns = 8;
+    histogram.buckets[3] = 50;
+    histogram.buckets[8] = 50;
+    assert_int_equal(3, messenger_histogram_percentile(&histogram, 0));
+    assert_int_equal(3, messenger_histogram_percentile(&histogram, 50));
+    assert_int_equal(8, messenger_histogram_percentile(&histogram, 51));
+    assert_int_equal(8, messenger_histogram_percentile(&histogram, 100));
+    run_stats_test();
+}
+
+static void stats_sysv_test(void **state)
+{
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_stats_test();
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+}
+
+/*********************************************************************
+ *************** Request Test ****************************************
+ ********************************************************************/
+#define REQUEST_TEST_IN_FLIGHT 2000
+#define REQUEST_TEST_TIMEOUT_MS 20
+#define REQUEST_TEST_DROP UINT32_MAX //!< Requests the handler never answers
+#define REQUEST_TEST_DEFER (UINT32_MAX - 1) //!< Requests the handler leaves for the test to answer
+#define REQUEST_TEST_FILL (UINT32_MAX - 2) //!< Requests the handler answers once the channel waiting on the reply is full
+
+static atomic_uint request_test_ok; //!< Replies that matched their request
+static atomic_uint request_test_timed_out; //!< Requests that timed out
+static atomic_uint request_test_cancelled; //!< Requests cancelled by their channel stopping
+static atomic_uint request_test_wrong; //!< Replies that did not match their request
+static atomic_uint request_test_dropped; //!< Requests whose reply could not be sent
+static atomic_int request_test_fill_result; //!< What messenger_reply returned for the REQUEST_TEST_FILL request
+static messenger_request_t request_test_deferred; //!< The request left for the test to answer
+static atomic_bool request_test_have_deferred; //!< Set once request_test_deferred is filled in
+
+static void request_test_handler(const messenger_request_t *request, void *msg, long message_size)
+{
+    uint32_t value;
+    assert_int_equal(sizeof(value), message_size);
+    memcpy(&value, msg, sizeof(value));
+    if(REQUEST_TEST_DROP == value)
+    {
+        return;
+    }
+    if(REQUEST_TEST_DEFER == value)
+    {
+        request_test_deferred = request[0];
+        atomic_store(&request_test_have_deferred, true);
+        return;
+    }
+    if(REQUEST_TEST_FILL == value)
+    {
+        //Nothing drains the channel while its own dispatch thread is in here
+        while(MESSENGER_SEND_OK == messenger_channel_try_send(request->reply_to, &value, sizeof(value)))
+        {
+        }
+        atomic_store(&request_test_fill_result, messenger_reply(request, &value, sizeof(value)));
+        return;
+    }
+    value *= 2;
+    messenger_reply(request, &value, sizeof(value));
+}
+
+static void request_test_reply(void *context, enum messenger_reply_status_e status, void *reply, long reply_size)
+{
+    uint32_t value;
+    switch(status)
+    {
+        case MESSENGER_REPLY_OK:
+            assert_int_equal(sizeof(value), reply_size);
+            memcpy(&value, reply, sizeof(value));
+            atomic_fetch_add((value == 2 * (uint32_t)(uintptr_t)context) ? &request_test_ok : &request_test_wrong, 1);
+            break;
+        case MESSENGER_REPLY_TIMED_OUT:
+            assert_null(reply);
+            atomic_fetch_add(&request_test_timed_out, 1);
+            break;
+        case MESSENGER_REPLY_DROPPED:
+            assert_null(reply);
+            atomic_fetch_add(&request_test_dropped, 1);
+            break;
+        default:
+            atomic_fetch_add(&request_test_cancelled, 1);
+            break;
+    }
+}
+
+/**
+ * @brief keep thousands of requests in flight from one thread, then check timeouts, late replies,
+ * futures and the requests cancelled when the channel waiting on them is destroyed
+ */
+static void run_request_test(enum messenger_transport_e transport)
+{
+    messenger_config_t config;
+    messenger_t *server;
+    messenger_t *client;
+    messenger_future_t *future;
+    uint32_t value;
+    long reply_size;
+    atomic_store(&request_test_ok, 0);
+    atomic_store(&request_test_timed_out, 0);
+    atomic_store(&request_test_cancelled, 0);
+    atomic_store(&request_test_wrong, 0);
+    atomic_store(&request_test_dropped, 0);
+    atomic_store(&request_test_fill_result, MESSENGER_SEND_OK);
+    atomic_store(&request_test_have_deferred, false);
+    messenger_config_init(&config);
+    config.transport = transport;
+    server = messenger_create(&config);
+    client = messenger_create(&config);
+    messenger_channel_register_request_handler(server, request_test_handler);
+    for(uint32_t i = 0; i < REQUEST_TEST_IN_FLIGHT; i++)
+    {
+        assert_int_equal(MESSENGER_SEND_OK, messenger_channel_request(server, client, &i, sizeof(i), 1000, request_test_reply, (void *)(uintptr_t)i));
+    }
+    timer_test_wait_for(&request_test_ok, REQUEST_TEST_IN_FLIGHT);
+    assert_int_equal(0, atomic_load(&request_test_wrong));
+    assert_int_equal(0, atomic_load(&request_test_timed_out));
+    //The reply that never comes times out on the client's timer wheel
+    value = REQUEST_TEST_DROP;
+    assert_int_equal(MESSENGER_SEND_OK, messenger_channel_request(server, client, &value, sizeof(value), REQUEST_TEST_TIMEOUT_MS, request_test_reply, NULL));
+    timer_test_wait_for(&request_test_timed_out, 1);
+    //A reply after the timeout is dropped
+    value = REQUEST_TEST_DEFER;
+    assert_int_equal(MESSENGER_SEND_OK, messenger_channel_request(server, client, &value, sizeof(value), REQUEST_TEST_TIMEOUT_MS, request_test_reply, NULL));
+    timer_test_wait_for(&request_test_timed_out, 2);
+    assert_true(atomic_load(&request_test_have_deferred));
+    messenger_reply(&request_test_deferred, &value, sizeof(value));
+    value = 21;
+    future = messenger_channel_request_future(server, client, &value, sizeof(value), 1000);
+    assert_non_null(future);
+    value = 0;
+    assert_int_equal(MESSENGER_REPLY_OK, messenger_future_wait(future, &value, sizeof(value), &reply_size));
+    assert_int_equal(sizeof(value), reply_size);
+    assert_int_equal(42, value);
+    assert_int_equal(REQUEST_TEST_IN_FLIGHT, atomic_load(&request_test_ok));
+    assert_int_equal(0, atomic_load(&request_test_wrong));
+    assert_int_equal(2, atomic_load(&request_test_timed_out));
+    //A channel answering its own request when it is full can not wait for room, so the request ends dropped
+    value = REQUEST_TEST_FILL;
+    assert_int_equal(MESSENGER_SEND_OK, messenger_channel_request(server, server, &value, sizeof(value), 0, request_test_reply, NULL));
+    timer_test_wait_for(&request_test_dropped, 1);
+    assert_int_equal(MESSENGER_SEND_WOULD_BLOCK, atomic_load(&request_test_fill_result));
+    //Requests without a timeout are cancelled when the channel waiting on them goes
+    value = REQUEST_TEST_DROP;
+    assert_int_equal(MESSENGER_SEND_OK, messenger_channel_request(server, client, &value, sizeof(value), 0, request_test_reply, NULL));
+    future = messenger_channel_request_future(server, client, &value, sizeof(value), 0);
+    messenger_destroy(client);
+    assert_int_equal(1, atomic_load(&request_test_cancelled));
+    assert_true(messenger_future_done(future));
+    assert_int_equal(MESSENGER_REPLY_CANCELLED, messenger_future_wait(future, NULL, 0, NULL));
+    messenger_destroy(server);
+    //The default messenger answers its own requests
+    messenger_register_request_handler(request_test_handler);
+    value = 5;
+    future = messenger_request_future(&value, sizeof(value), 1000);
+    assert_int_equal(MESSENGER_REPLY_OK, messenger_future_wait(future, &value, sizeof(value), NULL));
+    assert_int_equal(10, value);
+    messenger_kill();
+}
+
+static void request_test(void **state)
+{
+    run_request_test(MESSENGER_TRANSPORT_RING);
+}
+
+static void request_sysv_test(void **state)
+{
+    messenger_set_transport(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    run_request_test(MESSENGER_TRANSPORT_SYSV_QUEUE);
+    messenger_set_transport(MESSENGER_TRANSPORT_RING);
+}
+
+/*********************************************************************
+ *************** Typed Test ******************************************
+ ********************************************************************/
+#define TYPED_TEST_MESSAGES 200
+#define TYPED_TEST_POINT 1 //!< Fixed size type
+#define TYPED_TEST_TEXT 2 //!< Variable size type
+#define TYPED_TEST_UNUSED 3 //!< Type without a handler
+#define TYPED_TEST_TEXT_MAX 16
+
+typedef struct typed_test_counts_s
+{
+    atomic_uint points; //!< Messages seen by the point handler
+    atomic_uint texts; //!< Messages seen by the text handler
+    atomic_uint untyped; //!< Messages seen by the channel callback
+} typed_test_counts_s; //!< What the handlers of the typed test are given as their context
+
+static void typed_test_point_handler(void *context, void *msg, long message_size)
+{
+    typed_test_counts_s *counts = context;
+    assert_int_equal(2 * sizeof(uint32_t), message_size);
+    assert_int_equal(TYPED_TEST_POINT, ((uint32_t *)msg)[0]);
+    atomic_fetch_add(&counts->points, 1);
+}
+
+static void typed_test_text_handler(void *context, void *msg, long message_size)
+{
+    typed_test_counts_s *counts = context;
+    assert_in_range(message_size, 1, TYPED_TEST_TEXT_MAX);
+    assert_int_equal('t', ((char *)msg)[0]);
+    atomic_fetch_add(&counts->texts, 1);
+}
+
+static void typed_test_untyped_callback(void *context, void *msg, long message_size)
+{
+    typed_test_counts_s *counts = context;
+    assert_int_equal('u', ((char *)msg)[0]);
+    atomic_fetch_add(&counts->untyped, 1);
+}
+
+static void run_typed_test(enum messenger_transport_e transport, unsigned int workers)
+{
+    messenger_config_t config;
+    messenger_t *messenger;
+#if LOCAL_MESSENGER_STATS
+    messenger_stats_s stats;
+#endif //LOCAL_MESSENGER_STATS
+    typed_test_counts_s counts;
+    uint32_t point[2] = {TYPED_TEST_POINT, 0};
+    char text[2 * TYPED_TEST_TEXT_MAX] = "text";
+    char untyped[] = "untyped";
+    atomic_init(&counts.points, 0);
+    atomic_init(&counts.texts, 0);
+    atomic_init(&counts.untyped, 0);
+    messenger_config_init(&config);
+    config.transport = transport;
+    config.workers = workers;
+    messenger = messenger_create(&config);
+    messenger_channel_register_context_callback(messenger, typed_test_untyped_callback, &counts);
+    messenger_channel_register_handler(messenger, TYPED_TEST_POINT, sizeof(point), sizeof(point), typed_test_point_handler, &counts);
+    messenger_channel_register_handler(messenger, TYPED_TEST_TEXT, 1, TYPED_TEST_TEXT_MAX, typed_test_text_handler, &counts);
+    for(unsigned int i = 0; i < TYPED_TEST_MESSAGES; i++)
+    {
+        point[1] = i;
+        messenger_channel_send_typed(messenger, TYPED_TEST_POINT, point, sizeof(point));
+        messenger_channel_send_typed(messenger, TYPED_TEST_TEXT, text, (long)(1 + (i % TYPED_TEST_TEXT_MAX)));
+        messenger_channel_send(messenger, untyped, sizeof(untyped));
+    }
+    //None of these reach a handler
+    messenger_channel_send_typed(messenger, TYPED_TEST_POINT, point, sizeof(point[0]));
+    messenger_channel_send_typed(messenger, TYPED_TEST_TEXT, text, sizeof(text));
+    messenger_channel_send_typed(messenger, TYPED_TEST_UNUSED, point, sizeof(point));
+    while(TYPED_TEST_MESSAGES != atomic_load(&counts.points) || TYPED_TEST_MESSAGES != atomic_load(&counts.texts) ||
+            TYPED_TEST_MESSAGES != atomic_load(&counts.untyped))
+    {
+        test_sleep_ms(1);
+    }
+#if LOCAL_MESSENGER_STATS
+    //The rejected messages were sent last so they are counted once the dispatch thread gets to them
+    do
+    {
+        test_sleep_ms(1);
+        messenger_channel_get_stats(messenger, &stats);
+    } while(3 != stats.messages_rejected);
+#endif //LOCAL_MESSENGER_STATS
+    messenger_destroy(messenger);
+    assert_int_equal(TYPED_TEST_MESSAGES, atomic_load(&counts.points));
+    assert_int_equal(TYPED_TEST_MESSAGES, atomic_load(&counts.texts));
+    assert_int_equal(TYPED_TEST_MESSAGES, atomic_load(&counts.untyped));
+}
+
+static void typed_test(void **state)
+{
+    run_typed_test(MESSENGER_TRANSPORT_RING, 0);
+    run_typed_test(MESSENGER_TRANSPORT_RING, 2);
+}
+
+static void typed_sysv_test(void **state)
+{
+    run_typed_test(MESSENGER_TRANSPORT_SYSV_QUEUE, 0);
+}
+
+/*********************************************************************
+ *************** Pollable Test ***************************************
+ ********************************************************************/
+#define POLLABLE_TEST_MESSAGES 5000
+#define POLLABLE_TEST_MAX_DISPATCH 16
+#define POLLABLE_TEST_DELAY_MS 20
+
+typedef struct pollable_test_state_s
+{
+    pthread_t owner; //!< The thread running the event loop
+    unsigned int received; //!< Messages handed out. Only touched by the owner
+    unsigned int delayed; //!< Delayed messages handed out
+} pollable_test_state_s; //!< Context of the pollable test callback
+
+static void pollable_test_callback(void *context, void *msg, long message_size)
+{
+    pollable_test_state_s *state = context;
+    //Messages are handed out on the thread that dispatches, never on one of ours
+    assert_true(pthread_equal(state->owner, pthread_self()));
+    if(0 == memcmp(msg, "delayed", sizeof("delayed")))
+    {
+        state->delayed++;
+        return;
+    }
+    assert_int_equal(sizeof(unsigned int), message_size);
+    assert_int_equal(state->received, ((unsigned int *)msg)[0]);
+    state->received++;
+}
+
+static void *pollable_test_producer(void *arg)
+{
+    messenger_t *messenger = arg;
+    for(unsigned int i = 0; i < POLLABLE_TEST_MESSAGES; i++)
+    {
+        messenger_channel_send(messenger, &i, sizeof(i));
+    }
+    return NULL;
+}
+
+static void pollable_test(void **state)
+{
+    messenger_config_t config;
+    messenger_t *messenger;
+    pthread_t producer;
+    pollable_test_state_s test_state = {.owner = pthread_self(), .received = 0, .delayed = 0};
+    struct pollfd poll_fd;
+    unsigned int value = 0;
+    messenger_config_init(&config);
+    config.pollable = true;
+    messenger = messenger_create(&config);
+    messenger_channel_register_context_callback(messenger, pollable_test_callback, &test_state);
+    poll_fd.fd = messenger_channel_fd(messenger);
+    poll_fd.events = POLLIN;
+    //Nothing is pending so the descriptor is quiet
+    assert_int_equal(0, poll(&poll_fd, 1, 0));
+    assert_int_equal(-1, messenger_channel_next_timeout_ms(messenger));
+    assert_int_equal(0, pthread_create(&producer, NULL, pollable_test_producer, messenger));
+    while(POLLABLE_TEST_MESSAGES != test_state.received)
+    {
+        assert_int_equal(1, poll(&poll_fd, 1, 1000));
+        assert_in_range(messenger_channel_dispatch_pending(messenger, POLLABLE_TEST_MAX_DISPATCH), 0, POLLABLE_TEST_MAX_DISPATCH);
+    }
+    pthread_join(producer, NULL);
+    messenger_channel_dispatch_pending(messenger, POLLABLE_TEST_MAX_DISPATCH);
+    assert_int_equal(0, poll(&poll_fd, 1, 0));
+    //Delayed messages are run by dispatch_pending once the loop's timeout says they are due
+    messenger_channel_send_delayed(messenger, "delayed", sizeof("delayed"), POLLABLE_TEST_DELAY_MS);
+    assert_int_equal(1, poll(&poll_fd, 1, 1000));
+    assert_int_equal(1, messenger_channel_dispatch_pending(messenger, POLLABLE_TEST_MAX_DISPATCH));
+    //The deadline is rounded up to the next tick of the timer wheel
+    assert_in_range(messenger_channel_next_timeout_ms(messenger), 1, POLLABLE_TEST_DELAY_MS + 1);
+    while(0 == test_state.delayed)
+    {
+        poll(&poll_fd, 1, messenger_channel_next_timeout_ms(messenger));
+        messenger_channel_dispatch_pending(messenger, POLLABLE_TEST_MAX_DISPATCH);
+    }
+    assert_int_equal(-1, messenger_channel_next_timeout_ms(messenger));
+    //Messages left behind by the limit keep the descriptor readable
+    for(unsigned int i = 0; i < 2 * POLLABLE_TEST_MAX_DISPATCH; i++)
+    {
+        value = test_state.received + i;
+        messenger_channel_send(messenger, &value, sizeof(value));
+    }
+    assert_int_equal(POLLABLE_TEST_MAX_DISPATCH, messenger_channel_dispatch_pending(messenger, POLLABLE_TEST_MAX_DISPATCH));
+    assert_int_equal(1, poll(&poll_fd, 1, 0));
+    assert_int_equal(POLLABLE_TEST_MAX_DISPATCH, messenger_channel_dispatch_pending(messenger, POLLABLE_TEST_MAX_DISPATCH));
+    assert_int_equal(0, poll(&poll_fd, 1, 0));
+    messenger_destroy(messenger);
+    assert_int_equal(POLLABLE_TEST_MESSAGES + 2 * POLLABLE_TEST_MAX_DISPATCH, test_state.received);
+    assert_int_equal(1, test_state.delayed);
+    //The default messenger can be pollable too
+    messenger_init(&config);
+    test_state.received = 0;
+    messenger_register_context_callback(pollable_test_callback, &test_state);
+    messenger_send(&value, sizeof(value));
+    test_state.received = value;
+    assert_int_equal(1, messenger_dispatch_pending(POLLABLE_TEST_MAX_DISPATCH));
+    assert_int_equal(value + 1, test_state.received);
+    messenger_kill();
+    messenger_config_init(&config);
+    messenger_init(&config);
+    messenger_kill();
+}
+
+/*********************************************************************
+ *************** Wait Strategy Test **********************************
+ ********************************************************************/
+#define WAIT_TEST_MESSAGES 1000
+#define WAIT_TEST_DELAY_MS 20
+
+typedef struct wait_test_state_s
+{
+    int cpu; //!< The CPU the dispatch thread is pinned to. -1 when it is not pinned
+    atomic_uint received; //!< Messages handed out
+    atomic_uint delayed; //!< Delayed messages handed out
+} wait_test_state_s; //!< Context of the wait strategy test callback
+
+static void wait_test_callback(void *context, void *msg, long message_size)
+{
+    wait_test_state_s *state = context;
+#ifdef __linux__
+    if(0 <= state->cpu)
+    {
+        assert_int_equal(state->cpu, sched_getcpu());
+    }
+#endif //__linux__
+    if(0 == memcmp(msg, "delayed", sizeof("delayed")))
+    {
+        atomic_fetch_add(&state->delayed, 1);
+        return;
+    }
+    assert_int_equal(sizeof(unsigned int), message_size);
+    assert_int_equal(atomic_load(&state->received), ((unsigned int *)msg)[0]);
+    atomic_fetch_add(&state->received, 1);
+}
+
+/**
+ * @brief send on a channel with the wait strategy of a config, in bursts and with gaps the dispatch
+ * thread sleeps through, and check that every message and a delayed message arrive
+ * @param config the channel settings
+ * @param cpu the CPU the config pins the dispatch thread to. -1 when it is not pinned
+ */
+static void run_wait_test(messenger_config_t *config, int cpu)
+{
+    messenger_t *messenger;
+    wait_test_state_s test_state = {.cpu = cpu};
+    atomic_init(&test_state.received, 0);
+    atomic_init(&test_state.delayed, 0);
+    messenger = messenger_create(config);
+    messenger_channel_register_context_callback(messenger, wait_test_callback, &test_state);
+    for(unsigned int i = 0; i < WAIT_TEST_MESSAGES; i++)
+    {
+        messenger_channel_send(messenger, &i, sizeof(i));
+        if(0 == (i % 100))
+        {
+            //Long enough for a spinning dispatch thread to give up and park
+            test_sleep_ns(200000);
+        }
+    }
+    //Timers still go off while the dispatch thread polls
+    messenger_channel_send_delayed(messenger, "delayed", sizeof("delayed"), WAIT_TEST_DELAY_MS);
+    while(WAIT_TEST_MESSAGES != atomic_load(&test_state.received) || 0 == atomic_load(&test_state.delayed))
+    {
+        test_sleep_ns(TIME_OUT_HELPER_NS_PER_MS);
+    }
+    messenger_destroy(messenger);
+}
+
+static void wait_strategy_test(void **state)
+{
+    static const enum messenger_wait_strategy_e strategies[] =
+    {
+        MESSENGER_WAIT_PARK,
+        MESSENGER_WAIT_SPIN_THEN_PARK,
+        MESSENGER_WAIT_BUSY_POLL
+    };
+    static const enum messenger_transport_e transports[] = {MESSENGER_TRANSPORT_RING, MESSENGER_TRANSPORT_SYSV_QUEUE};
+    messenger_config_t config;
+    int cpu = -1;
+#ifdef __linux__
+    cpu_set_t cpus;
+    assert_int_equal(0, sched_getaffinity(0, sizeof(cpus), &cpus));
+    for(int i = 0; i < 64 && -1 == cpu; i++)
+    {
+        cpu = CPU_ISSET(i, &cpus) ? i : -1;
+    }
+#endif //__linux__
+    for(unsigned int t = 0; t < ARRAY_MAX_COUNT(transports); t++)
+    {
+        for(unsigned int s = 0; s < ARRAY_MAX_COUNT(strategies); s++)
+        {
+            messenger_config_init(&config);
+            config.transport = transports[t];
+            config.wait_strategy = strategies[s];
+            run_wait_test(&config, -1);
+        }
+    }
+#ifdef __linux__
+    //Pinned, and on SCHED_FIFO when the test may use it. A parking thread so it can not starve the test
+    messenger_config_init(&config);
+    config.cpu_mask = 1ULL << cpu;
+    config.sched_priority = 1;
+    run_wait_test(&config, cpu);
+#endif //__linux__
+}
+
+/*********************************************************************
+ *************** Journal Test ****************************************
+ ********************************************************************/
+#define JOURNAL_TEST_MESSAGES 500
+#define JOURNAL_TEST_CRASH_AT 200
+#define JOURNAL_TEST_SEGMENT_SIZE 4096
+
+static atomic_bool journal_test_sent; //!< Set once the child has sent everything
+static atomic_uint journal_test_received; //!< Messages handed out after the restart
+static atomic_uint journal_test_next; //!< The value the next message handed out should have
+
+static void journal_test_crash_callback(void *msg, long message_size)
+{
+    while(false == atomic_load(&journal_test_sent))
+    {
+        test_sleep_ns(100000);
+    }
+    if(JOURNAL_TEST_CRASH_AT == ((unsigned int *)msg)[0])
+    {
+        //Die part way through without stopping the channel
+        _exit(0);
+    }
+}
+
+static void journal_test_callback(void *msg, long message_size)
+{
+    unsigned int value;
+    assert_int_equal(sizeof(value), message_size);
+    memcpy(&value, msg, sizeof(value));
+    if(0 == atomic_load(&journal_test_received))
+    {
+        //Messages of the batch the crash cut short were not acknowledged either
+        assert_in_range(value, 0, JOURNAL_TEST_CRASH_AT);
+        atomic_store(&journal_test_next, value);
+    }
+    assert_int_equal(atomic_load(&journal_test_next), value);
+    atomic_store(&journal_test_next, value + 1);
+    atomic_fetch_add(&journal_test_received, 1);
+}
+
+/**
+ * @brief count the segment files in a journal directory, or remove them all
+ * @param path the journal directory
+ * @param remove true to delete the files and the directory
+ * @return the number of segment files
+ */
+static unsigned int journal_test_segments(const char *path, bool remove)
+{
+    char file[512];
+    struct dirent *entry;
+    unsigned int rv = 0;
+    DIR *dir = opendir(path);
+    assert_non_null(dir);
+    while(NULL != (entry = readdir(dir)))
+    {
+        if('.' == entry->d_name[0])
+        {
+            continue;
+        }
+        rv += (NULL != strstr(entry->d_name, ".journal")) ? 1 : 0;
+        if(true == remove)
+        {
+            snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+            assert_int_equal(0, unlink(file));
+        }
+    }
+    closedir(dir);
+    if(true == remove)
+    {
+        assert_int_equal(0, rmdir(path));
+    }
+    return rv;
+}
+
+static void journal_test(void **state)
+{
+    char path[] = "/tmp/messenger-journal-XXXXXX";
+    messenger_config_t config;
+    messenger_t *messenger;
+    pid_t child;
+    int status;
+    unsigned int replayed;
+    assert_non_null(mkdtemp(path));
+    messenger_config_init(&config);
+    config.journal_path = path;
+    config.journal_segment_size = JOURNAL_TEST_SEGMENT_SIZE;
+    atomic_store(&journal_test_sent, false);
+    child = fork();
+    assert_true(0 <= child);
+    if(0 == child)
+    {
+        messenger = messenger_create(&config);
+        messenger_channel_register_callback(messenger, journal_test_crash_callback);
+        for(unsigned int i = 0; i < JOURNAL_TEST_MESSAGES; i++)
+        {
+            messenger_channel_send(messenger, &i, sizeof(i));
+        }
+        atomic_store(&journal_test_sent, true);
+        while(true)
+        {
+            test_sleep_ns(100000);
+        }
+    }
+    assert_int_equal(child, waitpid(child, &status, 0));
+    assert_true(WIFEXITED(status));
+    //The messages the crash left unhandled come back once the callback is registered
+    atomic_store(&journal_test_received, 0);
+    messenger = messenger_create(&config);
+    messenger_channel_register_callback(messenger, journal_test_callback);
+    replayed = messenger_channel_replay(messenger);
+    assert_in_range(replayed, JOURNAL_TEST_MESSAGES - JOURNAL_TEST_CRASH_AT, JOURNAL_TEST_MESSAGES);
+    assert_int_equal(0, messenger_channel_replay(messenger));
+    while(replayed != atomic_load(&journal_test_received))
+    {
+        test_sleep_ns(100000);
+    }
+    assert_int_equal(JOURNAL_TEST_MESSAGES, atomic_load(&journal_test_next));
+    //New messages go through the journal too, across many segments
+    for(unsigned int i = 0; i < JOURNAL_TEST_MESSAGES; i++)
+    {
+        replayed = JOURNAL_TEST_MESSAGES + i;
+        messenger_channel_send(messenger, &replayed, sizeof(replayed));
+    }
+    messenger_channel_sync(messenger);
+    while(2 * JOURNAL_TEST_MESSAGES != atomic_load(&journal_test_next))
+    {
+        test_sleep_ns(100000);
+    }
+    messenger_destroy(messenger);
+    //Everything was handed out so the checkpoint let the journal drop all but the segment being written
+    assert_int_equal(1, journal_test_segments(path, false));
+    messenger = messenger_create(&config);
+    assert_int_equal(0, messenger_channel_replay(messenger));
+    messenger_destroy(messenger);
+    journal_test_segments(path, true);
+}
+
+#define JOURNAL_TEST_FLOOD 20000 //!< Messages sent while another thread holds a slot it acquired
+#define JOURNAL_TEST_FLOOD_SIZE 64
+#define JOURNAL_TEST_FLOOD_RING (1024 * 1024) //!< Large enough that the journal fills before the ring does
+
+static atomic_uint journal_test_flood_sent; //!< Messages the flooding thread has sent
+static atomic_uint journal_test_flood_received; //!< Messages handed out
+
+static void journal_test_flood_callback(void *msg, long message_size)
+{
+    assert_int_equal(JOURNAL_TEST_FLOOD_SIZE, message_size);
+    atomic_fetch_add(&journal_test_flood_received, 1);
+}
+
+static void *journal_test_flood_task(void *args)
+{
+    messenger_t *messenger = args;
+    uint8_t message[JOURNAL_TEST_FLOOD_SIZE] = {0};
+    for(unsigned int i = 0; i < JOURNAL_TEST_FLOOD; i++)
+    {
+        assert_int_equal(MESSENGER_SEND_OK, messenger_channel_send(messenger, message, sizeof(message)));
+        atomic_fetch_add(&journal_test_flood_sent, 1);
+    }
+    return NULL;
+}
+
+/**
+ * @brief fill the journal while a slot acquired from the ring holds up the dispatch thread. The commit
+ * must not wait on the journal, which only the dispatch thread can make room in
+ */
+static void journal_acquire_test(void **state)
+{
+    char path[] = "/tmp/messenger-journal-XXXXXX";
+    messenger_config_t config;
+    messenger_t *messenger;
+    pthread_t flood;
+    void *message;
+    assert_non_null(mkdtemp(path));
+    messenger_config_init(&config);
+    config.journal_path = path;
+    config.journal_segment_size = JOURNAL_TEST_SEGMENT_SIZE;
+    config.ring_size = JOURNAL_TEST_FLOOD_RING;
+    atomic_store(&journal_test_flood_sent, 0);
+    atomic_store(&journal_test_flood_received, 0);
+    messenger = messenger_create(&config);
+    messenger_channel_register_callback(messenger, journal_test_flood_callback);
+    message = messenger_channel_acquire(messenger, JOURNAL_TEST_FLOOD_SIZE);
+    assert_non_null(message);
+    memset(message, 0, JOURNAL_TEST_FLOOD_SIZE);
+    assert_int_equal(0, pthread_create(&flood, NULL, journal_test_flood_task, messenger));
+    //Give the flood time to fill the journal behind the acquired slot
+    while(0 == atomic_load(&journal_test_flood_sent))
+    {
+        test_sleep_ns(100000);
+    }
+    test_sleep_ns(50000000);
+    assert_true(JOURNAL_TEST_FLOOD > atomic_load(&journal_test_flood_sent));
+    assert_int_equal(MESSENGER_SEND_OK, messenger_channel_commit(messenger, message));
+    assert_int_equal(0, pthread_join(flood, NULL));
+    while(JOURNAL_TEST_FLOOD + 1 != atomic_load(&journal_test_flood_received))
+    {
+        test_sleep_ns(100000);
+    }
+    messenger_destroy(messenger);
+    journal_test_segments(path, true);
+}
+
+/*********************************************************************
+ *************** Conflation Test *************************************
+ ********************************************************************/
+#define CONFLATION_TEST_KEYS 4
+#define CONFLATION_TEST_UPDATES 1000
+
+typedef struct conflation_test_value_s
+{
+    uint32_t key;
+    uint32_t value;
+} conflation_test_value_s;
+
+typedef struct conflation_test_state_s
+{
+    atomic_bool gate; //!< The first callback waits on this so the updates pile up behind it
+    atomic_uint calls;
+    _Atomic uint32_t latest[CONFLATION_TEST_KEYS];
+} conflation_test_state_s;
+
+static void conflation_test_callback(void *context, void *msg, long message_size)
+{
+    conflation_test_state_s *test_state = context;
+    conflation_test_value_s value;
+    assert_int_equal(sizeof(value), message_size);
+    memcpy(&value, msg, sizeof(value));
+    assert_in_range(value.key, 0, CONFLATION_TEST_KEYS - 1);
+    while(false == atomic_load(&test_state->gate))
+    {
+        test_sleep_ns(100000);
+    }
+    //Values of a key only move forward
+    assert_true(value.value > atomic_load(&test_state->latest[value.key]) || 0 == value.value);
+    atomic_store(&test_state->latest[value.key], value.value);
+    atomic_fetch_add(&test_state->calls, 1);
+}
+
+static void run_conflation_test(messenger_config_t *config)
+{
+    messenger_t *messenger;
+    conflation_test_state_s test_state;
+    conflation_test_value_s value = {.key = 0, .value = 0};
+    bool done = false;
+#if LOCAL_MESSENGER_STATS
+    messenger_stats_s stats;
+#endif //LOCAL_MESSENGER_STATS
+    atomic_init(&test_state.gate, false);
+    atomic_init(&test_state.calls, 0);
+    for(unsigned int key = 0; key < CONFLATION_TEST_KEYS; key++)
+    {
+        atomic_init(&test_state.latest[key], 0);
+    }
+    messenger = messenger_create(config);
+    messenger_channel_register_context_callback(messenger, conflation_test_callback, &test_state);
+    //The first value holds up the callback while the rest are sent
+    messenger_channel_send_conflated(messenger, value.key, &value, sizeof(value));
+    test_sleep_ns(10 * TIME_OUT_HELPER_NS_PER_MS);
+    for(value.value = 1; value.value <= CONFLATION_TEST_UPDATES; value.value++)
+    {
+        for(value.key = 0; value.key < CONFLATION_TEST_KEYS; value.key++)
+        {
+            messenger_channel_send_conflated(messenger, value.key, &value, sizeof(value));
+        }
+    }
+    atomic_store(&test_state.gate, true);
+    while(false == done)
+    {
+        test_sleep_ns(100000);
+        done = true;
+        for(unsigned int key = 0; key < CONFLATION_TEST_KEYS; key++)
+        {
+            done = done && (CONFLATION_TEST_UPDATES == atomic_load(&test_state.latest[key]));
+        }
+    }
+    if(0 == config->workers)
+    {
+        //One callback for the first value, then one for the newest value of each key
+        assert_int_equal(1 + CONFLATION_TEST_KEYS, atomic_load(&test_state.calls));
+#if LOCAL_MESSENGER_STATS
+        messenger_channel_get_stats(messenger, &stats);
+        assert_int_equal(CONFLATION_TEST_KEYS * (CONFLATION_TEST_UPDATES - 1), stats.messages_conflated);
+        assert_int_equal(1 + CONFLATION_TEST_KEYS, stats.messages_received);
+#endif //LOCAL_MESSENGER_STATS
+    }
+    messenger_destroy(messenger);
+}
+
+#define CONFLATION_TEST_OVERFLOW 8 //!< Keys sent past a full table
+
+static void conflation_test_overflow_callback(void *context, void *msg, long message_size)
+{
+    _Atomic uint32_t *latest = context;
+    conflation_test_value_s value;
+    assert_int_equal(sizeof(value), message_size);
+    memcpy(&value, msg, sizeof(value));
+    assert_in_range(value.key, 0, LOCAL_MESSENGER_MAX_CONFLATION_KEYS + CONFLATION_TEST_OVERFLOW - 1);
+    //Values of a key still arrive in order when it could not get a slot
+    assert_int_equal(atomic_load(&latest[value.key]) + 1, value.value);
+    atomic_store(&latest[value.key], value.value);
+}
+
+/**
+ * @brief send more keys than the table holds. The keys past it go out unconflated
+ */
+static void run_conflation_overflow_test(messenger_config_t *config)
+{
+    static _Atomic uint32_t latest[LOCAL_MESSENGER_MAX_CONFLATION_KEYS + CONFLATION_TEST_OVERFLOW];
+    messenger_t *messenger;
+    conflation_test_value_s value;
+    bool done = false;
+    for(unsigned int key = 0; key < ARRAY_MAX_COUNT(latest); key++)
+    {
+        atomic_init(&latest[key], 0);
+    }
+    messenger = messenger_create(config);
+    messenger_channel_register_context_callback(messenger, conflation_test_overflow_callback, latest);
+    for(value.value = 1; value.value <= 2; value.value++)
+    {
+        for(value.key = 0; value.key < ARRAY_MAX_COUNT(latest); value.key++)
+        {
+            //Only the keys past the table get their second value, so nothing is conflated away
+            if(1 == value.value || LOCAL_MESSENGER_MAX_CONFLATION_KEYS <= value.key)
+            {
+                assert_int_equal(MESSENGER_SEND_OK, messenger_channel_send_conflated(messenger, value.key, &value, sizeof(value)));
+            }
+        }
+    }
+    while(false == done)
+    {
+        test_sleep_ns(100000);
+        done = true;
+        for(unsigned int key = 0; key < ARRAY_MAX_COUNT(latest); key++)
+        {
+            done = done && (((LOCAL_MESSENGER_MAX_CONFLATION_KEYS <= key) ? 2 : 1) == atomic_load(&latest[key]));
+        }
+    }
+    messenger_destroy(messenger);
+}
+
+static void conflation_test(void **state)
+{
+    static const enum messenger_transport_e transports[] = {MESSENGER_TRANSPORT_RING, MESSENGER_TRANSPORT_SYSV_QUEUE};
+    messenger_config_t config;
+    for(unsigned int t = 0; t < ARRAY_MAX_COUNT(transports); t++)
+    {
+        messenger_config_init(&config);
+        config.transport = transports[t];
+        run_conflation_test(&config);
+        config.workers = 2;
+        run_conflation_test(&config);
+    }
+    messenger_config_init(&config);
+    run_conflation_overflow_test(&config);
+}
+
+/*********************************************************************
+ *************** Buffer Test *****************************************
+ ********************************************************************/
+#define BUFFER_TEST_CHANNELS 3
+#define BUFFER_TEST_MESSAGES 200
+
+typedef struct buffer_test_state_s
+{
+    atomic_uint received;
+    _Atomic(void *) kept; //!< A buffer the callback kept past its return
+    long kept_size; //!< Size of the kept buffer
+} buffer_test_state_s;
+
+static void buffer_test_callback(void *context, void *msg, long message_size)
+{
+    buffer_test_state_s *test_state = context;
+    unsigned char *bytes = msg;
+    void *expected = NULL;
+    for(long i = 0; i < message_size; i++)
+    {
+        assert_int_equal((unsigned char)(message_size + i), bytes[i]);
+    }
+    if(atomic_compare_exchange_strong(&test_state->kept, &expected, msg))
+    {
+        messenger_buffer_retain(msg);
+        test_state->kept_size = message_size;
+    }
+    atomic_fetch_add(&test_state->received, 1);
+}
+
+static void buffer_test(void **state)
+{
+    static const long sizes[] = {1, 100, 4000, 1024 * 1024};
+    buffer_test_state_s test_states[BUFFER_TEST_CHANNELS];
+    messenger_t *channels[BUFFER_TEST_CHANNELS];
+    messenger_config_t config;
+    unsigned char *buffer;
+    long size;
+#if LOCAL_MESSENGER_STATS
+    messenger_stats_s stats;
+    uint64_t bytes = 0;
+#endif //LOCAL_MESSENGER_STATS
+    for(unsigned int i = 0; i < BUFFER_TEST_CHANNELS; i++)
+    {
+        messenger_config_init(&config);
+        config.transport = (1 == i) ? MESSENGER_TRANSPORT_SYSV_QUEUE : MESSENGER_TRANSPORT_RING;
+        config.workers = (2 == i) ? 2 : 0;
+        atomic_init(&test_states[i].received, 0);
+        atomic_init(&test_states[i].kept, NULL);
+        channels[i] = messenger_create(&config);
+        messenger_channel_register_context_callback(channels[i], buffer_test_callback, &test_states[i]);
+    }
+    for(unsigned int m = 0; m < BUFFER_TEST_MESSAGES; m++)
+    {
+        size = sizes[m % ARRAY_MAX_COUNT(sizes)];
+#if LOCAL_MESSENGER_STATS
+        bytes += (uint64_t)size;
+#endif //LOCAL_MESSENGER_STATS
+        buffer = messenger_buffer_alloc(size);
+        for(long i = 0; i < size; i++)
+        {
+            buffer[i] = (unsigned char)(size + i);
+        }
+        //Every other buffer goes out one channel at a time
+        if(0 == (m % 2))
+        {
+            messenger_multicast_buffer(channels, BUFFER_TEST_CHANNELS, buffer);
+        }
+        else
+        {
+            for(unsigned int i = 0; i < BUFFER_TEST_CHANNELS; i++)
+            {
+                messenger_channel_send_buffer(channels[i], buffer);
+            }
+        }
+        messenger_buffer_release(buffer);
+    }
+    for(unsigned int i = 0; i < BUFFER_TEST_CHANNELS; i++)
+    {
+        while(BUFFER_TEST_MESSAGES != atomic_load(&test_states[i].received))
+        {
+            test_sleep_ns(100000);
+        }
+#if LOCAL_MESSENGER_STATS
+        //The bytes are those of the buffers, not of the handles
+        messenger_channel_get_stats(channels[i], &stats);
+        assert_int_equal(bytes, stats.bytes_sent);
+        assert_int_equal(bytes, stats.bytes_received);
+#endif //LOCAL_MESSENGER_STATS
+    }
+    for(unsigned int i = 0; i < BUFFER_TEST_CHANNELS; i++)
+    {
+        messenger_destroy(channels[i]);
+        //The kept buffer is still whole after every other reference is gone
+        buffer = atomic_load(&test_states[i].kept);
+        assert_non_null(buffer);
+        for(long b = 0; b < test_states[i].kept_size; b++)
+        {
+            assert_int_equal((unsigned char)(test_states[i].kept_size + b), buffer[b]);
+        }
+        messenger_buffer_release(buffer);
+    }
+    //Handles still queued when a channel is torn down give their references back
+    messenger_config_init(&config);
+    channels[0] = messenger_create(&config);
+    buffer = messenger_buffer_alloc(sizes[3]);
+    for(unsigned int m = 0; m < BUFFER_TEST_MESSAGES; m++)
+    {
+        messenger_channel_send_buffer(channels[0], buffer);
+    }
+    messenger_buffer_release(buffer);
+    messenger_destroy(channels[0]);
+}
+
+/*********************************************************************
+ *************** Time Out Helper Test ********************************
+ ********************************************************************/
+
+static void time_out_helper_test(void **state)
+{
+    static const enum time_out_helper_clock_e clocks[] =
+    {
+        TIME_OUT_HELPER_CLOCK_MONOTONIC,
+        TIME_OUT_HELPER_CLOCK_COARSE,
+        TIME_OUT_HELPER_CLOCK_TSC,
+    };
+    time_out_helper_data_s helper;
+    uint64_t remaining;
+    for(unsigned int i = 0; i < ARRAY_MAX_COUNT(clocks); i++)
+    {
+        time_out_helper_init_ns(&helper, 20 * TIME_OUT_HELPER_NS_PER_MS, clocks[i]);
+        assert_false(time_out_helper_check(&helper));
+        remaining = time_out_helper_remaining_ns(&helper);
+        assert_true(0 < remaining && remaining <= 25 * TIME_OUT_HELPER_NS_PER_MS);
+        //Real time rather than test_sleep_ms, which is scaled by ST_NS_PER_MS
+        test_sleep_ns(40 * TIME_OUT_HELPER_NS_PER_MS);
+        assert_true(time_out_helper_check(&helper));
+        assert_int_equal(0, time_out_helper_remaining_ns(&helper));
+    }
+    time_out_helper_init(&helper, 0);
+    assert_true(time_out_helper_check(&helper));
 }
 
 /**
@@ -180,6 +2518,45 @@ int main(void)
     {
         cmocka_unit_test(just_pass),
         cmocka_unit_test(basic_test),
+        cmocka_unit_test(basic_sysv_test),
+        cmocka_unit_test(variable_size_test),
+        cmocka_unit_test(variable_size_sysv_test),
+        cmocka_unit_test(large_burst_test),
+        cmocka_unit_test(acquire_commit_test),
+        cmocka_unit_test(acquire_commit_sysv_test),
+        cmocka_unit_test(batch_test),
+        cmocka_unit_test(batch_sysv_test),
+        cmocka_unit_test(multi_producer_test),
+        cmocka_unit_test(idle_kill_test),
+        cmocka_unit_test(channel_test),
+        cmocka_unit_test(worker_test),
+        cmocka_unit_test(topic_test),
+        cmocka_unit_test(topic_sysv_test),
+        cmocka_unit_test(priority_test),
+        cmocka_unit_test(priority_sysv_test),
+        cmocka_unit_test(backpressure_test),
+        cmocka_unit_test(backpressure_sysv_test),
+        cmocka_unit_test(time_out_helper_test),
+        cmocka_unit_test(timer_wheel_test),
+        cmocka_unit_test(timer_test),
+        cmocka_unit_test(timer_sysv_test),
+        cmocka_unit_test(shm_test),
+        cmocka_unit_test(restart_test),
+        cmocka_unit_test(restart_sysv_test),
+        cmocka_unit_test(first_send_test),
+        cmocka_unit_test(first_send_sysv_test),
+        cmocka_unit_test(stats_test),
+        cmocka_unit_test(stats_sysv_test),
+        cmocka_unit_test(request_test),
+        cmocka_unit_test(request_sysv_test),
+        cmocka_unit_test(typed_test),
+        cmocka_unit_test(typed_sysv_test),
+        cmocka_unit_test(pollable_test),
+        cmocka_unit_test(wait_strategy_test),
+        cmocka_unit_test(journal_test),
+        cmocka_unit_test(journal_acquire_test),
+        cmocka_unit_test(conflation_test),
+        cmocka_unit_test(buffer_test),
     };
     signal(SIGSEGV, segfault_catch);
 #ifndef DISABLE_TIME_OUT
@@ -0,0 +1,55 @@
+'''
+Module that compares two JSON result files written by msg-queue-bench-ex
+'''
+
+import argparse
+import json
+import sys
+
+HIGHER_IS_BETTER = ("msgs_per_s",)
+
+def load(path):
+    '''
+    Load a result file into a dict of name to (value, unit)
+    '''
+    with open(path, "r") as file:
+        data = json.load(file)
+    return data["config"], {result["name"]: (result["value"], result["unit"]) for result in data["results"]}
+
+def speedup(baseline, candidate, unit):
+    '''
+    Get how many times better the candidate is than the baseline
+    '''
+    if 0 == baseline or 0 == candidate:
+        return float("nan")
+    if unit in HIGHER_IS_BETTER:
+        return candidate / baseline
+    return baseline / candidate
+
+def compare(baseline_path, candidate_path):
+    '''
+    Print the results found in both files side by side
+    '''
+    baseline_config, baseline = load(baseline_path)
+    candidate_config, candidate = load(candidate_path)
+    print("baseline:  {} {}".format(baseline_path, baseline_config))
+    print("candidate: {} {}".format(candidate_path, candidate_config))
+    print("{:<48} {:>14} {:>14} {:<12} {:>8}".format("name", "baseline", "candidate", "unit", "speedup"))
+    for name, (value, unit) in baseline.items():
+        if name not in candidate:
+            continue
+        print("{:<48} {:>14.1f} {:>14.1f} {:<12} {:>7.2f}x".format(name, value, candidate[name][0], unit, speedup(value, candidate[name][0], unit)))
+
+def main():
+    '''
+    The Main Function
+    '''
+    parser = argparse.ArgumentParser(description="Compare two msg-queue benchmark result files")
+    parser.add_argument("baseline", help="The JSON results to compare against")
+    parser.add_argument("candidate", help="The JSON results to compare")
+    args = parser.parse_args()
+    compare(args.baseline, args.candidate)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -9,50 +9,137 @@
 #ifndef INC_LOCAL_MESSENGER_MESSAGE_TYPES_H_
 #define INC_LOCAL_MESSENGER_MESSAGE_TYPES_H_
 
+#include <stddef.h>
+#include <stdint.h>
+#include <local-messenger.h>
+
 #ifndef LOCAL_MESSENGER_MAX_MESSAGE_SIZE
-#define LOCAL_MESSENGER_MAX_MESSAGE_SIZE 100
+#define LOCAL_MESSENGER_MAX_MESSAGE_SIZE 100 //!< Largest payload sent without a heap allocation. Larger payloads are still supported
 #endif  //LOCAL_MESSENGER_MAX_MESSAGE_SIZE
 
 enum local_messenger_message_type_e
 {
     LOCAL_MESSAGE_TYPE_INTERNAL_ACTION,
-    LOCAL_MESSAGE_TYPE_USR
+    LOCAL_MESSAGE_TYPE_USR,
+    LOCAL_MESSAGE_TYPE_USR_KEYED, //!< User message that must stay in order with other messages of the same key
+    LOCAL_MESSAGE_TYPE_PUBLISH, //!< User message for the subscribers of a topic
+    LOCAL_MESSAGE_TYPE_REQUEST, //!< User message for the request handler. The payload starts with the channel to reply to
+    LOCAL_MESSAGE_TYPE_REPLY, //!< The answer to a request, for the channel that made it
+    LOCAL_MESSAGE_TYPE_TYPED, //!< User message for the handler of its type id
+    LOCAL_MESSAGE_TYPE_CONFLATED, //!< Marker that the newest value of the header's key waits in the channel's conflation table. No payload
+    LOCAL_MESSAGE_TYPE_BUFFER //!< Handle of a pooled buffer. The payload is the buffer ptr. The buffer itself is laid out as a message of this type
 }; //!< Enum for local message type
 
 enum local_messenger_message_internal_action_type_e
 {
-    LOCAL_MESSENGER_ACTION_NONE //!< There is no action to perform
+    LOCAL_MESSENGER_ACTION_NONE, //!< There is no action to perform
+    LOCAL_MESSENGER_ACTION_KILL, //!< Wake the central messenger and have it exit
+    LOCAL_MESSENGER_ACTION_TIMER_ADD, //!< Put the timer the payload points at on the timer wheel
+    LOCAL_MESSENGER_ACTION_TIMER_CANCEL, //!< Take the timer the payload points at off the timer wheel and free it
+    LOCAL_MESSENGER_ACTION_TIMER_WAKE, //!< Wake the central messenger so it can expire timers
+    LOCAL_MESSENGER_ACTION_PARK, //!< Drop what is queued and have the central messenger wait to be reused
+    LOCAL_MESSENGER_ACTION_REQUEST_TIMEOUT //!< Put the timeout of the request with the header's correlation id on the timer wheel
 }; //!< Enum for internal message actions
 
-struct local_messenger_user_message_s
-{
-    long message_size;
-    char message_data[LOCAL_MESSENGER_MAX_MESSAGE_SIZE];
-}; //!< Structure for user messages
-
-struct local_messanger_internal_message_s
+struct local_messenger_message_header_s
 {
     enum local_messenger_message_type_e type; //!< The current message type
+    enum local_messenger_message_internal_action_type_e action; //!< Internal Action. Only used by LOCAL_MESSAGE_TYPE_INTERNAL_ACTION
+    uint32_t key; //!< Ordering key. Only used by LOCAL_MESSAGE_TYPE_USR_KEYED and LOCAL_MESSAGE_TYPE_CONFLATED
     union
     {
-        struct local_messenger_user_message_s user; //!< The User data
-        enum local_messenger_message_internal_action_type_e action; //!< Internal Action
-    } data;
-}; //!< Structure used internally for the message manager
+        uint32_t topic; //!< The topic. Only used by LOCAL_MESSAGE_TYPE_PUBLISH
+        uint32_t type_id; //!< The message type id. Only used by LOCAL_MESSAGE_TYPE_TYPED
+    };
+    uint64_t correlation_id; //!< Pairs a reply with its request. Only used by requests, replies and LOCAL_MESSENGER_ACTION_REQUEST_TIMEOUT
+    uint64_t journal_position; //!< Where the message is kept in the channel's journal. 0 when it is not journaled
+    long message_size; //!< Number of payload bytes following the header
+#if LOCAL_MESSENGER_STATS
+    uint64_t enqueue_ns; //!< CLOCK_MONOTONIC time the message was sent. 0 to leave it out of the latency statistics
+#endif //LOCAL_MESSENGER_STATS
+}; //!< Length prefix placed in front of every message
+
+struct local_messanger_internal_message_s
+{
+    struct local_messenger_message_header_s header; //!< The message header
+    char message_data[]; //!< The payload. header.message_size bytes long
+}; //!< A variable length message as it is carried by the transports
 
 /**
- * @brief Function that builds an action message
+ * @brief Function that builds the header for an action message
  * @param action
- * @return The message to send out
+ * @return The header to send out. Action messages have no payload
+ */
+struct local_messenger_message_header_s local_messenger_build_action(enum local_messenger_message_internal_action_type_e action);
+
+/**
+ * @brief Function that builds the header for a user message
+ * @param message_size the size of the payload that will follow the header
+ * @return The header to send out
+ */
+struct local_messenger_message_header_s local_messenger_build_user_msg(long message_size);
+
+/**
+ * @brief Function that builds the header for a user message with an ordering key
+ * @param key the ordering key
+ * @param message_size the size of the payload that will follow the header
+ * @return The header to send out
+ */
+struct local_messenger_message_header_s local_messenger_build_keyed_user_msg(uint32_t key, long message_size);
+
+/**
+ * @brief Function that builds the header for a message published on a topic
+ * @param topic the topic
+ * @param message_size the size of the payload that will follow the header
+ * @return The header to send out
  */
-struct local_messanger_internal_message_s local_messenger_build_action(enum local_messenger_message_internal_action_type_e action);
+struct local_messenger_message_header_s local_messenger_build_publish_msg(uint32_t topic, long message_size);
 
 /**
- * @brief Function that builds an user message
- * @param data
- * @param message_size
- * @return The message to send out
+ * @brief Function that builds the header for a message for the handler of a type id
+ * @param type_id the message type id
+ * @param message_size the size of the payload that will follow the header
+ * @return The header to send out
  */
-struct local_messanger_internal_message_s local_messenger_build_user_msg(void *data, long message_size);
+struct local_messenger_message_header_s local_messenger_build_typed_msg(uint32_t type_id, long message_size);
+
+/**
+ * @brief Function that builds the marker of a conflated value
+ * @param key the key of the value
+ * @return The header to send out. Markers have no payload
+ */
+struct local_messenger_message_header_s local_messenger_build_conflated_msg(uint32_t key);
+
+/**
+ * @brief Function that builds the header for the handle of a pooled buffer
+ * @return The header to send out. The payload is the buffer ptr
+ */
+struct local_messenger_message_header_s local_messenger_build_buffer_msg(void);
+
+/**
+ * @brief Function that builds the header for a request
+ * @param correlation_id the id the reply is sent back with
+ * @param message_size the size of the payload that will follow the header, including the channel to reply to
+ * @return The header to send out
+ */
+struct local_messenger_message_header_s local_messenger_build_request_msg(uint64_t correlation_id, long message_size);
+
+/**
+ * @brief Function that builds the header for a reply
+ * @param correlation_id the id of the request being answered
+ * @param message_size the size of the payload that will follow the header
+ * @return The header to send out
+ */
+struct local_messenger_message_header_s local_messenger_build_reply_msg(uint64_t correlation_id, long message_size);
+
+/**
+ * @brief get the number of bytes a message takes up on a transport
+ * @param header the message header
+ * @return the header size plus the payload size
+ */
+static inline size_t local_messenger_frame_size(const struct local_messenger_message_header_s *header)
+{
+    return sizeof(struct local_messenger_message_header_s) + (size_t)header->message_size;
+}
 
 #endif /* INC_LOCAL_MESSENGER_MESSAGE_TYPES_H_ */
@@ -10,9 +10,613 @@
 #define INC_LOCAL_MESSENGER_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#ifndef LOCAL_MESSENGER_MAX_TOPICS
+#define LOCAL_MESSENGER_MAX_TOPICS 64 //!< Number of topics a channel supports. Topics are 0 to LOCAL_MESSENGER_MAX_TOPICS - 1
+#endif //LOCAL_MESSENGER_MAX_TOPICS
+
+#ifndef LOCAL_MESSENGER_PRIORITY_LEVELS
+#define LOCAL_MESSENGER_PRIORITY_LEVELS 4 //!< Number of priority lanes a channel has
+#endif //LOCAL_MESSENGER_PRIORITY_LEVELS
+
+#define LOCAL_MESSENGER_PRIORITY_HIGHEST 0 //!< The top lane. Internal actions are sent on it
+#define LOCAL_MESSENGER_PRIORITY_DEFAULT (LOCAL_MESSENGER_PRIORITY_LEVELS - 1) //!< The lane messages go on unless a priority is given
+
+#ifndef LOCAL_MESSENGER_MAX_SUBSCRIBERS
+#define LOCAL_MESSENGER_MAX_SUBSCRIBERS 8 //!< Most subscribers a topic can have
+#endif //LOCAL_MESSENGER_MAX_SUBSCRIBERS
+
+#ifndef LOCAL_MESSENGER_MAX_MESSAGE_TYPES
+#define LOCAL_MESSENGER_MAX_MESSAGE_TYPES 256 //!< Number of message type ids a channel can route. Type ids are 0 to LOCAL_MESSENGER_MAX_MESSAGE_TYPES - 1
+#endif //LOCAL_MESSENGER_MAX_MESSAGE_TYPES
+
+#ifndef LOCAL_MESSENGER_STATS
+#define LOCAL_MESSENGER_STATS 1 //!< Set to 0 to compile the channel statistics out. messenger_channel_get_stats then reports zeros
+#endif //LOCAL_MESSENGER_STATS
+
+#define MESSENGER_HISTOGRAM_SUB_BUCKET_BITS 3 //!< Each power of two is split into 2^3 buckets, so a bucket is within 12.5% of its values
+#define MESSENGER_HISTOGRAM_BUCKETS 256 //!< Buckets of a histogram. Covers values up to 2^34 ns, larger ones land in the last bucket
 
 typedef void (*messenger_on_messaage_rcv)(void *msg, long message_size);  //!< Typedef for callback function to call when a message is received
 
+typedef void (*messenger_on_context_rcv)(void *context, void *msg, long message_size); //!< Typedef for callback function to call with the context it was registered with when a message is received
+
+typedef struct messenger_message_s
+{
+    void *msg; //!< The message data
+    long message_size; //!< The size of the message
+} messenger_message_s; //!< A received message handed out in a batch
+
+typedef void (*messenger_on_batch_rcv)(messenger_message_s *messages, unsigned int count); //!< Typedef for callback function to call with a batch of received messages
+
+enum messenger_transport_e
+{
+    MESSENGER_TRANSPORT_SYSV_QUEUE, //!< System V message queue. Each priority lane is one message type, topics are not
+    MESSENGER_TRANSPORT_RING, //!< In process lock free ring. Only reachable from this process
+    MESSENGER_TRANSPORT_SHM //!< Lock free rings in named shared memory. Other processes send with messenger_attach. Linux only and needs a channel name
+}; //!< The transports the messenger can carry messages over
+
+enum messenger_wait_strategy_e
+{
+    MESSENGER_WAIT_PARK, //!< Sleep as soon as the transport is empty. Costs nothing while idle
+    MESSENGER_WAIT_SPIN_THEN_PARK, //!< Poll the transport for spin_us before sleeping, so a message soon after the last one skips the wakeup
+    MESSENGER_WAIT_BUSY_POLL //!< Never sleep. Takes a core for the lowest wake latency
+}; //!< How the dispatch thread waits for messages
+
+typedef struct messenger_s messenger_t; //!< A messenger channel. Each has its own transport, dispatch thread and callback
+
+enum messenger_send_result_e
+{
+    MESSENGER_SEND_OK, //!< The message was sent
+    MESSENGER_SEND_WOULD_BLOCK, //!< The transport was full and the send was not allowed to wait
+    MESSENGER_SEND_TIMED_OUT //!< The transport stayed full until the deadline
+}; //!< The outcome of a send that may fail when the transport is full
+
+typedef void (*messenger_on_watermark)(messenger_t *messenger, bool above_high); //!< Typedef for callback function to call when a channel's fill crosses a watermark
+
+typedef struct messenger_timer_s messenger_timer_t; //!< A periodic message. Cancel it with messenger_cancel_periodic
+
+enum messenger_reply_status_e
+{
+    MESSENGER_REPLY_OK, //!< The reply arrived
+    MESSENGER_REPLY_TIMED_OUT, //!< No reply arrived before the timeout
+    MESSENGER_REPLY_CANCELLED, //!< The channel waiting on the reply was stopped first
+    MESSENGER_REPLY_DROPPED //!< There was no room for the request, or for its reply on the channel waiting on it
+}; //!< How a request ended
+
+typedef struct messenger_request_s
+{
+    messenger_t *reply_to; //!< The channel waiting on the reply
+    uint64_t correlation_id; //!< Pairs the reply with the request
+} messenger_request_t; //!< Where the reply to a request goes. It may be copied to reply later from any thread
+
+typedef void (*messenger_on_request)(const messenger_request_t *request, void *msg, long message_size); //!< Typedef for callback function to call when a request is received. Answer it with messenger_reply
+
+typedef void (*messenger_on_reply)(void *context, enum messenger_reply_status_e status, void *reply, long reply_size); //!< Typedef for callback function to call when a request ends. reply is NULL unless status is MESSENGER_REPLY_OK
+
+typedef struct messenger_future_s messenger_future_t; //!< A request a thread can wait on. Each one must be passed to messenger_future_wait once
+
+typedef struct messenger_histogram_s
+{
+    uint64_t count; //!< Number of samples
+    uint64_t sum_ns; //!< Sum of the samples in nanoseconds
+    uint64_t max_ns; //!< The largest sample in nanoseconds
+    uint64_t buckets[MESSENGER_HISTOGRAM_BUCKETS]; //!< Sample counts by log linear bucket. Read them with messenger_histogram_percentile
+} messenger_histogram_s; //!< A latency histogram
+
+typedef struct messenger_stats_s
+{
+    uint64_t messages_sent; //!< User messages put on the transport
+    uint64_t bytes_sent; //!< Payload bytes of the messages sent
+    uint64_t messages_received; //!< User messages taken off the transport by the dispatch thread
+    uint64_t bytes_received; //!< Payload bytes of the messages received
+    uint64_t send_retries; //!< Sends that found the transport full and tried again
+    uint64_t send_would_block; //!< Sends that gave up because the transport was full and they could not wait
+    uint64_t send_timeouts; //!< Sends that gave up because the transport stayed full until their deadline
+    uint64_t messages_rejected; //!< Typed messages without a handler or out of its size range, and MESSENGER_TRANSPORT_SHM frames that could not be trusted
+    uint64_t messages_conflated; //!< Conflated sends that replaced an older value of their key before it was handed out. They are not counted as sent
+    uint64_t queue_depth; //!< Messages sent but not yet received
+    uint64_t queue_bytes; //!< Bytes in the transport now. For the ring that is the fullest lane
+    uint64_t peak_queue_bytes; //!< The most bytes the dispatch thread has found in the transport
+    messenger_histogram_s latency; //!< Time from a message being sent to its callback being called
+    messenger_histogram_s callback_duration; //!< Time spent in each call of a callback
+} messenger_stats_s; //!< A snapshot of the statistics of a channel
+
+typedef struct messenger_config_s
+{
+    const char *name; //!< Name to find the channel by with messenger_lookup. NULL for an anonymous channel
+    enum messenger_transport_e transport; //!< The transport the channel carries messages over
+    uint64_t ring_size; //!< The ring size in bytes for MESSENGER_TRANSPORT_RING and MESSENGER_TRANSPORT_SHM. Must be a power of two
+    unsigned int dispatch_batch; //!< The most messages handed out per wakeup
+    unsigned int workers; //!< Worker threads running the callbacks. 0 runs them on the dispatch thread
+    bool pollable; //!< Start no dispatch thread. The owner waits on messenger_channel_fd and calls messenger_channel_dispatch_pending. MESSENGER_TRANSPORT_RING only
+    enum messenger_wait_strategy_e wait_strategy; //!< How the dispatch thread waits for messages. Not used by a pollable channel
+    unsigned int spin_us; //!< How long MESSENGER_WAIT_SPIN_THEN_PARK polls before sleeping
+    uint64_t cpu_mask; //!< CPUs the dispatch thread may run on, bit n for CPU n. 0 to leave it to the scheduler. Linux only
+    int sched_priority; //!< SCHED_FIFO priority of the dispatch thread. 0 for the default policy. Falls back to the default policy without the privilege for SCHED_FIFO. Linux only
+    const char *journal_path; //!< Directory to journal the messages sent on the channel in, so they survive the process. NULL for no journal. Not for MESSENGER_TRANSPORT_SHM
+    uint64_t journal_segment_size; //!< Size of each journal segment file in bytes. Must be a power of two of at least a page
+} messenger_config_t; //!< The settings a channel is created with
+
+/**
+ * @brief fill a config with the default settings
+ * @param config the config to fill
+ */
+void messenger_config_init(messenger_config_t *config);
+
+/**
+ * @brief create a channel and start its dispatch thread. Channels are independent of each other
+ * and of the default channel used by the functions that do not take a channel
+ * @param config the channel settings. NULL for the defaults
+ * @return the new channel
+ */
+messenger_t *messenger_create(const messenger_config_t *config);
+
+/**
+ * @brief stop a channel's dispatch thread and free the channel.
+ * The stop overtakes queued messages, anything not yet handed out is dropped.
+ * For a handle from messenger_attach this only drops the handle, the channel keeps running
+ * @param messenger the channel to destroy
+ */
+void messenger_destroy(messenger_t *messenger);
+
+/**
+ * @brief find a channel by name
+ * @param name the name the channel was created with
+ * @return the channel, NULL if there is no channel with that name
+ */
+messenger_t *messenger_lookup(const char *name);
+
+/**
+ * @brief get a send only handle to a MESSENGER_TRANSPORT_SHM channel created by another process.
+ * Messages sent through the handle are written straight into the channel's shared memory.
+ * The handle can not register callbacks, subscribe, set watermarks or send timed messages.
+ * Free it with messenger_destroy
+ * @param name the name the channel was created with
+ * @return the handle, NULL if no process has a channel with that name
+ */
+messenger_t *messenger_attach(const char *name);
+
+/**
+ * @brief take a snapshot of the statistics of a channel. The counters are gathered
+ * while the channel runs, so they are only consistent with each other to within the messages in flight
+ * @param messenger the channel
+ * @param stats filled with the snapshot
+ */
+void messenger_channel_get_stats(messenger_t *messenger, messenger_stats_s *stats);
+
+/**
+ * @brief get a percentile of a histogram
+ * @param histogram the histogram
+ * @param percentile 0 to 100
+ * @return the top of the bucket holding the percentile in nanoseconds, never more than max_ns. 0 for an empty histogram
+ */
+uint64_t messenger_histogram_percentile(const messenger_histogram_s *histogram, unsigned int percentile);
+
+/**
+ * @brief register a callback to call when a message is received on a channel
+ * @param messenger the channel
+ * @param cb The callback in question
+ */
+void messenger_channel_register_callback(messenger_t *messenger, messenger_on_messaage_rcv cb);
+
+/**
+ * @brief register a callback to call with batches of messages received on a channel.
+ * Only one of the two callback kinds may be registered
+ * @param messenger the channel
+ * @param cb The callback in question
+ */
+void messenger_channel_register_batch_callback(messenger_t *messenger, messenger_on_batch_rcv cb);
+
+/**
+ * @brief register a callback to call with a context when a message is received on a channel.
+ * Only one of the callback kinds may be registered
+ * @param messenger the channel
+ * @param cb The callback in question
+ * @param context passed to cb
+ */
+void messenger_channel_register_context_callback(messenger_t *messenger, messenger_on_context_rcv cb, void *context);
+
+/**
+ * @brief register the handler of a message type id on a channel. Messages sent with
+ * messenger_channel_send_typed go straight to the handler of their type, skipping the channel
+ * callback. A message whose type has no handler or whose size is outside
+ * [min_size, max_size] is dropped before the handler is called and counted in messages_rejected
+ * @param messenger the channel
+ * @param type_id the message type id. Less than LOCAL_MESSENGER_MAX_MESSAGE_TYPES
+ * @param min_size the smallest message the handler accepts
+ * @param max_size the largest message the handler accepts. Equal to min_size for a fixed size message
+ * @param cb the handler
+ * @param context passed to cb
+ */
+void messenger_channel_register_handler(messenger_t *messenger, uint32_t type_id, long min_size, long max_size, messenger_on_context_rcv cb, void *context);
+
+/**
+ * @brief get the largest message a channel can carry
+ * @param messenger the channel
+ * @return the max message size in bytes
+ */
+long messenger_channel_max_message_size(messenger_t *messenger);
+
+/**
+ * @brief send a message over a channel
+ * @param messenger the channel
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send(messenger_t *messenger, void *message, long message_size);
+
+/**
+ * @brief send a message over a channel if there is room for it right now
+ * @param messenger the channel
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_WOULD_BLOCK if the transport is full
+ */
+enum messenger_send_result_e messenger_channel_try_send(messenger_t *messenger, void *message, long message_size);
+
+/**
+ * @brief send a message over a channel, sleeping while the transport is full.
+ * The dispatch thread wakes the sender each time it frees up room
+ * @param messenger the channel
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param timeout_ms the longest to wait for room in milliseconds
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_timeout(messenger_t *messenger, void *message, long message_size, unsigned int timeout_ms);
+
+/**
+ * @brief set the fill levels a channel reports to a callback so producers can throttle before it fills up.
+ * The callback is called with above_high set by the sender that fills the channel to high_percent,
+ * then with above_high cleared by the dispatch thread once the channel drains to low_percent
+ * @param messenger the channel
+ * @param high_percent the fill percentage that calls the callback with above_high set
+ * @param low_percent the fill percentage that calls the callback with above_high cleared
+ * @param cb the callback. NULL to stop reporting
+ */
+void messenger_channel_set_watermarks(messenger_t *messenger, unsigned int high_percent, unsigned int low_percent, messenger_on_watermark cb);
+
+/**
+ * @brief get the file descriptor of a pollable channel, to add to an epoll set or poll
+ * @param messenger the pollable channel
+ * @return an eventfd that is readable while messages are waiting. Wait on it for reading, do not read it
+ */
+int messenger_channel_fd(messenger_t *messenger);
+
+/**
+ * @brief hand out the messages waiting on a pollable channel on the calling thread. The callbacks,
+ * handlers, delayed messages and request timeouts of the channel all run inside this call.
+ * Only one thread may dispatch a channel at a time
+ * @param messenger the pollable channel
+ * @param max_messages the most messages to take off the transport. The file descriptor stays readable if more are left
+ * @return the number of messages taken off the transport, including the internal ones
+ */
+unsigned int messenger_channel_dispatch_pending(messenger_t *messenger, unsigned int max_messages);
+
+/**
+ * @brief get how long the owner of a pollable channel may wait on its file descriptor before
+ * a delayed message, periodic message or request timeout is due. Only call from the dispatching thread
+ * @param messenger the pollable channel
+ * @return the time in milliseconds, rounded up. -1 if nothing is due, as epoll_wait and poll take it
+ */
+int messenger_channel_next_timeout_ms(messenger_t *messenger);
+
+/**
+ * @brief send the messages a previous run left unhandled in the journal of a channel through it again.
+ * Call it once the callbacks are registered. Each message is only replayed once. The replay stops once the
+ * channel is full, and a pollable channel does not wait for room, so dispatch the channel and call it again
+ * until it returns 0. Until then the journal can not drop the segments holding those messages
+ * @param messenger the journaled channel
+ * @return the number of messages replayed
+ */
+unsigned int messenger_channel_replay(messenger_t *messenger);
+
+/**
+ * @brief wait until every message sent on a journaled channel so far is on disk.
+ * Callers waiting at the same time share one flush
+ * @param messenger the journaled channel
+ */
+void messenger_channel_sync(messenger_t *messenger);
+
+/**
+ * @brief send a message over a channel on a priority lane. Queued messages of a higher lane are always
+ * handed out before those of a lower one. Messages keep their order within a lane.
+ * Plain sends, keyed sends and publishes go on LOCAL_MESSENGER_PRIORITY_DEFAULT
+ * @param messenger the channel
+ * @param priority the lane. LOCAL_MESSENGER_PRIORITY_HIGHEST is the highest
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_priority(messenger_t *messenger, unsigned int priority, void *message, long message_size);
+
+/**
+ * @brief send a message over a channel that is handled in order with the other messages of the same key.
+ * With workers, messages of one key all run on the same worker while different keys run in parallel
+ * @param messenger the channel
+ * @param key the ordering key
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_keyed(messenger_t *messenger, uint32_t key, void *message, long message_size);
+
+/**
+ * @brief send the newest value of a key over a channel. A value of the same key still waiting to be
+ * handed out is replaced in place rather than queued behind, so only the newest one reaches the callback
+ * and the backlog is bounded by the number of keys. It goes out like a keyed message, in the place of the
+ * oldest value it replaced. Values are not journaled and can not be sent from a messenger_attach handle
+ * @param messenger the channel
+ * @param key the key. A channel conflates at most LOCAL_MESSENGER_MAX_CONFLATION_KEYS different keys, 1024 unless
+ * built with another power of two. Keys past that are sent like messenger_channel_send_keyed, without conflation
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if the key had nothing waiting and there was no room in time.
+ * The value is then kept and goes out with the next send of the key
+ */
+enum messenger_send_result_e messenger_channel_send_conflated(messenger_t *messenger, uint32_t key, void *message, long message_size);
+
+/**
+ * @brief get a reference counted buffer to fill with a payload and send by handle with messenger_channel_send_buffer.
+ * Buffers come from per thread pools of size classes so the steady state does not call malloc
+ * @param size the size of the payload
+ * @return ptr to the payload. The caller holds the only reference and drops it with messenger_buffer_release
+ */
+void *messenger_buffer_alloc(long size);
+
+/**
+ * @brief keep a buffer past the callback it was handed to. Only for callbacks of channels sent buffers
+ * @param buffer the payload ptr passed to the callback
+ */
+void messenger_buffer_retain(void *buffer);
+
+/**
+ * @brief drop a reference to a buffer. The last one returns it to the pool of the calling thread
+ * @param buffer the payload ptr
+ */
+void messenger_buffer_release(void *buffer);
+
+/**
+ * @brief send a buffer over a channel by handle. Only the handle is copied. The channel holds a reference until
+ * the callbacks have returned, so the sender may release its own straight after. Do not write to the buffer once
+ * it is sent. Not for MESSENGER_TRANSPORT_SHM channels, which can not trust a handle
+ * @param messenger the channel
+ * @param buffer the payload ptr from messenger_buffer_alloc
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time. The reference of the channel is dropped again
+ */
+enum messenger_send_result_e messenger_channel_send_buffer(messenger_t *messenger, void *buffer);
+
+/**
+ * @brief send one buffer to several channels by handle, taking the references for all of them at once
+ * @param channels the channels
+ * @param count the number of channels
+ * @param buffer the payload ptr from messenger_buffer_alloc
+ * @return the number of channels the buffer was sent to. Channels that stayed full are skipped
+ */
+unsigned int messenger_multicast_buffer(messenger_t *const *channels, unsigned int count, void *buffer);
+
+/**
+ * @brief send a message over a channel to the handler of its type id
+ * @param messenger the channel
+ * @param type_id the message type id. Less than LOCAL_MESSENGER_MAX_MESSAGE_TYPES
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_typed(messenger_t *messenger, uint32_t type_id, void *message, long message_size);
+
+/**
+ * @brief add a subscriber to a topic of a channel. Subscribers run on the channel's
+ * dispatch thread, or its workers, alongside the channel callback
+ * @param messenger the channel
+ * @param topic the topic. Less than LOCAL_MESSENGER_MAX_TOPICS
+ * @param cb the callback to call with the messages published on the topic
+ */
+void messenger_channel_subscribe(messenger_t *messenger, uint32_t topic, messenger_on_messaage_rcv cb);
+
+/**
+ * @brief remove a subscriber from a topic of a channel
+ * @param messenger the channel
+ * @param topic the topic
+ * @param cb the callback passed to messenger_channel_subscribe
+ */
+void messenger_channel_unsubscribe(messenger_t *messenger, uint32_t topic, messenger_on_messaage_rcv cb);
+
+/**
+ * @brief publish a message to the subscribers of a topic of a channel.
+ * Messages published on a topic without subscribers are dropped before they reach the transport.
+ * Publishes keep their order with the other messages of their lane.
+ * The topic travels in the message header, so with MESSENGER_TRANSPORT_SYSV_QUEUE msgrcv can not select a topic.
+ * The channel's dispatch thread drains the whole queue and routes each publish to its subscribers
+ * @param messenger the channel
+ * @param topic the topic. Less than LOCAL_MESSENGER_MAX_TOPICS
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_publish(messenger_t *messenger, uint32_t topic, void *message, long message_size);
+
+/**
+ * @brief send several messages over a channel in one call
+ * @param messenger the channel
+ * @param messages ptrs to the message data to send. They will be copied
+ * @param message_sizes The size of each message
+ * @param count The number of messages
+ * @return the number of messages sent, oldest first. Less than count if the channel stayed full
+ */
+unsigned int messenger_channel_send_batch(messenger_t *messenger, void **messages, const long *message_sizes, unsigned int count);
+
+/**
+ * @brief get a buffer to build a message for a channel in place
+ * @param messenger the channel
+ * @param message_size The size of the message that will be written
+ * @return ptr to message_size bytes to write the message into. Pass it to messenger_channel_commit once written.
+ * NULL if there was no room in time
+ */
+void *messenger_channel_acquire(messenger_t *messenger, long message_size);
+
+/**
+ * @brief send a message built in a buffer from messenger_channel_acquire
+ * @param messenger the channel the buffer was acquired from
+ * @param message the ptr returned by messenger_channel_acquire. It must not be touched after this call
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time. The ring transport
+ * reserved the room in messenger_channel_acquire so it always sends, unless the channel's journal was full
+ * and the message had to be sent again behind it
+ */
+enum messenger_send_result_e messenger_channel_commit(messenger_t *messenger, void *message);
+
+/**
+ * @brief send a message over a channel once a delay has passed. The channel's dispatch thread keeps
+ * the message on its timer wheel, so pending messages cost no threads of their own.
+ * Not for MESSENGER_TRANSPORT_SHM channels, which can not trust the ptr the timer is handed over by
+ * @param messenger the channel
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param delay_ms the delay in milliseconds. The message is never handed out early
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_delayed(messenger_t *messenger, void *message, long message_size, unsigned int delay_ms);
+
+/**
+ * @brief send a message over a channel every period until it is cancelled.
+ * The first one goes out one period from now. Periods missed while the dispatch thread was busy are skipped.
+ * Not for MESSENGER_TRANSPORT_SHM channels
+ * @param messenger the channel
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param period_ms the period in milliseconds
+ * @return the periodic message. Pass it to messenger_cancel_periodic to stop it. NULL if there was no room in time
+ */
+messenger_timer_t *messenger_channel_send_periodic(messenger_t *messenger, void *message, long message_size, unsigned int period_ms);
+
+/**
+ * @brief stop a periodic message. A send that was already due may still be handed out.
+ * Must be called at most once per periodic message and before its channel is destroyed.
+ * Periodic messages not cancelled are dropped with their channel
+ * @param timer the ptr returned by messenger_channel_send_periodic or messenger_send_periodic
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time. The message keeps going out until a cancel is sent
+ */
+enum messenger_send_result_e messenger_cancel_periodic(messenger_timer_t *timer);
+
+/**
+ * @brief register a callback to call when a request is received on a channel.
+ * Requests without a handler are dropped and time out at the requester
+ * @param messenger the channel
+ * @param cb The callback in question
+ */
+void messenger_channel_register_request_handler(messenger_t *messenger, messenger_on_request cb);
+
+/**
+ * @brief send a request over a channel and have its reply handed to a callback.
+ * The reply, or the timeout, is handled on the dispatch thread of reply_to, which keeps the request
+ * in a table until then, so any number of requests can be in flight without a thread each.
+ * Both channels must be in this process. messenger must not be a MESSENGER_TRANSPORT_SHM channel, which
+ * can not trust the ptr to reply_to the request carries
+ * @param messenger the channel the request goes to
+ * @param reply_to the channel the reply comes back on. May be the same channel
+ * @param message ptr to the request data to send. It will be copied
+ * @param message_size The size of the request. At most the max message size less the size of a ptr
+ * @param timeout_ms time to wait for the reply in milliseconds. 0 to wait until reply_to is stopped
+ * @param cb called once with the reply or with why there was none
+ * @param context passed to cb
+ * @return MESSENGER_SEND_OK, MESSENGER_SEND_WOULD_BLOCK if reply_to already has LOCAL_MESSENGER_MAX_PENDING_REQUESTS in flight,
+ * or MESSENGER_SEND_TIMED_OUT if there was no room in time. cb is not called for MESSENGER_SEND_WOULD_BLOCK, and is called
+ * with MESSENGER_REPLY_DROPPED for MESSENGER_SEND_TIMED_OUT
+ */
+enum messenger_send_result_e messenger_channel_request(messenger_t *messenger, messenger_t *reply_to, void *message, long message_size, unsigned int timeout_ms,
+                                                       messenger_on_reply cb, void *context);
+
+/**
+ * @brief send a request over a channel and get a future to wait on its reply with.
+ * Do not wait on it from the dispatch thread of reply_to, which is the thread that completes it
+ * @param messenger the channel the request goes to
+ * @param reply_to the channel the reply comes back on
+ * @param message ptr to the request data to send. It will be copied
+ * @param message_size The size of the request
+ * @param timeout_ms time to wait for the reply in milliseconds. 0 to wait until reply_to is stopped
+ * @return the future, NULL if reply_to already has LOCAL_MESSENGER_MAX_PENDING_REQUESTS in flight. A request there was no room
+ * for in time ends with MESSENGER_REPLY_DROPPED
+ */
+messenger_future_t *messenger_channel_request_future(messenger_t *messenger, messenger_t *reply_to, void *message, long message_size, unsigned int timeout_ms);
+
+/**
+ * @brief answer a request. May be called from the request handler or later from any thread,
+ * as long as the channel that made the request has not been destroyed. On the dispatch thread of the
+ * channel waiting on the reply it does not wait for room, since only that thread makes any. A reply
+ * that could not be sent ends the request with MESSENGER_REPLY_DROPPED
+ * @param request the request passed to the handler, or a copy of it
+ * @param reply ptr to the reply data to send. It will be copied
+ * @param reply_size The size of the reply
+ * @return MESSENGER_SEND_OK, MESSENGER_SEND_WOULD_BLOCK if there was no room on that dispatch thread,
+ * or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_reply(const messenger_request_t *request, void *reply, long reply_size);
+
+/**
+ * @brief tell if the request of a future has ended
+ * @param future the future
+ * @return true once messenger_future_wait will not block
+ */
+bool messenger_future_done(messenger_future_t *future);
+
+/**
+ * @brief wait for the request of a future to end and free the future
+ * @param future the future
+ * @param reply buffer the reply is copied into. May be NULL if reply_capacity is 0
+ * @param reply_capacity size of the buffer. A longer reply is cut short
+ * @param reply_size set to the full size of the reply. May be NULL
+ * @return how the request ended
+ */
+enum messenger_reply_status_e messenger_future_wait(messenger_future_t *future, void *reply, long reply_capacity, long *reply_size);
+
+/**
+ * @brief start the messenger now rather than on first use, so the first send does not pay for
+ * creating the transport and the dispatch thread. Must be called while the messenger is not running
+ * @param config the settings to start with. They are kept for later starts. NULL for the current settings.
+ * The name must be NULL
+ */
+void messenger_init(const messenger_config_t *config);
+
+/**
+ * @brief select the transport the messenger uses the next time it starts.
+ * Must be called while the messenger is not running
+ * @param transport the transport to use
+ */
+void messenger_set_transport(enum messenger_transport_e transport);
+
+/**
+ * @brief set the size of the ring used by MESSENGER_TRANSPORT_RING the next time the messenger starts.
+ * The largest message the ring carries is a bit under half of this.
+ * Must be called while the messenger is not running
+ * @param ring_size the ring size in bytes. Must be a power of two
+ */
+void messenger_set_ring_size(uint64_t ring_size);
+
+/**
+ * @brief set the most messages the messenger hands out per wakeup the next time it starts.
+ * Must be called while the messenger is not running
+ * @param max_batch the batch size. 1 dispatches messages one at a time
+ */
+void messenger_set_dispatch_batch(unsigned int max_batch);
+
+/**
+ * @brief set the number of worker threads running the callbacks the next time the messenger starts.
+ * With workers, unkeyed messages are handled in parallel and in no particular order.
+ * Each message is copied off the transport for its worker and batch callbacks get one message at a time.
+ * Must be called while the messenger is not running
+ * @param workers the number of workers. 0 runs the callbacks on the dispatch thread
+ */
+void messenger_set_workers(unsigned int workers);
+
+/**
+ * @brief get the largest message the running transport can carry
+ * @return the max message size in bytes
+ */
+long messenger_max_message_size(void);
+
 /**
  * @brief register a callback to call when a message is received
  * @param cb The callback in question
@@ -20,16 +624,256 @@ typedef void (*messenger_on_messaage_rcv)(void *msg, long message_size);  //!< T
 void messenger_register_callback(messenger_on_messaage_rcv cb);
 
 /**
- * @brief Kill the messenger task and reset the module
+ * @brief register a callback to call with batches of received messages.
+ * Replaces messenger_register_callback, only one of the two may be registered.
+ * The messages are only valid until the callback returns
+ * @param cb The callback in question
+ */
+void messenger_register_batch_callback(messenger_on_batch_rcv cb);
+
+/**
+ * @brief register a callback to call with a context when a message is received.
+ * Only one of the callback kinds may be registered
+ * @param cb The callback in question
+ * @param context passed to cb
+ */
+void messenger_register_context_callback(messenger_on_context_rcv cb, void *context);
+
+/**
+ * @brief register the handler of a message type id
+ * @param type_id the message type id. Less than LOCAL_MESSENGER_MAX_MESSAGE_TYPES
+ * @param min_size the smallest message the handler accepts
+ * @param max_size the largest message the handler accepts. Equal to min_size for a fixed size message
+ * @param cb the handler
+ * @param context passed to cb
+ */
+void messenger_register_handler(uint32_t type_id, long min_size, long max_size, messenger_on_context_rcv cb, void *context);
+
+/**
+ * @brief take a snapshot of the statistics of the messenger
+ * @param stats filled with the snapshot
+ */
+void messenger_get_stats(messenger_stats_s *stats);
+
+/**
+ * @brief get the file descriptor of the messenger. It must have been started pollable with messenger_init
+ * @return an eventfd that is readable while messages are waiting
+ */
+int messenger_fd(void);
+
+/**
+ * @brief hand out the messages waiting on the messenger on the calling thread.
+ * It must have been started pollable with messenger_init
+ * @param max_messages the most messages to take off the transport
+ * @return the number of messages taken off the transport
+ */
+unsigned int messenger_dispatch_pending(unsigned int max_messages);
+
+/**
+ * @brief get how long the owner of the messenger may wait on its file descriptor before a timer is due
+ * @return the time in milliseconds, -1 if nothing is due
+ */
+int messenger_next_timeout_ms(void);
+
+/**
+ * @brief send the messages a previous run left unhandled in the journal of the messenger through it again.
+ * It must have been started with a journal_path by messenger_init
+ * @return the number of messages replayed
+ */
+unsigned int messenger_replay(void);
+
+/**
+ * @brief wait until every message sent on the messenger so far is on disk
+ */
+void messenger_sync(void);
+
+/**
+ * @brief Kill the messenger task and reset the module.
+ * The kill is sent on the top lane and overtakes queued messages, anything not yet handed out is dropped.
+ * The transport is released unless warm restart is on, see messenger_set_warm_restart
  */
 void messenger_kill(void);
 
+/**
+ * @brief keep the transport and the dispatch thread of the messenger parked across messenger_kill.
+ * The next start reuses them if the settings have not changed, which saves creating a queue and a thread.
+ * Callbacks, subscribers and watermarks are still reset by the kill.
+ * Turning it off releases a parked messenger. Must be called while the messenger is not running
+ * @param enabled true to park the messenger on kill
+ */
+void messenger_set_warm_restart(bool enabled);
+
 /**
  * @brief send a message over the sender
  * @param message ptr to the message data to send. It will be copied
  * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send(void *message, long message_size);
+
+/**
+ * @brief send a message if there is room for it right now
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_WOULD_BLOCK if the transport is full
+ */
+enum messenger_send_result_e messenger_try_send(void *message, long message_size);
+
+/**
+ * @brief send a message, sleeping while the transport is full
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param timeout_ms the longest to wait for room in milliseconds
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_timeout(void *message, long message_size, unsigned int timeout_ms);
+
+/**
+ * @brief set the fill levels the messenger reports to a callback. See messenger_channel_set_watermarks
+ * @param high_percent the fill percentage that calls the callback with above_high set
+ * @param low_percent the fill percentage that calls the callback with above_high cleared
+ * @param cb the callback. NULL to stop reporting
+ */
+void messenger_set_watermarks(unsigned int high_percent, unsigned int low_percent, messenger_on_watermark cb);
+
+/**
+ * @brief send a message on a priority lane. Queued messages of a higher lane are always handed out first
+ * @param priority the lane. LOCAL_MESSENGER_PRIORITY_HIGHEST is the highest
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_priority(unsigned int priority, void *message, long message_size);
+
+/**
+ * @brief send a message that is handled in order with the other messages of the same key
+ * @param key the ordering key
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_keyed(uint32_t key, void *message, long message_size);
+
+/**
+ * @brief send the newest value of a key, replacing a value of the same key still waiting to be handed out
+ * @param key the key
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if the key had nothing waiting and there was no room in time
+ */
+enum messenger_send_result_e messenger_send_conflated(uint32_t key, void *message, long message_size);
+
+/**
+ * @brief send a buffer by handle
+ * @param buffer the payload ptr from messenger_buffer_alloc
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_buffer(void *buffer);
+
+/**
+ * @brief send a message to the handler of its type id
+ * @param type_id the message type id. Less than LOCAL_MESSENGER_MAX_MESSAGE_TYPES
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_typed(uint32_t type_id, void *message, long message_size);
+
+/**
+ * @brief add a subscriber to a topic
+ * @param topic the topic. Less than LOCAL_MESSENGER_MAX_TOPICS
+ * @param cb the callback to call with the messages published on the topic
+ */
+void messenger_subscribe(uint32_t topic, messenger_on_messaage_rcv cb);
+
+/**
+ * @brief remove a subscriber from a topic
+ * @param topic the topic
+ * @param cb the callback passed to messenger_subscribe
+ */
+void messenger_unsubscribe(uint32_t topic, messenger_on_messaage_rcv cb);
+
+/**
+ * @brief publish a message to the subscribers of a topic
+ * @param topic the topic. Less than LOCAL_MESSENGER_MAX_TOPICS
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_publish(uint32_t topic, void *message, long message_size);
+
+/**
+ * @brief send several messages in one call. With MESSENGER_TRANSPORT_RING the messages are
+ * reserved and published in runs, so a run costs one reservation and at most one wakeup
+ * @param messages ptrs to the message data to send. They will be copied
+ * @param message_sizes The size of each message
+ * @param count The number of messages
+ * @return the number of messages sent, oldest first
+ */
+unsigned int messenger_send_batch(void **messages, const long *message_sizes, unsigned int count);
+
+/**
+ * @brief get a buffer to build a message in place, skipping the copy messenger_send makes.
+ * With MESSENGER_TRANSPORT_RING the buffer is the message's slot in the ring and the callback
+ * receives a ptr to the same slot. Other messages queue up behind it until it is committed
+ * @param message_size The size of the message that will be written
+ * @return ptr to message_size bytes to write the message into. Pass it to messenger_commit once written. NULL if there was no room in time
+ */
+void *messenger_acquire(long message_size);
+
+/**
+ * @brief send a message built in a buffer from messenger_acquire
+ * @param message the ptr returned by messenger_acquire. It must not be touched after this call
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_commit(void *message);
+
+/**
+ * @brief send a message once a delay has passed
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param delay_ms the delay in milliseconds. The message is never handed out early
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_delayed(void *message, long message_size, unsigned int delay_ms);
+
+/**
+ * @brief send a message every period until it is cancelled. The first one goes out one period from now
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param period_ms the period in milliseconds
+ * @return the periodic message. Pass it to messenger_cancel_periodic to stop it. NULL if there was no room in time
+ */
+messenger_timer_t *messenger_send_periodic(void *message, long message_size, unsigned int period_ms);
+
+/**
+ * @brief register a callback to call when a request is received
+ * @param cb The callback in question
+ */
+void messenger_register_request_handler(messenger_on_request cb);
+
+/**
+ * @brief send a request to the messenger and have its reply handed to a callback. The reply comes back
+ * on the messenger, so the handler and the callback both run on its dispatch thread
+ * @param message ptr to the request data to send. It will be copied
+ * @param message_size The size of the request
+ * @param timeout_ms time to wait for the reply in milliseconds. 0 to wait until the messenger is killed
+ * @param cb called once with the reply or with why there was none
+ * @param context passed to cb
+ * @return MESSENGER_SEND_OK, MESSENGER_SEND_WOULD_BLOCK if too many requests are in flight, or MESSENGER_SEND_TIMED_OUT if there was no room in time.
+ * cb is not called for MESSENGER_SEND_WOULD_BLOCK, and is called with MESSENGER_REPLY_DROPPED for MESSENGER_SEND_TIMED_OUT
+ */
+enum messenger_send_result_e messenger_request(void *message, long message_size, unsigned int timeout_ms, messenger_on_reply cb, void *context);
+
+/**
+ * @brief send a request to the messenger and get a future to wait on its reply with.
+ * Do not wait on it from a callback of the messenger
+ * @param message ptr to the request data to send. It will be copied
+ * @param message_size The size of the request
+ * @param timeout_ms time to wait for the reply in milliseconds. 0 to wait until the messenger is killed
+ * @return the future, NULL if too many requests are in flight. A request there was no room for in time ends with MESSENGER_REPLY_DROPPED
  */
-void messenger_send(void *message, long message_size);
+messenger_future_t *messenger_request_future(void *message, long message_size, unsigned int timeout_ms);
 
 
 #endif /* INC_LOCAL_MESSENGER_H_ */
@@ -3,34 +3,157 @@
  * @author Kade Cox
  * @date Created: Mar 6, 2020
  * @details
+ * Deadlines on a monotonic clock. The deadline is worked out once when the helper is
+ * initialized so a check is a clock read and one compare. Wall clock steps do not affect it.
  *
+ * Also holds a hierarchical timer wheel for keeping many timers on one thread. Timers are
+ * hashed into slots by their expiry tick so adding and cancelling one is O(1). Timers too far
+ * out for the first level wait in a coarser level and move down as their time gets close.
+ * A wheel is not thread safe. The thread that owns it adds, cancels and advances it.
  */
 
 #ifndef INC_TIME_OUT_HELPER_H_
 #define INC_TIME_OUT_HELPER_H_
 
-#include <sys/time.h>
 #include <stdbool.h>
 #include <stdint.h>
 
+#define TIME_OUT_HELPER_NS_PER_MS 1000000ULL
+
+#define TIME_OUT_HELPER_WHEEL_LEVELS 4 //!< Levels of the timer wheel
+#define TIME_OUT_HELPER_WHEEL_SLOT_BITS 8
+#define TIME_OUT_HELPER_WHEEL_SLOTS (1U << TIME_OUT_HELPER_WHEEL_SLOT_BITS) //!< Slots in each level of the timer wheel
+#define TIME_OUT_HELPER_NEVER UINT64_MAX //!< Deadline of a wheel with no timers
+
+enum time_out_helper_clock_e
+{
+    TIME_OUT_HELPER_CLOCK_MONOTONIC, //!< CLOCK_MONOTONIC. Nanosecond resolution, read through the vDSO on Linux
+    TIME_OUT_HELPER_CLOCK_COARSE, //!< CLOCK_MONOTONIC_COARSE where there is one. Cheapest clock read, resolution of a scheduler tick
+    TIME_OUT_HELPER_CLOCK_TSC //!< The invariant time stamp counter calibrated against CLOCK_MONOTONIC. Falls back to CLOCK_MONOTONIC where there is none
+}; //!< The clocks a timeout can be measured on
+
 typedef struct time_out_helper_data_s
 {
-    struct timeval init_time;
-    uint64_t timeout_ms;
+    uint64_t deadline; //!< When the timeout elapses, in the units of the clock
+    enum time_out_helper_clock_e clock; //!< The clock the deadline is measured on
 } time_out_helper_data_s;
 
+struct time_out_helper_timer_s;
+
+typedef void (*time_out_helper_timer_cb)(struct time_out_helper_timer_s *timer, void *context); //!< Called when a timer expires. The timer may be added again from the callback
+
+typedef struct time_out_helper_timer_s
+{
+    struct time_out_helper_timer_s *next; //!< The next timer in the slot
+    struct time_out_helper_timer_s **pprev; //!< The link pointing at this timer. NULL while the timer is not pending
+    uint64_t expires; //!< The tick the timer expires on
+    time_out_helper_timer_cb callback; //!< Called when the timer expires
+    void *context; //!< Passed to the callback
+} time_out_helper_timer_s; //!< A timer kept on a timer wheel
+
+typedef struct time_out_helper_wheel_s
+{
+    uint64_t start_ns; //!< CLOCK_MONOTONIC time of tick 0
+    uint64_t tick_ns; //!< Length of a tick in nanoseconds
+    uint64_t current; //!< The next tick to expire
+    unsigned int pending; //!< Number of timers on the wheel
+    time_out_helper_timer_s *slots[TIME_OUT_HELPER_WHEEL_LEVELS][TIME_OUT_HELPER_WHEEL_SLOTS]; //!< Timers by level and slot
+} time_out_helper_wheel_s; //!< A hierarchical timer wheel
+
 /**
- * @brief Function that initializes a timeout helper instance
+ * @brief Function that initializes a timeout helper instance on CLOCK_MONOTONIC
  * @param data the instance data to initialize
  * @param timeout_ms timeout occurs after this many milliseconds
  */
 void time_out_helper_init(time_out_helper_data_s *data, uint64_t timeout_ms);
 
+/**
+ * @brief Function that initializes a timeout helper instance on a chosen clock
+ * @param data the instance data to initialize
+ * @param timeout_ns timeout occurs after this many nanoseconds
+ * @param clock the clock to measure the timeout on
+ */
+void time_out_helper_init_ns(time_out_helper_data_s *data, uint64_t timeout_ns, enum time_out_helper_clock_e clock);
+
 /**
  * @brief Function that checks if the timeout time has elapsed
  * @param data the instance data
  * @return true if the time has elapsed, false otherwise
  */
-bool time_out_helper_check(time_out_helper_data_s *data);
+bool time_out_helper_check(const time_out_helper_data_s *data);
+
+/**
+ * @brief Function that gets the time left before the timeout elapses
+ * @param data the instance data
+ * @return the nanoseconds left, 0 once the time has elapsed
+ */
+uint64_t time_out_helper_remaining_ns(const time_out_helper_data_s *data);
+
+/**
+ * @brief Function that reads a clock
+ * @param clock the clock to read
+ * @return the time in nanoseconds from an arbitrary start point
+ */
+uint64_t time_out_helper_now_ns(enum time_out_helper_clock_e clock);
+
+/**
+ * @brief Function that initializes a timer wheel
+ * @param wheel the wheel to initialize
+ * @param tick_ns the resolution of the wheel in nanoseconds. Timers expire on a tick boundary, never early
+ */
+void time_out_helper_wheel_init(time_out_helper_wheel_s *wheel, uint64_t tick_ns);
+
+/**
+ * @brief Function that initializes a timer
+ * @param timer the timer to initialize
+ * @param callback called when the timer expires
+ * @param context passed to the callback
+ */
+void time_out_helper_timer_init(time_out_helper_timer_s *timer, time_out_helper_timer_cb callback, void *context);
+
+/**
+ * @brief Function that adds a timer to a wheel. O(1)
+ * @param wheel the wheel
+ * @param timer the timer. Must not already be pending
+ * @param deadline_ns when the timer expires, on time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC)
+ */
+void time_out_helper_wheel_add(time_out_helper_wheel_s *wheel, time_out_helper_timer_s *timer, uint64_t deadline_ns);
+
+/**
+ * @brief Function that takes a pending timer off a wheel. O(1)
+ * @param wheel the wheel
+ * @param timer the timer. Does nothing if it is not pending
+ */
+void time_out_helper_wheel_cancel(time_out_helper_wheel_s *wheel, time_out_helper_timer_s *timer);
+
+/**
+ * @brief Function that checks if a timer is on a wheel
+ * @param timer the timer
+ * @return true if the timer is waiting to expire
+ */
+bool time_out_helper_timer_pending(const time_out_helper_timer_s *timer);
+
+/**
+ * @brief Function that expires every timer due by a given time and calls their callbacks
+ * @param wheel the wheel
+ * @param now_ns the time on time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC)
+ * @return the number of timers that expired
+ */
+unsigned int time_out_helper_wheel_advance(time_out_helper_wheel_s *wheel, uint64_t now_ns);
+
+/**
+ * @brief Function that gets when the wheel next needs advancing
+ * @param wheel the wheel
+ * @return the time on time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC), TIME_OUT_HELPER_NEVER if no timers are pending.
+ * This is never later than the earliest timer but may be earlier when timers have to move down a level
+ */
+uint64_t time_out_helper_wheel_next_deadline(const time_out_helper_wheel_s *wheel);
+
+/**
+ * @brief Function that takes any one timer off a wheel without expiring it. Used to tear a wheel down
+ * @param wheel the wheel
+ * @return the timer, NULL if no timers are pending
+ */
+time_out_helper_timer_s *time_out_helper_wheel_take_any(time_out_helper_wheel_s *wheel);
 
 #endif /* INC_TIME_OUT_HELPER_H_ */
@@ -0,0 +1,267 @@
+/**
+ * @file local-messenger-buffers.c
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Pool of reference counted payload buffers
+ */
+
+#include <local-messenger-buffers.h>
+#include <local-messenger.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+/***********************************************************************************/
+/***************************** Defines and Macros **********************************/
+/***********************************************************************************/
+
+#define BUFFER_CLASS_SIZE(size_class) (((size_t)LOCAL_MESSENGER_BUFFER_MIN_SIZE) << (size_class))
+#define BUFFER_HEADERS_SIZE (sizeof(local_messenger_buffer_s) + sizeof(struct local_messenger_message_header_s))
+
+/***********************************************************************************/
+/***************************** Type Defs *******************************************/
+/***********************************************************************************/
+
+struct buffer_cache_s
+{
+    local_messenger_buffer_s *head[LOCAL_MESSENGER_BUFFER_CLASSES]; //!< Free buffers by class
+    unsigned int count[LOCAL_MESSENGER_BUFFER_CLASSES]; //!< Number of buffers on each list
+    bool registered; //!< Set once the list is handed back to the shared one when the thread exits
+}; //!< The free lists of a thread
+
+/***********************************************************************************/
+/***************************** Function Declarations *******************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Static Variables ************************************/
+/***********************************************************************************/
+
+static _Thread_local struct buffer_cache_s buffer_cache; //!< The free lists of the calling thread
+static pthread_mutex_t buffer_pool_mutex = PTHREAD_MUTEX_INITIALIZER; //!< Protects buffer_pool
+static local_messenger_buffer_s *buffer_pool[LOCAL_MESSENGER_BUFFER_CLASSES]; //!< Free buffers handed back by the threads, by class
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT; //!< Creates buffer_key on first use
+static pthread_key_t buffer_key; //!< Hands the free lists of an exiting thread back to buffer_pool
+
+/***********************************************************************************/
+/***************************** Function Definitions ********************************/
+/***********************************************************************************/
+
+/**
+ * @brief move buffers from the free list of the calling thread to the shared one
+ * @param cache the free lists of the thread
+ * @param size_class the class
+ * @param count the number of buffers to move
+ */
+static void buffer_spill(struct buffer_cache_s *cache, uint32_t size_class, unsigned int count)
+{
+    local_messenger_buffer_s *first = cache->head[size_class];
+    local_messenger_buffer_s *last = first;
+    if(0 == count)
+    {
+        return;
+    }
+    for(unsigned int i = 1; i < count; i++)
+    {
+        last = last->next;
+    }
+    cache->head[size_class] = last->next;
+    cache->count[size_class] -= count;
+    //The chain is cut off outside the lock so the lock is held for one link
+    assert(0 == pthread_mutex_lock(&buffer_pool_mutex));
+    last->next = buffer_pool[size_class];
+    buffer_pool[size_class] = first;
+    pthread_mutex_unlock(&buffer_pool_mutex);
+}
+
+/**
+ * @brief hand the free lists of an exiting thread back to the shared ones
+ * @param context the free lists of the thread
+ */
+static void buffer_cache_destroy(void *context)
+{
+    struct buffer_cache_s *cache = context;
+    for(uint32_t size_class = 0; size_class < LOCAL_MESSENGER_BUFFER_CLASSES; size_class++)
+    {
+        buffer_spill(cache, size_class, cache->count[size_class]);
+    }
+}
+
+/**
+ * @brief create the key that hands the free lists of exiting threads back
+ */
+static void buffer_key_create(void)
+{
+    assert(0 == pthread_key_create(&buffer_key, buffer_cache_destroy));
+}
+
+/**
+ * @brief get the free lists of the calling thread
+ * @return the free lists
+ */
+static inline struct buffer_cache_s *buffer_cache_get(void)
+{
+    struct buffer_cache_s *cache = &buffer_cache;
+    if(false == cache->registered)
+    {
+        pthread_once(&buffer_key_once, buffer_key_create);
+        assert(0 == pthread_setspecific(buffer_key, cache));
+        cache->registered = true;
+    }
+    return cache;
+}
+
+/**
+ * @brief get the smallest class a buffer fits in
+ * @param size the size of the buffer, headers included
+ * @return the class. LOCAL_MESSENGER_BUFFER_CLASSES if it is too large for all of them
+ */
+static inline uint32_t buffer_class_of(size_t size)
+{
+    uint32_t rv = 0;
+    while(rv < LOCAL_MESSENGER_BUFFER_CLASSES && BUFFER_CLASS_SIZE(rv) < size)
+    {
+        rv++;
+    }
+    return rv;
+}
+
+/**
+ * @brief get a free buffer of a class
+ * @param size_class the class
+ * @return the buffer
+ */
+static local_messenger_buffer_s *buffer_take(uint32_t size_class)
+{
+    struct buffer_cache_s *cache = buffer_cache_get();
+    local_messenger_buffer_s *rv;
+    if(0 == cache->count[size_class])
+    {
+        //Take up to half a cache at once so the lock is only taken once per batch
+        assert(0 == pthread_mutex_lock(&buffer_pool_mutex));
+        while(NULL != buffer_pool[size_class] && cache->count[size_class] < LOCAL_MESSENGER_BUFFER_CACHE / 2)
+        {
+            rv = buffer_pool[size_class];
+            buffer_pool[size_class] = rv->next;
+            rv->next = cache->head[size_class];
+            cache->head[size_class] = rv;
+            cache->count[size_class]++;
+        }
+        pthread_mutex_unlock(&buffer_pool_mutex);
+    }
+    if(0 == cache->count[size_class])
+    {
+        rv = malloc(BUFFER_CLASS_SIZE(size_class));
+        assert(NULL != rv);
+        return rv;
+    }
+    rv = cache->head[size_class];
+    cache->head[size_class] = rv->next;
+    cache->count[size_class]--;
+    return rv;
+}
+
+/**
+ * @brief get the buffer holding a payload handed out by messenger_buffer_alloc
+ * @param payload the payload ptr
+ * @return the buffer
+ */
+local_messenger_buffer_s *local_messenger_buffer_from_payload(void *payload)
+{
+    assert(NULL != payload);
+    return local_messenger_buffer_from_msg((struct local_messanger_internal_message_s *)(((char *)payload) - offsetof(struct local_messanger_internal_message_s, message_data)));
+}
+
+/**
+ * @brief add references to a buffer. The caller must already hold one
+ * @param buffer the buffer
+ * @param count the number of references to add
+ */
+void local_messenger_buffer_retain(local_messenger_buffer_s *buffer, uint32_t count)
+{
+    assert(NULL != buffer);
+    assert(0 < atomic_fetch_add_explicit(&buffer->refs, count, memory_order_relaxed));
+}
+
+/**
+ * @brief drop a reference to a buffer. The last one puts it back on the free list of the calling thread
+ * @param buffer the buffer
+ */
+void local_messenger_buffer_release(local_messenger_buffer_s *buffer)
+{
+    struct buffer_cache_s *cache;
+    uint32_t refs;
+    assert(NULL != buffer);
+    //Release so the readers are done before the last reference frees it, acquire on the last one to see that
+    refs = atomic_fetch_sub_explicit(&buffer->refs, 1, memory_order_acq_rel);
+    assert(0 < refs);
+    if(1 != refs)
+    {
+        return;
+    }
+    if(LOCAL_MESSENGER_BUFFER_CLASSES == buffer->size_class)
+    {
+        free(buffer);
+        return;
+    }
+    cache = buffer_cache_get();
+    buffer->next = cache->head[buffer->size_class];
+    cache->head[buffer->size_class] = buffer;
+    cache->count[buffer->size_class]++;
+    if(LOCAL_MESSENGER_BUFFER_CACHE < cache->count[buffer->size_class])
+    {
+        buffer_spill(cache, buffer->size_class, LOCAL_MESSENGER_BUFFER_CACHE / 2);
+    }
+}
+
+/**
+ * @brief get a reference counted buffer to fill with a payload and send by handle
+ * @param size the size of the payload
+ * @return ptr to the payload. The caller holds the only reference
+ */
+void *messenger_buffer_alloc(long size)
+{
+    local_messenger_buffer_s *buffer;
+    struct local_messanger_internal_message_s *msg;
+    uint32_t size_class;
+    assert(0 < size);
+    size_class = buffer_class_of(BUFFER_HEADERS_SIZE + (size_t)size);
+    if(LOCAL_MESSENGER_BUFFER_CLASSES == size_class)
+    {
+        buffer = malloc(BUFFER_HEADERS_SIZE + (size_t)size);
+        assert(NULL != buffer);
+    }
+    else
+    {
+        buffer = buffer_take(size_class);
+    }
+    buffer->next = NULL;
+    buffer->size_class = size_class;
+    atomic_init(&buffer->refs, 1);
+    msg = local_messenger_buffer_msg(buffer);
+    memset(&msg->header, 0, sizeof(msg->header));
+    msg->header.type = LOCAL_MESSAGE_TYPE_BUFFER;
+    msg->header.message_size = size;
+    return msg->message_data;
+}
+
+/**
+ * @brief keep a buffer handed to a callback by a buffer send past the callback
+ * @param buffer the payload ptr
+ */
+void messenger_buffer_retain(void *buffer)
+{
+    local_messenger_buffer_retain(local_messenger_buffer_from_payload(buffer), 1);
+}
+
+/**
+ * @brief drop a reference to a buffer
+ * @param buffer the payload ptr
+ */
+void messenger_buffer_release(void *buffer)
+{
+    local_messenger_buffer_release(local_messenger_buffer_from_payload(buffer));
+}
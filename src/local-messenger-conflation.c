@@ -0,0 +1,213 @@
+/**
+ * @file local-messenger-conflation.c
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * The newest value of each key of a conflating channel
+ */
+
+#include <local-messenger-conflation.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/***********************************************************************************/
+/***************************** Defines and Macros **********************************/
+/***********************************************************************************/
+
+#define CONFLATION_HASH(key) ((uint32_t)((key) * 2654435761U) & (LOCAL_MESSENGER_MAX_CONFLATION_KEYS - 1))
+
+/***********************************************************************************/
+/***************************** Type Defs *******************************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Function Declarations *******************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Static Variables ************************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Function Definitions ********************************/
+/***********************************************************************************/
+
+/**
+ * @brief find the slot of a key. The table must be allocated and locked
+ * @param conflation the table
+ * @param key the key
+ * @param add true to give the key a slot if it has none
+ * @return the slot, NULL if the key has none and add is false
+ */
+static local_messenger_conflation_entry_s *conflation_find(local_messenger_conflation_s *conflation, uint32_t key, bool add)
+{
+    local_messenger_conflation_entry_s *entry;
+    uint32_t slot = CONFLATION_HASH(key);
+    //Keys are never removed so the probe ends at the key or at the first unused slot
+    for(uint32_t i = 0; i < LOCAL_MESSENGER_MAX_CONFLATION_KEYS; i++)
+    {
+        entry = &conflation->entries[(slot + i) & (LOCAL_MESSENGER_MAX_CONFLATION_KEYS - 1)];
+        if(true == entry->used && key == entry->key)
+        {
+            return entry;
+        }
+        if(false == entry->used)
+        {
+            if(false == add)
+            {
+                return NULL;
+            }
+            entry->used = true;
+            entry->key = key;
+            conflation->used++;
+            return entry;
+        }
+    }
+    //Every slot has another key
+    return NULL;
+}
+
+/**
+ * @brief set up an empty table. The slots are only allocated once a value is put
+ * @param conflation the table
+ */
+void local_messenger_conflation_init(local_messenger_conflation_s *conflation)
+{
+    assert(NULL != conflation);
+    assert(0 == (LOCAL_MESSENGER_MAX_CONFLATION_KEYS & (LOCAL_MESSENGER_MAX_CONFLATION_KEYS - 1)));
+    assert(0 == pthread_mutex_init(&conflation->mutex, NULL));
+    conflation->entries = NULL;
+    conflation->used = 0;
+}
+
+/**
+ * @brief free a table and the values in it
+ * @param conflation the table
+ */
+void local_messenger_conflation_destroy(local_messenger_conflation_s *conflation)
+{
+    assert(NULL != conflation);
+    for(uint32_t i = 0; NULL != conflation->entries && i < LOCAL_MESSENGER_MAX_CONFLATION_KEYS; i++)
+    {
+        free(conflation->entries[i].msg);
+    }
+    free(conflation->entries);
+    conflation->entries = NULL;
+    conflation->used = 0;
+    pthread_mutex_destroy(&conflation->mutex);
+}
+
+/**
+ * @brief store the newest value of a key. Called by any thread
+ * @param conflation the table
+ * @param header the header of the value, built by local_messenger_build_keyed_user_msg
+ * @param payload the value. header->message_size bytes long
+ * @return what storing the value did
+ */
+enum local_messenger_conflation_put_e local_messenger_conflation_put(local_messenger_conflation_s *conflation, const struct local_messenger_message_header_s *header, const void *payload)
+{
+    local_messenger_conflation_entry_s *entry;
+    size_t size = local_messenger_frame_size(header);
+    enum local_messenger_conflation_put_e rv;
+    assert(NULL != conflation);
+    assert(NULL != header);
+    assert(NULL != payload);
+    assert(0 == pthread_mutex_lock(&conflation->mutex));
+    if(NULL == conflation->entries)
+    {
+        //Channels that never conflate do not pay for the table
+        conflation->entries = calloc(LOCAL_MESSENGER_MAX_CONFLATION_KEYS, sizeof(local_messenger_conflation_entry_s));
+        assert(NULL != conflation->entries);
+    }
+    entry = conflation_find(conflation, header->key, true);
+    if(NULL == entry)
+    {
+        pthread_mutex_unlock(&conflation->mutex);
+        return LOCAL_MESSENGER_CONFLATION_FULL;
+    }
+    if(size > entry->capacity)
+    {
+        free(entry->msg);
+        entry->msg = malloc(size);
+        assert(NULL != entry->msg);
+        entry->capacity = size;
+    }
+    memcpy(&entry->msg->header, header, sizeof(struct local_messenger_message_header_s));
+    memcpy(entry->msg->message_data, payload, (size_t)header->message_size);
+    rv = (true == entry->pending) ? LOCAL_MESSENGER_CONFLATION_REPLACED : LOCAL_MESSENGER_CONFLATION_MARK;
+    entry->pending = true;
+    pthread_mutex_unlock(&conflation->mutex);
+    return rv;
+}
+
+/**
+ * @brief take the value of a key out of the table. Only called by the dispatch thread when the marker of the key arrives
+ * @param conflation the table
+ * @param key the key
+ * @param msg buffer the value is copied into, as a keyed user message. Grown with realloc when the value does not fit
+ * @param capacity the size of the buffer. Updated when it grows
+ * @return false if the key had nothing waiting
+ */
+bool local_messenger_conflation_take(local_messenger_conflation_s *conflation, uint32_t key, struct local_messanger_internal_message_s **msg, size_t *capacity)
+{
+    local_messenger_conflation_entry_s *entry;
+    size_t size;
+    assert(NULL != conflation);
+    assert(NULL != msg);
+    assert(NULL != capacity);
+    assert(0 == pthread_mutex_lock(&conflation->mutex));
+    entry = (NULL == conflation->entries) ? NULL : conflation_find(conflation, key, false);
+    if(NULL == entry || false == entry->pending)
+    {
+        pthread_mutex_unlock(&conflation->mutex);
+        return false;
+    }
+    size = local_messenger_frame_size(&entry->msg->header);
+    if(size > capacity[0])
+    {
+        msg[0] = realloc(msg[0], size);
+        assert(NULL != msg[0]);
+        capacity[0] = size;
+    }
+    //The copy lets senders store the next value while the callback runs on this one
+    memcpy(msg[0], entry->msg, size);
+    entry->pending = false;
+    pthread_mutex_unlock(&conflation->mutex);
+    return true;
+}
+
+/**
+ * @brief forget that a key has a marker on the transport, because sending the marker failed. The value is
+ * kept and goes out with the marker of the next value put for the key
+ * @param conflation the table
+ * @param key the key
+ */
+void local_messenger_conflation_unmark(local_messenger_conflation_s *conflation, uint32_t key)
+{
+    local_messenger_conflation_entry_s *entry;
+    assert(NULL != conflation);
+    assert(0 == pthread_mutex_lock(&conflation->mutex));
+    entry = (NULL == conflation->entries) ? NULL : conflation_find(conflation, key, false);
+    if(NULL != entry)
+    {
+        entry->pending = false;
+    }
+    pthread_mutex_unlock(&conflation->mutex);
+}
+
+/**
+ * @brief drop every value waiting to be handed out. Only called once the dispatch thread has
+ * parked and the markers on the transport are gone
+ * @param conflation the table
+ */
+void local_messenger_conflation_drop(local_messenger_conflation_s *conflation)
+{
+    assert(NULL != conflation);
+    assert(0 == pthread_mutex_lock(&conflation->mutex));
+    for(uint32_t i = 0; NULL != conflation->entries && i < LOCAL_MESSENGER_MAX_CONFLATION_KEYS; i++)
+    {
+        conflation->entries[i].pending = false;
+    }
+    pthread_mutex_unlock(&conflation->mutex);
+}
@@ -0,0 +1,662 @@
+/**
+ * @file local-messenger-journal.c
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Write ahead log of the messages sent on a channel
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif //__linux__
+
+#include <local-messenger-journal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+/***********************************************************************************/
+/***************************** Defines and Macros **********************************/
+/***********************************************************************************/
+
+#ifdef DEBUG_MESSENGER
+#define PRINT_MSG(...) printf(__VA_ARGS__)
+#else
+#define PRINT_MSG(...)
+#endif //DEBUG_MESSENGER
+
+#define JOURNAL_MAGIC 0x4c4d4a4e //!< "LMJN"
+#define JOURNAL_SEGMENT_HEADER_SIZE 64 //!< Records start after the segment header so no record is at position 0
+#define JOURNAL_RECORD_ALIGN(x) (((x) + 7) & ~((uint64_t)7))
+#define JOURNAL_RECORD_SIZE(length) JOURNAL_RECORD_ALIGN(sizeof(struct journal_record_s) + (uint64_t)(length))
+#define JOURNAL_SEGMENT_FORMAT "%s/%016" PRIx64 ".journal"
+#define JOURNAL_CHECKPOINT_FORMAT "%s/checkpoint"
+#define JOURNAL_FILE_PATH_LENGTH (LOCAL_MESSENGER_JOURNAL_PATH_LENGTH + 32)
+#define JOURNAL_NS_PER_MS 1000000ULL
+#define JOURNAL_NS_PER_SEC 1000000000ULL
+#define JOURNAL_FNV_OFFSET 2166136261U
+#define JOURNAL_FNV_PRIME 16777619U
+
+/***********************************************************************************/
+/***************************** Type Defs *******************************************/
+/***********************************************************************************/
+
+struct journal_segment_header_s
+{
+    uint32_t magic; //!< Identifies the file as a journal segment
+    uint32_t reserved; //!< Keeps segment_size aligned
+    uint64_t segment_size; //!< Size of the segment file in bytes
+}; //!< Placed at the start of each segment
+
+struct journal_record_s
+{
+    _Atomic uint32_t length; //!< Bytes in the frame. Stored last so a record is only seen once it is whole. 0 where the records of a segment end
+    _Atomic uint32_t acked; //!< Set once the message has been handed out
+    uint32_t checksum; //!< FNV-1a of the frame, to find records torn by a crash of the machine
+    uint32_t reserved; //!< Keeps the frame aligned
+    long frame[]; //!< The message header and payload
+}; //!< A message in a segment
+
+/***********************************************************************************/
+/***************************** Function Declarations *******************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Static Variables ************************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Function Definitions ********************************/
+/***********************************************************************************/
+
+/**
+ * @brief get the segment a position is in
+ * @param journal
+ * @param position
+ * @return the segment number
+ */
+static inline uint64_t journal_segment_of(const local_messenger_journal_s *journal, uint64_t position)
+{
+    return position / journal->segment_size;
+}
+
+/**
+ * @brief get the position of the first record of a segment
+ * @param journal
+ * @param segment the segment number
+ * @return the position
+ */
+static inline uint64_t journal_segment_start(const local_messenger_journal_s *journal, uint64_t segment)
+{
+    return (segment * journal->segment_size) + JOURNAL_SEGMENT_HEADER_SIZE;
+}
+
+/**
+ * @brief get the record at a position. Its segment must be mapped
+ * @param journal
+ * @param position
+ * @return ptr to the record
+ */
+static inline struct journal_record_s *journal_record_at(local_messenger_journal_s *journal, uint64_t position)
+{
+    uint8_t *segment = atomic_load_explicit(&journal->segments[journal_segment_of(journal, position) % LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS], memory_order_acquire);
+    assert(NULL != segment);
+    return (struct journal_record_s *)&segment[position & (journal->segment_size - 1)];
+}
+
+/**
+ * @brief tell if the records of a segment end at a position
+ * @param journal
+ * @param position
+ * @return true if there is no record at the position
+ */
+static inline bool journal_segment_ends(local_messenger_journal_s *journal, uint64_t position)
+{
+    if((position & (journal->segment_size - 1)) + sizeof(struct journal_record_s) > journal->segment_size)
+    {
+        return true;
+    }
+    return 0 == atomic_load_explicit(&journal_record_at(journal, position)->length, memory_order_acquire);
+}
+
+/**
+ * @brief checksum a frame
+ * @param frame
+ * @param length
+ * @return the FNV-1a hash of the frame
+ */
+static uint32_t journal_checksum(const void *frame, uint32_t length)
+{
+    const uint8_t *bytes = frame;
+    uint32_t hash = JOURNAL_FNV_OFFSET;
+    for(uint32_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ bytes[i]) * JOURNAL_FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * @brief build the path of a segment file
+ * @param journal
+ * @param segment the segment number
+ * @param path buffer of JOURNAL_FILE_PATH_LENGTH bytes
+ */
+static void journal_segment_path(const local_messenger_journal_s *journal, uint64_t segment, char *path)
+{
+    assert(JOURNAL_FILE_PATH_LENGTH > snprintf(path, JOURNAL_FILE_PATH_LENGTH, JOURNAL_SEGMENT_FORMAT, journal->path, segment));
+}
+
+/**
+ * @brief map a segment file
+ * @param journal
+ * @param segment the segment number
+ * @param create true to create a new empty segment, false to map one already on disk
+ */
+static void journal_map_segment(local_messenger_journal_s *journal, uint64_t segment, bool create)
+{
+    char path[JOURNAL_FILE_PATH_LENGTH];
+    struct journal_segment_header_s *header;
+    void *memory;
+    int fd;
+    journal_segment_path(journal, segment, path);
+    fd = open(path, O_RDWR | O_CLOEXEC | ((true == create) ? (O_CREAT | O_TRUNC) : 0), 0600);
+    assert(0 <= fd);
+    if(true == create)
+    {
+        assert(0 == ftruncate(fd, (off_t)journal->segment_size));
+    }
+    memory = mmap(NULL, journal->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    assert(MAP_FAILED != memory);
+    header = memory;
+    if(true == create)
+    {
+        header->magic = JOURNAL_MAGIC;
+        header->segment_size = journal->segment_size;
+    }
+    //Positions are computed from the segment size so every segment has to agree on it
+    assert(JOURNAL_MAGIC == header->magic && journal->segment_size == header->segment_size);
+    assert(NULL == atomic_load_explicit(&journal->segments[segment % LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS], memory_order_relaxed));
+    atomic_store_explicit(&journal->segments[segment % LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS], memory, memory_order_release);
+}
+
+/**
+ * @brief unmap a segment
+ * @param journal
+ * @param segment the segment number
+ * @param remove true to also delete the file
+ */
+static void journal_unmap_segment(local_messenger_journal_s *journal, uint64_t segment, bool remove)
+{
+    char path[JOURNAL_FILE_PATH_LENGTH];
+    uint8_t *memory = atomic_exchange_explicit(&journal->segments[segment % LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS], NULL, memory_order_acq_rel);
+    if(NULL != memory)
+    {
+        munmap(memory, journal->segment_size);
+    }
+    if(true == remove)
+    {
+        journal_segment_path(journal, segment, path);
+        unlink(path);
+    }
+}
+
+/**
+ * @brief find the oldest and newest segment files in the directory
+ * @param journal
+ * @param first set to the oldest segment
+ * @param last set to the newest segment
+ * @return false if there are none
+ */
+static bool journal_find_segments(local_messenger_journal_s *journal, uint64_t *first, uint64_t *last)
+{
+    DIR *dir;
+    struct dirent *entry;
+    uint64_t segment;
+    char suffix[16];
+    bool found = false;
+    dir = opendir(journal->path);
+    assert(NULL != dir);
+    while(NULL != (entry = readdir(dir)))
+    {
+        if(2 != sscanf(entry->d_name, "%16" SCNx64 ".%15s", &segment, suffix) || 0 != strcmp(suffix, "journal"))
+        {
+            continue;
+        }
+        first[0] = (false == found || segment < first[0]) ? segment : first[0];
+        last[0] = (false == found || segment > last[0]) ? segment : last[0];
+        found = true;
+    }
+    closedir(dir);
+    return found;
+}
+
+/**
+ * @brief walk the records left by a previous run to find where the next record goes.
+ * A record torn by a crash of the machine ends the log
+ * @param journal
+ * @param last the newest segment on disk
+ * @return the position after the last whole record
+ */
+static uint64_t journal_find_tail(local_messenger_journal_s *journal, uint64_t last)
+{
+    struct journal_record_s *record;
+    uint64_t position = journal->checkpoint;
+    uint32_t length;
+    while(true)
+    {
+        if(true == journal_segment_ends(journal, position))
+        {
+            if(journal_segment_of(journal, position) >= last)
+            {
+                return position;
+            }
+            position = journal_segment_start(journal, journal_segment_of(journal, position) + 1);
+            continue;
+        }
+        record = journal_record_at(journal, position);
+        length = atomic_load_explicit(&record->length, memory_order_relaxed);
+        if((position & (journal->segment_size - 1)) + JOURNAL_RECORD_SIZE(length) >= journal->segment_size ||
+           journal_checksum(record->frame, length) != record->checksum)
+        {
+            PRINT_MSG("%s torn record at %" PRIu64 "\r\n", __FUNCTION__, position);
+            return position;
+        }
+        position += JOURNAL_RECORD_SIZE(length);
+    }
+}
+
+/**
+ * @brief flush the records between two positions to disk
+ * @param journal
+ * @param from the first position to flush
+ * @param to the position after the last one
+ */
+static void journal_flush(local_messenger_journal_s *journal, uint64_t from, uint64_t to)
+{
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t start;
+    uint64_t end;
+    uint8_t *memory;
+    if(from >= to)
+    {
+        return;
+    }
+    for(uint64_t segment = journal_segment_of(journal, from); segment <= journal_segment_of(journal, to); segment++)
+    {
+        memory = atomic_load_explicit(&journal->segments[segment % LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS], memory_order_acquire);
+        start = (segment == journal_segment_of(journal, from)) ? (from & (journal->segment_size - 1)) & ~(page - 1) : 0;
+        end = (segment == journal_segment_of(journal, to)) ? (to & (journal->segment_size - 1)) : journal->segment_size;
+        if(NULL != memory && end > start)
+        {
+            assert(0 == msync(&memory[start], end - start, MS_SYNC));
+        }
+    }
+}
+
+/**
+ * @brief move the checkpoint over the acknowledged records in front of it
+ * @param journal
+ * @param checkpoint the current checkpoint
+ * @param limit the checkpoint may not pass this
+ * @return the new checkpoint
+ */
+static uint64_t journal_advance(local_messenger_journal_s *journal, uint64_t checkpoint, uint64_t limit)
+{
+    struct journal_record_s *record;
+    while(checkpoint < limit)
+    {
+        if(true == journal_segment_ends(journal, checkpoint))
+        {
+            checkpoint = journal_segment_start(journal, journal_segment_of(journal, checkpoint) + 1);
+            continue;
+        }
+        record = journal_record_at(journal, checkpoint);
+        if(0 == atomic_load_explicit(&record->acked, memory_order_acquire))
+        {
+            break;
+        }
+        checkpoint += JOURNAL_RECORD_SIZE(atomic_load_explicit(&record->length, memory_order_relaxed));
+    }
+    return checkpoint;
+}
+
+/**
+ * @brief The task that flushes appends in groups and moves the checkpoint on
+ * @param args the journal
+ */
+static void *journal_sync_task(void *args)
+{
+    local_messenger_journal_s *journal = args;
+    struct timespec deadline;
+    uint64_t target;
+    uint64_t from;
+    uint64_t checkpoint;
+    uint64_t limit;
+    uint64_t timeout_ns;
+    bool exiting;
+    assert(0 == pthread_mutex_lock(&journal->mutex));
+    while(true)
+    {
+        if(false == journal->stop && journal->sync_requested <= journal->synced)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            timeout_ns = (uint64_t)deadline.tv_nsec + (LOCAL_MESSENGER_JOURNAL_SYNC_MS * JOURNAL_NS_PER_MS);
+            deadline.tv_sec += (time_t)(timeout_ns / JOURNAL_NS_PER_SEC);
+            deadline.tv_nsec = (long)(timeout_ns % JOURNAL_NS_PER_SEC);
+            pthread_cond_timedwait(&journal->sync_cond, &journal->mutex, &deadline);
+        }
+        exiting = journal->stop;
+        target = journal->tail;
+        from = journal->synced;
+        checkpoint = journal->checkpoint;
+        limit = (journal->pin < target) ? journal->pin : target;
+        pthread_mutex_unlock(&journal->mutex);
+        //Everything appended since the last pass goes out in one flush
+        journal_flush(journal, from, target);
+        limit = journal_advance(journal, checkpoint, limit);
+        if(limit != checkpoint)
+        {
+            assert(sizeof(limit) == pwrite(journal->checkpoint_fd, &limit, sizeof(limit), 0));
+            assert(0 == fdatasync(journal->checkpoint_fd));
+        }
+        assert(0 == pthread_mutex_lock(&journal->mutex));
+        journal->synced = target;
+        journal->checkpoint = limit;
+        //The checkpoint is on disk so the segments behind it are no longer needed
+        while(journal->first_segment < journal_segment_of(journal, limit))
+        {
+            journal_unmap_segment(journal, journal->first_segment, true);
+            journal->first_segment++;
+        }
+        pthread_cond_broadcast(&journal->cond);
+        if(true == exiting)
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    return NULL;
+}
+
+/**
+ * @brief open the journal in a directory, creating it if needed, and find the records a previous
+ * run left unacknowledged
+ * @param journal the journal to open
+ * @param path the directory
+ * @param segment_size the size of each segment file. Must be a power of two of at least a page and match the segments already there
+ */
+void local_messenger_journal_open(local_messenger_journal_s *journal, const char *path, uint64_t segment_size)
+{
+    char file_path[JOURNAL_FILE_PATH_LENGTH];
+    pthread_condattr_t cond_attr;
+    uint64_t first = 0;
+    uint64_t last = 0;
+    uint64_t checkpoint = 0;
+    struct journal_record_s *record;
+    bool found;
+    assert(NULL != journal);
+    assert(NULL != path);
+    assert(strlen(path) < sizeof(journal->path));
+    assert(0 == (segment_size & (segment_size - 1)));
+    assert(segment_size >= (uint64_t)sysconf(_SC_PAGESIZE));
+    memset(journal, 0, sizeof(local_messenger_journal_s));
+    strncpy(journal->path, path, sizeof(journal->path) - 1);
+    journal->segment_size = segment_size;
+    journal->pin = UINT64_MAX;
+    assert(0 == mkdir(path, 0700) || EEXIST == errno);
+    assert(JOURNAL_FILE_PATH_LENGTH > snprintf(file_path, sizeof(file_path), JOURNAL_CHECKPOINT_FORMAT, path));
+    journal->checkpoint_fd = open(file_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    assert(0 <= journal->checkpoint_fd);
+    if(sizeof(checkpoint) != pread(journal->checkpoint_fd, &checkpoint, sizeof(checkpoint), 0))
+    {
+        checkpoint = 0;
+    }
+    found = journal_find_segments(journal, &first, &last);
+    //A crash between writing the checkpoint and removing the segments behind it leaves them here
+    for(; true == found && first <= last && first < journal_segment_of(journal, checkpoint); first++)
+    {
+        journal_unmap_segment(journal, first, true);
+    }
+    if(false == found || first > last)
+    {
+        first = journal_segment_of(journal, checkpoint);
+        last = first;
+        journal_map_segment(journal, first, true);
+    }
+    else
+    {
+        assert(last - first < LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS);
+        for(uint64_t segment = first; segment <= last; segment++)
+        {
+            journal_map_segment(journal, segment, false);
+        }
+    }
+    journal->first_segment = first;
+    if(checkpoint < journal_segment_start(journal, first))
+    {
+        checkpoint = journal_segment_start(journal, first);
+    }
+    journal->checkpoint = checkpoint;
+    journal->tail = journal_find_tail(journal, last);
+    for(uint64_t segment = journal_segment_of(journal, journal->tail) + 1; segment <= last; segment++)
+    {
+        journal_unmap_segment(journal, segment, true);
+    }
+    if(false == journal_segment_ends(journal, journal->tail))
+    {
+        //A torn record. Clear it and anything after it so the next appends read back cleanly
+        record = journal_record_at(journal, journal->tail);
+        memset(record, 0, journal->segment_size - (journal->tail & (journal->segment_size - 1)));
+    }
+    journal->replay_end = (journal->tail > journal->checkpoint) ? journal->tail : 0;
+    journal->replay_next = journal->checkpoint;
+    journal->synced = journal->tail;
+    journal->sync_requested = journal->tail;
+    assert(0 == pthread_mutex_init(&journal->mutex, NULL));
+    assert(0 == pthread_cond_init(&journal->cond, NULL));
+    assert(0 == pthread_condattr_init(&cond_attr));
+    assert(0 == pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC));
+    assert(0 == pthread_cond_init(&journal->sync_cond, &cond_attr));
+    pthread_condattr_destroy(&cond_attr);
+    assert(0 == pthread_create(&journal->sync_thread, NULL, journal_sync_task, journal));
+}
+
+/**
+ * @brief flush the journal and close it. Unacknowledged records stay on disk for the next open
+ * @param journal the journal
+ */
+void local_messenger_journal_close(local_messenger_journal_s *journal)
+{
+    assert(NULL != journal);
+    assert(0 == pthread_mutex_lock(&journal->mutex));
+    journal->stop = true;
+    pthread_cond_signal(&journal->sync_cond);
+    pthread_mutex_unlock(&journal->mutex);
+    pthread_join(journal->sync_thread, NULL);
+    for(uint64_t segment = journal->first_segment; segment <= journal_segment_of(journal, journal->tail); segment++)
+    {
+        journal_unmap_segment(journal, segment, false);
+    }
+    close(journal->checkpoint_fd);
+    pthread_mutex_destroy(&journal->mutex);
+    pthread_cond_destroy(&journal->cond);
+    pthread_cond_destroy(&journal->sync_cond);
+}
+
+/**
+ * @brief append a message
+ * @param header the message header
+ * @param payload the message payload. header->message_size bytes long
+ * @param wait true to wait while LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS segments hold unacknowledged records
+ * @return the position of the record. 0 if the journal was full and wait was false
+ */
+static uint64_t journal_append(local_messenger_journal_s *journal, const struct local_messenger_message_header_s *header, const void *payload, bool wait)
+{
+    struct journal_record_s *record;
+    uint32_t length = (uint32_t)local_messenger_frame_size(header);
+    uint64_t size = JOURNAL_RECORD_SIZE(length);
+    uint64_t next;
+    uint64_t rv;
+    assert(NULL != journal);
+    assert(JOURNAL_SEGMENT_HEADER_SIZE + size < journal->segment_size);
+    assert(0 == pthread_mutex_lock(&journal->mutex));
+    //A record never ends right on the end of a segment so no position lands on the header of the next one
+    while((journal->tail & (journal->segment_size - 1)) + size >= journal->segment_size)
+    {
+        next = journal_segment_of(journal, journal->tail) + 1;
+        if(next - journal->first_segment >= LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS)
+        {
+            //Have the sync thread move the checkpoint on now rather than at its next pass
+            journal->sync_requested = journal->tail;
+            pthread_cond_signal(&journal->sync_cond);
+            if(false == wait)
+            {
+                pthread_mutex_unlock(&journal->mutex);
+                return 0;
+            }
+            //Another append may have moved on to the next segment while this one waited, so the tail is checked again
+            pthread_cond_wait(&journal->cond, &journal->mutex);
+            continue;
+        }
+        journal_map_segment(journal, next, true);
+        journal->tail = journal_segment_start(journal, next);
+    }
+    record = journal_record_at(journal, journal->tail);
+    memcpy(record->frame, header, sizeof(struct local_messenger_message_header_s));
+    if(0 != header->message_size)
+    {
+        memcpy(&((uint8_t *)record->frame)[sizeof(struct local_messenger_message_header_s)], payload, (size_t)header->message_size);
+    }
+    record->checksum = journal_checksum(record->frame, length);
+    atomic_store_explicit(&record->acked, 0, memory_order_relaxed);
+    atomic_store_explicit(&record->length, length, memory_order_release);
+    rv = journal->tail;
+    journal->tail += size;
+    pthread_mutex_unlock(&journal->mutex);
+    return rv;
+}
+
+/**
+ * @brief append a message. Called by any thread. Waits while LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS segments hold unacknowledged records
+ * @param journal the journal
+ * @param header the message header
+ * @param payload the message payload. header->message_size bytes long
+ * @return the position of the record. Never 0
+ */
+uint64_t local_messenger_journal_append(local_messenger_journal_s *journal, const struct local_messenger_message_header_s *header, const void *payload)
+{
+    return journal_append(journal, header, payload, true);
+}
+
+/**
+ * @brief append a message without waiting. Called by any thread, including one holding room
+ * on a transport the dispatch thread is stuck behind
+ * @param journal the journal
+ * @param header the message header
+ * @param payload the message payload. header->message_size bytes long
+ * @return the position of the record. 0 if LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS segments hold unacknowledged records
+ */
+uint64_t local_messenger_journal_try_append(local_messenger_journal_s *journal, const struct local_messenger_message_header_s *header, const void *payload)
+{
+    return journal_append(journal, header, payload, false);
+}
+
+/**
+ * @brief mark a record acknowledged so it is not replayed. Called by any thread
+ * @param journal the journal
+ * @param position the position from local_messenger_journal_append
+ */
+void local_messenger_journal_ack(local_messenger_journal_s *journal, uint64_t position)
+{
+    assert(NULL != journal);
+    assert(0 != position);
+    //The checkpoint can not pass an unacknowledged record so its segment is still mapped
+    atomic_store_explicit(&journal_record_at(journal, position)->acked, 1, memory_order_release);
+}
+
+/**
+ * @brief wait until every record appended before the call is on disk. Callers share the
+ * sync thread's next flush
+ * @param journal the journal
+ */
+void local_messenger_journal_sync(local_messenger_journal_s *journal)
+{
+    uint64_t target;
+    assert(NULL != journal);
+    assert(0 == pthread_mutex_lock(&journal->mutex));
+    target = journal->tail;
+    if(journal->sync_requested < target)
+    {
+        journal->sync_requested = target;
+        pthread_cond_signal(&journal->sync_cond);
+    }
+    while(journal->synced < target)
+    {
+        pthread_cond_wait(&journal->cond, &journal->mutex);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+}
+
+/**
+ * @brief run the records left unacknowledged by a previous run through a callback, oldest first.
+ * Records are only replayed once. A replay the callback stops carries on from the record it stopped at on the next call
+ * @param journal the journal
+ * @param cb called with the position and the message of each record. Returns false to stop at that record
+ * @param context passed to cb
+ * @return the number of records replayed
+ */
+unsigned int local_messenger_journal_replay(local_messenger_journal_s *journal, local_messenger_journal_replay_cb cb, void *context)
+{
+    struct journal_record_s *record;
+    uint64_t position;
+    uint64_t end;
+    unsigned int rv = 0;
+    assert(NULL != journal);
+    assert(NULL != cb);
+    assert(0 == pthread_mutex_lock(&journal->mutex));
+    end = journal->replay_end;
+    //The record a stopped replay left off at is still unacknowledged so the checkpoint is never past it
+    position = journal->replay_next;
+    journal->replay_end = 0;
+    //Replayed records are acknowledged as they are handed out. Keep the checkpoint from freeing the segments being walked
+    journal->pin = position;
+    pthread_mutex_unlock(&journal->mutex);
+    while(position < end)
+    {
+        if(true == journal_segment_ends(journal, position))
+        {
+            position = journal_segment_start(journal, journal_segment_of(journal, position) + 1);
+            continue;
+        }
+        record = journal_record_at(journal, position);
+        if(0 == atomic_load_explicit(&record->acked, memory_order_acquire))
+        {
+            if(false == cb(context, position, (const struct local_messanger_internal_message_s *)record->frame))
+            {
+                break;
+            }
+            rv++;
+        }
+        position += JOURNAL_RECORD_SIZE(atomic_load_explicit(&record->length, memory_order_relaxed));
+    }
+    assert(0 == pthread_mutex_lock(&journal->mutex));
+    if(position < end)
+    {
+        journal->replay_next = position;
+        journal->replay_end = end;
+    }
+    journal->pin = UINT64_MAX;
+    pthread_mutex_unlock(&journal->mutex);
+    return rv;
+}
@@ -7,7 +7,7 @@
  */
 
 #include <local-messenger-message-types.h>
-#include <string.h>
+#include <time-out-helper.h>
 #include <assert.h>
 
 /***********************************************************************************/
@@ -35,33 +35,146 @@
 
 
 /**
- * @brief Function that builds an action message
+ * @brief Function that builds the header for an action message
  * @param action
- * @return The message to send out
+ * @return The header to send out. Action messages have no payload
  */
-struct local_messanger_internal_message_s local_messenger_build_action(enum local_messenger_message_internal_action_type_e action)
+struct local_messenger_message_header_s local_messenger_build_action(enum local_messenger_message_internal_action_type_e action)
 {
-    struct local_messanger_internal_message_s rv;
+    struct local_messenger_message_header_s rv;
     rv.type = LOCAL_MESSAGE_TYPE_INTERNAL_ACTION;
-    rv.data.action = action;
+    rv.action = action;
+    rv.key = 0;
+    rv.topic = 0;
+    rv.correlation_id = 0;
+    rv.journal_position = 0;
+    rv.message_size = 0;
+#if LOCAL_MESSENGER_STATS
+    rv.enqueue_ns = 0;
+#endif //LOCAL_MESSENGER_STATS
     return rv;
 }
 
 
 /**
- * @brief Function that builds an user message
- * @param data
- * @param message_size
- * @return The message to send out
+ * @brief Function that builds the header for a user message
+ * @param message_size the size of the payload that will follow the header
+ * @return The header to send out
  */
-struct local_messanger_internal_message_s local_messenger_build_user_msg(void *data, long message_size)
+struct local_messenger_message_header_s local_messenger_build_user_msg(long message_size)
 {
-    struct local_messanger_internal_message_s rv;
-    rv.type = LOCAL_MESSAGE_TYPE_USR;
-    assert(NULL != data);
+    struct local_messenger_message_header_s rv;
     assert(0 < message_size);
-    assert(ARRAY_MAX_COUNT(rv.data.user.message_data) >= message_size);
-    memcpy(rv.data.user.message_data, data, message_size);
-    rv.data.user.message_size = message_size;
+    rv.type = LOCAL_MESSAGE_TYPE_USR;
+    rv.action = LOCAL_MESSENGER_ACTION_NONE;
+    rv.key = 0;
+    rv.topic = 0;
+    rv.correlation_id = 0;
+    rv.journal_position = 0;
+    rv.message_size = message_size;
+#if LOCAL_MESSENGER_STATS
+    rv.enqueue_ns = time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC);
+#endif //LOCAL_MESSENGER_STATS
+    return rv;
+}
+
+
+/**
+ * @brief Function that builds the header for a user message with an ordering key
+ * @param key the ordering key
+ * @param message_size the size of the payload that will follow the header
+ * @return The header to send out
+ */
+struct local_messenger_message_header_s local_messenger_build_keyed_user_msg(uint32_t key, long message_size)
+{
+    struct local_messenger_message_header_s rv = local_messenger_build_user_msg(message_size);
+    rv.type = LOCAL_MESSAGE_TYPE_USR_KEYED;
+    rv.key = key;
+    return rv;
+}
+
+
+/**
+ * @brief Function that builds the header for a message published on a topic
+ * @param topic the topic
+ * @param message_size the size of the payload that will follow the header
+ * @return The header to send out
+ */
+struct local_messenger_message_header_s local_messenger_build_publish_msg(uint32_t topic, long message_size)
+{
+    struct local_messenger_message_header_s rv = local_messenger_build_user_msg(message_size);
+    rv.type = LOCAL_MESSAGE_TYPE_PUBLISH;
+    rv.topic = topic;
+    return rv;
+}
+
+
+/**
+ * @brief Function that builds the header for a message for the handler of a type id
+ * @param type_id the message type id
+ * @param message_size the size of the payload that will follow the header
+ * @return The header to send out
+ */
+struct local_messenger_message_header_s local_messenger_build_typed_msg(uint32_t type_id, long message_size)
+{
+    struct local_messenger_message_header_s rv = local_messenger_build_user_msg(message_size);
+    rv.type = LOCAL_MESSAGE_TYPE_TYPED;
+    rv.type_id = type_id;
+    return rv;
+}
+
+
+/**
+ * @brief Function that builds the marker of a conflated value
+ * @param key the key of the value
+ * @return The header to send out. Markers have no payload
+ */
+struct local_messenger_message_header_s local_messenger_build_conflated_msg(uint32_t key)
+{
+    struct local_messenger_message_header_s rv = local_messenger_build_action(LOCAL_MESSENGER_ACTION_NONE);
+    rv.type = LOCAL_MESSAGE_TYPE_CONFLATED;
+    rv.key = key;
+    return rv;
+}
+
+
+/**
+ * @brief Function that builds the header for the handle of a pooled buffer
+ * @return The header to send out. The payload is the buffer ptr
+ */
+struct local_messenger_message_header_s local_messenger_build_buffer_msg(void)
+{
+    struct local_messenger_message_header_s rv = local_messenger_build_user_msg(sizeof(void *));
+    rv.type = LOCAL_MESSAGE_TYPE_BUFFER;
+    return rv;
+}
+
+
+/**
+ * @brief Function that builds the header for a request
+ * @param correlation_id the id the reply is sent back with
+ * @param message_size the size of the payload that will follow the header, including the channel to reply to
+ * @return The header to send out
+ */
+struct local_messenger_message_header_s local_messenger_build_request_msg(uint64_t correlation_id, long message_size)
+{
+    struct local_messenger_message_header_s rv = local_messenger_build_user_msg(message_size);
+    rv.type = LOCAL_MESSAGE_TYPE_REQUEST;
+    rv.correlation_id = correlation_id;
+    return rv;
+}
+
+
+/**
+ * @brief Function that builds the header for a reply
+ * @param correlation_id the id of the request being answered
+ * @param message_size the size of the payload that will follow the header
+ * @return The header to send out
+ */
+struct local_messenger_message_header_s local_messenger_build_reply_msg(uint64_t correlation_id, long message_size)
+{
+    struct local_messenger_message_header_s rv = local_messenger_build_user_msg(message_size);
+    rv.type = LOCAL_MESSAGE_TYPE_REPLY;
+    rv.correlation_id = correlation_id;
     return rv;
 }
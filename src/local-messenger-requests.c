@@ -0,0 +1,354 @@
+/**
+ * @file local-messenger-requests.c
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Requests waiting on their replies and the futures that wait on them
+ */
+
+#include <local-messenger-requests.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/***********************************************************************************/
+/***************************** Defines and Macros **********************************/
+/***********************************************************************************/
+
+#define REQUEST_SLOT(id) ((uint32_t)((id) & 0xFFFFFFFFULL))
+#define REQUEST_ID(generation, slot) ((((uint64_t)(generation)) << 32) | (uint64_t)(slot))
+
+/***********************************************************************************/
+/***************************** Type Defs *******************************************/
+/***********************************************************************************/
+
+struct messenger_future_s
+{
+    pthread_mutex_t mutex; //!< Protects the rest of the future
+    pthread_cond_t cond; //!< Signaled when the request ends
+    bool done; //!< Set once the request has ended
+    enum messenger_reply_status_e status; //!< How the request ended
+    void *reply; //!< Copy of the reply. NULL unless status is MESSENGER_REPLY_OK
+    long reply_size; //!< Size of the reply
+}; //!< A request a thread can wait on
+
+/***********************************************************************************/
+/***************************** Function Declarations *******************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Static Variables ************************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Function Definitions ********************************/
+/***********************************************************************************/
+
+/**
+ * @brief set up an empty table. The slots are only allocated once a request is opened
+ * @param requests the table
+ * @param expired called when the timer of a request expires
+ * @param context passed to expired
+ */
+void local_messenger_requests_init(local_messenger_requests_s *requests, time_out_helper_timer_cb expired, void *context)
+{
+    assert(NULL != requests);
+    assert(NULL != expired);
+    assert(0 == pthread_mutex_init(&requests->mutex, NULL));
+    requests->entries = NULL;
+    requests->expired = expired;
+    requests->expired_context = context;
+    requests->free_head = 0;
+    requests->pending = 0;
+    atomic_init(&requests->dropped, 0);
+}
+
+/**
+ * @brief free a table. Every request must have been closed
+ * @param requests the table
+ */
+void local_messenger_requests_destroy(local_messenger_requests_s *requests)
+{
+    assert(NULL != requests);
+    assert(0 == requests->pending);
+    free(requests->entries);
+    requests->entries = NULL;
+    pthread_mutex_destroy(&requests->mutex);
+}
+
+/**
+ * @brief take a slot for a request. Called by any thread
+ * @param requests the table
+ * @param callback called with the reply
+ * @param context passed to the callback
+ * @param deadline_ns when the request times out on CLOCK_MONOTONIC. TIME_OUT_HELPER_NEVER for never
+ * @return the correlation id, 0 if every slot is taken
+ */
+uint64_t local_messenger_requests_open(local_messenger_requests_s *requests, messenger_on_reply callback, void *context, uint64_t deadline_ns)
+{
+    local_messenger_request_entry_s *entry;
+    uint32_t slot;
+    assert(NULL != requests);
+    assert(NULL != callback);
+    assert(0 == pthread_mutex_lock(&requests->mutex));
+    if(NULL == requests->entries)
+    {
+        //Channels that never make a request do not pay for the table
+        requests->entries = malloc(LOCAL_MESSENGER_MAX_PENDING_REQUESTS * sizeof(local_messenger_request_entry_s));
+        assert(NULL != requests->entries);
+        for(uint32_t i = 0; i < LOCAL_MESSENGER_MAX_PENDING_REQUESTS; i++)
+        {
+            requests->entries[i].id = REQUEST_ID(1, i);
+            requests->entries[i].callback = NULL;
+            requests->entries[i].next_free = i + 1;
+            requests->entries[i].dropped = 0;
+        }
+        requests->free_head = 0;
+    }
+    slot = requests->free_head;
+    if(LOCAL_MESSENGER_MAX_PENDING_REQUESTS <= slot)
+    {
+        pthread_mutex_unlock(&requests->mutex);
+        return 0;
+    }
+    entry = &requests->entries[slot];
+    requests->free_head = entry->next_free;
+    requests->pending++;
+    pthread_mutex_unlock(&requests->mutex);
+    entry->callback = callback;
+    entry->context = context;
+    entry->deadline_ns = deadline_ns;
+    time_out_helper_timer_init(&entry->timer, requests->expired, requests->expired_context);
+    return entry->id;
+}
+
+/**
+ * @brief find the request a correlation id belongs to. Only called by the dispatch thread
+ * @param requests the table
+ * @param id the correlation id
+ * @return the request, NULL if it was already closed
+ */
+local_messenger_request_entry_s *local_messenger_requests_find(local_messenger_requests_s *requests, uint64_t id)
+{
+    local_messenger_request_entry_s *entry;
+    assert(NULL != requests);
+    if(NULL == requests->entries || LOCAL_MESSENGER_MAX_PENDING_REQUESTS <= REQUEST_SLOT(id))
+    {
+        return NULL;
+    }
+    entry = &requests->entries[REQUEST_SLOT(id)];
+    //The id is checked first. The callback of a slot being reopened is only read once its new id is in
+    if(id != entry->id || NULL == entry->callback)
+    {
+        return NULL;
+    }
+    return entry;
+}
+
+/**
+ * @brief give the slot of a request back. Only called by the dispatch thread, or once it has stopped.
+ * The timer must not be pending
+ * @param requests the table
+ * @param entry the request
+ */
+void local_messenger_requests_close(local_messenger_requests_s *requests, local_messenger_request_entry_s *entry)
+{
+    uint32_t slot;
+    assert(NULL != requests);
+    assert(NULL != entry);
+    assert(false == time_out_helper_timer_pending(&entry->timer));
+    slot = REQUEST_SLOT(entry->id);
+    //A new generation so replies still on their way for the old request find nothing
+    entry->id = REQUEST_ID((entry->id >> 32) + 1, slot);
+    if(0 == (entry->id >> 32))
+    {
+        entry->id = REQUEST_ID(1, slot);
+    }
+    entry->callback = NULL;
+    assert(0 == pthread_mutex_lock(&requests->mutex));
+    entry->next_free = requests->free_head;
+    requests->free_head = slot;
+    requests->pending--;
+    pthread_mutex_unlock(&requests->mutex);
+}
+
+/**
+ * @brief note that the reply to a request could not be sent. Called by any thread
+ * @param requests the table
+ * @param id the correlation id
+ */
+void local_messenger_requests_drop(local_messenger_requests_s *requests, uint64_t id)
+{
+    local_messenger_request_entry_s *entry;
+    assert(NULL != requests);
+    assert(0 == pthread_mutex_lock(&requests->mutex));
+    if(NULL != requests->entries && LOCAL_MESSENGER_MAX_PENDING_REQUESTS > REQUEST_SLOT(id))
+    {
+        entry = &requests->entries[REQUEST_SLOT(id)];
+        if(0 == entry->dropped)
+        {
+            atomic_fetch_add(&requests->dropped, 1);
+        }
+        //Only one reply per request gets through so the newest id of the slot is the one that matters
+        entry->dropped = id;
+    }
+    pthread_mutex_unlock(&requests->mutex);
+}
+
+/**
+ * @brief take a correlation id noted by local_messenger_requests_drop. Only called by the dispatch thread
+ * @param requests the table
+ * @return the correlation id, 0 once there are none left. The request may have ended already
+ */
+uint64_t local_messenger_requests_take_dropped(local_messenger_requests_s *requests)
+{
+    uint64_t id = 0;
+    assert(NULL != requests);
+    if(0 == atomic_load(&requests->dropped))
+    {
+        return 0;
+    }
+    assert(0 == pthread_mutex_lock(&requests->mutex));
+    for(uint32_t slot = 0; slot < LOCAL_MESSENGER_MAX_PENDING_REQUESTS; slot++)
+    {
+        if(0 != requests->entries[slot].dropped)
+        {
+            id = requests->entries[slot].dropped;
+            requests->entries[slot].dropped = 0;
+            atomic_fetch_sub(&requests->dropped, 1);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&requests->mutex);
+    return id;
+}
+
+/**
+ * @brief end every open request with MESSENGER_REPLY_CANCELLED. Only called once the dispatch
+ * thread has stopped or parked and the timers of the requests are off the wheel
+ * @param requests the table
+ */
+void local_messenger_requests_cancel_all(local_messenger_requests_s *requests)
+{
+    local_messenger_request_entry_s *entry;
+    messenger_on_reply callback;
+    void *context;
+    assert(NULL != requests);
+    for(uint32_t slot = 0; NULL != requests->entries && slot < LOCAL_MESSENGER_MAX_PENDING_REQUESTS && 0 < requests->pending; slot++)
+    {
+        entry = &requests->entries[slot];
+        if(NULL != entry->callback)
+        {
+            callback = entry->callback;
+            context = entry->context;
+            local_messenger_requests_close(requests, entry);
+            callback(context, MESSENGER_REPLY_CANCELLED, NULL, 0);
+        }
+    }
+}
+
+/**
+ * @brief get the request of a timer
+ * @param timer the timer of a request
+ * @return the request
+ */
+local_messenger_request_entry_s *local_messenger_requests_from_timer(time_out_helper_timer_s *timer)
+{
+    return (local_messenger_request_entry_s *)(((char *)timer) - offsetof(local_messenger_request_entry_s, timer));
+}
+
+/**
+ * @brief get a future for a request. Pass local_messenger_future_complete and the future as the
+ * callback and context of the request
+ * @return the future
+ */
+messenger_future_t *local_messenger_future_create(void)
+{
+    messenger_future_t *future = malloc(sizeof(messenger_future_t));
+    assert(NULL != future);
+    assert(0 == pthread_mutex_init(&future->mutex, NULL));
+    assert(0 == pthread_cond_init(&future->cond, NULL));
+    future->done = false;
+    future->status = MESSENGER_REPLY_CANCELLED;
+    future->reply = NULL;
+    future->reply_size = 0;
+    return future;
+}
+
+/**
+ * @brief the reply callback of a future. Keeps a copy of the reply and wakes the waiter
+ * @param context the future
+ * @param status how the request ended
+ * @param reply the reply. NULL unless status is MESSENGER_REPLY_OK
+ * @param reply_size the size of the reply
+ */
+void local_messenger_future_complete(void *context, enum messenger_reply_status_e status, void *reply, long reply_size)
+{
+    messenger_future_t *future = context;
+    void *copy = NULL;
+    if(MESSENGER_REPLY_OK == status)
+    {
+        //The reply only lives until the callback returns
+        copy = malloc((size_t)reply_size);
+        assert(NULL != copy);
+        memcpy(copy, reply, (size_t)reply_size);
+    }
+    assert(0 == pthread_mutex_lock(&future->mutex));
+    future->status = status;
+    future->reply = copy;
+    future->reply_size = (NULL == copy) ? 0 : reply_size;
+    future->done = true;
+    pthread_cond_signal(&future->cond);
+    pthread_mutex_unlock(&future->mutex);
+}
+
+/**
+ * @brief tell if the request of a future has ended
+ * @param future the future
+ * @return true once messenger_future_wait will not block
+ */
+bool messenger_future_done(messenger_future_t *future)
+{
+    bool rv;
+    assert(NULL != future);
+    assert(0 == pthread_mutex_lock(&future->mutex));
+    rv = future->done;
+    pthread_mutex_unlock(&future->mutex);
+    return rv;
+}
+
+/**
+ * @brief wait for the request of a future to end and free the future
+ * @param future the future
+ * @param reply buffer the reply is copied into. May be NULL if reply_capacity is 0
+ * @param reply_capacity size of the buffer. A longer reply is cut short
+ * @param reply_size set to the full size of the reply. May be NULL
+ * @return how the request ended
+ */
+enum messenger_reply_status_e messenger_future_wait(messenger_future_t *future, void *reply, long reply_capacity, long *reply_size)
+{
+    enum messenger_reply_status_e rv;
+    assert(NULL != future);
+    assert(NULL != reply || 0 == reply_capacity);
+    assert(0 == pthread_mutex_lock(&future->mutex));
+    while(false == future->done)
+    {
+        pthread_cond_wait(&future->cond, &future->mutex);
+    }
+    pthread_mutex_unlock(&future->mutex);
+    rv = future->status;
+    if(0 < future->reply_size && 0 < reply_capacity)
+    {
+        memcpy(reply, future->reply, (size_t)((future->reply_size < reply_capacity) ? future->reply_size : reply_capacity));
+    }
+    if(NULL != reply_size)
+    {
+        reply_size[0] = future->reply_size;
+    }
+    free(future->reply);
+    pthread_mutex_destroy(&future->mutex);
+    pthread_cond_destroy(&future->cond);
+    free(future);
+    return rv;
+}
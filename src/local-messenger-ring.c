@@ -0,0 +1,649 @@
+/**
+ * @file local-messenger-ring.c
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Bounded lock free multi producer single consumer ring
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif //__linux__
+
+#include <local-messenger-ring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif //__linux__
+
+/***********************************************************************************/
+/***************************** Defines and Macros **********************************/
+/***********************************************************************************/
+
+#define RING_RECORD_ALIGNMENT 8
+#define RING_ALIGN(x) (((x) + (RING_RECORD_ALIGNMENT - 1)) & ~((uint64_t)RING_RECORD_ALIGNMENT - 1))
+#define RING_PADDING_SIZE UINT32_MAX
+#define RING_NS_PER_SEC 1000000000ULL
+#define RING_STATE_SIZE ((sizeof(local_messenger_ring_state_s) + LOCAL_MESSENGER_CACHE_LINE - 1) & ~((uint64_t)LOCAL_MESSENGER_CACHE_LINE - 1))
+
+#ifdef __linux__
+//Futexes in process shared memory have to use the shared flavor of the operations
+#define RING_FUTEX_OP(ring, op) ((true == (ring)->process_shared) ? (op) : (op ## _PRIVATE))
+#endif //__linux__
+
+/***********************************************************************************/
+/***************************** Type Defs *******************************************/
+/***********************************************************************************/
+
+struct ring_record_header_s
+{
+    _Atomic uint32_t length; //!< Aligned length of the record including the header. 0 until the record is committed
+    uint32_t size; //!< Size of the data in the record, RING_PADDING_SIZE for padding records
+}; //!< Header placed in front of every record in the ring
+
+/***********************************************************************************/
+/***************************** Function Declarations *******************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Static Variables ************************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Function Definitions ********************************/
+/***********************************************************************************/
+
+/**
+ * @brief get the header of the record at a ring position
+ * @param ring
+ * @param position
+ * @return ptr to the header
+ */
+static inline struct ring_record_header_s *ring_header_at(local_messenger_ring_s *ring, uint64_t position)
+{
+    return (struct ring_record_header_s *)&ring->buffer[position & ring->mask];
+}
+
+/**
+ * @brief zero a consumed record so the slot reads as uncommitted on the next lap
+ * @param header the record header
+ * @param length the record length
+ */
+static inline void ring_clear_record(struct ring_record_header_s *header, uint32_t length)
+{
+    memset(&header[1], 0, length - sizeof(struct ring_record_header_s));
+    header->size = 0;
+    atomic_store_explicit(&header->length, 0, memory_order_relaxed);
+}
+
+/**
+ * @brief check if the consumer has a committed record waiting
+ * @param ring
+ * @return true if there is nothing to read
+ */
+static inline bool ring_is_empty(local_messenger_ring_s *ring)
+{
+    return 0 == atomic_load_explicit(&ring_header_at(ring, ring->read)->length, memory_order_acquire);
+}
+
+#ifdef __linux__
+/**
+ * @brief sleep until the wake sequence moves off of expected or the timeout passes
+ * @param ring
+ * @param expected
+ * @param timeout_ns the longest to sleep. LOCAL_MESSENGER_RING_WAIT_FOREVER to not time out
+ */
+static void ring_park(local_messenger_ring_s *ring, uint32_t expected, uint64_t timeout_ns)
+{
+    struct timespec timeout;
+    if(LOCAL_MESSENGER_RING_WAIT_FOREVER == timeout_ns)
+    {
+        syscall(SYS_futex, &ring->state->wake_seq, RING_FUTEX_OP(ring, FUTEX_WAIT), expected, NULL, NULL, 0);
+        return;
+    }
+    //The futex timeout is relative and measured on CLOCK_MONOTONIC
+    timeout.tv_sec = (time_t)(timeout_ns / RING_NS_PER_SEC);
+    timeout.tv_nsec = (long)(timeout_ns % RING_NS_PER_SEC);
+    syscall(SYS_futex, &ring->state->wake_seq, RING_FUTEX_OP(ring, FUTEX_WAIT), expected, &timeout, NULL, 0);
+}
+
+/**
+ * @brief wake the consumer
+ * @param ring
+ */
+static void ring_unpark(local_messenger_ring_s *ring)
+{
+    uint64_t one = 1;
+    if(0 <= ring->wake_fd)
+    {
+        //Only the first commit after the consumer armed pays for the write
+        if(0 != atomic_exchange(&ring->state->sleeping, 0))
+        {
+            assert((ssize_t)sizeof(one) == write(ring->wake_fd, &one, sizeof(one)));
+        }
+        return;
+    }
+    atomic_fetch_add(&ring->state->wake_seq, 1);
+    syscall(SYS_futex, &ring->state->wake_seq, RING_FUTEX_OP(ring, FUTEX_WAKE), 1, NULL, NULL, 0);
+}
+#else
+/**
+ * @brief sleep until the wake sequence moves off of expected or the timeout passes
+ * @param ring
+ * @param expected
+ * @param timeout_ns the longest to sleep. LOCAL_MESSENGER_RING_WAIT_FOREVER to not time out
+ */
+static void ring_park(local_messenger_ring_s *ring, uint32_t expected, uint64_t timeout_ns)
+{
+    struct timespec deadline;
+    int result = 0;
+    if(LOCAL_MESSENGER_RING_WAIT_FOREVER != timeout_ns)
+    {
+        //The condition is on CLOCK_REALTIME
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        timeout_ns += (uint64_t)deadline.tv_nsec;
+        deadline.tv_sec += (time_t)(timeout_ns / RING_NS_PER_SEC);
+        deadline.tv_nsec = (long)(timeout_ns % RING_NS_PER_SEC);
+    }
+    pthread_mutex_lock(&ring->wake_mutex);
+    while(expected == atomic_load(&ring->state->wake_seq) && 0 == result)
+    {
+        if(LOCAL_MESSENGER_RING_WAIT_FOREVER == timeout_ns)
+        {
+            pthread_cond_wait(&ring->wake_cond, &ring->wake_mutex);
+        }
+        else
+        {
+            result = pthread_cond_timedwait(&ring->wake_cond, &ring->wake_mutex, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&ring->wake_mutex);
+}
+
+/**
+ * @brief wake the consumer
+ * @param ring
+ */
+static void ring_unpark(local_messenger_ring_s *ring)
+{
+    pthread_mutex_lock(&ring->wake_mutex);
+    atomic_fetch_add(&ring->state->wake_seq, 1);
+    pthread_cond_signal(&ring->wake_cond);
+    pthread_mutex_unlock(&ring->wake_mutex);
+}
+#endif //__linux__
+
+/**
+ * @brief set up the parts of a ring that are local to the process
+ * @param ring
+ * @param capacity
+ */
+static void ring_init_local(local_messenger_ring_s *ring, uint64_t capacity)
+{
+    assert(0 == (capacity & (capacity - 1)));
+    assert(capacity >= 2 * RING_RECORD_ALIGNMENT);
+    ring->capacity = capacity;
+    ring->mask = capacity - 1;
+    ring->read = 0;
+    ring->wake = ring;
+    ring->wake_fd = -1;
+#ifndef __linux__
+    pthread_mutex_init(&ring->wake_mutex, NULL);
+    pthread_cond_init(&ring->wake_cond, NULL);
+#endif //__linux__
+}
+
+/**
+ * @brief reset the shared state of a ring
+ * @param state
+ */
+static void ring_init_state(local_messenger_ring_state_s *state)
+{
+    atomic_init(&state->tail, 0);
+    atomic_init(&state->head, 0);
+    atomic_init(&state->wake_seq, 0);
+    atomic_init(&state->sleeping, 0);
+}
+
+/**
+ * @brief initialize a ring
+ * @param ring the ring to initialize
+ * @param capacity the size of the ring buffer in bytes. Must be a power of two
+ */
+void local_messenger_ring_init(local_messenger_ring_s *ring, uint64_t capacity)
+{
+    assert(NULL != ring);
+    ring_init_local(ring, capacity);
+    ring->buffer = calloc(1, capacity);
+    assert(NULL != ring->buffer);
+    ring->process_shared = false;
+    ring->state = &ring->own_state;
+    ring_init_state(ring->state);
+}
+
+/**
+ * @brief get the bytes of shared memory a process shared ring takes up
+ * @param capacity the size of the ring buffer in bytes
+ * @return the size of the shared state and the buffer
+ */
+uint64_t local_messenger_ring_shared_size(uint64_t capacity)
+{
+    return RING_STATE_SIZE + capacity;
+}
+
+/**
+ * @brief initialize a ring kept in memory mapped by several processes.
+ * Only one process may consume from it. Any process that maps it may produce
+ * @param ring the process local handle of the ring
+ * @param capacity the size of the ring buffer in bytes. Must be a power of two
+ * @param memory local_messenger_ring_shared_size(capacity) bytes of cache line aligned shared memory
+ * @param create true to set up a new ring in the memory, false to use the ring another process set up
+ */
+void local_messenger_ring_init_shared(local_messenger_ring_s *ring, uint64_t capacity, void *memory, bool create)
+{
+    assert(NULL != ring);
+    assert(NULL != memory);
+    assert(0 == ((uintptr_t)memory & (LOCAL_MESSENGER_CACHE_LINE - 1)));
+#ifndef __linux__
+    assert(false); //Waking a consumer in another process needs futexes
+#endif //__linux__
+    ring_init_local(ring, capacity);
+    ring->process_shared = true;
+    ring->state = memory;
+    ring->buffer = ((uint8_t *)memory) + RING_STATE_SIZE;
+    if(true == create)
+    {
+        memset(memory, 0, local_messenger_ring_shared_size(capacity));
+        ring_init_state(ring->state);
+    }
+}
+
+/**
+ * @brief release the resources held by a ring
+ * @param ring
+ */
+void local_messenger_ring_destroy(local_messenger_ring_s *ring)
+{
+    assert(NULL != ring);
+    if(false == ring->process_shared)
+    {
+        free(ring->buffer);
+    }
+    ring->buffer = NULL;
+#ifndef __linux__
+    pthread_mutex_destroy(&ring->wake_mutex);
+    pthread_cond_destroy(&ring->wake_cond);
+#endif //__linux__
+}
+
+/**
+ * @brief get the largest record the ring can carry
+ * @param ring
+ * @return the max size in bytes
+ */
+uint64_t local_messenger_ring_max_record(const local_messenger_ring_s *ring)
+{
+    //A record that does not fit before the end of the buffer costs the rest of the lap as padding.
+    //Keeping records under half the ring means an empty ring can always take one.
+    return (ring->capacity / 2) - sizeof(struct ring_record_header_s);
+}
+
+/**
+ * @brief get the number of bytes in use, committed or not. Safe to call from any thread
+ * @param ring
+ * @return the bytes in use
+ */
+uint64_t local_messenger_ring_used(local_messenger_ring_s *ring)
+{
+    uint64_t head = atomic_load_explicit(&ring->state->head, memory_order_relaxed);
+    return atomic_load_explicit(&ring->state->tail, memory_order_relaxed) - head;
+}
+
+/**
+ * @brief get the number of ring bytes a record takes up
+ * @param size the record size in bytes
+ * @return the size of the record with its header and alignment
+ */
+uint64_t local_messenger_ring_footprint(uint64_t size)
+{
+    return RING_ALIGN(sizeof(struct ring_record_header_s) + size);
+}
+
+/**
+ * @brief reserve space for a run of records so they can be written in place. Safe to call from any thread.
+ * The records are placed back to back and cost a single reservation.
+ * The consumer stops at the first record until it is committed, so commit them promptly
+ * @param ring
+ * @param sizes the size in bytes of each record
+ * @param count the number of records
+ * @return ptr to where the first record's data goes, NULL if the ring does not have room for the records.
+ * Use local_messenger_ring_next_reserved to step to the following records
+ */
+void *local_messenger_ring_reserve_many(local_messenger_ring_s *ring, const uint64_t *sizes, unsigned int count)
+{
+    struct ring_record_header_s *record;
+    uint64_t span_length = 0;
+    uint64_t reserve_length;
+    uint64_t tail;
+    uint64_t head;
+    uint64_t to_end;
+    assert(NULL != ring);
+    assert(NULL != sizes);
+    assert(0 < count);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        span_length += local_messenger_ring_footprint(sizes[i]);
+    }
+    assert(span_length <= local_messenger_ring_footprint(local_messenger_ring_max_record(ring)));
+    tail = atomic_load_explicit(&ring->state->tail, memory_order_relaxed);
+    do
+    {
+        head = atomic_load_explicit(&ring->state->head, memory_order_acquire);
+        to_end = ring->capacity - (tail & ring->mask);
+        reserve_length = span_length;
+        if(span_length > to_end)
+        {
+            //Pad out the end of the buffer and start the records at the front
+            reserve_length += to_end;
+        }
+        if(reserve_length > ring->capacity - (tail - head))
+        {
+            return NULL;
+        }
+    } while(false == atomic_compare_exchange_weak_explicit(&ring->state->tail, &tail, tail + reserve_length, memory_order_relaxed, memory_order_relaxed));
+    if(reserve_length != span_length)
+    {
+        record = ring_header_at(ring, tail);
+        record->size = RING_PADDING_SIZE;
+        atomic_store_explicit(&record->length, (uint32_t)to_end, memory_order_release);
+        tail += to_end;
+    }
+    for(unsigned int i = 0; i < count; i++)
+    {
+        record = ring_header_at(ring, tail);
+        record->size = (uint32_t)sizes[i];
+        tail += RING_ALIGN(sizeof(struct ring_record_header_s) + sizes[i]);
+    }
+    return &ring_header_at(ring, tail - span_length)[1];
+}
+
+/**
+ * @brief reserve space for a record so it can be written in place. Safe to call from any thread.
+ * The consumer stops at the record until it is committed, so commit it promptly
+ * @param ring
+ * @param size the record size in bytes
+ * @return ptr to where the record data goes, NULL if the ring does not have room for the record
+ */
+void *local_messenger_ring_reserve(local_messenger_ring_s *ring, uint64_t size)
+{
+    assert(size <= local_messenger_ring_max_record(ring));
+    return local_messenger_ring_reserve_many(ring, &size, 1);
+}
+
+/**
+ * @brief step to the next record of a run reserved with local_messenger_ring_reserve_many
+ * @param record a record in the run
+ * @return ptr to where the next record's data goes
+ */
+void *local_messenger_ring_next_reserved(void *record)
+{
+    struct ring_record_header_s *header;
+    assert(NULL != record);
+    header = ((struct ring_record_header_s *)record) - 1;
+    return ((uint8_t *)record) + RING_ALIGN(sizeof(struct ring_record_header_s) + header->size);
+}
+
+/**
+ * @brief publish a run of records reserved with local_messenger_ring_reserve_many to the consumer
+ * @param ring
+ * @param record the ptr returned by local_messenger_ring_reserve_many
+ * @param count the number of records in the run
+ */
+void local_messenger_ring_commit_many(local_messenger_ring_s *ring, void *record, unsigned int count)
+{
+    struct ring_record_header_s *header;
+    assert(NULL != ring);
+    assert(NULL != record);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        header = ((struct ring_record_header_s *)record) - 1;
+        record = local_messenger_ring_next_reserved(record);
+        atomic_store_explicit(&header->length, (uint32_t)RING_ALIGN(sizeof(struct ring_record_header_s) + header->size), memory_order_release);
+    }
+    //Pairs with the fence in local_messenger_ring_wait_any so either we see the consumer parked or it sees our records
+    atomic_thread_fence(memory_order_seq_cst);
+    if(0 != atomic_load_explicit(&ring->wake->state->sleeping, memory_order_relaxed))
+    {
+        ring_unpark(ring->wake);
+    }
+}
+
+/**
+ * @brief publish a record reserved with local_messenger_ring_reserve to the consumer
+ * @param ring
+ * @param record the ptr returned by local_messenger_ring_reserve
+ */
+void local_messenger_ring_commit(local_messenger_ring_s *ring, void *record)
+{
+    local_messenger_ring_commit_many(ring, record, 1);
+}
+
+/**
+ * @brief write a record into the ring. Safe to call from any thread.
+ * The record is gathered from a header and a body so callers do not have to assemble it first
+ * @param ring
+ * @param header the leading bytes of the record
+ * @param header_size the size of header in bytes
+ * @param body the rest of the record. May be NULL if body_size is 0
+ * @param body_size the size of body in bytes
+ * @return false if the ring does not have room for the record
+ */
+bool local_messenger_ring_write(local_messenger_ring_s *ring, const void *header, uint64_t header_size, const void *body, uint64_t body_size)
+{
+    uint8_t *record;
+    assert(NULL != header);
+    assert(NULL != body || 0 == body_size);
+    record = local_messenger_ring_reserve(ring, header_size + body_size);
+    if(NULL == record)
+    {
+        return false;
+    }
+    memcpy(record, header, header_size);
+    if(0 != body_size)
+    {
+        memcpy(&record[header_size], body, body_size);
+    }
+    local_messenger_ring_commit(ring, record);
+    return true;
+}
+
+/**
+ * @brief take the next record in the ring without copying it. Only call from the consumer.
+ * Calling it again moves on to the following record
+ * @param ring
+ * @param size set to the size of the record
+ * @return ptr to the record in the ring, NULL if the ring is empty.
+ * The records taken stay valid until local_messenger_ring_release is called
+ */
+void *local_messenger_ring_peek(local_messenger_ring_s *ring, uint64_t *size)
+{
+    struct ring_record_header_s *record;
+    uint32_t length;
+    assert(NULL != ring);
+    assert(NULL != size);
+    while(true)
+    {
+        if(ring->read - atomic_load_explicit(&ring->state->head, memory_order_relaxed) == ring->capacity)
+        {
+            //Every byte of the ring is taken. Going further would lap back onto the first record
+            return NULL;
+        }
+        record = ring_header_at(ring, ring->read);
+        length = atomic_load_explicit(&record->length, memory_order_acquire);
+        if(0 == length)
+        {
+            return NULL;
+        }
+        ring->read += length;
+        if(RING_PADDING_SIZE != record->size)
+        {
+            break;
+        }
+    }
+    size[0] = record->size;
+    return &record[1];
+}
+
+/**
+ * @brief hand the space of every record taken with local_messenger_ring_peek back to the producers
+ * @param ring
+ */
+void local_messenger_ring_release(local_messenger_ring_s *ring)
+{
+    struct ring_record_header_s *record;
+    uint32_t length;
+    uint64_t head;
+    assert(NULL != ring);
+    head = atomic_load_explicit(&ring->state->head, memory_order_relaxed);
+    while(head != ring->read)
+    {
+        record = ring_header_at(ring, head);
+        length = atomic_load_explicit(&record->length, memory_order_relaxed);
+        assert(0 != length);
+        ring_clear_record(record, length);
+        head += length;
+    }
+    atomic_store_explicit(&ring->state->head, head, memory_order_release);
+}
+
+/**
+ * @brief check if none of several rings has a committed record waiting
+ * @param rings
+ * @param count
+ * @return true if there is nothing to read
+ */
+static inline bool ring_all_empty(local_messenger_ring_s *rings, unsigned int count)
+{
+    for(unsigned int i = 0; i < count; i++)
+    {
+        if(false == ring_is_empty(&rings[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief park the consumer until the ring has a record in it
+ * @param ring
+ */
+void local_messenger_ring_wait(local_messenger_ring_s *ring)
+{
+    local_messenger_ring_wait_any_timeout(ring, 1, LOCAL_MESSENGER_RING_WAIT_FOREVER);
+}
+
+/**
+ * @brief have commits to a ring wake the consumer parked on another ring.
+ * Used when one consumer reads several rings with local_messenger_ring_wait_any
+ * @param ring the ring
+ * @param wake the ring the consumer parks on
+ */
+void local_messenger_ring_share_wake(local_messenger_ring_s *ring, local_messenger_ring_s *wake)
+{
+    assert(NULL != ring);
+    assert(NULL != wake);
+    assert(wake == wake->wake);
+    ring->wake = wake;
+}
+
+/**
+ * @brief park the consumer until any of several rings has a record in it.
+ * rings[1] and up must share the wake of rings[0]
+ * @param rings the rings
+ * @param count the number of rings
+ */
+void local_messenger_ring_wait_any(local_messenger_ring_s *rings, unsigned int count)
+{
+    local_messenger_ring_wait_any_timeout(rings, count, LOCAL_MESSENGER_RING_WAIT_FOREVER);
+}
+
+/**
+ * @brief park the consumer until any of several rings has a record in it or the timeout passes.
+ * May return early, so check the rings after it returns. rings[1] and up must share the wake of rings[0]
+ * @param rings the rings
+ * @param count the number of rings
+ * @param timeout_ns the longest to wait. LOCAL_MESSENGER_RING_WAIT_FOREVER to not time out
+ */
+void local_messenger_ring_wait_any_timeout(local_messenger_ring_s *rings, unsigned int count, uint64_t timeout_ns)
+{
+    local_messenger_ring_s *wake;
+    uint32_t seq;
+    assert(NULL != rings);
+    assert(0 < count);
+    wake = &rings[0];
+    assert(wake == wake->wake);
+    while(true == ring_all_empty(rings, count))
+    {
+        seq = atomic_load(&wake->state->wake_seq);
+        atomic_store(&wake->state->sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if(false == ring_all_empty(rings, count))
+        {
+            atomic_store(&wake->state->sleeping, 0);
+            return;
+        }
+        ring_park(wake, seq, timeout_ns);
+        atomic_store(&wake->state->sleeping, 0);
+        if(LOCAL_MESSENGER_RING_WAIT_FOREVER != timeout_ns)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief have the consumer of a ring be woken by a write to a file descriptor instead of the futex
+ * @param ring the ring the consumer would park on
+ * @param fd the file descriptor. -1 to go back to the futex
+ */
+void local_messenger_ring_set_wake_fd(local_messenger_ring_s *ring, int fd)
+{
+    assert(NULL != ring);
+    assert(ring == ring->wake);
+#ifndef __linux__
+    assert(false); //Producers only write the descriptor in the futex build
+#endif //__linux__
+    ring->wake_fd = fd;
+}
+
+/**
+ * @brief ask for the next commit to any of several rings to write the wake file descriptor.
+ * rings[1] and up must share the wake of rings[0]
+ * @param rings the rings
+ * @param count the number of rings
+ * @return false if a record is already waiting, so the consumer should carry on instead of waiting on the descriptor
+ */
+bool local_messenger_ring_arm_any(local_messenger_ring_s *rings, unsigned int count)
+{
+    local_messenger_ring_s *wake;
+    assert(NULL != rings);
+    assert(0 < count);
+    wake = &rings[0];
+    assert(wake == wake->wake);
+    assert(0 <= wake->wake_fd);
+    atomic_store(&wake->state->sleeping, 1);
+    //Pairs with the fence in local_messenger_ring_commit_many like the one in local_messenger_ring_wait_any_timeout
+    atomic_thread_fence(memory_order_seq_cst);
+    if(false == ring_all_empty(rings, count))
+    {
+        atomic_store(&wake->state->sleeping, 0);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,247 @@
+/**
+ * @file local-messenger-shm.c
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Named shared memory holding the rings of a cross process channel
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif //__linux__
+
+#include <local-messenger-shm.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif //__linux__
+
+/***********************************************************************************/
+/***************************** Defines and Macros **********************************/
+/***********************************************************************************/
+
+#ifdef DEBUG_MESSENGER
+#define PRINT_MSG(...) printf(__VA_ARGS__)
+#else
+#define PRINT_MSG(...)
+#endif //DEBUG_MESSENGER
+
+#define SHM_MAGIC 0x4c4d5348 //!< "LMSH"
+#define SHM_NAME_PREFIX "/local-messenger-"
+#define SHM_ALIGN(x) (((x) + LOCAL_MESSENGER_CACHE_LINE - 1) & ~((uint64_t)LOCAL_MESSENGER_CACHE_LINE - 1))
+#define SHM_HEADER_SIZE SHM_ALIGN(sizeof(local_messenger_shm_header_s))
+
+/***********************************************************************************/
+/***************************** Type Defs *******************************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Function Declarations *******************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Static Variables ************************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Function Definitions ********************************/
+/***********************************************************************************/
+
+/**
+ * @brief get the bytes one ring takes up in the mapping
+ * @param ring_size the size of the ring buffer
+ * @return the size, rounded up so the next ring starts on a cache line
+ */
+static inline uint64_t shm_ring_stride(uint64_t ring_size)
+{
+    return SHM_ALIGN(local_messenger_ring_shared_size(ring_size));
+}
+
+/**
+ * @brief build the shared memory object name of a channel
+ * @param shm
+ * @param name the channel name
+ */
+static void shm_set_name(local_messenger_shm_s *shm, const char *name)
+{
+    assert(NULL != name);
+    assert(0 != name[0]);
+    assert(NULL == strchr(name, '/'));
+    assert(sizeof(shm->name) > (size_t)snprintf(shm->name, sizeof(shm->name), SHM_NAME_PREFIX "%s", name));
+}
+
+/**
+ * @brief point the process local ring handles at the rings in the mapping
+ * @param shm
+ * @param rings
+ * @param create true to set the rings up
+ */
+static void shm_init_rings(local_messenger_shm_s *shm, local_messenger_ring_s *rings, bool create)
+{
+    uint8_t *base = ((uint8_t *)shm->header) + SHM_HEADER_SIZE;
+    uint64_t stride = shm_ring_stride(shm->header->ring_size);
+    for(unsigned int lane = 0; lane < shm->header->lanes; lane++)
+    {
+        local_messenger_ring_init_shared(&rings[lane], shm->header->ring_size, &base[lane * stride], create);
+        local_messenger_ring_share_wake(&rings[lane], &rings[0]);
+    }
+}
+
+/**
+ * @brief create the shared memory of a channel and set up its rings.
+ * A stale object left behind by a process that did not close its channel is replaced
+ * @param shm the mapping to create
+ * @param name the channel name
+ * @param rings the process local ring handles to set up. One per lane
+ * @param lanes the number of rings
+ * @param ring_size the size of each ring buffer in bytes. Must be a power of two
+ */
+void local_messenger_shm_create(local_messenger_shm_s *shm, const char *name, local_messenger_ring_s *rings, unsigned int lanes, uint64_t ring_size)
+{
+    int fd;
+    void *memory;
+    assert(NULL != shm);
+    assert(NULL != rings);
+    assert(0 < lanes);
+    shm_set_name(shm, name);
+    fd = shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(0 > fd && EEXIST == errno)
+    {
+        PRINT_MSG("%s replacing stale %s\r\n", __FUNCTION__, shm->name);
+        shm_unlink(shm->name);
+        fd = shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    assert(0 <= fd);
+    shm->size = SHM_HEADER_SIZE + (lanes * shm_ring_stride(ring_size));
+    assert(0 == ftruncate(fd, (off_t)shm->size));
+    memory = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    assert(MAP_FAILED != memory);
+    shm->header = memory;
+    shm->owner = true;
+    shm->header->magic = SHM_MAGIC;
+    shm->header->lanes = lanes;
+    shm->header->ring_size = ring_size;
+    atomic_init(&shm->header->space_seq, 0);
+    atomic_init(&shm->header->space_waiters, 0);
+    shm_init_rings(shm, rings, true);
+    //Producers in other processes may only touch the rings once this is seen
+    atomic_store_explicit(&shm->header->ready, 1, memory_order_release);
+}
+
+/**
+ * @brief map the shared memory of a channel created by another process
+ * @param shm the mapping
+ * @param name the channel name
+ * @param rings the process local ring handles to set up. One per lane
+ * @param lanes the number of rings. Must match the creator
+ * @return false if there is no ready channel with that name
+ */
+bool local_messenger_shm_attach(local_messenger_shm_s *shm, const char *name, local_messenger_ring_s *rings, unsigned int lanes)
+{
+    struct stat info;
+    int fd;
+    void *memory;
+    assert(NULL != shm);
+    assert(NULL != rings);
+    shm_set_name(shm, name);
+    fd = shm_open(shm->name, O_RDWR, 0);
+    if(0 > fd)
+    {
+        assert(ENOENT == errno);
+        return false;
+    }
+    assert(0 == fstat(fd, &info));
+    if((size_t)info.st_size < SHM_HEADER_SIZE)
+    {
+        //The creator has not sized the object yet
+        close(fd);
+        return false;
+    }
+    shm->size = (size_t)info.st_size;
+    memory = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    assert(MAP_FAILED != memory);
+    shm->header = memory;
+    shm->owner = false;
+    if(0 == atomic_load_explicit(&shm->header->ready, memory_order_acquire))
+    {
+        local_messenger_shm_close(shm);
+        return false;
+    }
+    assert(SHM_MAGIC == shm->header->magic);
+    assert(lanes == shm->header->lanes); //Both sides must be built with the same LOCAL_MESSENGER_PRIORITY_LEVELS
+    assert(shm->size >= SHM_HEADER_SIZE + (lanes * shm_ring_stride(shm->header->ring_size)));
+    shm_init_rings(shm, rings, false);
+    return true;
+}
+
+/**
+ * @brief unmap the shared memory. The creator also removes the name so no new process can attach
+ * @param shm the mapping
+ */
+void local_messenger_shm_close(local_messenger_shm_s *shm)
+{
+    assert(NULL != shm);
+    if(true == shm->owner)
+    {
+        shm_unlink(shm->name);
+    }
+    munmap(shm->header, shm->size);
+    shm->header = NULL;
+    shm->size = 0;
+}
+
+/**
+ * @brief get the current room sequence. Read it after counting yourself in space_waiters
+ * and before retrying the send, then pass it to local_messenger_shm_space_wait
+ * @param shm the mapping
+ * @return the sequence
+ */
+uint32_t local_messenger_shm_space_seq(local_messenger_shm_s *shm)
+{
+    return atomic_load(&shm->header->space_seq);
+}
+
+/**
+ * @brief sleep until the consumer frees up room or the deadline passes
+ * @param shm the mapping
+ * @param seq the sequence from local_messenger_shm_space_seq
+ * @param deadline the absolute deadline on CLOCK_MONOTONIC
+ * @return false if the deadline passed
+ */
+bool local_messenger_shm_space_wait(local_messenger_shm_s *shm, uint32_t seq, const struct timespec *deadline)
+{
+#ifdef __linux__
+    //FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline
+    if(0 > syscall(SYS_futex, &shm->header->space_seq, FUTEX_WAIT_BITSET, seq, deadline, NULL, FUTEX_BITSET_MATCH_ANY))
+    {
+        assert(ETIMEDOUT == errno || EAGAIN == errno || EINTR == errno);
+        return (ETIMEDOUT != errno);
+    }
+    return true;
+#else
+    assert(false);
+    return false;
+#endif //__linux__
+}
+
+/**
+ * @brief wake every producer waiting for room
+ * @param shm the mapping
+ */
+void local_messenger_shm_space_wake(local_messenger_shm_s *shm)
+{
+    atomic_fetch_add(&shm->header->space_seq, 1);
+#ifdef __linux__
+    syscall(SYS_futex, &shm->header->space_seq, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+#endif //__linux__
+}
@@ -0,0 +1,209 @@
+/**
+ * @file local-messenger-stats.c
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Statistics kept by a channel while it runs
+ */
+
+#include <local-messenger-stats.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+/***********************************************************************************/
+/***************************** Defines and Macros **********************************/
+/***********************************************************************************/
+
+#define STATS_SUB_BUCKETS (1U << MESSENGER_HISTOGRAM_SUB_BUCKET_BITS)
+
+/***********************************************************************************/
+/***************************** Type Defs *******************************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Function Declarations *******************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Static Variables ************************************/
+/***********************************************************************************/
+
+static _Atomic unsigned int stats_next_shard = 0; //!< Hands shards out to threads round robin
+_Thread_local unsigned int local_messenger_stats_thread_shard = 0;
+
+/***********************************************************************************/
+/***************************** Function Definitions ********************************/
+/***********************************************************************************/
+
+/**
+ * @brief give the calling thread a shard
+ * @return the shard index plus one
+ */
+unsigned int local_messenger_stats_assign_shard(void)
+{
+    local_messenger_stats_thread_shard = (atomic_fetch_add_explicit(&stats_next_shard, 1, memory_order_relaxed) % LOCAL_MESSENGER_STATS_SHARDS) + 1;
+    return local_messenger_stats_thread_shard;
+}
+
+/**
+ * @brief get the bucket a value falls in. Values below 2^3 get a bucket each, after that
+ * each power of two is split into 2^3 equal buckets
+ * @param value_ns the value
+ * @return the bucket index
+ */
+static unsigned int stats_bucket(uint64_t value_ns)
+{
+    unsigned int exponent;
+    unsigned int bucket;
+    if(STATS_SUB_BUCKETS > value_ns)
+    {
+        return (unsigned int)value_ns;
+    }
+    exponent = 63 - (unsigned int)__builtin_clzll(value_ns);
+    bucket = ((exponent - MESSENGER_HISTOGRAM_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKETS) +
+            (unsigned int)((value_ns >> (exponent - MESSENGER_HISTOGRAM_SUB_BUCKET_BITS)) & (STATS_SUB_BUCKETS - 1));
+    if(MESSENGER_HISTOGRAM_BUCKETS <= bucket)
+    {
+        bucket = MESSENGER_HISTOGRAM_BUCKETS - 1;
+    }
+    return bucket;
+}
+
+/**
+ * @brief get the largest value that falls in a bucket
+ * @param bucket the bucket index
+ * @return the value
+ */
+static uint64_t stats_bucket_top(unsigned int bucket)
+{
+    unsigned int shift;
+    uint64_t low;
+    assert(MESSENGER_HISTOGRAM_BUCKETS > bucket);
+    if(STATS_SUB_BUCKETS > bucket)
+    {
+        return bucket;
+    }
+    if(MESSENGER_HISTOGRAM_BUCKETS - 1 == bucket)
+    {
+        return UINT64_MAX;
+    }
+    shift = (bucket / STATS_SUB_BUCKETS) - 1;
+    low = ((uint64_t)(STATS_SUB_BUCKETS + (bucket % STATS_SUB_BUCKETS))) << shift;
+    return low + (1ULL << shift) - 1;
+}
+
+/**
+ * @brief add a sample to a histogram
+ * @param histogram the histogram
+ * @param value_ns the sample in nanoseconds
+ * @param shared true if other threads may add samples at the same time. A single writer skips the locked instructions
+ */
+void local_messenger_stats_record(local_messenger_stats_histogram_s *histogram, uint64_t value_ns, bool shared)
+{
+    _Atomic uint64_t *bucket = &histogram->buckets[stats_bucket(value_ns)];
+    uint64_t max = atomic_load_explicit(&histogram->max_ns, memory_order_relaxed);
+    if(false == shared)
+    {
+        atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+        atomic_store_explicit(&histogram->sum_ns, atomic_load_explicit(&histogram->sum_ns, memory_order_relaxed) + value_ns, memory_order_relaxed);
+        atomic_store_explicit(&histogram->count, atomic_load_explicit(&histogram->count, memory_order_relaxed) + 1, memory_order_relaxed);
+        if(value_ns > max)
+        {
+            atomic_store_explicit(&histogram->max_ns, value_ns, memory_order_relaxed);
+        }
+        return;
+    }
+    atomic_fetch_add_explicit(bucket, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum_ns, value_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    while(value_ns > max && false == atomic_compare_exchange_weak_explicit(&histogram->max_ns, &max, value_ns, memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+/**
+ * @brief copy a histogram into a snapshot
+ * @param histogram the histogram
+ * @param snapshot the copy
+ */
+static void stats_histogram_snapshot(local_messenger_stats_histogram_s *histogram, messenger_histogram_s *snapshot)
+{
+    snapshot->count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    snapshot->sum_ns = atomic_load_explicit(&histogram->sum_ns, memory_order_relaxed);
+    snapshot->max_ns = atomic_load_explicit(&histogram->max_ns, memory_order_relaxed);
+    for(unsigned int i = 0; i < MESSENGER_HISTOGRAM_BUCKETS; i++)
+    {
+        snapshot->buckets[i] = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief add the shards of the statistics up into a snapshot. queue_bytes is left for the caller
+ * @param stats the channel statistics
+ * @param snapshot filled with the totals
+ */
+void local_messenger_stats_snapshot(local_messenger_stats_s *stats, messenger_stats_s *snapshot)
+{
+    uint64_t totals[LOCAL_MESSENGER_STATS_COUNTERS] = {0};
+    assert(NULL != stats);
+    assert(NULL != snapshot);
+    memset(snapshot, 0, sizeof(*snapshot));
+    for(unsigned int shard = 0; shard < LOCAL_MESSENGER_STATS_SHARDS; shard++)
+    {
+        for(unsigned int counter = 0; counter < LOCAL_MESSENGER_STATS_COUNTERS; counter++)
+        {
+            totals[counter] += atomic_load_explicit(&stats->shards[shard].counters[counter], memory_order_relaxed);
+        }
+    }
+    snapshot->messages_sent = totals[LOCAL_MESSENGER_STATS_SENT];
+    snapshot->bytes_sent = totals[LOCAL_MESSENGER_STATS_BYTES_SENT];
+    snapshot->messages_received = atomic_load_explicit(&stats->received, memory_order_relaxed);
+    snapshot->bytes_received = atomic_load_explicit(&stats->bytes_received, memory_order_relaxed);
+    snapshot->send_retries = totals[LOCAL_MESSENGER_STATS_RETRIES];
+    snapshot->send_would_block = totals[LOCAL_MESSENGER_STATS_WOULD_BLOCK];
+    snapshot->send_timeouts = totals[LOCAL_MESSENGER_STATS_TIMEOUTS];
+    snapshot->messages_conflated = totals[LOCAL_MESSENGER_STATS_CONFLATED];
+    snapshot->messages_rejected = atomic_load_explicit(&stats->rejected, memory_order_relaxed);
+    //The shards are read one after another so a receive can be counted before its send
+    if(snapshot->messages_sent > snapshot->messages_received)
+    {
+        snapshot->queue_depth = snapshot->messages_sent - snapshot->messages_received;
+    }
+    snapshot->peak_queue_bytes = atomic_load_explicit(&stats->peak_queue_bytes, memory_order_relaxed);
+    stats_histogram_snapshot(&stats->latency, &snapshot->latency);
+    stats_histogram_snapshot(&stats->callback_duration, &snapshot->callback_duration);
+}
+
+/**
+ * @brief get a percentile of a histogram
+ * @param histogram the histogram
+ * @param percentile 0 to 100
+ * @return the top of the bucket holding the percentile in nanoseconds, never more than max_ns. 0 for an empty histogram
+ */
+uint64_t messenger_histogram_percentile(const messenger_histogram_s *histogram, unsigned int percentile)
+{
+    uint64_t target;
+    uint64_t seen = 0;
+    uint64_t top;
+    assert(NULL != histogram);
+    assert(100 >= percentile);
+    if(0 == histogram->count)
+    {
+        return 0;
+    }
+    //The sample the percentile lands on, counting from 1
+    target = ((histogram->count * percentile) + 99) / 100;
+    target = (0 == target) ? 1 : target;
+    for(unsigned int bucket = 0; bucket < MESSENGER_HISTOGRAM_BUCKETS; bucket++)
+    {
+        seen += histogram->buckets[bucket];
+        if(seen >= target)
+        {
+            top = stats_bucket_top(bucket);
+            return (top < histogram->max_ns) ? top : histogram->max_ns;
+        }
+    }
+    //A snapshot taken while samples land may not add up exactly
+    return histogram->max_ns;
+}
@@ -0,0 +1,254 @@
+/**
+ * @file local-messenger-workers.c
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Pool of worker threads with per key ordering and work stealing
+ */
+
+#include <local-messenger-workers.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+/***********************************************************************************/
+/***************************** Defines and Macros **********************************/
+/***********************************************************************************/
+
+#ifdef DEBUG_MESSENGER
+#define PRINT_MSG(...) printf(__VA_ARGS__)
+#else
+#define PRINT_MSG(...)
+#endif //DEBUG_MESSENGER
+
+/***********************************************************************************/
+/***************************** Type Defs *******************************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Function Declarations *******************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Static Variables ************************************/
+/***********************************************************************************/
+
+/***********************************************************************************/
+/***************************** Function Definitions ********************************/
+/***********************************************************************************/
+
+/**
+ * @brief add a message to the back of a queue
+ * @param queue
+ * @param work
+ */
+static inline void work_queue_push(local_messenger_work_queue_s *queue, local_messenger_work_s *work)
+{
+    work->next = NULL;
+    if(NULL == queue->tail)
+    {
+        queue->head = work;
+    }
+    else
+    {
+        queue->tail->next = work;
+    }
+    queue->tail = work;
+}
+
+/**
+ * @brief take the message at the front of a queue
+ * @param queue
+ * @return the message, NULL if the queue is empty
+ */
+static inline local_messenger_work_s *work_queue_pop(local_messenger_work_queue_s *queue)
+{
+    local_messenger_work_s *rv = queue->head;
+    if(NULL != rv)
+    {
+        queue->head = rv->next;
+        if(NULL == queue->head)
+        {
+            queue->tail = NULL;
+        }
+    }
+    return rv;
+}
+
+/**
+ * @brief take an unkeyed message queued on another worker
+ * @param worker the worker looking for work
+ * @return the message, NULL if there was nothing to steal
+ */
+static local_messenger_work_s *worker_steal(local_messenger_worker_s *worker)
+{
+    local_messenger_workers_s *pool = worker->pool;
+    local_messenger_worker_s *victim;
+    local_messenger_work_s *rv = NULL;
+    for(unsigned int i = 1; i < pool->count && NULL == rv; i++)
+    {
+        victim = &pool->workers[(worker->index + i) % pool->count];
+        //A busy victim is skipped rather than waited on
+        if(0 == pthread_mutex_trylock(&victim->mutex))
+        {
+            rv = work_queue_pop(&victim->shared);
+            pthread_mutex_unlock(&victim->mutex);
+        }
+    }
+    return rv;
+}
+
+/**
+ * @brief The worker task
+ * @param args the worker
+ */
+static void *worker_task(void *args)
+{
+    local_messenger_worker_s *worker = args;
+    local_messenger_workers_s *pool = worker->pool;
+    local_messenger_work_s *work;
+    while(true)
+    {
+        assert(0 == pthread_mutex_lock(&worker->mutex));
+        work = work_queue_pop(&worker->pinned);
+        if(NULL == work)
+        {
+            work = work_queue_pop(&worker->shared);
+        }
+        pthread_mutex_unlock(&worker->mutex);
+        if(NULL == work)
+        {
+            work = worker_steal(worker);
+        }
+        if(NULL == work)
+        {
+            assert(0 == pthread_mutex_lock(&worker->mutex));
+            if(NULL == worker->pinned.head && NULL == worker->shared.head)
+            {
+                if(true == atomic_load(&pool->stop))
+                {
+                    pthread_mutex_unlock(&worker->mutex);
+                    break;
+                }
+                atomic_store(&worker->sleeping, true);
+                pthread_cond_wait(&worker->cond, &worker->mutex);
+                atomic_store(&worker->sleeping, false);
+            }
+            pthread_mutex_unlock(&worker->mutex);
+            continue;
+        }
+        pool->handler(pool->context, (struct local_messanger_internal_message_s *)work->frame);
+        free(work);
+    }
+    PRINT_MSG("%s worker %u exiting\r\n", __FUNCTION__, worker->index);
+    return NULL;
+}
+
+/**
+ * @brief start a pool of workers
+ * @param pool the pool to start
+ * @param count the number of worker threads
+ * @param handler the function messages are run through
+ * @param context passed to the handler
+ */
+void local_messenger_workers_init(local_messenger_workers_s *pool, unsigned int count, local_messenger_work_handler handler, void *context)
+{
+    assert(NULL != pool);
+    assert(0 < count);
+    assert(NULL != handler);
+    pool->workers = calloc(count, sizeof(local_messenger_worker_s));
+    assert(NULL != pool->workers);
+    pool->count = count;
+    pool->next = 0;
+    pool->handler = handler;
+    pool->context = context;
+    atomic_init(&pool->stop, false);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        atomic_init(&pool->workers[i].sleeping, false);
+        assert(0 == pthread_mutex_init(&pool->workers[i].mutex, NULL));
+        assert(0 == pthread_cond_init(&pool->workers[i].cond, NULL));
+    }
+    for(unsigned int i = 0; i < count; i++)
+    {
+        assert(0 == pthread_create(&pool->workers[i].thread, NULL, worker_task, &pool->workers[i]));
+    }
+}
+
+/**
+ * @brief run every queued message, then stop and join the workers
+ * @param pool the pool to stop
+ */
+void local_messenger_workers_destroy(local_messenger_workers_s *pool)
+{
+    assert(NULL != pool);
+    atomic_store(&pool->stop, true);
+    for(unsigned int i = 0; i < pool->count; i++)
+    {
+        assert(0 == pthread_mutex_lock(&pool->workers[i].mutex));
+        pthread_cond_signal(&pool->workers[i].cond);
+        pthread_mutex_unlock(&pool->workers[i].mutex);
+    }
+    for(unsigned int i = 0; i < pool->count; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for(unsigned int i = 0; i < pool->count; i++)
+    {
+        pthread_mutex_destroy(&pool->workers[i].mutex);
+        pthread_cond_destroy(&pool->workers[i].cond);
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->count = 0;
+}
+
+/**
+ * @brief queue a copy of a message on the pool. Only one thread may submit to a pool.
+ * LOCAL_MESSAGE_TYPE_USR_KEYED messages run on the worker owning their key, after earlier messages with the same key
+ * @param pool the pool
+ * @param msg the message
+ */
+void local_messenger_workers_submit(local_messenger_workers_s *pool, const struct local_messanger_internal_message_s *msg)
+{
+    local_messenger_work_s *work;
+    local_messenger_worker_s *worker;
+    size_t frame_size;
+    bool keyed;
+    assert(NULL != pool);
+    assert(0 < pool->count);
+    assert(NULL != msg);
+    frame_size = local_messenger_frame_size(&msg->header);
+    work = malloc(sizeof(local_messenger_work_s) + frame_size);
+    assert(NULL != work);
+    memcpy(work->frame, msg, frame_size);
+    keyed = (LOCAL_MESSAGE_TYPE_USR_KEYED == msg->header.type);
+    if(true == keyed)
+    {
+        worker = &pool->workers[msg->header.key % pool->count];
+    }
+    else
+    {
+        //Prefer an idle worker, otherwise spread the load and let idle workers steal it back
+        worker = &pool->workers[pool->next];
+        for(unsigned int i = 0; i < pool->count; i++)
+        {
+            if(true == atomic_load_explicit(&pool->workers[(pool->next + i) % pool->count].sleeping, memory_order_relaxed))
+            {
+                worker = &pool->workers[(pool->next + i) % pool->count];
+                break;
+            }
+        }
+        pool->next = (worker->index + 1) % pool->count;
+    }
+    assert(0 == pthread_mutex_lock(&worker->mutex));
+    work_queue_push((true == keyed) ? &worker->pinned : &worker->shared, work);
+    if(true == atomic_load(&worker->sleeping))
+    {
+        pthread_cond_signal(&worker->cond);
+    }
+    pthread_mutex_unlock(&worker->mutex);
+}
@@ -6,9 +6,21 @@
  *
  */
 
-#include <time-out-helper.h>
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif //__linux__
+
 #include <local-messenger.h>
 #include <local-messenger-message-types.h>
+#include <local-messenger-buffers.h>
+#include <local-messenger-conflation.h>
+#include <local-messenger-journal.h>
+#include <local-messenger-requests.h>
+#include <local-messenger-ring.h>
+#include <local-messenger-shm.h>
+#include <local-messenger-stats.h>
+#include <local-messenger-workers.h>
+#include <time-out-helper.h>
 #include <sys/msg.h>
 #include <sys/types.h>
 #include <stdbool.h>
@@ -17,6 +29,15 @@
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif //__linux__
 
 /***********************************************************************************/
 /***************************** Defines and Macros **********************************/
@@ -35,27 +56,184 @@
 #define TIME_OUT_MS 1000
 #endif //TIME_OUT_MS
 
+#ifdef __linux__
+#define SPACE_WAIT_CLOCK CLOCK_MONOTONIC //!< Clock the send deadlines are measured on
+#else
+#define SPACE_WAIT_CLOCK CLOCK_REALTIME //!< Clock the send deadlines are measured on
+#endif //__linux__
+
+#define NS_PER_US 1000L
+#define NS_PER_MS 1000000L
+#define NS_PER_SEC 1000000000L
+
 #define MODULE_MESSAGE_TYPE 1
+//One System V type per priority, highest first. Everything on a lane shares its type so the lane stays in send order.
+//There is no type per topic: msgrcv with a negative type takes the lowest type first, so topic types would reorder a lane
+#define SYSV_MESSAGE_TYPE(priority) (MODULE_MESSAGE_TYPE + (long)(priority))
+#define SYSV_LAST_MESSAGE_TYPE SYSV_MESSAGE_TYPE(LOCAL_MESSENGER_PRIORITY_LEVELS - 1)
+
+#ifndef LOCAL_MESSENGER_DEFAULT_TRANSPORT
+#define LOCAL_MESSENGER_DEFAULT_TRANSPORT MESSENGER_TRANSPORT_RING
+#endif //LOCAL_MESSENGER_DEFAULT_TRANSPORT
+
+#ifndef LOCAL_MESSENGER_RING_SIZE
+#define LOCAL_MESSENGER_RING_SIZE (64 * 1024)
+#endif //LOCAL_MESSENGER_RING_SIZE
+
+#ifndef LOCAL_MESSENGER_DISPATCH_BATCH
+#define LOCAL_MESSENGER_DISPATCH_BATCH 64
+#endif //LOCAL_MESSENGER_DISPATCH_BATCH
+
+#ifndef LOCAL_MESSENGER_WORKERS
+#define LOCAL_MESSENGER_WORKERS 0
+#endif //LOCAL_MESSENGER_WORKERS
+
+#ifndef LOCAL_MESSENGER_WAIT_STRATEGY
+#define LOCAL_MESSENGER_WAIT_STRATEGY MESSENGER_WAIT_PARK
+#endif //LOCAL_MESSENGER_WAIT_STRATEGY
+
+#ifndef LOCAL_MESSENGER_SPIN_US
+#define LOCAL_MESSENGER_SPIN_US 50
+#endif //LOCAL_MESSENGER_SPIN_US
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define CPU_RELAX()
+#endif //CPU_RELAX
+
+#ifndef LOCAL_MESSENGER_JOURNAL_SEGMENT_SIZE
+#define LOCAL_MESSENGER_JOURNAL_SEGMENT_SIZE (16 * 1024 * 1024)
+#endif //LOCAL_MESSENGER_JOURNAL_SEGMENT_SIZE
+
+#ifndef LOCAL_MESSENGER_SEND_BATCH_CHUNK
+#define LOCAL_MESSENGER_SEND_BATCH_CHUNK 64
+#endif //LOCAL_MESSENGER_SEND_BATCH_CHUNK
+
+#ifndef LOCAL_MESSENGER_NAME_LENGTH
+#define LOCAL_MESSENGER_NAME_LENGTH 32
+#endif //LOCAL_MESSENGER_NAME_LENGTH
+
+#ifndef LOCAL_MESSENGER_TIMER_TICK_NS
+#define LOCAL_MESSENGER_TIMER_TICK_NS TIME_OUT_HELPER_NS_PER_MS //!< Resolution of delayed and periodic messages
+#endif //LOCAL_MESSENGER_TIMER_TICK_NS
+
+#define ALIGN_TO_LONG(x) (((x) + (sizeof(long) - 1)) & ~(sizeof(long) - 1))
 
 /***********************************************************************************/
 /***************************** Type Defs *******************************************/
 /***********************************************************************************/
 
-struct messenger_module_data_s
+struct module_message_transaction_data_s
+{
+    long mtype; //The message type
+    char mdata[]; //The message header followed by the payload
+}; //!< Structure used in the message transactions
+
+struct messenger_topic_s
 {
-    bool initialized; //!< Tells if the module has been initialized
+    _Atomic unsigned int count; //!< Number of subscribers
+    _Atomic unsigned int used; //!< Subscriber slots in use, including emptied ones
+    _Atomic(messenger_on_messaage_rcv) subscribers[LOCAL_MESSENGER_MAX_SUBSCRIBERS]; //!< The subscribers. NULL for emptied slots
+}; //!< The subscribers of a topic
+
+struct messenger_handler_s
+{
+    _Atomic(messenger_on_context_rcv) cb; //!< The handler. NULL for a type without one
+    void *context; //!< Passed to cb
+    long min_size; //!< Smallest message the handler accepts
+    long max_size; //!< Largest message the handler accepts
+}; //!< The handler of a message type id
+
+struct messenger_timer_s
+{
+    time_out_helper_timer_s timer; //!< Entry on the channel's timer wheel
+    messenger_t *messenger; //!< The channel the message goes out on
+    uint64_t deadline_ns; //!< When the message is next due on CLOCK_MONOTONIC
+    uint64_t period_ns; //!< Time between sends. 0 for a message sent once
+    long frame[]; //!< The message header and payload
+}; //!< A delayed or periodic message
+
+struct messenger_s
+{
+    char name[LOCAL_MESSENGER_NAME_LENGTH]; //!< The channel name. Empty for anonymous channels
+    struct messenger_s *next; //!< The next named channel
+    enum messenger_transport_e transport; //!< The transport messages are carried over
     int queue_id; //!< The msg queue id returned on creation
-    pthread_t master_thread; //!< The master thread id
+    char *rcv_buffer; //!< Buffer System V messages are received into. Holds a batch of messages back to back
+    size_t rcv_buffer_size; //!< Size of rcv_buffer in bytes
+    size_t rcv_offset; //!< Bytes of rcv_buffer used by the batch being dispatched
+    local_messenger_ring_s rings[LOCAL_MESSENGER_PRIORITY_LEVELS]; //!< The rings. One per priority, highest first
+    local_messenger_shm_s shm; //!< The shared memory holding the rings. Only used by the shared memory transport
+    bool attached; //!< Set for a send only handle from messenger_attach. There is no dispatch thread behind it
+    uint64_t ring_size; //!< Size of the ring in bytes
+    long max_message_size; //!< Largest payload the transport can carry
+    pthread_t master_thread; //!< The master thread id. Not started for a pollable channel
+    enum messenger_wait_strategy_e wait_strategy; //!< How the master thread waits for messages
+    unsigned int spin_us; //!< How long the master thread polls before sleeping with MESSENGER_WAIT_SPIN_THEN_PARK
+    uint64_t spin_ns; //!< How long the master thread polls the transport before sleeping. UINT64_MAX to never sleep
+    uint64_t cpu_mask; //!< CPUs the master thread may run on. 0 for any
+    int sched_priority; //!< SCHED_FIFO priority of the master thread. 0 for the default policy
+    bool pollable; //!< Set for a channel dispatched by its owner with messenger_channel_dispatch_pending instead of a master thread
+    int poll_fd; //!< The eventfd that is readable while a pollable channel has messages waiting. -1 for other channels
     bool kill_master_thread; //!< Flag used to kill the master thread
-    pthread_mutex_t init_mutex; //!< The mutex to protect the module initialization
-    messenger_on_messaage_rcv cb; //!< The callback to call when a user message is received
-};
+    bool park_master_thread; //!< Set by the master thread when it is asked to park
+    bool parked; //!< Set while the master thread is parked for a warm restart
+    bool park_exit; //!< Set to have a parked master thread exit
+    pthread_mutex_t park_mutex; //!< Protects the parked state
+    pthread_cond_t park_cond; //!< Signaled when the parked state changes
+    _Atomic(messenger_on_messaage_rcv) cb; //!< The callback to call when a user message is received
+    _Atomic(messenger_on_batch_rcv) batch_cb; //!< The callback to call with a batch of user messages
+    _Atomic(messenger_on_context_rcv) context_cb; //!< The callback to call with cb_context when a user message is received
+    void *cb_context; //!< Passed to context_cb. Set before context_cb
+    _Atomic(messenger_on_request) request_cb; //!< The callback to call when a request is received
+    local_messenger_requests_s requests; //!< Requests made with this channel as reply_to that are waiting on replies
+    local_messenger_journal_s *journal; //!< Where the messages sent are kept until they are handed out. NULL when the channel is not journaled
+    local_messenger_conflation_s conflation; //!< The newest value of each key sent with messenger_channel_send_conflated
+    struct local_messanger_internal_message_s *conflated; //!< The conflated value being handed out. Only touched by the dispatch thread
+    size_t conflated_capacity; //!< Size of conflated in bytes
+    unsigned int dispatch_batch; //!< Most user messages handed out per wakeup
+    messenger_message_s *batch; //!< The batch being dispatched
+    unsigned int batch_buffers; //!< Pooled buffers in the batch, released once it has been handed out
+    unsigned int worker_count; //!< Number of worker threads running the callbacks. 0 runs them on the dispatch thread
+    local_messenger_workers_s workers; //!< The worker pool
+    pthread_mutex_t topic_mutex; //!< Serializes changes to the subscriber table
+    pthread_mutex_t space_mutex; //!< Protects the sleep of producers waiting for room on the transport
+    pthread_cond_t space_cond; //!< Signaled by the dispatch thread when it frees up room
+    _Atomic uint32_t *space_waiters; //!< Number of producers waiting for room. Points into the shared memory for the shared memory transport
+    _Atomic uint32_t local_space_waiters; //!< What space_waiters points at for the in process transports
+    _Atomic uint64_t sysv_queued_bytes; //!< Bytes sitting in the System V queue
+    uint64_t capacity_bytes; //!< Bytes the transport holds when full. Per lane for the ring
+    unsigned int high_watermark; //!< Fill percentage that calls watermark_cb with above_high set
+    unsigned int low_watermark; //!< Fill percentage that calls watermark_cb with above_high cleared
+    _Atomic(messenger_on_watermark) watermark_cb; //!< The callback to call when the fill crosses a watermark
+    _Atomic bool above_high_watermark; //!< Set from crossing the high watermark until falling to the low one
+    time_out_helper_wheel_s timers; //!< Delayed and periodic messages. Only touched by the dispatch thread
+    pthread_t timer_thread; //!< Wakes the dispatch thread out of msgrcv when a timer is due. Only used by the System V transport
+    bool timer_thread_running; //!< Set once timer_thread has been started
+    bool timer_thread_stop; //!< Set to have timer_thread exit
+    pthread_mutex_t timer_mutex; //!< Protects the timer_thread state
+    pthread_cond_t timer_cond; //!< Signaled when timer_wake_ns changes
+    uint64_t timer_wake_ns; //!< When timer_thread wakes the dispatch thread. TIME_OUT_HELPER_NEVER for never
+    struct messenger_topic_s topics[LOCAL_MESSENGER_MAX_TOPICS]; //!< Subscriber table indexed by topic
+    struct messenger_handler_s handlers[LOCAL_MESSENGER_MAX_MESSAGE_TYPES]; //!< Handler table indexed by type id
+#if LOCAL_MESSENGER_STATS
+    local_messenger_stats_s stats; //!< Counters and histograms read by messenger_channel_get_stats
+#endif //LOCAL_MESSENGER_STATS
+}; //!< A messenger channel. Each one has its own transport, dispatch thread and callback
 
-struct module_message_transaction_data_s
+struct messenger_module_data_s
 {
-    long mtype; //The message data
-    char mdata[sizeof(struct local_messanger_internal_message_s)]; //The message data
-}; //!< Structure used in the message transactions
+    _Atomic(messenger_t *) default_messenger; //!< The channel used by the functions that do not take a channel. NULL until it is started
+    messenger_config_t default_config; //!< The config the default channel is started with
+    pthread_mutex_t init_mutex; //!< The mutex to protect the module initialization
+    messenger_t *channels; //!< List of the named channels
+    bool warm_restart; //!< Park the default channel on messenger_kill instead of tearing it down
+    messenger_t *parked_messenger; //!< The parked default channel, NULL if there is none
+    char default_journal_path[LOCAL_MESSENGER_JOURNAL_PATH_LENGTH]; //!< Copy of the journal_path of default_config
+};
 
 /***********************************************************************************/
 /***************************** Function Declarations *******************************/
@@ -63,17 +241,55 @@ struct module_message_transaction_data_s
 
 /**
  * @brief internal function for receiving a message
- * @param msg pointer to the object to place the message into
- * @return true if a message was received
+ * @param wait true to block until a message arrives
+ * @return ptr to the message, NULL if there was none or the wait was interrupted.
+ * The message is valid until internal_message_release is called
+ */
+static struct local_messanger_internal_message_s *internal_message_receive(messenger_t *messenger, bool wait);
+
+/**
+ * @brief internal function for releasing every message returned by internal_message_receive
+ */
+static void internal_message_release(messenger_t *messenger);
+
+/**
+ * Internal function for sending a message. Waits up to TIME_OUT_MS for room
+ * @param priority the priority lane to send on
+ * @param header the message header
+ * @param payload the message payload. header->message_size bytes long
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+static enum messenger_send_result_e internal_message_send(messenger_t *messenger, unsigned int priority, const struct local_messenger_message_header_s *header, const void *payload);
+
+/**
+ * @brief called by the dispatch thread once it has handed room on the transport back.
+ * Wakes producers waiting for room and reports falling below the low watermark
+ */
+static void internal_space_released(messenger_t *messenger);
+
+/**
+ * @brief get the absolute time a number of nanoseconds from now
+ * @param deadline set to the deadline on SPACE_WAIT_CLOCK
+ * @param timeout_ns the number of nanoseconds
  */
-static bool internal_message_receive(struct local_messanger_internal_message_s *msg);
+static void internal_deadline_after_ns(struct timespec *deadline, uint64_t timeout_ns);
 
+/**
+ * @brief get how full the transport is. For the ring that is the fullest lane
+ * @return the bytes in use
+ */
+static uint64_t internal_transport_used(messenger_t *messenger);
 
 /**
  * Internal function for sending a message
- * @param msg
+ * @param priority the priority lane to send on
+ * @param header the message header
+ * @param payload the message payload. header->message_size bytes long
+ * @param deadline the absolute deadline on SPACE_WAIT_CLOCK. NULL to not wait at all
+ * @return MESSENGER_SEND_OK if the message was sent
  */
-static void internal_message_send(struct local_messanger_internal_message_s *msg);
+static enum messenger_send_result_e internal_message_send_deadline(messenger_t *messenger, unsigned int priority, const struct local_messenger_message_header_s *header, const void *payload,
+                                                                  const struct timespec *deadline);
 
 /***********************************************************************************/
 /***************************** Static Variables ************************************/
@@ -81,209 +297,3451 @@ static void internal_message_send(struct local_messanger_internal_message_s *msg
 
 static struct messenger_module_data_s messenger_module_data =
 {
-    .initialized = false,
-    .init_mutex = PTHREAD_MUTEX_INITIALIZER
+    .default_messenger = NULL,
+    .warm_restart = false,
+    .parked_messenger = NULL,
+    .default_config =
+    {
+        .name = NULL,
+        .transport = LOCAL_MESSENGER_DEFAULT_TRANSPORT,
+        .ring_size = LOCAL_MESSENGER_RING_SIZE,
+        .dispatch_batch = LOCAL_MESSENGER_DISPATCH_BATCH,
+        .workers = LOCAL_MESSENGER_WORKERS,
+        .pollable = false,
+        .wait_strategy = LOCAL_MESSENGER_WAIT_STRATEGY,
+        .spin_us = LOCAL_MESSENGER_SPIN_US,
+        .cpu_mask = 0,
+        .sched_priority = 0,
+        .journal_path = NULL,
+        .journal_segment_size = LOCAL_MESSENGER_JOURNAL_SEGMENT_SIZE
+    },
+    .init_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .channels = NULL
 };
 
+static _Thread_local messenger_t *dispatching_messenger = NULL; //!< The channel the calling thread is handing messages out for. NULL off the dispatch threads
+
 /***********************************************************************************/
 /***************************** Function Definitions ********************************/
 /***********************************************************************************/
 
 /**
- * @brief The Central messenger task
- * @param args
+ * @brief get the message that holds a payload handed out by messenger_acquire
+ * @param message the payload ptr
+ * @return ptr to the message
  */
-static void *central_messenger(void *args)
+static inline struct local_messanger_internal_message_s *internal_message_from_payload(void *message)
 {
-    messenger_on_messaage_rcv callback;
-    struct local_messanger_internal_message_s c_message;
-    messenger_module_data.kill_master_thread = false;
-    while(false == messenger_module_data.kill_master_thread)
+    return (struct local_messanger_internal_message_s *)(((char *)message) - offsetof(struct local_messanger_internal_message_s, message_data));
+}
+
+/**
+ * @brief read the clock the callback statistics are kept on
+ * @return CLOCK_MONOTONIC in nanoseconds. 0 when the statistics are compiled out
+ */
+static inline uint64_t dispatch_stats_now(void)
+{
+#if LOCAL_MESSENGER_STATS
+    return time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC);
+#else
+    return 0;
+#endif //LOCAL_MESSENGER_STATS
+}
+
+/**
+ * @brief record how long a message took from being sent to its callback being called
+ * @param msg the message
+ * @param now the time the callback is called
+ */
+static inline void dispatch_stats_latency(messenger_t *messenger, const struct local_messanger_internal_message_s *msg, uint64_t now)
+{
+#if LOCAL_MESSENGER_STATS
+    //Delayed messages have no stamp. Their wait is not latency. Without workers the dispatch thread is the only writer
+    if(0 != msg->header.enqueue_ns && now > msg->header.enqueue_ns)
     {
-        PRINT_MSG("%s waiting on message\r\n", __FUNCTION__);
-        if(true == internal_message_receive(&c_message))
+        STATS_RECORD(&messenger->stats.latency, now - msg->header.enqueue_ns, (0 < messenger->worker_count));
+    }
+#endif //LOCAL_MESSENGER_STATS
+}
+
+/**
+ * @brief mark a message handed out in the journal so it is not replayed
+ * @param msg the message
+ */
+static inline void dispatch_journal_ack(messenger_t *messenger, const struct local_messanger_internal_message_s *msg)
+{
+    if(0 != msg->header.journal_position)
+    {
+        local_messenger_journal_ack(messenger->journal, msg->header.journal_position);
+    }
+}
+
+/**
+ * @brief get the pooled buffer a handle points at
+ * @param msg the LOCAL_MESSAGE_TYPE_BUFFER message carrying the handle
+ * @return the buffer
+ */
+static inline local_messenger_buffer_s *dispatch_buffer_of(const struct local_messanger_internal_message_s *msg)
+{
+    local_messenger_buffer_s *rv;
+    assert(sizeof(rv) == msg->header.message_size);
+    memcpy(&rv, msg->message_data, sizeof(rv));
+    return rv;
+}
+
+/**
+ * @brief hand the collected user messages to the registered callback
+ * @param count the number of messages in messenger->batch
+ */
+static void dispatch_batch(messenger_t *messenger, unsigned int count)
+{
+    messenger_on_messaage_rcv callback = atomic_load_explicit(&messenger->cb, memory_order_acquire);
+    messenger_on_batch_rcv batch_callback = atomic_load_explicit(&messenger->batch_cb, memory_order_acquire);
+    messenger_on_context_rcv context_callback = atomic_load_explicit(&messenger->context_cb, memory_order_acquire);
+    struct local_messanger_internal_message_s *msg;
+    uint64_t start;
+    uint64_t end;
+    if(0 == count)
+    {
+        return;
+    }
+    start = dispatch_stats_now();
+    if(NULL != batch_callback)
+    {
+        for(unsigned int i = 0; i < count; i++)
         {
-            callback = messenger_module_data.cb;
-            PRINT_MSG("%s received message\r\n", __FUNCTION__);
-            switch(c_message.type)
-            {
-                case LOCAL_MESSAGE_TYPE_INTERNAL_ACTION:
-                    PRINT_MSG("%s received message of type LOCAL_MESSAGE_TYPE_INTERNAL_ACTION\r\n", __FUNCTION__);
-                    break;
-                case LOCAL_MESSAGE_TYPE_USR:
-                    PRINT_MSG("%s received message of type LOCAL_MESSAGE_TYPE_USR\r\n", __FUNCTION__);
-                    if(NULL != callback)
-                    {
-                        callback(c_message.data.user.message_data, c_message.data.user.message_size);
-                    }
-                    break;
-                default:
-                    assert(false);
-                    break;
-            }
+            dispatch_stats_latency(messenger, internal_message_from_payload(messenger->batch[i].msg), start);
         }
+        batch_callback(messenger->batch, count);
+        end = dispatch_stats_now();
+        STATS_RECORD(&messenger->stats.callback_duration, end - start, (0 < messenger->worker_count));
     }
-    return NULL;
+    else if(NULL != callback)
+    {
+        //Each callback ends where the next one starts so it is one clock read per message
+        for(unsigned int i = 0; i < count; i++)
+        {
+            dispatch_stats_latency(messenger, internal_message_from_payload(messenger->batch[i].msg), start);
+            callback(messenger->batch[i].msg, messenger->batch[i].message_size);
+            end = dispatch_stats_now();
+            STATS_RECORD(&messenger->stats.callback_duration, end - start, (0 < messenger->worker_count));
+            start = end;
+        }
+    }
+    else if(NULL != context_callback)
+    {
+        for(unsigned int i = 0; i < count; i++)
+        {
+            dispatch_stats_latency(messenger, internal_message_from_payload(messenger->batch[i].msg), start);
+            context_callback(messenger->cb_context, messenger->batch[i].msg, messenger->batch[i].message_size);
+            end = dispatch_stats_now();
+            STATS_RECORD(&messenger->stats.callback_duration, end - start, (0 < messenger->worker_count));
+            start = end;
+        }
+    }
+    for(unsigned int i = 0; (NULL != messenger->journal || 0 < messenger->batch_buffers) && i < count; i++)
+    {
+        msg = internal_message_from_payload(messenger->batch[i].msg);
+        if(LOCAL_MESSAGE_TYPE_BUFFER == msg->header.type)
+        {
+            local_messenger_buffer_release(local_messenger_buffer_from_msg(msg));
+            continue;
+        }
+        dispatch_journal_ack(messenger, msg);
+    }
+    messenger->batch_buffers = 0;
 }
 
 /**
- * Initialize the ipc message queue
+ * @brief find the handler of a typed message. Only called by the dispatch thread, so a message is
+ * checked once before it is handed out
+ * @param msg the message
+ * @return the handler, NULL if the type has none or the message size is out of its range
  */
-static inline void init_msg_queue(void)
+static struct messenger_handler_s *dispatch_typed_handler(messenger_t *messenger, struct local_messanger_internal_message_s *msg)
 {
-    int error_number;
-    int result;
-    result = msgget(IPC_PRIVATE, IPC_CREAT | IPC_EXCL | 0666);
-    if(0  > result)
+    struct messenger_handler_s *handler;
+    //Another process can send on a shared memory channel so the type id is not trusted
+    if(LOCAL_MESSENGER_MAX_MESSAGE_TYPES <= msg->header.type_id)
     {
-        error_number = errno;
-        switch(error_number)
+        return NULL;
+    }
+    handler = &messenger->handlers[msg->header.type_id];
+    if(NULL == atomic_load_explicit(&handler->cb, memory_order_acquire) ||
+            handler->min_size > msg->header.message_size || handler->max_size < msg->header.message_size)
+    {
+        return NULL;
+    }
+    return handler;
+}
+
+/**
+ * @brief hand a typed message to the handler of its type. The message was already checked by dispatch_typed_handler
+ * @param msg the message
+ */
+static void dispatch_typed(messenger_t *messenger, struct local_messanger_internal_message_s *msg)
+{
+    struct messenger_handler_s *handler = &messenger->handlers[msg->header.type_id];
+    messenger_on_context_rcv callback = atomic_load_explicit(&handler->cb, memory_order_acquire);
+    uint64_t start = dispatch_stats_now();
+    dispatch_stats_latency(messenger, msg, start);
+    callback(handler->context, msg->message_data, msg->header.message_size);
+    STATS_RECORD(&messenger->stats.callback_duration, dispatch_stats_now() - start, (0 < messenger->worker_count));
+}
+
+/**
+ * @brief hand a published message to the subscribers of its topic
+ * @param msg the message
+ */
+static void dispatch_publish(messenger_t *messenger, struct local_messanger_internal_message_s *msg)
+{
+    struct messenger_topic_s *topic;
+    messenger_on_messaage_rcv callback;
+    unsigned int used;
+    uint64_t start;
+    uint64_t end;
+    assert(LOCAL_MESSENGER_MAX_TOPICS > msg->header.topic);
+    topic = &messenger->topics[msg->header.topic];
+    used = atomic_load_explicit(&topic->used, memory_order_acquire);
+    start = dispatch_stats_now();
+    dispatch_stats_latency(messenger, msg, start);
+    for(unsigned int i = 0; i < used; i++)
+    {
+        callback = atomic_load_explicit(&topic->subscribers[i], memory_order_acquire);
+        if(NULL != callback)
         {
-            case EACCES:
-                PRINT_MSG("-----msgget returned EACCES\r\n");
-                break;
-            case EEXIST:
-                PRINT_MSG("-----msgget returned EEXIST\r\n");
-                break;
-            case ENOENT:
-                PRINT_MSG("-----msgget returned ENOENT\r\n");
-                break;
-            case ENOMEM:
-                PRINT_MSG("-----msgget returned ENOMEM\r\n");
-                break;
-            case ENOSPC:
-                PRINT_MSG("-----msgget returned ENOSPC\r\n");
-                break;
-            default:
-                PRINT_MSG("Error Unknown error\r\n");
-                assert(false);
+            callback(msg->message_data, msg->header.message_size);
+            end = dispatch_stats_now();
+            STATS_RECORD(&messenger->stats.callback_duration, end - start, (0 < messenger->worker_count));
+            start = end;
         }
     }
-    messenger_module_data.queue_id = result;
 }
 
 /**
- * @brief Function that initializes the messaging module if needed
+ * @brief hand a request to the request handler
+ * @param msg the message. The payload starts with the channel to reply to
  */
-static void init_if_needed(void)
+static void dispatch_request(messenger_t *messenger, struct local_messanger_internal_message_s *msg)
 {
-    if(false == messenger_module_data.initialized)
+    messenger_on_request callback = atomic_load_explicit(&messenger->request_cb, memory_order_acquire);
+    messenger_request_t request;
+    uint64_t start;
+    assert(sizeof(request.reply_to) < (size_t)msg->header.message_size);
+    if(NULL == callback)
     {
-        assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
-        if(false == messenger_module_data.initialized)
+        return;
+    }
+    memcpy(&request.reply_to, msg->message_data, sizeof(request.reply_to));
+    request.correlation_id = msg->header.correlation_id;
+    start = dispatch_stats_now();
+    dispatch_stats_latency(messenger, msg, start);
+    callback(&request, &msg->message_data[sizeof(request.reply_to)], msg->header.message_size - (long)sizeof(request.reply_to));
+    STATS_RECORD(&messenger->stats.callback_duration, dispatch_stats_now() - start, (0 < messenger->worker_count));
+}
+
+/**
+ * @brief hand a reply to the callback of its request. Only called by the dispatch thread,
+ * which owns the timeouts of the requests. Replies to requests that already ended are dropped
+ * @param msg the message
+ */
+static void dispatch_reply(messenger_t *messenger, struct local_messanger_internal_message_s *msg)
+{
+    local_messenger_request_entry_s *entry = local_messenger_requests_find(&messenger->requests, msg->header.correlation_id);
+    messenger_on_reply callback;
+    void *context;
+    uint64_t start;
+    if(NULL == entry)
+    {
+        return;
+    }
+    time_out_helper_wheel_cancel(&messenger->timers, &entry->timer);
+    callback = entry->callback;
+    context = entry->context;
+    //The slot is free before the callback runs so it can make the next request
+    local_messenger_requests_close(&messenger->requests, entry);
+    start = dispatch_stats_now();
+    dispatch_stats_latency(messenger, msg, start);
+    callback(context, MESSENGER_REPLY_OK, msg->message_data, msg->header.message_size);
+    STATS_RECORD(&messenger->stats.callback_duration, dispatch_stats_now() - start, (0 < messenger->worker_count));
+}
+
+/**
+ * @brief end the requests whose replies could not be sent. Only called by the dispatch thread
+ */
+static void dispatch_dropped_replies(messenger_t *messenger)
+{
+    local_messenger_request_entry_s *entry;
+    messenger_on_reply callback;
+    void *context;
+    uint64_t id;
+    while(0 != (id = local_messenger_requests_take_dropped(&messenger->requests)))
+    {
+        //A reply that was sent before the dropped one already ended the request
+        entry = local_messenger_requests_find(&messenger->requests, id);
+        if(NULL == entry)
         {
-            PRINT_MSG("%s initializing module\r\n", __FUNCTION__);
-            init_msg_queue();
-            messenger_module_data.kill_master_thread = true;
-            assert(0 == pthread_create(&messenger_module_data.master_thread, NULL, central_messenger, NULL));
-            while(true == messenger_module_data.kill_master_thread) {}
-            assert(false == messenger_module_data.kill_master_thread);
-            messenger_module_data.cb = NULL;
-            messenger_module_data.initialized = true;
+            continue;
         }
-        pthread_mutex_unlock(&messenger_module_data.init_mutex);
+        time_out_helper_wheel_cancel(&messenger->timers, &entry->timer);
+        callback = entry->callback;
+        context = entry->context;
+        local_messenger_requests_close(&messenger->requests, entry);
+        callback(context, MESSENGER_REPLY_DROPPED, NULL, 0);
     }
 }
 
+/**
+ * @brief end a request whose reply did not arrive in time
+ * @param timer the timer of the request
+ * @param context the channel the request was waiting on
+ */
+static void internal_request_expired(time_out_helper_timer_s *timer, void *context)
+{
+    messenger_t *messenger = context;
+    local_messenger_request_entry_s *entry = local_messenger_requests_from_timer(timer);
+    messenger_on_reply callback = entry->callback;
+    void *callback_context = entry->context;
+    local_messenger_requests_close(&messenger->requests, entry);
+    callback(callback_context, MESSENGER_REPLY_TIMED_OUT, NULL, 0);
+}
 
 /**
- * @brief internal function for receiving a message
- * @param msg pointer to the object to place the message into
- * @return true if a message was received
+ * @brief hand a message taken off the worker pool to the registered callback
+ * @param context the channel
+ * @param msg the message
  */
-static bool internal_message_receive(struct local_messanger_internal_message_s *msg)
+static void dispatch_worker_message(void *context, struct local_messanger_internal_message_s *msg)
 {
-    int result = -1;
-    time_out_helper_data_s time_data;
-    struct module_message_transaction_data_s data;
-    assert(NULL != msg);
-    time_out_helper_init(&time_data, TIME_OUT_MS);
-    while(false == time_out_helper_check(&time_data) && result < 0)
+    messenger_t *messenger = context;
+    messenger_on_messaage_rcv callback = atomic_load_explicit(&messenger->cb, memory_order_acquire);
+    messenger_on_batch_rcv batch_callback = atomic_load_explicit(&messenger->batch_cb, memory_order_acquire);
+    messenger_on_context_rcv context_callback = atomic_load_explicit(&messenger->context_cb, memory_order_acquire);
+    local_messenger_buffer_s *buffer = NULL;
+    messenger_message_s message;
+    uint64_t start;
+    if(LOCAL_MESSAGE_TYPE_BUFFER == msg->header.type)
     {
-        result = msgrcv(messenger_module_data.queue_id, &data, sizeof(struct local_messanger_internal_message_s), MODULE_MESSAGE_TYPE, IPC_NOWAIT);
+        buffer = dispatch_buffer_of(msg);
+        dispatch_stats_latency(messenger, msg, dispatch_stats_now());
+        msg = local_messenger_buffer_msg(buffer);
     }
-    if(0 > result)
+    message.msg = msg->message_data;
+    message.message_size = msg->header.message_size;
+    if(LOCAL_MESSAGE_TYPE_TYPED == msg->header.type)
     {
-        return false;
+        dispatch_typed(messenger, msg);
+        dispatch_journal_ack(messenger, msg);
+        return;
     }
-    assert(result == sizeof(struct local_messanger_internal_message_s));
-    memcpy(msg, data.mdata, sizeof(struct local_messanger_internal_message_s));
-    return true;
+    if(LOCAL_MESSAGE_TYPE_PUBLISH == msg->header.type)
+    {
+        dispatch_publish(messenger, msg);
+        dispatch_journal_ack(messenger, msg);
+        return;
+    }
+    if(LOCAL_MESSAGE_TYPE_REQUEST == msg->header.type)
+    {
+        dispatch_request(messenger, msg);
+        return;
+    }
+    if(NULL == batch_callback && NULL == callback && NULL == context_callback)
+    {
+        dispatch_journal_ack(messenger, msg);
+        if(NULL != buffer)
+        {
+            local_messenger_buffer_release(buffer);
+        }
+        return;
+    }
+    start = dispatch_stats_now();
+    dispatch_stats_latency(messenger, msg, start);
+    if(NULL != batch_callback)
+    {
+        batch_callback(&message, 1);
+    }
+    else if(NULL != callback)
+    {
+        callback(message.msg, message.message_size);
+    }
+    else
+    {
+        context_callback(messenger->cb_context, message.msg, message.message_size);
+    }
+    STATS_RECORD(&messenger->stats.callback_duration, dispatch_stats_now() - start, (0 < messenger->worker_count));
+    dispatch_journal_ack(messenger, msg);
+    if(NULL != buffer)
+    {
+        local_messenger_buffer_release(buffer);
+    }
+}
+
+/**
+ * @brief hand out a delayed or periodic message once it is due and put periodic ones back on the wheel
+ * @param timer the wheel entry
+ * @param context the message
+ */
+static void internal_timer_expired(time_out_helper_timer_s *timer, void *context)
+{
+    messenger_timer_t *entry = context;
+    messenger_t *messenger = entry->messenger;
+    struct local_messanger_internal_message_s *msg = (struct local_messanger_internal_message_s *)entry->frame;
+    uint64_t now;
+    if(0 < messenger->worker_count)
+    {
+        local_messenger_workers_submit(&messenger->workers, msg);
+    }
+    else
+    {
+        dispatch_worker_message(messenger, msg);
+    }
+    if(0 == entry->period_ns)
+    {
+        free(entry);
+        return;
+    }
+    //Step from the old deadline rather than from now so the period does not drift
+    now = time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC);
+    do
+    {
+        entry->deadline_ns += entry->period_ns;
+    } while(entry->deadline_ns <= now);
+    time_out_helper_wheel_add(&messenger->timers, timer, entry->deadline_ns);
 }
 
 /**
- * @brief Function that prints an internal message number
- * @param function
- * @param errornum
+ * @brief hand out every delayed and periodic message that is due
  */
-static inline void internal_print_error_number(const char *function, int errornum)
+static void internal_timers_expire(messenger_t *messenger)
 {
-    PRINT_MSG("**** %s had error %i: %s\r\n", function, errornum, strerror(errornum));
+    if(0 < messenger->timers.pending)
+    {
+        time_out_helper_wheel_advance(&messenger->timers, time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC));
+    }
 }
 
 /**
- * Internal function for sending a message
- * @param msg
+ * @brief get how long the dispatch thread may sleep before a timer needs it
+ * @return the time in nanoseconds, LOCAL_MESSENGER_RING_WAIT_FOREVER if no timers are pending
+ */
+static uint64_t internal_timers_wait_ns(messenger_t *messenger)
+{
+    uint64_t deadline = time_out_helper_wheel_next_deadline(&messenger->timers);
+    uint64_t now;
+    if(TIME_OUT_HELPER_NEVER == deadline)
+    {
+        return LOCAL_MESSENGER_RING_WAIT_FOREVER;
+    }
+    now = time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC);
+    return (deadline > now) ? deadline - now : 0;
+}
+
+/**
+ * @brief The task that wakes the dispatch thread of a System V channel when a timer is due.
+ * msgrcv can not time out, so a wake action is sent to interrupt it
+ * @param args the channel
  */
-static void internal_message_send(struct local_messanger_internal_message_s *msg)
+static void *internal_timer_waker(void *args)
 {
-    int result = -1;
-    time_out_helper_data_s time_data;
-    struct module_message_transaction_data_s data;
-    data.mtype = MODULE_MESSAGE_TYPE;
-    memcpy(data.mdata, msg, sizeof(struct local_messanger_internal_message_s));
-    time_out_helper_init(&time_data, TIME_OUT_MS);
-    while(false == time_out_helper_check(&time_data) && result < 0)
+    messenger_t *messenger = args;
+    struct local_messenger_message_header_s header = local_messenger_build_action(LOCAL_MESSENGER_ACTION_TIMER_WAKE);
+    struct timespec deadline;
+    uint64_t now;
+    assert(0 == pthread_mutex_lock(&messenger->timer_mutex));
+    while(false == messenger->timer_thread_stop)
     {
-        result = msgsnd(messenger_module_data.queue_id, &data, sizeof(struct local_messanger_internal_message_s), IPC_NOWAIT);
-        if(0 > result)
+        if(TIME_OUT_HELPER_NEVER == messenger->timer_wake_ns)
+        {
+            pthread_cond_wait(&messenger->timer_cond, &messenger->timer_mutex);
+            continue;
+        }
+        now = time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC);
+        if(now >= messenger->timer_wake_ns)
         {
-            internal_print_error_number("msgsnd", errno);
+            messenger->timer_wake_ns = TIME_OUT_HELPER_NEVER;
+            pthread_mutex_unlock(&messenger->timer_mutex);
+            //Do not wait for room. A full queue wakes the dispatch thread by itself
+            internal_message_send_deadline(messenger, LOCAL_MESSENGER_PRIORITY_HIGHEST, &header, NULL, NULL);
+            assert(0 == pthread_mutex_lock(&messenger->timer_mutex));
+            continue;
         }
+        internal_deadline_after_ns(&deadline, messenger->timer_wake_ns - now);
+        pthread_cond_timedwait(&messenger->timer_cond, &messenger->timer_mutex, &deadline);
     }
-    PRINT_MSG("%s result: %i\r\n", __FUNCTION__, result);
-    assert(0 <= result);
+    pthread_mutex_unlock(&messenger->timer_mutex);
+    return NULL;
 }
 
 /**
- * @brief register a callback to call when a message is received
- * @param cb The callback in question
+ * @brief have the timer waker wake the dispatch thread when the next timer is due.
+ * Starts the waker the first time a timer is pending
  */
-void messenger_register_callback(messenger_on_messaage_rcv cb)
+static void internal_timer_waker_arm(messenger_t *messenger)
 {
-    init_if_needed();
-    assert(NULL != cb);
-    assert(NULL == messenger_module_data.cb); //We do not support overwriting the callback
-    messenger_module_data.cb = cb;
+    uint64_t deadline = time_out_helper_wheel_next_deadline(&messenger->timers);
+    if(TIME_OUT_HELPER_NEVER != deadline && false == messenger->timer_thread_running)
+    {
+        messenger->timer_thread_stop = false;
+        messenger->timer_wake_ns = TIME_OUT_HELPER_NEVER;
+        assert(0 == pthread_create(&messenger->timer_thread, NULL, internal_timer_waker, messenger));
+        messenger->timer_thread_running = true;
+    }
+    if(true == messenger->timer_thread_running)
+    {
+        assert(0 == pthread_mutex_lock(&messenger->timer_mutex));
+        if(deadline != messenger->timer_wake_ns)
+        {
+            messenger->timer_wake_ns = deadline;
+            pthread_cond_signal(&messenger->timer_cond);
+        }
+        pthread_mutex_unlock(&messenger->timer_mutex);
+    }
 }
 
 /**
- * Kill the messenger task and reset the module
+ * @brief stop the timer waker if it was started
  */
-void messenger_kill(void)
+static void internal_timer_waker_stop(messenger_t *messenger)
 {
-    struct local_messanger_internal_message_s msg;
-    init_if_needed();
-    //Add the Kill Logic here
-    messenger_module_data.kill_master_thread = true;
-    msg = local_messenger_build_action(LOCAL_MESSENGER_ACTION_NONE);
-    internal_message_send(&msg);
-    pthread_join(messenger_module_data.master_thread, NULL);
-    messenger_module_data.initialized = false;
+    if(true == messenger->timer_thread_running)
+    {
+        assert(0 == pthread_mutex_lock(&messenger->timer_mutex));
+        messenger->timer_thread_stop = true;
+        pthread_cond_signal(&messenger->timer_cond);
+        pthread_mutex_unlock(&messenger->timer_mutex);
+        pthread_join(messenger->timer_thread, NULL);
+        messenger->timer_thread_running = false;
+    }
 }
 
 /**
- * @brief send a message over the sender
- * @param message ptr to the message data to send. It will be copied
- * @param message_size The size of the message to send.
+ * @brief handle a timer action sent to the dispatch thread
+ * @param msg the action message. Its payload is the ptr to the timer
  */
-void messenger_send(void *message, long message_size)
+static void internal_timer_action(messenger_t *messenger, struct local_messanger_internal_message_s *msg)
 {
-    struct local_messanger_internal_message_s msg;
-    assert(NULL != message);
-    assert(0 < message_size);
-    init_if_needed();
-    msg = local_messenger_build_user_msg(message, message_size);
-    internal_message_send(&msg);
+    messenger_timer_t *entry;
+    local_messenger_request_entry_s *request;
+    if(LOCAL_MESSENGER_ACTION_TIMER_WAKE == msg->header.action || LOCAL_MESSENGER_ACTION_NONE == msg->header.action)
+    {
+        return;
+    }
+    if(LOCAL_MESSENGER_ACTION_REQUEST_TIMEOUT == msg->header.action)
+    {
+        //The reply may already have beaten the timeout here
+        request = local_messenger_requests_find(&messenger->requests, msg->header.correlation_id);
+        if(NULL != request)
+        {
+            time_out_helper_wheel_add(&messenger->timers, &request->timer, request->deadline_ns);
+        }
+        return;
+    }
+    if(MESSENGER_TRANSPORT_SHM == messenger->transport)
+    {
+        //Another process can send on a shared memory channel and its timer ptrs point nowhere in ours
+        STATS_REJECTED(&messenger->stats);
+        return;
+    }
+    assert(sizeof(entry) == msg->header.message_size);
+    memcpy(&entry, msg->message_data, sizeof(entry));
+    if(LOCAL_MESSENGER_ACTION_TIMER_ADD == msg->header.action)
+    {
+        time_out_helper_wheel_add(&messenger->timers, &entry->timer, entry->deadline_ns);
+    }
+    else
+    {
+        assert(LOCAL_MESSENGER_ACTION_TIMER_CANCEL == msg->header.action);
+        time_out_helper_wheel_cancel(&messenger->timers, &entry->timer);
+        free(entry);
+    }
 }
 
+/**
+ * @brief free the delayed and periodic messages of a stopped channel, including those still on their way to the wheel
+ */
+static void internal_timers_drop(messenger_t *messenger)
+{
+    time_out_helper_timer_s *timer;
+    struct local_messanger_internal_message_s *msg;
+    messenger_timer_t *entry;
+    bool received = true;
+    while(NULL != (timer = time_out_helper_wheel_take_any(&messenger->timers)))
+    {
+        //Request timeouts live in the request table, the rest are delayed and periodic messages
+        if(internal_timer_expired == timer->callback)
+        {
+            free(timer->context);
+        }
+    }
+    while(true == received)
+    {
+        received = false;
+        while(NULL != (msg = internal_message_receive(messenger, false)))
+        {
+            received = true;
+            if(LOCAL_MESSAGE_TYPE_INTERNAL_ACTION == msg->header.type && LOCAL_MESSENGER_ACTION_TIMER_ADD == msg->header.action &&
+                    MESSENGER_TRANSPORT_SHM != messenger->transport)
+            {
+                memcpy(&entry, msg->message_data, sizeof(entry));
+                free(entry);
+            }
+            else if(LOCAL_MESSAGE_TYPE_BUFFER == msg->header.type && MESSENGER_TRANSPORT_SHM != messenger->transport)
+            {
+                //The reference the channel held for the dropped handle
+                local_messenger_buffer_release(dispatch_buffer_of(msg));
+            }
+        }
+        internal_message_release(messenger);
+    }
+}
+
+/**
+ * @brief park the central messenger until the channel is reused or torn down.
+ * Anything still queued is dropped like it is on a kill
+ * @param messenger the channel
+ */
+static void central_messenger_park(messenger_t *messenger)
+{
+    internal_timers_drop(messenger);
+    internal_space_released(messenger);
+    assert(0 == pthread_mutex_lock(&messenger->park_mutex));
+    messenger->parked = true;
+    pthread_cond_broadcast(&messenger->park_cond);
+    while(true == messenger->parked && false == messenger->park_exit)
+    {
+        pthread_cond_wait(&messenger->park_cond, &messenger->park_mutex);
+    }
+    if(true == messenger->park_exit)
+    {
+        messenger->kill_master_thread = true;
+    }
+    pthread_mutex_unlock(&messenger->park_mutex);
+}
+
+/**
+ * @brief hand out a received message and what is queued behind it. Runs on the master thread,
+ * or on the owner's thread for a pollable channel
+ * @param c_message the first message. May be NULL
+ * @param max_messages the most messages to take off the transport
+ * @return the number of messages taken off the transport
+ */
+static unsigned int central_messenger_dispatch(messenger_t *messenger, struct local_messanger_internal_message_s *c_message, unsigned int max_messages)
+{
+    struct local_messanger_internal_message_s *buffer_msg;
+    messenger_t *outer = dispatching_messenger;
+    unsigned int count = 0;
+    unsigned int taken = 0;
+    //A pollable channel can be dispatched from the callback of another channel
+    dispatching_messenger = messenger;
+    //Drain what is already queued so one wakeup covers a burst
+    while(NULL != c_message)
+    {
+        PRINT_MSG("%s received message\r\n", __FUNCTION__);
+        taken++;
+        switch(c_message->header.type)
+        {
+            case LOCAL_MESSAGE_TYPE_INTERNAL_ACTION:
+                PRINT_MSG("%s received message of type LOCAL_MESSAGE_TYPE_INTERNAL_ACTION\r\n", __FUNCTION__);
+                //Anything queued ahead of the action goes out first
+                dispatch_batch(messenger, count);
+                count = 0;
+                if(LOCAL_MESSENGER_ACTION_KILL == c_message->header.action)
+                {
+                    messenger->kill_master_thread = true;
+                }
+                else if(LOCAL_MESSENGER_ACTION_PARK == c_message->header.action)
+                {
+                    messenger->park_master_thread = true;
+                }
+                else
+                {
+                    internal_timer_action(messenger, c_message);
+                }
+                break;
+            case LOCAL_MESSAGE_TYPE_USR:
+            case LOCAL_MESSAGE_TYPE_USR_KEYED:
+                PRINT_MSG("%s received message of type LOCAL_MESSAGE_TYPE_USR\r\n", __FUNCTION__);
+                STATS_RECEIVED(&messenger->stats, (uint64_t)c_message->header.message_size);
+                if(0 < messenger->worker_count)
+                {
+                    local_messenger_workers_submit(&messenger->workers, c_message);
+                    break;
+                }
+                messenger->batch[count].msg = c_message->message_data;
+                messenger->batch[count].message_size = c_message->header.message_size;
+                count++;
+                break;
+            case LOCAL_MESSAGE_TYPE_CONFLATED:
+                PRINT_MSG("%s received message of type LOCAL_MESSAGE_TYPE_CONFLATED\r\n", __FUNCTION__);
+                //The newest value of the key, however many were sent since the marker
+                if(false == local_messenger_conflation_take(&messenger->conflation, c_message->header.key, &messenger->conflated, &messenger->conflated_capacity))
+                {
+                    break;
+                }
+                STATS_RECEIVED(&messenger->stats, (uint64_t)messenger->conflated->header.message_size);
+                if(0 < messenger->worker_count)
+                {
+                    local_messenger_workers_submit(&messenger->workers, messenger->conflated);
+                    break;
+                }
+                //The value is taken into one buffer so it goes out on its own, in order with the messages ahead of it
+                dispatch_batch(messenger, count);
+                messenger->batch[0].msg = messenger->conflated->message_data;
+                messenger->batch[0].message_size = messenger->conflated->header.message_size;
+                dispatch_batch(messenger, 1);
+                count = 0;
+                break;
+            case LOCAL_MESSAGE_TYPE_BUFFER:
+                PRINT_MSG("%s received message of type LOCAL_MESSAGE_TYPE_BUFFER\r\n", __FUNCTION__);
+                //Another process can send on a shared memory channel and its handles point nowhere in ours
+                if(MESSENGER_TRANSPORT_SHM == messenger->transport)
+                {
+                    STATS_RECEIVED(&messenger->stats, 0);
+                    STATS_REJECTED(&messenger->stats);
+                    break;
+                }
+                STATS_RECEIVED(&messenger->stats, (uint64_t)local_messenger_buffer_msg(dispatch_buffer_of(c_message))->header.message_size);
+                if(0 < messenger->worker_count)
+                {
+                    local_messenger_workers_submit(&messenger->workers, c_message);
+                    break;
+                }
+                //The buffer header carries no send time so the latency is taken from the handle
+                dispatch_stats_latency(messenger, c_message, dispatch_stats_now());
+                buffer_msg = local_messenger_buffer_msg(dispatch_buffer_of(c_message));
+                messenger->batch[count].msg = buffer_msg->message_data;
+                messenger->batch[count].message_size = buffer_msg->header.message_size;
+                messenger->batch_buffers++;
+                count++;
+                break;
+            case LOCAL_MESSAGE_TYPE_TYPED:
+                PRINT_MSG("%s received message of type LOCAL_MESSAGE_TYPE_TYPED\r\n", __FUNCTION__);
+                STATS_RECEIVED(&messenger->stats, (uint64_t)c_message->header.message_size);
+                if(NULL == dispatch_typed_handler(messenger, c_message))
+                {
+                    STATS_REJECTED(&messenger->stats);
+                    dispatch_journal_ack(messenger, c_message);
+                    break;
+                }
+                if(0 < messenger->worker_count)
+                {
+                    local_messenger_workers_submit(&messenger->workers, c_message);
+                    break;
+                }
+                //Keep the message in order with the user messages ahead of it
+                dispatch_batch(messenger, count);
+                count = 0;
+                dispatch_typed(messenger, c_message);
+                dispatch_journal_ack(messenger, c_message);
+                break;
+            case LOCAL_MESSAGE_TYPE_PUBLISH:
+                PRINT_MSG("%s received message of type LOCAL_MESSAGE_TYPE_PUBLISH\r\n", __FUNCTION__);
+                STATS_RECEIVED(&messenger->stats, (uint64_t)c_message->header.message_size);
+                //Another process can send on a shared memory channel so the topic is not trusted
+                if(LOCAL_MESSENGER_MAX_TOPICS <= c_message->header.topic)
+                {
+                    STATS_REJECTED(&messenger->stats);
+                    dispatch_journal_ack(messenger, c_message);
+                    break;
+                }
+                if(0 < messenger->worker_count)
+                {
+                    local_messenger_workers_submit(&messenger->workers, c_message);
+                    break;
+                }
+                //Keep the message in order with the user messages ahead of it
+                dispatch_batch(messenger, count);
+                count = 0;
+                dispatch_publish(messenger, c_message);
+                dispatch_journal_ack(messenger, c_message);
+                break;
+            case LOCAL_MESSAGE_TYPE_REQUEST:
+                PRINT_MSG("%s received message of type LOCAL_MESSAGE_TYPE_REQUEST\r\n", __FUNCTION__);
+                STATS_RECEIVED(&messenger->stats, (uint64_t)c_message->header.message_size);
+                //The channel to reply to is a ptr, and on a shared memory channel it may be from another process
+                if(MESSENGER_TRANSPORT_SHM == messenger->transport)
+                {
+                    STATS_REJECTED(&messenger->stats);
+                    break;
+                }
+                if(0 < messenger->worker_count)
+                {
+                    local_messenger_workers_submit(&messenger->workers, c_message);
+                    break;
+                }
+                dispatch_batch(messenger, count);
+                count = 0;
+                dispatch_request(messenger, c_message);
+                break;
+            case LOCAL_MESSAGE_TYPE_REPLY:
+                PRINT_MSG("%s received message of type LOCAL_MESSAGE_TYPE_REPLY\r\n", __FUNCTION__);
+                STATS_RECEIVED(&messenger->stats, (uint64_t)c_message->header.message_size);
+                //Replies stay on the dispatch thread even with workers since it owns the request timeouts
+                dispatch_batch(messenger, count);
+                count = 0;
+                dispatch_reply(messenger, c_message);
+                break;
+            default:
+                //Only another process sending on a shared memory channel can get a type wrong
+                assert(MESSENGER_TRANSPORT_SHM == messenger->transport);
+                STATS_REJECTED(&messenger->stats);
+                break;
+        }
+        if(messenger->dispatch_batch == count || max_messages == taken || true == messenger->kill_master_thread || true == messenger->park_master_thread)
+        {
+            break;
+        }
+        c_message = internal_message_receive(messenger, false);
+    }
+    dispatch_batch(messenger, count);
+    internal_message_release(messenger);
+    internal_space_released(messenger);
+    dispatch_dropped_replies(messenger);
+    dispatching_messenger = outer;
+    return taken;
+}
+
+/**
+ * @brief The Central messenger task
+ * @param args
+ */
+static void *central_messenger(void *args)
+{
+    messenger_t *messenger = args;
+    while(false == messenger->kill_master_thread)
+    {
+        internal_timers_expire(messenger);
+        PRINT_MSG("%s waiting on message\r\n", __FUNCTION__);
+        central_messenger_dispatch(messenger, internal_message_receive(messenger, true), UINT_MAX);
+        if(true == messenger->park_master_thread)
+        {
+            messenger->park_master_thread = false;
+            central_messenger_park(messenger);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Initialize the ipc message queue
+ */
+static inline void init_msg_queue(messenger_t *messenger)
+{
+    int error_number;
+    int result;
+    result = msgget(IPC_PRIVATE, IPC_CREAT | IPC_EXCL | 0666);
+    if(0  > result)
+    {
+        error_number = errno;
+        switch(error_number)
+        {
+            case EACCES:
+                PRINT_MSG("-----msgget returned EACCES\r\n");
+                break;
+            case EEXIST:
+                PRINT_MSG("-----msgget returned EEXIST\r\n");
+                break;
+            case ENOENT:
+                PRINT_MSG("-----msgget returned ENOENT\r\n");
+                break;
+            case ENOMEM:
+                PRINT_MSG("-----msgget returned ENOMEM\r\n");
+                break;
+            case ENOSPC:
+                PRINT_MSG("-----msgget returned ENOSPC\r\n");
+                break;
+            default:
+                PRINT_MSG("Error Unknown error\r\n");
+                assert(false);
+        }
+    }
+    messenger->queue_id = result;
+}
+
+/**
+ * @brief get the largest message the kernel will put on a System V queue
+ * @return the max size in bytes
+ */
+static inline long sysv_max_frame_size(messenger_t *messenger)
+{
+#ifdef __linux__
+    struct msginfo info;
+    assert(0 <= msgctl(0, IPC_INFO, (struct msqid_ds *)&info));
+    return info.msgmax;
+#else
+    struct msqid_ds queue_data;
+    assert(0 == msgctl(messenger->queue_id, IPC_STAT, &queue_data));
+    return (long)queue_data.msg_qbytes;
+#endif //__linux__
+}
+
+/**
+ * @brief get the number of bytes the System V queue holds
+ * @return the queue capacity in bytes
+ */
+static inline uint64_t sysv_queue_capacity(messenger_t *messenger)
+{
+    struct msqid_ds queue_data;
+    assert(0 == msgctl(messenger->queue_id, IPC_STAT, &queue_data));
+    return (uint64_t)queue_data.msg_qbytes;
+}
+
+/**
+ * @brief make sure the System V receive buffer is at least a given size.
+ * Only call while no received messages are in use
+ * @param size the buffer size in bytes
+ */
+static void sysv_reserve_receive_buffer(messenger_t *messenger, size_t size)
+{
+    assert(0 == messenger->rcv_offset);
+    if(messenger->rcv_buffer_size < size)
+    {
+        free(messenger->rcv_buffer);
+        messenger->rcv_buffer = malloc(size);
+        assert(NULL != messenger->rcv_buffer);
+        messenger->rcv_buffer_size = size;
+    }
+}
+
+/**
+ * @brief tell if a channel carries its messages in rings
+ * @return true for the in process and the shared memory rings
+ */
+static inline bool internal_uses_ring(messenger_t *messenger)
+{
+    return (MESSENGER_TRANSPORT_RING == messenger->transport || MESSENGER_TRANSPORT_SHM == messenger->transport);
+}
+
+/**
+ * @brief Set up the transport selected for the module
+ */
+static inline void init_transport(messenger_t *messenger)
+{
+    messenger->batch = malloc(messenger->dispatch_batch * sizeof(messenger_message_s));
+    assert(NULL != messenger->batch);
+    switch(messenger->transport)
+    {
+        case MESSENGER_TRANSPORT_SYSV_QUEUE:
+            init_msg_queue(messenger);
+            messenger->max_message_size = sysv_max_frame_size(messenger) - (long)sizeof(struct local_messenger_message_header_s);
+            messenger->capacity_bytes = sysv_queue_capacity(messenger);
+            atomic_store(&messenger->sysv_queued_bytes, 0);
+            //Start out sized for a batch of small messages. The buffer grows if a larger one shows up
+            messenger->rcv_offset = 0;
+            sysv_reserve_receive_buffer(messenger, messenger->dispatch_batch * ALIGN_TO_LONG(sizeof(struct module_message_transaction_data_s) + sizeof(struct local_messenger_message_header_s) + LOCAL_MESSENGER_MAX_MESSAGE_SIZE));
+            break;
+        case MESSENGER_TRANSPORT_RING:
+            for(unsigned int priority = 0; priority < LOCAL_MESSENGER_PRIORITY_LEVELS; priority++)
+            {
+                local_messenger_ring_init(&messenger->rings[priority], messenger->ring_size);
+                local_messenger_ring_share_wake(&messenger->rings[priority], &messenger->rings[0]);
+            }
+            messenger->max_message_size = (long)(local_messenger_ring_max_record(&messenger->rings[0]) - sizeof(struct local_messenger_message_header_s));
+            messenger->capacity_bytes = messenger->ring_size;
+            break;
+        case MESSENGER_TRANSPORT_SHM:
+            //Other processes find the rings by the channel name
+            local_messenger_shm_create(&messenger->shm, messenger->name, messenger->rings, LOCAL_MESSENGER_PRIORITY_LEVELS, messenger->ring_size);
+            messenger->space_waiters = &messenger->shm.header->space_waiters;
+            messenger->max_message_size = (long)(local_messenger_ring_max_record(&messenger->rings[0]) - sizeof(struct local_messenger_message_header_s));
+            messenger->capacity_bytes = messenger->ring_size;
+            break;
+        default:
+            assert(false);
+            break;
+    }
+}
+
+/**
+ * @brief Release the transport once the central messenger has stopped
+ */
+static inline void destroy_transport(messenger_t *messenger)
+{
+    free(messenger->batch);
+    messenger->batch = NULL;
+    switch(messenger->transport)
+    {
+        case MESSENGER_TRANSPORT_SYSV_QUEUE:
+            //The kernel keeps a queue until it is removed, even after the process exits
+            assert(0 == msgctl(messenger->queue_id, IPC_RMID, NULL));
+            messenger->queue_id = -1;
+            free(messenger->rcv_buffer);
+            messenger->rcv_buffer = NULL;
+            messenger->rcv_buffer_size = 0;
+            break;
+        case MESSENGER_TRANSPORT_RING:
+        case MESSENGER_TRANSPORT_SHM:
+            for(unsigned int priority = 0; priority < LOCAL_MESSENGER_PRIORITY_LEVELS; priority++)
+            {
+                local_messenger_ring_destroy(&messenger->rings[priority]);
+            }
+            if(MESSENGER_TRANSPORT_SHM == messenger->transport)
+            {
+                local_messenger_shm_close(&messenger->shm);
+                messenger->space_waiters = &messenger->local_space_waiters;
+            }
+            break;
+        default:
+            assert(false);
+            break;
+    }
+}
+
+/**
+ * @brief create the master thread of a channel on its CPUs and with its scheduling policy
+ * @param messenger the channel
+ */
+static void internal_master_thread_start(messenger_t *messenger)
+{
+    pthread_attr_t attr;
+    int result;
+#ifdef __linux__
+    cpu_set_t cpus;
+    struct sched_param param;
+#endif //__linux__
+    assert(0 == pthread_attr_init(&attr));
+#ifdef __linux__
+    if(0 != messenger->cpu_mask)
+    {
+        CPU_ZERO(&cpus);
+        for(unsigned int cpu = 0; cpu < 64; cpu++)
+        {
+            if(0 != (messenger->cpu_mask & (1ULL << cpu)))
+            {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+        assert(0 == pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus));
+    }
+    if(0 < messenger->sched_priority)
+    {
+        param.sched_priority = messenger->sched_priority;
+        assert(0 == pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED));
+        assert(0 == pthread_attr_setschedpolicy(&attr, SCHED_FIFO));
+        assert(0 == pthread_attr_setschedparam(&attr, &param));
+    }
+#else
+    assert(0 == messenger->cpu_mask && 0 == messenger->sched_priority);
+#endif //__linux__
+    result = pthread_create(&messenger->master_thread, &attr, central_messenger, messenger);
+    if(EPERM == result)
+    {
+        //SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO. A channel on the default policy beats no channel
+        PRINT_MSG("%s no permission for SCHED_FIFO on channel %s\r\n", __FUNCTION__, messenger->name);
+        assert(0 == pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED));
+        result = pthread_create(&messenger->master_thread, &attr, central_messenger, messenger);
+    }
+    assert(0 == result);
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * @brief Start the transport and dispatch thread of a channel
+ * @param messenger the channel to start
+ */
+static void messenger_start(messenger_t *messenger)
+{
+    PRINT_MSG("%s starting channel %s\r\n", __FUNCTION__, messenger->name);
+    init_transport(messenger);
+    time_out_helper_wheel_init(&messenger->timers, LOCAL_MESSENGER_TIMER_TICK_NS);
+    atomic_store_explicit(&messenger->cb, NULL, memory_order_relaxed);
+    atomic_store_explicit(&messenger->batch_cb, NULL, memory_order_relaxed);
+    atomic_store_explicit(&messenger->context_cb, NULL, memory_order_relaxed);
+    atomic_store_explicit(&messenger->request_cb, NULL, memory_order_relaxed);
+    //Everything the master thread reads is set up before it is created, so there is nothing to wait for
+    messenger->kill_master_thread = false;
+    if(0 < messenger->worker_count)
+    {
+        local_messenger_workers_init(&messenger->workers, messenger->worker_count, dispatch_worker_message, messenger);
+    }
+    if(true == messenger->pollable)
+    {
+#ifdef __linux__
+        messenger->poll_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif //__linux__
+        assert(0 <= messenger->poll_fd);
+        //Commits write the eventfd instead of waking a master thread. The rings start out empty so arming succeeds
+        local_messenger_ring_set_wake_fd(&messenger->rings[0], messenger->poll_fd);
+        assert(true == local_messenger_ring_arm_any(messenger->rings, LOCAL_MESSENGER_PRIORITY_LEVELS));
+        return;
+    }
+    internal_master_thread_start(messenger);
+}
+
+/**
+ * @brief Stop the dispatch thread of a channel and release its transport
+ * @param messenger the channel to stop
+ */
+static void messenger_stop(messenger_t *messenger)
+{
+    struct local_messenger_message_header_s header;
+    if(true == messenger->pollable)
+    {
+        //There is no master thread. The owner has stopped dispatching so the transport is ours
+        if(0 < messenger->workers.count)
+        {
+            local_messenger_workers_destroy(&messenger->workers);
+        }
+        internal_timers_drop(messenger);
+        local_messenger_requests_cancel_all(&messenger->requests);
+        destroy_transport(messenger);
+        close(messenger->poll_fd);
+        messenger->poll_fd = -1;
+        return;
+    }
+    if(true == messenger->parked)
+    {
+        //A parked master thread is not reading the transport so it is told directly
+        assert(0 == pthread_mutex_lock(&messenger->park_mutex));
+        messenger->park_exit = true;
+        pthread_cond_broadcast(&messenger->park_cond);
+        pthread_mutex_unlock(&messenger->park_mutex);
+    }
+    else
+    {
+        header = local_messenger_build_action(LOCAL_MESSENGER_ACTION_KILL);
+        //Actions go in the top lane so a backlog of user messages can not hold them up.
+        //The dispatch thread keeps taking messages off, so keep trying until there is room
+        while(MESSENGER_SEND_OK != internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_HIGHEST, &header, NULL))
+        {
+        }
+    }
+    pthread_join(messenger->master_thread, NULL);
+    internal_timer_waker_stop(messenger);
+    if(0 < messenger->workers.count)
+    {
+        local_messenger_workers_destroy(&messenger->workers);
+    }
+    internal_timers_drop(messenger);
+    //Anyone still waiting on a reply is told it will not come
+    local_messenger_requests_cancel_all(&messenger->requests);
+    destroy_transport(messenger);
+}
+
+/**
+ * @brief park the master thread of a channel and reset the channel so it can be reused.
+ * The transport and the master thread are kept, anything queued is dropped
+ * @param messenger the channel to park
+ */
+static void messenger_park(messenger_t *messenger)
+{
+    struct local_messenger_message_header_s header;
+    header = local_messenger_build_action(LOCAL_MESSENGER_ACTION_PARK);
+    while(MESSENGER_SEND_OK != internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_HIGHEST, &header, NULL))
+    {
+    }
+    assert(0 == pthread_mutex_lock(&messenger->park_mutex));
+    while(false == messenger->parked)
+    {
+        pthread_cond_wait(&messenger->park_cond, &messenger->park_mutex);
+    }
+    pthread_mutex_unlock(&messenger->park_mutex);
+    internal_timer_waker_stop(messenger);
+    if(0 < messenger->workers.count)
+    {
+        //The workers finish the messages handed out before the park
+        local_messenger_workers_destroy(&messenger->workers);
+    }
+    //The master thread is parked so nothing else touches the channel
+    local_messenger_requests_cancel_all(&messenger->requests);
+    //Their markers went with the rest of the queue
+    local_messenger_conflation_drop(&messenger->conflation);
+    atomic_store(&messenger->cb, NULL);
+    atomic_store(&messenger->batch_cb, NULL);
+    atomic_store(&messenger->context_cb, NULL);
+    atomic_store(&messenger->request_cb, NULL);
+    atomic_store(&messenger->watermark_cb, NULL);
+    atomic_store(&messenger->above_high_watermark, false);
+    for(unsigned int topic = 0; topic < LOCAL_MESSENGER_MAX_TOPICS; topic++)
+    {
+        atomic_store(&messenger->topics[topic].count, 0);
+        atomic_store(&messenger->topics[topic].used, 0);
+    }
+    for(unsigned int type_id = 0; type_id < LOCAL_MESSENGER_MAX_MESSAGE_TYPES; type_id++)
+    {
+        atomic_store(&messenger->handlers[type_id].cb, NULL);
+    }
+#if LOCAL_MESSENGER_STATS
+    //The next user of the channel starts counting from zero
+    memset(&messenger->stats, 0, sizeof(messenger->stats));
+#endif //LOCAL_MESSENGER_STATS
+}
+
+/**
+ * @brief wake a parked channel back up
+ * @param messenger the channel
+ */
+static void messenger_unpark(messenger_t *messenger)
+{
+    if(0 < messenger->worker_count)
+    {
+        local_messenger_workers_init(&messenger->workers, messenger->worker_count, dispatch_worker_message, messenger);
+    }
+    assert(0 == pthread_mutex_lock(&messenger->park_mutex));
+    messenger->parked = false;
+    pthread_cond_broadcast(&messenger->park_cond);
+    pthread_mutex_unlock(&messenger->park_mutex);
+}
+
+/**
+ * @brief tell if a parked channel was started with a config
+ * @param messenger the parked channel
+ * @param config the config
+ * @return true if the channel can be reused for the config
+ */
+static bool messenger_matches_config(const messenger_t *messenger, const messenger_config_t *config)
+{
+    return (config->transport == messenger->transport && config->ring_size == messenger->ring_size &&
+            config->dispatch_batch == messenger->dispatch_batch && config->workers == messenger->worker_count &&
+            config->pollable == messenger->pollable && config->wait_strategy == messenger->wait_strategy &&
+            config->spin_us == messenger->spin_us && config->cpu_mask == messenger->cpu_mask &&
+            config->sched_priority == messenger->sched_priority && NULL == config->journal_path);
+}
+
+/**
+ * @brief Function that initializes the messaging module if needed
+ * @return the default channel
+ */
+static messenger_t *init_if_needed(void)
+{
+    //Pairs with the release store below so a started channel is seen fully set up
+    messenger_t *messenger = atomic_load_explicit(&messenger_module_data.default_messenger, memory_order_acquire);
+    if(NULL != messenger)
+    {
+        return messenger;
+    }
+    assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
+    messenger = atomic_load_explicit(&messenger_module_data.default_messenger, memory_order_relaxed);
+    if(NULL == messenger)
+    {
+        PRINT_MSG("%s initializing module\r\n", __FUNCTION__);
+        messenger = messenger_module_data.parked_messenger;
+        messenger_module_data.parked_messenger = NULL;
+        if(NULL != messenger && true == messenger_matches_config(messenger, &messenger_module_data.default_config))
+        {
+            //Warm restart. Reuse the queue and the master thread
+            messenger_unpark(messenger);
+        }
+        else
+        {
+            if(NULL != messenger)
+            {
+                messenger_destroy(messenger);
+            }
+            messenger = messenger_create(&messenger_module_data.default_config);
+        }
+        atomic_store_explicit(&messenger_module_data.default_messenger, messenger, memory_order_release);
+    }
+    pthread_mutex_unlock(&messenger_module_data.init_mutex);
+    return messenger;
+}
+
+/**
+ * @brief poll the transport for a message before the master thread goes to sleep
+ * @param messenger the channel
+ * @param wait_ns how long the master thread may wait. The time spent polling is taken off
+ * @return ptr to the message, NULL if none showed up
+ */
+static struct local_messanger_internal_message_s *internal_message_spin(messenger_t *messenger, uint64_t *wait_ns)
+{
+    struct local_messanger_internal_message_s *msg;
+    uint64_t spin_ns = (messenger->spin_ns < wait_ns[0]) ? messenger->spin_ns : wait_ns[0];
+    uint64_t start = time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC);
+    uint64_t spent = 0;
+    //A message that shows up while polling is taken without a sleep and a wakeup
+    while(NULL == (msg = internal_message_receive(messenger, false)) && spent < spin_ns)
+    {
+        CPU_RELAX();
+        spent = time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC) - start;
+    }
+    if(LOCAL_MESSENGER_RING_WAIT_FOREVER != wait_ns[0])
+    {
+        wait_ns[0] -= (spent < wait_ns[0]) ? spent : wait_ns[0];
+    }
+    return msg;
+}
+
+/**
+ * @brief internal function for receiving a message
+ * @param wait true to block until a message arrives
+ * @return ptr to the message, NULL if there was none or the wait was interrupted.
+ * The message is valid until internal_message_release is called
+ */
+static struct local_messanger_internal_message_s *internal_message_receive(messenger_t *messenger, bool wait)
+{
+    ssize_t result;
+    uint64_t size;
+    size_t offset;
+    struct module_message_transaction_data_s *data;
+    struct local_messanger_internal_message_s *msg;
+    uint64_t wait_ns = LOCAL_MESSENGER_RING_WAIT_FOREVER;
+    if(true == wait)
+    {
+        //Only sleep until the next timer is due
+        wait_ns = internal_timers_wait_ns(messenger);
+        wait = (0 != wait_ns);
+    }
+    if(true == wait && 0 != messenger->spin_ns)
+    {
+        msg = internal_message_spin(messenger, &wait_ns);
+        if(NULL != msg)
+        {
+            return msg;
+        }
+        wait = (0 != wait_ns);
+    }
+    if(true == internal_uses_ring(messenger))
+    {
+        //Hand out the message where it sits in the ring. Higher priority rings are always emptied first
+        if(true == wait)
+        {
+            local_messenger_ring_wait_any_timeout(messenger->rings, LOCAL_MESSENGER_PRIORITY_LEVELS, wait_ns);
+            STATS_PEAK(&messenger->stats, internal_transport_used(messenger));
+        }
+        for(unsigned int priority = 0; priority < LOCAL_MESSENGER_PRIORITY_LEVELS; priority++)
+        {
+            while(NULL != (msg = local_messenger_ring_peek(&messenger->rings[priority], &size)))
+            {
+                //Only a channel with a journal puts journal positions in its frames
+                if(sizeof(struct local_messenger_message_header_s) <= size && size == local_messenger_frame_size(&msg->header) &&
+                   (0 == msg->header.journal_position || NULL != messenger->journal))
+                {
+                    return msg;
+                }
+                //Another process can send on a shared memory channel so the header is not trusted to match its record
+                assert(MESSENGER_TRANSPORT_SHM == messenger->transport);
+                STATS_REJECTED(&messenger->stats);
+            }
+        }
+        return NULL;
+    }
+    //Messages of a batch are received back to back so they all stay valid until released
+    offset = messenger->rcv_offset;
+    if(offset + sizeof(struct module_message_transaction_data_s) + sizeof(struct local_messenger_message_header_s) > messenger->rcv_buffer_size)
+    {
+        return NULL;
+    }
+    data = (struct module_message_transaction_data_s *)&messenger->rcv_buffer[offset];
+    if(true == wait)
+    {
+        internal_timer_waker_arm(messenger);
+    }
+    //Sleep in the kernel until a message shows up. messenger_kill wakes us with a kill action.
+    //A negative type takes the lowest type first, so higher priorities are taken first. Each lane stays in order
+    result = msgrcv(messenger->queue_id, data, messenger->rcv_buffer_size - offset - sizeof(struct module_message_transaction_data_s), -SYSV_LAST_MESSAGE_TYPE, (true == wait) ? 0 : IPC_NOWAIT);
+    if(0 > result)
+    {
+        if(E2BIG == errno && 0 == offset)
+        {
+            //The message stays on the queue. Grow the buffer and pick it up next time around
+            sysv_reserve_receive_buffer(messenger, 2 * messenger->rcv_buffer_size);
+        }
+        else
+        {
+            assert(EINTR == errno || ENOMSG == errno || E2BIG == errno);
+        }
+        return NULL;
+    }
+    msg = (struct local_messanger_internal_message_s *)data->mdata;
+    assert((size_t)result == local_messenger_frame_size(&msg->header));
+    if(true == wait)
+    {
+        //The message is still counted so this is the fill the wakeup found
+        STATS_PEAK(&messenger->stats, atomic_load_explicit(&messenger->sysv_queued_bytes, memory_order_relaxed));
+    }
+    atomic_fetch_sub_explicit(&messenger->sysv_queued_bytes, (uint64_t)result, memory_order_relaxed);
+    messenger->rcv_offset = offset + ALIGN_TO_LONG(sizeof(struct module_message_transaction_data_s) + (size_t)result);
+    return msg;
+}
+
+/**
+ * @brief internal function for releasing every message returned by internal_message_receive
+ */
+static void internal_message_release(messenger_t *messenger)
+{
+    if(true == internal_uses_ring(messenger))
+    {
+        for(unsigned int priority = 0; priority < LOCAL_MESSENGER_PRIORITY_LEVELS; priority++)
+        {
+            local_messenger_ring_release(&messenger->rings[priority]);
+        }
+    }
+    messenger->rcv_offset = 0;
+}
+
+/**
+ * @brief get the absolute time a number of nanoseconds from now
+ * @param deadline set to the deadline on SPACE_WAIT_CLOCK
+ * @param timeout_ns the number of nanoseconds
+ */
+static void internal_deadline_after_ns(struct timespec *deadline, uint64_t timeout_ns)
+{
+    assert(0 == clock_gettime(SPACE_WAIT_CLOCK, deadline));
+    timeout_ns += (uint64_t)deadline->tv_nsec;
+    deadline->tv_sec += (time_t)(timeout_ns / NS_PER_SEC);
+    deadline->tv_nsec = (long)(timeout_ns % NS_PER_SEC);
+}
+
+/**
+ * @brief get the absolute time a number of milliseconds from now
+ * @param deadline set to the deadline on SPACE_WAIT_CLOCK
+ * @param timeout_ms the number of milliseconds
+ */
+static void internal_deadline_after_ms(struct timespec *deadline, unsigned int timeout_ms)
+{
+    internal_deadline_after_ns(deadline, (uint64_t)timeout_ms * NS_PER_MS);
+}
+
+/**
+ * @brief get how full the transport is. For the ring that is the fullest lane
+ * @return the bytes in use
+ */
+static uint64_t internal_transport_used(messenger_t *messenger)
+{
+    uint64_t used = 0;
+    uint64_t lane_used;
+    if(true == internal_uses_ring(messenger))
+    {
+        for(unsigned int priority = 0; priority < LOCAL_MESSENGER_PRIORITY_LEVELS; priority++)
+        {
+            lane_used = local_messenger_ring_used(&messenger->rings[priority]);
+            used = (lane_used > used) ? lane_used : used;
+        }
+        return used;
+    }
+    return atomic_load_explicit(&messenger->sysv_queued_bytes, memory_order_relaxed);
+}
+
+/**
+ * @brief call the watermark callback if a send filled the transport past the high watermark
+ */
+static inline void internal_check_high_watermark(messenger_t *messenger)
+{
+    messenger_on_watermark callback = atomic_load_explicit(&messenger->watermark_cb, memory_order_acquire);
+    if(NULL == callback || true == atomic_load_explicit(&messenger->above_high_watermark, memory_order_relaxed))
+    {
+        return;
+    }
+    if(100 * internal_transport_used(messenger) >= (uint64_t)messenger->high_watermark * messenger->capacity_bytes)
+    {
+        //Only the producer that flips the state reports it
+        if(false == atomic_exchange(&messenger->above_high_watermark, true))
+        {
+            callback(messenger, true);
+        }
+    }
+}
+
+/**
+ * @brief called by the dispatch thread once it has handed room on the transport back.
+ * Wakes producers waiting for room and reports falling below the low watermark
+ */
+static void internal_space_released(messenger_t *messenger)
+{
+    messenger_on_watermark callback;
+    //Pairs with the fence in internal_space_wait_begin so either we see the waiter or it sees the room
+    atomic_thread_fence(memory_order_seq_cst);
+    if(0 != atomic_load_explicit(messenger->space_waiters, memory_order_relaxed))
+    {
+        if(MESSENGER_TRANSPORT_SHM == messenger->transport)
+        {
+            //The waiters may be in other processes so they sleep on a futex in the shared memory
+            local_messenger_shm_space_wake(&messenger->shm);
+        }
+        else
+        {
+            assert(0 == pthread_mutex_lock(&messenger->space_mutex));
+            pthread_cond_broadcast(&messenger->space_cond);
+            pthread_mutex_unlock(&messenger->space_mutex);
+        }
+    }
+    if(true == atomic_load_explicit(&messenger->above_high_watermark, memory_order_relaxed) &&
+       100 * internal_transport_used(messenger) <= (uint64_t)messenger->low_watermark * messenger->capacity_bytes)
+    {
+        callback = atomic_load_explicit(&messenger->watermark_cb, memory_order_acquire);
+        if(true == atomic_exchange(&messenger->above_high_watermark, false) && NULL != callback)
+        {
+            callback(messenger, false);
+        }
+    }
+}
+
+/**
+ * @brief get ready to sleep until the dispatch thread frees up room.
+ * Retry the send after this, before waiting, so room freed in between is not missed
+ * @return the room sequence to pass to internal_space_wait. Only used by the shared memory transport
+ */
+static uint32_t internal_space_wait_begin(messenger_t *messenger)
+{
+    atomic_fetch_add(messenger->space_waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if(MESSENGER_TRANSPORT_SHM == messenger->transport)
+    {
+        return local_messenger_shm_space_seq(&messenger->shm);
+    }
+    assert(0 == pthread_mutex_lock(&messenger->space_mutex));
+    return 0;
+}
+
+/**
+ * @brief sleep until the dispatch thread frees up room or the deadline passes
+ * @param deadline the absolute deadline on SPACE_WAIT_CLOCK
+ * @param seq the room sequence read before the last retry. Updated for the next retry
+ * @return false if the deadline passed
+ */
+static bool internal_space_wait(messenger_t *messenger, const struct timespec *deadline, uint32_t *seq)
+{
+    int result;
+    bool rv;
+    if(MESSENGER_TRANSPORT_SHM == messenger->transport)
+    {
+        rv = local_messenger_shm_space_wait(&messenger->shm, seq[0], deadline);
+        seq[0] = local_messenger_shm_space_seq(&messenger->shm);
+        return rv;
+    }
+    result = pthread_cond_timedwait(&messenger->space_cond, &messenger->space_mutex, deadline);
+    assert(0 == result || ETIMEDOUT == result);
+    return (0 == result);
+}
+
+/**
+ * @brief done waiting for room
+ */
+static void internal_space_wait_end(messenger_t *messenger)
+{
+    if(MESSENGER_TRANSPORT_SHM != messenger->transport)
+    {
+        pthread_mutex_unlock(&messenger->space_mutex);
+    }
+    atomic_fetch_sub(messenger->space_waiters, 1);
+}
+
+/**
+ * @brief write a message to the journal of its channel ahead of the transport and keep the position in its header
+ * @param header the message header. Left alone if the channel has no journal or the message is not journaled
+ * @param payload the message payload. header->message_size bytes long
+ */
+static inline void internal_journal_append(messenger_t *messenger, struct local_messenger_message_header_s *header, const void *payload)
+{
+    if(NULL != messenger->journal && 0 == header->journal_position && true == local_messenger_journal_wants(header))
+    {
+        header->journal_position = local_messenger_journal_append(messenger->journal, header, payload);
+    }
+}
+
+/**
+ * @brief make one attempt at putting a message on the transport
+ * @param priority the priority lane to send on
+ * @param header the message header
+ * @param payload the message payload
+ * @param data the assembled System V transaction. Only used by the System V transport
+ * @return true if the message was sent
+ */
+static bool internal_message_try_send(messenger_t *messenger, unsigned int priority, const struct local_messenger_message_header_s *header, const void *payload, struct module_message_transaction_data_s *data)
+{
+    int result;
+    if(true == internal_uses_ring(messenger))
+    {
+        return local_messenger_ring_write(&messenger->rings[priority], header, sizeof(struct local_messenger_message_header_s), payload, header->message_size);
+    }
+    //Count the bytes first so the dispatch thread never takes off more than was put on
+    atomic_fetch_add_explicit(&messenger->sysv_queued_bytes, local_messenger_frame_size(header), memory_order_relaxed);
+    result = msgsnd(messenger->queue_id, data, local_messenger_frame_size(header), IPC_NOWAIT);
+    if(0 > result)
+    {
+        atomic_fetch_sub_explicit(&messenger->sysv_queued_bytes, local_messenger_frame_size(header), memory_order_relaxed);
+        assert(EAGAIN == errno || EINTR == errno);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief get the payload size of the buffer a handle is sent for
+ * @param payload the payload of a LOCAL_MESSAGE_TYPE_BUFFER message, the buffer ptr
+ * @return the size of the buffer's message
+ */
+static inline uint64_t internal_buffer_bytes(const void *payload)
+{
+    local_messenger_buffer_s *buffer;
+    memcpy(&buffer, payload, sizeof(buffer));
+    return (uint64_t)local_messenger_buffer_msg(buffer)->header.message_size;
+}
+
+/**
+ * @brief put a message on the transport, sleeping until the deadline while the transport is full
+ * @param priority the priority lane to send on
+ * @param header the message header
+ * @param payload the message payload
+ * @param data the assembled System V transaction. Only used by the System V transport
+ * @param deadline the absolute deadline on SPACE_WAIT_CLOCK. NULL to not wait at all
+ * @return MESSENGER_SEND_OK if the message was sent
+ */
+static enum messenger_send_result_e internal_message_send_wait(messenger_t *messenger, unsigned int priority, const struct local_messenger_message_header_s *header, const void *payload,
+                                                              struct module_message_transaction_data_s *data, const struct timespec *deadline)
+{
+    bool sent;
+    uint32_t seq;
+#if LOCAL_MESSENGER_STATS
+    //A handle may be released by the dispatch thread as soon as it is sent, so the size of its buffer is read first
+    uint64_t bytes = (LOCAL_MESSAGE_TYPE_BUFFER == header->type) ? internal_buffer_bytes(payload) : (uint64_t)header->message_size;
+#endif //LOCAL_MESSENGER_STATS
+    sent = internal_message_try_send(messenger, priority, header, payload, data);
+    if(false == sent && NULL == deadline)
+    {
+        STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_WOULD_BLOCK, 1);
+        return MESSENGER_SEND_WOULD_BLOCK;
+    }
+    if(false == sent)
+    {
+        seq = internal_space_wait_begin(messenger);
+        while(false == (sent = internal_message_try_send(messenger, priority, header, payload, data)))
+        {
+            STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_RETRIES, 1);
+            if(false == internal_space_wait(messenger, deadline, &seq))
+            {
+                sent = internal_message_try_send(messenger, priority, header, payload, data);
+                break;
+            }
+        }
+        internal_space_wait_end(messenger);
+    }
+    PRINT_MSG("%s sent: %i\r\n", __FUNCTION__, sent);
+    if(false == sent)
+    {
+        STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_TIMEOUTS, 1);
+        return MESSENGER_SEND_TIMED_OUT;
+    }
+    if(LOCAL_MESSAGE_TYPE_INTERNAL_ACTION != header->type)
+    {
+        STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_SENT, 1);
+        STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_BYTES_SENT, bytes);
+    }
+    internal_check_high_watermark(messenger);
+    return MESSENGER_SEND_OK;
+}
+
+/**
+ * Internal function for sending a message
+ * @param priority the priority lane to send on
+ * @param header the message header
+ * @param payload the message payload. header->message_size bytes long
+ * @param deadline the absolute deadline on SPACE_WAIT_CLOCK. NULL to not wait at all
+ * @return MESSENGER_SEND_OK if the message was sent
+ */
+static enum messenger_send_result_e internal_message_send_deadline(messenger_t *messenger, unsigned int priority, const struct local_messenger_message_header_s *header, const void *payload,
+                                                                  const struct timespec *deadline)
+{
+    enum messenger_send_result_e rv;
+    size_t frame_size;
+    long stack_data[(sizeof(struct module_message_transaction_data_s) + sizeof(struct local_messenger_message_header_s) + LOCAL_MESSENGER_MAX_MESSAGE_SIZE + sizeof(long) - 1) / sizeof(long)];
+    struct module_message_transaction_data_s *data = NULL;
+    struct local_messenger_message_header_s journaled;
+    assert(NULL != header);
+    assert(NULL != payload || 0 == header->message_size);
+    assert(LOCAL_MESSENGER_PRIORITY_LEVELS > priority);
+    if(NULL != messenger->journal && 0 == header->journal_position && true == local_messenger_journal_wants(header))
+    {
+        //Periodic messages send the same header again so the position goes on a copy
+        journaled = *header;
+        internal_journal_append(messenger, &journaled, payload);
+        header = &journaled;
+    }
+    if(MESSENGER_TRANSPORT_SYSV_QUEUE == messenger->transport)
+    {
+        //msgsnd needs the message in one piece. Only go to the heap for large payloads
+        frame_size = local_messenger_frame_size(header);
+        data = (struct module_message_transaction_data_s *)stack_data;
+        if(sizeof(struct module_message_transaction_data_s) + frame_size > sizeof(stack_data))
+        {
+            data = malloc(sizeof(struct module_message_transaction_data_s) + frame_size);
+            assert(NULL != data);
+        }
+        data->mtype = SYSV_MESSAGE_TYPE(priority);
+        memcpy(data->mdata, header, sizeof(struct local_messenger_message_header_s));
+        if(0 != header->message_size)
+        {
+            memcpy(&data->mdata[sizeof(struct local_messenger_message_header_s)], payload, header->message_size);
+        }
+    }
+    rv = internal_message_send_wait(messenger, priority, header, payload, data, deadline);
+    if(MESSENGER_SEND_OK != rv && &journaled == header)
+    {
+        //The caller is told the message was not sent so it must not come back on a replay
+        local_messenger_journal_ack(messenger->journal, journaled.journal_position);
+    }
+    if(NULL != data && (void *)stack_data != (void *)data)
+    {
+        free(data);
+    }
+    return rv;
+}
+
+/**
+ * Internal function for sending a message. Waits up to TIME_OUT_MS for room
+ * @param priority the priority lane to send on
+ * @param header the message header
+ * @param payload the message payload. header->message_size bytes long
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+static enum messenger_send_result_e internal_message_send(messenger_t *messenger, unsigned int priority, const struct local_messenger_message_header_s *header, const void *payload)
+{
+    struct timespec deadline;
+    internal_deadline_after_ms(&deadline, TIME_OUT_MS);
+    return internal_message_send_deadline(messenger, priority, header, payload, &deadline);
+}
+
+/**
+ * @brief reserve a run of message slots in the ring, sleeping up to TIME_OUT_MS while the ring is full
+ * @param frame_sizes the size of each message
+ * @param count the number of messages
+ * @return ptr to the first reserved message. NULL if there was no room in time
+ */
+static struct local_messanger_internal_message_s *internal_ring_reserve(messenger_t *messenger, const uint64_t *frame_sizes, unsigned int count)
+{
+    struct local_messanger_internal_message_s *msg;
+    struct timespec deadline;
+    uint32_t seq;
+    msg = local_messenger_ring_reserve_many(&messenger->rings[LOCAL_MESSENGER_PRIORITY_DEFAULT], frame_sizes, count);
+    if(NULL == msg)
+    {
+        internal_deadline_after_ms(&deadline, TIME_OUT_MS);
+        seq = internal_space_wait_begin(messenger);
+        while(NULL == (msg = local_messenger_ring_reserve_many(&messenger->rings[LOCAL_MESSENGER_PRIORITY_DEFAULT], frame_sizes, count)))
+        {
+            STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_RETRIES, 1);
+            if(false == internal_space_wait(messenger, &deadline, &seq))
+            {
+                msg = local_messenger_ring_reserve_many(&messenger->rings[LOCAL_MESSENGER_PRIORITY_DEFAULT], frame_sizes, count);
+                break;
+            }
+        }
+        internal_space_wait_end(messenger);
+        if(NULL == msg)
+        {
+            STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_TIMEOUTS, 1);
+        }
+    }
+    return msg;
+}
+
+/**
+ * @brief send a batch of messages over the ring. Messages are reserved and committed in runs
+ * so a run costs one reservation and at most one wakeup
+ * @param messages the messages to send
+ * @param message_sizes the size of each message
+ * @param count the number of messages
+ * @return the number of messages sent. Less than count if the ring stayed full for TIME_OUT_MS
+ */
+static unsigned int internal_ring_send_batch(messenger_t *messenger, void **messages, const long *message_sizes, unsigned int count)
+{
+    uint64_t frame_sizes[LOCAL_MESSENGER_SEND_BATCH_CHUNK];
+    uint64_t positions[LOCAL_MESSENGER_SEND_BATCH_CHUNK];
+    struct local_messenger_message_header_s header;
+    uint64_t span_limit;
+    uint64_t span;
+    unsigned int run;
+    unsigned int sent = 0;
+    struct local_messanger_internal_message_s *first;
+    struct local_messanger_internal_message_s *msg;
+    span_limit = local_messenger_ring_footprint(local_messenger_ring_max_record(&messenger->rings[LOCAL_MESSENGER_PRIORITY_DEFAULT]));
+    while(sent < count)
+    {
+        run = 0;
+        span = 0;
+        while(sent + run < count && run < LOCAL_MESSENGER_SEND_BATCH_CHUNK)
+        {
+            frame_sizes[run] = sizeof(struct local_messenger_message_header_s) + message_sizes[sent + run];
+            span += local_messenger_ring_footprint(frame_sizes[run]);
+            if(0 != run && span > span_limit)
+            {
+                break;
+            }
+            run++;
+        }
+        //The journal can wait on the dispatch thread, which waits on the reserved room, so the run is journaled first
+        for(unsigned int i = 0; i < run; i++)
+        {
+            header = local_messenger_build_user_msg(message_sizes[sent + i]);
+            internal_journal_append(messenger, &header, messages[sent + i]);
+            positions[i] = header.journal_position;
+        }
+        first = internal_ring_reserve(messenger, frame_sizes, run);
+        if(NULL == first)
+        {
+            for(unsigned int i = 0; i < run && NULL != messenger->journal; i++)
+            {
+                //The caller is told these were not sent so they must not come back on a replay
+                local_messenger_journal_ack(messenger->journal, positions[i]);
+            }
+            break;
+        }
+        msg = first;
+        for(unsigned int i = 0; i < run; i++)
+        {
+            msg->header = local_messenger_build_user_msg(message_sizes[sent + i]);
+            msg->header.journal_position = positions[i];
+            memcpy(msg->message_data, messages[sent + i], message_sizes[sent + i]);
+            msg = local_messenger_ring_next_reserved(msg);
+        }
+        local_messenger_ring_commit_many(&messenger->rings[LOCAL_MESSENGER_PRIORITY_DEFAULT], first, run);
+        sent += run;
+    }
+#if LOCAL_MESSENGER_STATS
+    uint64_t bytes = 0;
+    for(unsigned int i = 0; i < sent; i++)
+    {
+        bytes += (uint64_t)message_sizes[i];
+    }
+    STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_SENT, sent);
+    STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_BYTES_SENT, bytes);
+#endif //LOCAL_MESSENGER_STATS
+    internal_check_high_watermark(messenger);
+    return sent;
+}
+
+/**
+ * @brief fill a config with the default settings
+ * @param config the config to fill
+ */
+void messenger_config_init(messenger_config_t *config)
+{
+    assert(NULL != config);
+    config->name = NULL;
+    config->transport = LOCAL_MESSENGER_DEFAULT_TRANSPORT;
+    config->ring_size = LOCAL_MESSENGER_RING_SIZE;
+    config->dispatch_batch = LOCAL_MESSENGER_DISPATCH_BATCH;
+    config->workers = LOCAL_MESSENGER_WORKERS;
+    config->pollable = false;
+    config->wait_strategy = LOCAL_MESSENGER_WAIT_STRATEGY;
+    config->spin_us = LOCAL_MESSENGER_SPIN_US;
+    config->cpu_mask = 0;
+    config->sched_priority = 0;
+    config->journal_path = NULL;
+    config->journal_segment_size = LOCAL_MESSENGER_JOURNAL_SEGMENT_SIZE;
+}
+
+/**
+ * @brief get how long the master thread of a channel polls the transport before sleeping
+ * @param config the channel settings
+ * @return the time in ns. UINT64_MAX to never sleep
+ */
+static uint64_t internal_spin_ns(const messenger_config_t *config)
+{
+    switch(config->wait_strategy)
+    {
+        case MESSENGER_WAIT_SPIN_THEN_PARK:
+            return (uint64_t)config->spin_us * NS_PER_US;
+        case MESSENGER_WAIT_BUSY_POLL:
+            return UINT64_MAX;
+        case MESSENGER_WAIT_PARK:
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief allocate a channel and set up its locks
+ * @return the channel. Nothing is running yet
+ */
+static messenger_t *internal_messenger_alloc(void)
+{
+    messenger_t *messenger;
+    pthread_condattr_t cond_attr;
+    size_t size;
+    //The ring keeps its producer and consumer state on separate cache lines
+    size = (sizeof(messenger_t) + LOCAL_MESSENGER_CACHE_LINE - 1) & ~((size_t)LOCAL_MESSENGER_CACHE_LINE - 1);
+    messenger = aligned_alloc(LOCAL_MESSENGER_CACHE_LINE, size);
+    assert(NULL != messenger);
+    memset(messenger, 0, sizeof(messenger_t));
+    messenger->space_waiters = &messenger->local_space_waiters;
+    messenger->poll_fd = -1;
+    local_messenger_requests_init(&messenger->requests, internal_request_expired, messenger);
+    local_messenger_conflation_init(&messenger->conflation);
+    assert(0 == pthread_mutex_init(&messenger->topic_mutex, NULL));
+    assert(0 == pthread_mutex_init(&messenger->space_mutex, NULL));
+    assert(0 == pthread_condattr_init(&cond_attr));
+#ifdef __linux__
+    assert(0 == pthread_condattr_setclock(&cond_attr, SPACE_WAIT_CLOCK));
+#endif //__linux__
+    assert(0 == pthread_cond_init(&messenger->space_cond, &cond_attr));
+    assert(0 == pthread_mutex_init(&messenger->timer_mutex, NULL));
+    assert(0 == pthread_cond_init(&messenger->timer_cond, &cond_attr));
+    pthread_condattr_destroy(&cond_attr);
+    assert(0 == pthread_mutex_init(&messenger->park_mutex, NULL));
+    assert(0 == pthread_cond_init(&messenger->park_cond, NULL));
+    return messenger;
+}
+
+/**
+ * @brief tear down the locks of a channel and free it
+ * @param messenger the channel. Nothing may be running
+ */
+static void internal_messenger_free(messenger_t *messenger)
+{
+    local_messenger_requests_destroy(&messenger->requests);
+    local_messenger_conflation_destroy(&messenger->conflation);
+    free(messenger->conflated);
+    pthread_mutex_destroy(&messenger->topic_mutex);
+    pthread_mutex_destroy(&messenger->space_mutex);
+    pthread_cond_destroy(&messenger->space_cond);
+    pthread_mutex_destroy(&messenger->timer_mutex);
+    pthread_cond_destroy(&messenger->timer_cond);
+    pthread_mutex_destroy(&messenger->park_mutex);
+    pthread_cond_destroy(&messenger->park_cond);
+    free(messenger);
+}
+
+/**
+ * @brief create a channel and start its dispatch thread
+ * @param config the channel settings. NULL for the defaults
+ * @return the new channel
+ */
+messenger_t *messenger_create(const messenger_config_t *config)
+{
+    messenger_t *messenger;
+    messenger_config_t defaults;
+    if(NULL == config)
+    {
+        messenger_config_init(&defaults);
+        config = &defaults;
+    }
+    assert(0 == (config->ring_size & (config->ring_size - 1)));
+    assert(0 < config->dispatch_batch);
+    assert(MESSENGER_TRANSPORT_SHM != config->transport || NULL != config->name); //Other processes attach by name
+    //Producers wake a pollable channel with an eventfd, so they have to be in this process
+    assert(false == config->pollable || MESSENGER_TRANSPORT_RING == config->transport);
+    assert(0 <= config->sched_priority);
+    //Processes that attach to a shared memory channel write into it without the journal
+    assert(NULL == config->journal_path || MESSENGER_TRANSPORT_SHM != config->transport);
+    messenger = internal_messenger_alloc();
+    messenger->transport = config->transport;
+    messenger->pollable = config->pollable;
+    messenger->wait_strategy = config->wait_strategy;
+    messenger->spin_us = config->spin_us;
+    messenger->spin_ns = internal_spin_ns(config);
+    messenger->cpu_mask = config->cpu_mask;
+    messenger->sched_priority = config->sched_priority;
+    if(NULL != config->journal_path)
+    {
+        messenger->journal = malloc(sizeof(local_messenger_journal_s));
+        assert(NULL != messenger->journal);
+        local_messenger_journal_open(messenger->journal, config->journal_path, config->journal_segment_size);
+    }
+    messenger->ring_size = config->ring_size;
+    messenger->dispatch_batch = config->dispatch_batch;
+    messenger->worker_count = config->workers;
+    if(NULL != config->name)
+    {
+        assert(strlen(config->name) < ARRAY_MAX_COUNT(messenger->name));
+        strncpy(messenger->name, config->name, ARRAY_MAX_COUNT(messenger->name) - 1);
+    }
+    messenger_start(messenger);
+    if(NULL != config->name)
+    {
+        assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
+        for(messenger_t *channel = messenger_module_data.channels; NULL != channel; channel = channel->next)
+        {
+            assert(0 != strcmp(channel->name, messenger->name)); //Channel names must be unique
+        }
+        messenger->next = messenger_module_data.channels;
+        messenger_module_data.channels = messenger;
+        pthread_mutex_unlock(&messenger_module_data.init_mutex);
+    }
+    return messenger;
+}
+
+/**
+ * @brief stop a channel's dispatch thread and free the channel
+ * @param messenger the channel to destroy
+ */
+void messenger_destroy(messenger_t *messenger)
+{
+    messenger_t **link;
+    assert(NULL != messenger);
+    if(true == messenger->attached)
+    {
+        //The channel belongs to another process. Only drop our mapping of it
+        local_messenger_shm_close(&messenger->shm);
+        internal_messenger_free(messenger);
+        return;
+    }
+    if(0 != messenger->name[0])
+    {
+        assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
+        for(link = &messenger_module_data.channels; NULL != link[0]; link = &link[0]->next)
+        {
+            if(messenger == link[0])
+            {
+                link[0] = messenger->next;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&messenger_module_data.init_mutex);
+    }
+    messenger_stop(messenger);
+    if(NULL != messenger->journal)
+    {
+        //Whatever the stop dropped is still unacknowledged in the journal for the next run
+        local_messenger_journal_close(messenger->journal);
+        free(messenger->journal);
+    }
+    internal_messenger_free(messenger);
+}
+
+/**
+ * @brief find a channel by name
+ * @param name the name the channel was created with
+ * @return the channel, NULL if there is no channel with that name
+ */
+messenger_t *messenger_lookup(const char *name)
+{
+    messenger_t *rv = NULL;
+    assert(NULL != name);
+    assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
+    for(messenger_t *channel = messenger_module_data.channels; NULL != channel; channel = channel->next)
+    {
+        if(0 == strcmp(channel->name, name))
+        {
+            rv = channel;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&messenger_module_data.init_mutex);
+    return rv;
+}
+
+/**
+ * @brief get a send only handle to a MESSENGER_TRANSPORT_SHM channel created by another process
+ * @param name the name the channel was created with
+ * @return the handle, NULL if no process has a channel with that name
+ */
+messenger_t *messenger_attach(const char *name)
+{
+    messenger_t *messenger;
+    assert(NULL != name);
+    assert(strlen(name) < LOCAL_MESSENGER_NAME_LENGTH);
+    messenger = internal_messenger_alloc();
+    messenger->transport = MESSENGER_TRANSPORT_SHM;
+    messenger->attached = true;
+    if(false == local_messenger_shm_attach(&messenger->shm, name, messenger->rings, LOCAL_MESSENGER_PRIORITY_LEVELS))
+    {
+        internal_messenger_free(messenger);
+        return NULL;
+    }
+    messenger->space_waiters = &messenger->shm.header->space_waiters;
+    messenger->ring_size = messenger->shm.header->ring_size;
+    messenger->max_message_size = (long)(local_messenger_ring_max_record(&messenger->rings[0]) - sizeof(struct local_messenger_message_header_s));
+    messenger->capacity_bytes = messenger->ring_size;
+    return messenger;
+}
+
+/**
+ * @brief register a callback to call when a message is received on a channel
+ * @param messenger the channel
+ * @param cb The callback in question
+ */
+void messenger_channel_register_callback(messenger_t *messenger, messenger_on_messaage_rcv cb)
+{
+    assert(NULL != messenger);
+    assert(false == messenger->attached); //Only the process that created the channel receives on it
+    assert(NULL != cb);
+    assert(NULL == atomic_load(&messenger->cb)); //We do not support overwriting the callback
+    assert(NULL == atomic_load(&messenger->batch_cb));
+    assert(NULL == atomic_load(&messenger->context_cb));
+    atomic_store_explicit(&messenger->cb, cb, memory_order_release);
+}
+
+/**
+ * @brief register a callback to call with batches of messages received on a channel
+ * @param messenger the channel
+ * @param cb The callback in question
+ */
+void messenger_channel_register_batch_callback(messenger_t *messenger, messenger_on_batch_rcv cb)
+{
+    assert(NULL != messenger);
+    assert(false == messenger->attached); //Only the process that created the channel receives on it
+    assert(NULL != cb);
+    assert(NULL == atomic_load(&messenger->cb)); //We do not support overwriting the callback
+    assert(NULL == atomic_load(&messenger->batch_cb));
+    assert(NULL == atomic_load(&messenger->context_cb));
+    atomic_store_explicit(&messenger->batch_cb, cb, memory_order_release);
+}
+
+/**
+ * @brief register a callback to call with a context when a message is received on a channel
+ * @param messenger the channel
+ * @param cb The callback in question
+ * @param context passed to cb
+ */
+void messenger_channel_register_context_callback(messenger_t *messenger, messenger_on_context_rcv cb, void *context)
+{
+    assert(NULL != messenger);
+    assert(false == messenger->attached); //Only the process that created the channel receives on it
+    assert(NULL != cb);
+    assert(NULL == atomic_load(&messenger->cb)); //We do not support overwriting the callback
+    assert(NULL == atomic_load(&messenger->batch_cb));
+    assert(NULL == atomic_load(&messenger->context_cb));
+    //The release store of the callback publishes the context with it
+    messenger->cb_context = context;
+    atomic_store_explicit(&messenger->context_cb, cb, memory_order_release);
+}
+
+/**
+ * @brief register the handler of a message type id on a channel
+ * @param messenger the channel
+ * @param type_id the message type id. Less than LOCAL_MESSENGER_MAX_MESSAGE_TYPES
+ * @param min_size the smallest message the handler accepts
+ * @param max_size the largest message the handler accepts
+ * @param cb the handler
+ * @param context passed to cb
+ */
+void messenger_channel_register_handler(messenger_t *messenger, uint32_t type_id, long min_size, long max_size, messenger_on_context_rcv cb, void *context)
+{
+    struct messenger_handler_s *handler;
+    assert(NULL != messenger);
+    assert(false == messenger->attached); //Only the process that created the channel receives on it
+    assert(NULL != cb);
+    assert(LOCAL_MESSENGER_MAX_MESSAGE_TYPES > type_id);
+    assert(0 < min_size);
+    assert(min_size <= max_size);
+    handler = &messenger->handlers[type_id];
+    assert(NULL == atomic_load(&handler->cb)); //We do not support overwriting a handler
+    handler->context = context;
+    handler->min_size = min_size;
+    handler->max_size = max_size;
+    atomic_store_explicit(&handler->cb, cb, memory_order_release);
+}
+
+/**
+ * @brief get the largest message a channel can carry
+ * @param messenger the channel
+ * @return the max message size in bytes
+ */
+long messenger_channel_max_message_size(messenger_t *messenger)
+{
+    assert(NULL != messenger);
+    return messenger->max_message_size;
+}
+
+/**
+ * @brief send a message over a channel
+ * @param messenger the channel
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send(messenger_t *messenger, void *message, long message_size)
+{
+    struct local_messenger_message_header_s header;
+    assert(NULL != messenger);
+    assert(NULL != message);
+    assert(0 < message_size);
+    assert(message_size <= messenger->max_message_size);
+    header = local_messenger_build_user_msg(message_size);
+    return internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, message);
+}
+
+/**
+ * @brief send a message over a channel if there is room for it right now
+ * @param messenger the channel
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_WOULD_BLOCK if the transport is full
+ */
+enum messenger_send_result_e messenger_channel_try_send(messenger_t *messenger, void *message, long message_size)
+{
+    struct local_messenger_message_header_s header;
+    assert(NULL != messenger);
+    assert(NULL != message);
+    assert(0 < message_size);
+    assert(message_size <= messenger->max_message_size);
+    header = local_messenger_build_user_msg(message_size);
+    return internal_message_send_deadline(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, message, NULL);
+}
+
+/**
+ * @brief send a message over a channel, sleeping while the transport is full
+ * @param messenger the channel
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param timeout_ms the longest to wait for room in milliseconds
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_timeout(messenger_t *messenger, void *message, long message_size, unsigned int timeout_ms)
+{
+    struct local_messenger_message_header_s header;
+    struct timespec deadline;
+    assert(NULL != messenger);
+    assert(NULL != message);
+    assert(0 < message_size);
+    assert(message_size <= messenger->max_message_size);
+    internal_deadline_after_ms(&deadline, timeout_ms);
+    header = local_messenger_build_user_msg(message_size);
+    return internal_message_send_deadline(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, message, &deadline);
+}
+
+/**
+ * @brief set the fill levels a channel reports to a callback
+ * @param messenger the channel
+ * @param high_percent the fill percentage that calls the callback with above_high set
+ * @param low_percent the fill percentage that calls the callback with above_high cleared
+ * @param cb the callback. NULL to stop reporting
+ */
+void messenger_channel_set_watermarks(messenger_t *messenger, unsigned int high_percent, unsigned int low_percent, messenger_on_watermark cb)
+{
+    assert(NULL != messenger);
+    assert(false == messenger->attached); //Only the process that created the channel receives on it
+    assert(low_percent < high_percent);
+    assert(100 >= high_percent);
+    atomic_store(&messenger->watermark_cb, NULL);
+    messenger->high_watermark = high_percent;
+    messenger->low_watermark = low_percent;
+    atomic_store(&messenger->above_high_watermark, false);
+    atomic_store(&messenger->watermark_cb, cb);
+}
+
+/**
+ * @brief take a snapshot of the statistics of a channel. The counters are gathered
+ * while the channel runs, so they are only consistent with each other to within the messages in flight
+ * @param messenger the channel
+ * @param stats filled with the snapshot
+ */
+void messenger_channel_get_stats(messenger_t *messenger, messenger_stats_s *stats)
+{
+    assert(NULL != messenger);
+    assert(NULL != stats);
+#if LOCAL_MESSENGER_STATS
+    local_messenger_stats_snapshot(&messenger->stats, stats);
+    stats->queue_bytes = internal_transport_used(messenger);
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif //LOCAL_MESSENGER_STATS
+}
+
+/**
+ * @brief get the file descriptor of a pollable channel
+ * @param messenger the pollable channel
+ * @return an eventfd that is readable while messages are waiting. Wait on it for reading, do not read it
+ */
+int messenger_channel_fd(messenger_t *messenger)
+{
+    assert(NULL != messenger);
+    assert(true == messenger->pollable);
+    return messenger->poll_fd;
+}
+
+/**
+ * @brief hand out the messages waiting on a pollable channel on the calling thread
+ * @param messenger the pollable channel
+ * @param max_messages the most messages to take off the transport
+ * @return the number of messages taken off the transport, including the internal ones
+ */
+unsigned int messenger_channel_dispatch_pending(messenger_t *messenger, unsigned int max_messages)
+{
+    struct local_messanger_internal_message_s *c_message;
+    unsigned int taken = 0;
+    uint64_t value;
+    assert(NULL != messenger);
+    assert(true == messenger->pollable);
+    assert(0 < max_messages);
+    //Clear the eventfd first. A commit landing after this sets it again so nothing is missed
+    (void)read(messenger->poll_fd, &value, sizeof(value));
+    internal_timers_expire(messenger);
+    while(taken < max_messages && NULL != (c_message = internal_message_receive(messenger, false)))
+    {
+        taken += central_messenger_dispatch(messenger, c_message, max_messages - taken);
+    }
+    //The wheel only reports a true next deadline once it has caught up with the clock, which matters once the messages added timers
+    internal_timers_expire(messenger);
+    //Keep the eventfd readable while anything is left so a level triggered loop comes back for it
+    if(false == local_messenger_ring_arm_any(messenger->rings, LOCAL_MESSENGER_PRIORITY_LEVELS))
+    {
+        value = 1;
+        assert((ssize_t)sizeof(value) == write(messenger->poll_fd, &value, sizeof(value)));
+    }
+    return taken;
+}
+
+/**
+ * @brief get how long the owner of a pollable channel may wait on its file descriptor before
+ * a delayed message, periodic message or request timeout is due
+ * @param messenger the pollable channel
+ * @return the time in milliseconds, rounded up. -1 if nothing is due, as epoll_wait and poll take it
+ */
+int messenger_channel_next_timeout_ms(messenger_t *messenger)
+{
+    uint64_t wait_ns;
+    assert(NULL != messenger);
+    assert(true == messenger->pollable);
+    wait_ns = internal_timers_wait_ns(messenger);
+    if(LOCAL_MESSENGER_RING_WAIT_FOREVER == wait_ns)
+    {
+        return -1;
+    }
+    wait_ns = (wait_ns + NS_PER_MS - 1) / NS_PER_MS;
+    return (INT_MAX < wait_ns) ? INT_MAX : (int)wait_ns;
+}
+
+/**
+ * @brief send a record left unacknowledged by a previous run through the channel again
+ * @param context the channel
+ * @param position the position of the record, kept so the record is acknowledged once handed out
+ * @param msg the message in the record
+ * @return false if there was no room, which stops the replay at this record
+ */
+static bool internal_journal_replay_send(void *context, uint64_t position, const struct local_messanger_internal_message_s *msg)
+{
+    messenger_t *messenger = context;
+    struct local_messenger_message_header_s header = msg->header;
+    header.journal_position = position;
+#if LOCAL_MESSENGER_STATS
+    //The time it was first sent is from another run
+    header.enqueue_ns = 0;
+#endif //LOCAL_MESSENGER_STATS
+    if(true == messenger->pollable)
+    {
+        //The caller is the only one dispatching the channel so waiting for room would never end
+        return (MESSENGER_SEND_OK == internal_message_send_deadline(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, msg->message_data, NULL));
+    }
+    return (MESSENGER_SEND_OK == internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, msg->message_data));
+}
+
+/**
+ * @brief send the messages a previous run left unhandled in the journal of a channel through it again.
+ * Call it once the callbacks are registered. Stops once the channel is full
+ * @param messenger the journaled channel
+ * @return the number of messages replayed
+ */
+unsigned int messenger_channel_replay(messenger_t *messenger)
+{
+    assert(NULL != messenger);
+    assert(NULL != messenger->journal);
+    return local_messenger_journal_replay(messenger->journal, internal_journal_replay_send, messenger);
+}
+
+/**
+ * @brief wait until every message sent on a journaled channel so far is on disk
+ * @param messenger the journaled channel
+ */
+void messenger_channel_sync(messenger_t *messenger)
+{
+    assert(NULL != messenger);
+    assert(NULL != messenger->journal);
+    local_messenger_journal_sync(messenger->journal);
+}
+
+/**
+ * @brief send a message over a channel on a priority lane. Higher lanes are handed out first
+ * @param messenger the channel
+ * @param priority the lane. LOCAL_MESSENGER_PRIORITY_HIGHEST is the highest
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_priority(messenger_t *messenger, unsigned int priority, void *message, long message_size)
+{
+    struct local_messenger_message_header_s header;
+    assert(NULL != messenger);
+    assert(NULL != message);
+    assert(0 < message_size);
+    assert(message_size <= messenger->max_message_size);
+    assert(LOCAL_MESSENGER_PRIORITY_LEVELS > priority);
+    header = local_messenger_build_user_msg(message_size);
+    return internal_message_send(messenger, priority, &header, message);
+}
+
+/**
+ * @brief send a message over a channel that is handled in order with the other messages of the same key
+ * @param messenger the channel
+ * @param key the ordering key
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_keyed(messenger_t *messenger, uint32_t key, void *message, long message_size)
+{
+    struct local_messenger_message_header_s header;
+    assert(NULL != messenger);
+    assert(NULL != message);
+    assert(0 < message_size);
+    assert(message_size <= messenger->max_message_size);
+    header = local_messenger_build_keyed_user_msg(key, message_size);
+    return internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, message);
+}
+
+/**
+ * @brief send the newest value of a key over a channel, replacing a value of the same key still waiting to be handed out
+ * @param messenger the channel
+ * @param key the key
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if the key had nothing waiting and there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_conflated(messenger_t *messenger, uint32_t key, void *message, long message_size)
+{
+    enum messenger_send_result_e rv;
+    struct local_messenger_message_header_s header;
+    assert(NULL != messenger);
+    assert(false == messenger->attached); //The values are kept in the process that created the channel
+    assert(NULL != message);
+    assert(0 < message_size);
+    assert(message_size <= messenger->max_message_size);
+    header = local_messenger_build_keyed_user_msg(key, message_size);
+    switch(local_messenger_conflation_put(&messenger->conflation, &header, message))
+    {
+        case LOCAL_MESSENGER_CONFLATION_REPLACED:
+            STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_CONFLATED, 1);
+            return MESSENGER_SEND_OK;
+        case LOCAL_MESSENGER_CONFLATION_FULL:
+            //A key that never got a slot always goes this way, so its values still arrive in order
+            return internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, message);
+        default:
+            break;
+    }
+    //The key had nothing waiting. Only now does the transport see it
+    header = local_messenger_build_conflated_msg(key);
+    rv = internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, NULL);
+    if(MESSENGER_SEND_OK != rv)
+    {
+        //Without a marker the value would never be handed out, and later sends of the key would only replace it
+        local_messenger_conflation_unmark(&messenger->conflation, key);
+        return rv;
+    }
+    STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_BYTES_SENT, (uint64_t)message_size);
+    return MESSENGER_SEND_OK;
+}
+
+/**
+ * @brief put the handle of a buffer on a channel. The caller has taken the reference the channel holds.
+ * It is dropped again if the buffer could not be sent
+ * @param messenger the channel
+ * @param buffer the buffer
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+static enum messenger_send_result_e internal_buffer_send(messenger_t *messenger, local_messenger_buffer_s *buffer)
+{
+    enum messenger_send_result_e rv;
+    struct local_messenger_message_header_s header;
+    assert(NULL != messenger);
+    //A handle only means something in this process
+    assert(false == messenger->attached && MESSENGER_TRANSPORT_SHM != messenger->transport);
+    header = local_messenger_build_buffer_msg();
+    rv = internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, &buffer);
+    if(MESSENGER_SEND_OK != rv)
+    {
+        local_messenger_buffer_release(buffer);
+    }
+    return rv;
+}
+
+/**
+ * @brief send a buffer over a channel by handle
+ * @param messenger the channel
+ * @param buffer the payload ptr from messenger_buffer_alloc
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_buffer(messenger_t *messenger, void *buffer)
+{
+    local_messenger_buffer_s *pooled = local_messenger_buffer_from_payload(buffer);
+    local_messenger_buffer_retain(pooled, 1);
+    return internal_buffer_send(messenger, pooled);
+}
+
+/**
+ * @brief send one buffer to several channels by handle, taking the references for all of them at once
+ * @param channels the channels
+ * @param count the number of channels
+ * @param buffer the payload ptr from messenger_buffer_alloc
+ * @return the number of channels the buffer was sent to. Channels that stayed full for TIME_OUT_MS are skipped
+ */
+unsigned int messenger_multicast_buffer(messenger_t *const *channels, unsigned int count, void *buffer)
+{
+    local_messenger_buffer_s *pooled = local_messenger_buffer_from_payload(buffer);
+    unsigned int rv = 0;
+    assert(NULL != channels || 0 == count);
+    if(0 == count)
+    {
+        return 0;
+    }
+    local_messenger_buffer_retain(pooled, count);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        if(MESSENGER_SEND_OK == internal_buffer_send(channels[i], pooled))
+        {
+            rv++;
+        }
+    }
+    return rv;
+}
+
+/**
+ * @brief send a message over a channel to the handler of its type id
+ * @param messenger the channel
+ * @param type_id the message type id. Less than LOCAL_MESSENGER_MAX_MESSAGE_TYPES
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_typed(messenger_t *messenger, uint32_t type_id, void *message, long message_size)
+{
+    struct local_messenger_message_header_s header;
+    assert(NULL != messenger);
+    assert(NULL != message);
+    assert(0 < message_size);
+    assert(message_size <= messenger->max_message_size);
+    assert(LOCAL_MESSENGER_MAX_MESSAGE_TYPES > type_id);
+    header = local_messenger_build_typed_msg(type_id, message_size);
+    return internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, message);
+}
+
+/**
+ * @brief add a subscriber to a topic of a channel
+ * @param messenger the channel
+ * @param topic the topic. Less than LOCAL_MESSENGER_MAX_TOPICS
+ * @param cb the callback to call with the messages published on the topic
+ */
+void messenger_channel_subscribe(messenger_t *messenger, uint32_t topic, messenger_on_messaage_rcv cb)
+{
+    struct messenger_topic_s *entry;
+    unsigned int used;
+    unsigned int slot;
+    assert(NULL != messenger);
+    assert(false == messenger->attached); //Only the process that created the channel receives on it
+    assert(NULL != cb);
+    assert(LOCAL_MESSENGER_MAX_TOPICS > topic);
+    entry = &messenger->topics[topic];
+    assert(0 == pthread_mutex_lock(&messenger->topic_mutex));
+    used = atomic_load_explicit(&entry->used, memory_order_relaxed);
+    //Reuse a slot emptied by an unsubscribe before growing the table
+    for(slot = 0; slot < used; slot++)
+    {
+        if(NULL == atomic_load_explicit(&entry->subscribers[slot], memory_order_relaxed))
+        {
+            break;
+        }
+    }
+    assert(LOCAL_MESSENGER_MAX_SUBSCRIBERS > slot);
+    atomic_store_explicit(&entry->subscribers[slot], cb, memory_order_release);
+    if(slot == used)
+    {
+        atomic_store_explicit(&entry->used, used + 1, memory_order_release);
+    }
+    atomic_fetch_add_explicit(&entry->count, 1, memory_order_release);
+    pthread_mutex_unlock(&messenger->topic_mutex);
+}
+
+/**
+ * @brief remove a subscriber from a topic of a channel
+ * @param messenger the channel
+ * @param topic the topic
+ * @param cb the callback passed to messenger_channel_subscribe
+ */
+void messenger_channel_unsubscribe(messenger_t *messenger, uint32_t topic, messenger_on_messaage_rcv cb)
+{
+    struct messenger_topic_s *entry;
+    unsigned int used;
+    assert(NULL != messenger);
+    assert(LOCAL_MESSENGER_MAX_TOPICS > topic);
+    entry = &messenger->topics[topic];
+    assert(0 == pthread_mutex_lock(&messenger->topic_mutex));
+    used = atomic_load_explicit(&entry->used, memory_order_relaxed);
+    for(unsigned int slot = 0; slot < used; slot++)
+    {
+        if(cb == atomic_load_explicit(&entry->subscribers[slot], memory_order_relaxed))
+        {
+            atomic_store_explicit(&entry->subscribers[slot], NULL, memory_order_release);
+            atomic_fetch_sub_explicit(&entry->count, 1, memory_order_release);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&messenger->topic_mutex);
+}
+
+/**
+ * @brief publish a message to the subscribers of a topic of a channel.
+ * Messages published on a topic without subscribers are dropped before they reach the transport.
+ * The topic travels in the message header, so with MESSENGER_TRANSPORT_SYSV_QUEUE msgrcv can not select a topic
+ * @param messenger the channel
+ * @param topic the topic. Less than LOCAL_MESSENGER_MAX_TOPICS
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_publish(messenger_t *messenger, uint32_t topic, void *message, long message_size)
+{
+    struct local_messenger_message_header_s header;
+    assert(NULL != messenger);
+    assert(NULL != message);
+    assert(0 < message_size);
+    assert(message_size <= messenger->max_message_size);
+    assert(LOCAL_MESSENGER_MAX_TOPICS > topic);
+    //An attached handle can not see the subscribers in the other process so it always sends
+    if(false == messenger->attached && 0 == atomic_load_explicit(&messenger->topics[topic].count, memory_order_acquire))
+    {
+        return MESSENGER_SEND_OK;
+    }
+    header = local_messenger_build_publish_msg(topic, message_size);
+    return internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, message);
+}
+
+/**
+ * @brief send several messages over a channel in one call
+ * @param messenger the channel
+ * @param messages ptrs to the message data to send. They will be copied
+ * @param message_sizes The size of each message
+ * @param count The number of messages
+ * @return the number of messages sent, oldest first. Less than count if the channel stayed full for TIME_OUT_MS
+ */
+unsigned int messenger_channel_send_batch(messenger_t *messenger, void **messages, const long *message_sizes, unsigned int count)
+{
+    struct local_messenger_message_header_s header;
+    assert(NULL != messenger);
+    assert(NULL != messages);
+    assert(NULL != message_sizes);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        assert(NULL != messages[i]);
+        assert(0 < message_sizes[i]);
+        assert(message_sizes[i] <= messenger->max_message_size);
+    }
+    if(true == internal_uses_ring(messenger))
+    {
+        return internal_ring_send_batch(messenger, messages, message_sizes, count);
+    }
+    //System V has no batched send so each message is its own msgsnd
+    for(unsigned int i = 0; i < count; i++)
+    {
+        header = local_messenger_build_user_msg(message_sizes[i]);
+        if(MESSENGER_SEND_OK != internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, messages[i]))
+        {
+            return i;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief get a buffer to build a message for a channel in place
+ * @param messenger the channel
+ * @param message_size The size of the message that will be written
+ * @return ptr to message_size bytes to write the message into. Pass it to messenger_channel_commit once written.
+ * NULL if the ring stayed full for TIME_OUT_MS
+ */
+void *messenger_channel_acquire(messenger_t *messenger, long message_size)
+{
+    uint64_t frame_size;
+    struct local_messenger_message_header_s header;
+    struct local_messanger_internal_message_s *msg;
+    struct module_message_transaction_data_s *data;
+    assert(NULL != messenger);
+    assert(0 < message_size);
+    assert(message_size <= messenger->max_message_size);
+    header = local_messenger_build_user_msg(message_size);
+    if(true == internal_uses_ring(messenger))
+    {
+        //The message is built right in its ring slot
+        frame_size = local_messenger_frame_size(&header);
+        msg = internal_ring_reserve(messenger, &frame_size, 1);
+        if(NULL == msg)
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        //msgsnd has to copy out of our memory anyway so stage the message on the heap
+        data = malloc(sizeof(struct module_message_transaction_data_s) + local_messenger_frame_size(&header));
+        assert(NULL != data);
+        data->mtype = SYSV_MESSAGE_TYPE(LOCAL_MESSENGER_PRIORITY_DEFAULT);
+        msg = (struct local_messanger_internal_message_s *)data->mdata;
+    }
+    msg->header = header;
+    return msg->message_data;
+}
+
+/**
+ * @brief send a message whose reserved ring slot could not be journaled. The slot goes out as an
+ * action the dispatch thread skips, which frees it to get on to the messages behind it, and the message
+ * is sent again the usual way, which journals it before it reserves any room
+ * @param msg the message in its reserved slot
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+static enum messenger_send_result_e internal_ring_commit_unjournaled(messenger_t *messenger, struct local_messanger_internal_message_s *msg)
+{
+    struct local_messenger_message_header_s header = msg->header;
+    struct timespec deadline;
+    enum messenger_send_result_e rv;
+    void *payload = malloc((size_t)header.message_size);
+    assert(NULL != payload);
+    memcpy(payload, msg->message_data, (size_t)header.message_size);
+    //The payload stays so the slot still matches the size it was reserved with
+    msg->header.type = LOCAL_MESSAGE_TYPE_INTERNAL_ACTION;
+    msg->header.action = LOCAL_MESSENGER_ACTION_NONE;
+    local_messenger_ring_commit(&messenger->rings[LOCAL_MESSENGER_PRIORITY_DEFAULT], msg);
+    internal_deadline_after_ms(&deadline, TIME_OUT_MS);
+    rv = internal_message_send_deadline(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, payload, &deadline);
+    free(payload);
+    return rv;
+}
+
+/**
+ * @brief send a message built in a buffer from messenger_channel_acquire
+ * @param messenger the channel the buffer was acquired from
+ * @param message the ptr returned by messenger_channel_acquire. It must not be touched after this call
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time. The ring transport
+ * reserved the room in messenger_channel_acquire so it always sends, unless the channel's journal was full
+ * and the message had to be sent again behind it
+ */
+enum messenger_send_result_e messenger_channel_commit(messenger_t *messenger, void *message)
+{
+    struct local_messanger_internal_message_s *msg;
+    struct module_message_transaction_data_s *data;
+    struct timespec deadline;
+    enum messenger_send_result_e rv;
+    assert(NULL != messenger);
+    assert(NULL != message);
+    msg = internal_message_from_payload(message);
+#if LOCAL_MESSENGER_STATS
+    //Latency runs from the commit, not from when the buffer was handed out
+    msg->header.enqueue_ns = time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC);
+#endif //LOCAL_MESSENGER_STATS
+    if(true == internal_uses_ring(messenger))
+    {
+        if(NULL != messenger->journal && true == local_messenger_journal_wants(&msg->header))
+        {
+            //The dispatch thread is stuck behind the reserved slot, so waiting on the journal here could wait forever
+            msg->header.journal_position = local_messenger_journal_try_append(messenger->journal, &msg->header, msg->message_data);
+            if(0 == msg->header.journal_position)
+            {
+                return internal_ring_commit_unjournaled(messenger, msg);
+            }
+        }
+        //The slot belongs to the dispatch thread once committed so count it first
+        STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_SENT, 1);
+        STATS_ADD(&messenger->stats, LOCAL_MESSENGER_STATS_BYTES_SENT, (uint64_t)msg->header.message_size);
+        local_messenger_ring_commit(&messenger->rings[LOCAL_MESSENGER_PRIORITY_DEFAULT], msg);
+        internal_check_high_watermark(messenger);
+        return MESSENGER_SEND_OK;
+    }
+    internal_journal_append(messenger, &msg->header, msg->message_data);
+    data = (struct module_message_transaction_data_s *)(((char *)msg) - offsetof(struct module_message_transaction_data_s, mdata));
+    internal_deadline_after_ms(&deadline, TIME_OUT_MS);
+    rv = internal_message_send_wait(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &msg->header, msg->message_data, data, &deadline);
+    if(MESSENGER_SEND_OK != rv && 0 != msg->header.journal_position)
+    {
+        //The caller is told the message was not sent so it must not come back on a replay
+        local_messenger_journal_ack(messenger->journal, msg->header.journal_position);
+    }
+    free(data);
+    return rv;
+}
+
+/**
+ * @brief hand a copy of a message to the dispatch thread to keep on its timer wheel
+ * @param delay_ns time until the message is first due
+ * @param period_ns time between sends. 0 to send once
+ * @return the timer. NULL if the dispatch thread could not be handed it in TIME_OUT_MS
+ */
+static messenger_timer_t *internal_timer_send(messenger_t *messenger, void *message, long message_size, uint64_t delay_ns, uint64_t period_ns)
+{
+    struct local_messenger_message_header_s header;
+    struct local_messanger_internal_message_s *msg;
+    messenger_timer_t *entry;
+    assert(NULL != messenger);
+    //The timer is handed over by ptr so it has to be in the process of the dispatch thread, and a shared memory channel can not trust a ptr
+    assert(false == messenger->attached && MESSENGER_TRANSPORT_SHM != messenger->transport);
+    assert(NULL != message);
+    assert(0 < message_size);
+    assert(message_size <= messenger->max_message_size);
+    entry = malloc(sizeof(messenger_timer_t) + sizeof(struct local_messenger_message_header_s) + (size_t)message_size);
+    assert(NULL != entry);
+    msg = (struct local_messanger_internal_message_s *)entry->frame;
+    msg->header = local_messenger_build_user_msg(message_size);
+#if LOCAL_MESSENGER_STATS
+    msg->header.enqueue_ns = 0;
+#endif //LOCAL_MESSENGER_STATS
+    memcpy(msg->message_data, message, message_size);
+    time_out_helper_timer_init(&entry->timer, internal_timer_expired, entry);
+    entry->messenger = messenger;
+    entry->period_ns = period_ns;
+    entry->deadline_ns = time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC) + delay_ns;
+    //Only the ptr travels. The dispatch thread owns the timer from here on
+    header = local_messenger_build_action(LOCAL_MESSENGER_ACTION_TIMER_ADD);
+    header.message_size = sizeof(entry);
+    if(MESSENGER_SEND_OK != internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_HIGHEST, &header, &entry))
+    {
+        free(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+/**
+ * @brief send a message over a channel once a delay has passed
+ * @param messenger the channel
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param delay_ms the delay in milliseconds
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_channel_send_delayed(messenger_t *messenger, void *message, long message_size, unsigned int delay_ms)
+{
+    if(NULL == internal_timer_send(messenger, message, message_size, (uint64_t)delay_ms * NS_PER_MS, 0))
+    {
+        return MESSENGER_SEND_TIMED_OUT;
+    }
+    return MESSENGER_SEND_OK;
+}
+
+/**
+ * @brief send a message over a channel every period until it is cancelled
+ * @param messenger the channel
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param period_ms the period in milliseconds
+ * @return the periodic message. Pass it to messenger_cancel_periodic to stop it. NULL if there was no room in time
+ */
+messenger_timer_t *messenger_channel_send_periodic(messenger_t *messenger, void *message, long message_size, unsigned int period_ms)
+{
+    assert(0 < period_ms);
+    return internal_timer_send(messenger, message, message_size, (uint64_t)period_ms * NS_PER_MS, (uint64_t)period_ms * NS_PER_MS);
+}
+
+/**
+ * @brief stop a periodic message
+ * @param timer the ptr returned by messenger_channel_send_periodic or messenger_send_periodic
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time. The message keeps going out until a cancel is sent
+ */
+enum messenger_send_result_e messenger_cancel_periodic(messenger_timer_t *timer)
+{
+    struct local_messenger_message_header_s header;
+    assert(NULL != timer);
+    assert(0 != timer->period_ns);
+    header = local_messenger_build_action(LOCAL_MESSENGER_ACTION_TIMER_CANCEL);
+    header.message_size = sizeof(timer);
+    //Same lane as the add so the cancel can not overtake it
+    return internal_message_send(timer->messenger, LOCAL_MESSENGER_PRIORITY_HIGHEST, &header, &timer);
+}
+
+/**
+ * @brief register a callback to call when a request is received on a channel
+ * @param messenger the channel
+ * @param cb The callback in question
+ */
+void messenger_channel_register_request_handler(messenger_t *messenger, messenger_on_request cb)
+{
+    assert(NULL != messenger);
+    assert(false == messenger->attached); //Only the process that created the channel receives on it
+    assert(NULL != cb);
+    assert(NULL == atomic_load(&messenger->request_cb)); //We do not support overwriting the callback
+    atomic_store_explicit(&messenger->request_cb, cb, memory_order_release);
+}
+
+/**
+ * @brief have the dispatch thread of a channel end a request with MESSENGER_REPLY_DROPPED. It owns the
+ * request and its timeout, so the request is only flagged here and the dispatch thread is woken to see it
+ * @param reply_to the channel waiting on the reply
+ * @param id the correlation id of the request
+ */
+static void internal_request_drop(messenger_t *reply_to, uint64_t id)
+{
+    struct local_messenger_message_header_s header = local_messenger_build_action(LOCAL_MESSENGER_ACTION_TIMER_WAKE);
+    local_messenger_requests_drop(&reply_to->requests, id);
+    //A full channel is already waking its dispatch thread, so there is no need to wait for room
+    (void)internal_message_send_deadline(reply_to, LOCAL_MESSENGER_PRIORITY_HIGHEST, &header, NULL, NULL);
+}
+
+/**
+ * @brief send a request over a channel and have its reply handed to a callback
+ * @param messenger the channel the request goes to
+ * @param reply_to the channel the reply comes back on
+ * @param message ptr to the request data to send. It will be copied
+ * @param message_size The size of the request
+ * @param timeout_ms time to wait for the reply in milliseconds. 0 to wait until reply_to is stopped
+ * @param cb called once with the reply or with why there was none
+ * @param context passed to cb
+ * @return MESSENGER_SEND_OK, MESSENGER_SEND_WOULD_BLOCK if reply_to already has LOCAL_MESSENGER_MAX_PENDING_REQUESTS in flight,
+ * or MESSENGER_SEND_TIMED_OUT if there was no room in time. cb is not called for MESSENGER_SEND_WOULD_BLOCK, and is called
+ * with MESSENGER_REPLY_DROPPED for MESSENGER_SEND_TIMED_OUT
+ */
+enum messenger_send_result_e messenger_channel_request(messenger_t *messenger, messenger_t *reply_to, void *message, long message_size, unsigned int timeout_ms,
+                                                       messenger_on_reply cb, void *context)
+{
+    struct local_messenger_message_header_s header;
+    uint64_t deadline_ns = TIME_OUT_HELPER_NEVER;
+    uint64_t id;
+    enum messenger_send_result_e rv;
+    long stack_payload[(sizeof(messenger_t *) + LOCAL_MESSENGER_MAX_MESSAGE_SIZE + sizeof(long) - 1) / sizeof(long)];
+    char *payload = (char *)stack_payload;
+    assert(NULL != messenger);
+    assert(NULL != reply_to);
+    //The channel to reply to travels as a ptr so both ends have to be in this process, and a shared memory channel can not trust a ptr
+    assert(false == messenger->attached && MESSENGER_TRANSPORT_SHM != messenger->transport);
+    assert(false == reply_to->attached);
+    assert(NULL != message);
+    assert(0 < message_size);
+    assert(message_size + (long)sizeof(reply_to) <= messenger->max_message_size);
+    assert(NULL != cb);
+    if(0 < timeout_ms)
+    {
+        deadline_ns = time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC) + ((uint64_t)timeout_ms * NS_PER_MS);
+    }
+    id = local_messenger_requests_open(&reply_to->requests, cb, context, deadline_ns);
+    if(0 == id)
+    {
+        return MESSENGER_SEND_WOULD_BLOCK;
+    }
+    if(TIME_OUT_HELPER_NEVER != deadline_ns)
+    {
+        //Only the dispatch thread of reply_to touches its timer wheel, so the timeout is handed to it
+        header = local_messenger_build_action(LOCAL_MESSENGER_ACTION_REQUEST_TIMEOUT);
+        header.correlation_id = id;
+        rv = internal_message_send(reply_to, LOCAL_MESSENGER_PRIORITY_HIGHEST, &header, NULL);
+        if(MESSENGER_SEND_OK != rv)
+        {
+            internal_request_drop(reply_to, id);
+            return rv;
+        }
+    }
+    if(sizeof(reply_to) + (size_t)message_size > sizeof(stack_payload))
+    {
+        payload = malloc(sizeof(reply_to) + (size_t)message_size);
+        assert(NULL != payload);
+    }
+    memcpy(payload, &reply_to, sizeof(reply_to));
+    memcpy(&payload[sizeof(reply_to)], message, message_size);
+    header = local_messenger_build_request_msg(id, (long)sizeof(reply_to) + message_size);
+    rv = internal_message_send(messenger, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, payload);
+    if((char *)stack_payload != payload)
+    {
+        free(payload);
+    }
+    if(MESSENGER_SEND_OK != rv)
+    {
+        internal_request_drop(reply_to, id);
+    }
+    return rv;
+}
+
+/**
+ * @brief send a request over a channel and get a future to wait on its reply with
+ * @param messenger the channel the request goes to
+ * @param reply_to the channel the reply comes back on
+ * @param message ptr to the request data to send. It will be copied
+ * @param message_size The size of the request
+ * @param timeout_ms time to wait for the reply in milliseconds. 0 to wait until reply_to is stopped
+ * @return the future, NULL if reply_to already has LOCAL_MESSENGER_MAX_PENDING_REQUESTS in flight. A request there was no room
+ * for in time ends with MESSENGER_REPLY_DROPPED
+ */
+messenger_future_t *messenger_channel_request_future(messenger_t *messenger, messenger_t *reply_to, void *message, long message_size, unsigned int timeout_ms)
+{
+    messenger_future_t *future = local_messenger_future_create();
+    //A request that was opened but not sent is still ended by the dispatch thread of reply_to, so only a full table gives no future
+    if(MESSENGER_SEND_WOULD_BLOCK == messenger_channel_request(messenger, reply_to, message, message_size, timeout_ms, local_messenger_future_complete, future))
+    {
+        //End the future so waiting on it frees it without blocking
+        local_messenger_future_complete(future, MESSENGER_REPLY_CANCELLED, NULL, 0);
+        messenger_future_wait(future, NULL, 0, NULL);
+        return NULL;
+    }
+    return future;
+}
+
+/**
+ * @brief answer a request. A reply that could not be sent ends the request with MESSENGER_REPLY_DROPPED
+ * @param request the request passed to the handler, or a copy of it
+ * @param reply ptr to the reply data to send. It will be copied
+ * @param reply_size The size of the reply
+ * @return MESSENGER_SEND_OK, MESSENGER_SEND_WOULD_BLOCK if there was no room on the dispatch thread
+ * of reply_to, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_reply(const messenger_request_t *request, void *reply, long reply_size)
+{
+    struct local_messenger_message_header_s header;
+    enum messenger_send_result_e rv;
+    struct timespec deadline;
+    assert(NULL != request);
+    assert(NULL != request->reply_to);
+    assert(NULL != reply);
+    assert(0 < reply_size);
+    assert(reply_size <= request->reply_to->max_message_size);
+    header = local_messenger_build_reply_msg(request->correlation_id, reply_size);
+    if(request->reply_to == dispatching_messenger)
+    {
+        //Only this thread makes room on reply_to so waiting for it would never end
+        rv = internal_message_send_deadline(request->reply_to, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, reply, NULL);
+    }
+    else
+    {
+        internal_deadline_after_ms(&deadline, TIME_OUT_MS);
+        rv = internal_message_send_deadline(request->reply_to, LOCAL_MESSENGER_PRIORITY_DEFAULT, &header, reply, &deadline);
+    }
+    if(MESSENGER_SEND_OK != rv)
+    {
+        internal_request_drop(request->reply_to, request->correlation_id);
+    }
+    return rv;
+}
+
+/**
+ * @brief register a callback to call when a message is received
+ * @param cb The callback in question
+ */
+void messenger_register_callback(messenger_on_messaage_rcv cb)
+{
+    messenger_channel_register_callback(init_if_needed(), cb);
+}
+
+/**
+ * @brief register a callback to call with batches of received messages
+ * @param cb The callback in question
+ */
+void messenger_register_batch_callback(messenger_on_batch_rcv cb)
+{
+    messenger_channel_register_batch_callback(init_if_needed(), cb);
+}
+
+/**
+ * @brief register a callback to call with a context when a message is received
+ * @param cb The callback in question
+ * @param context passed to cb
+ */
+void messenger_register_context_callback(messenger_on_context_rcv cb, void *context)
+{
+    messenger_channel_register_context_callback(init_if_needed(), cb, context);
+}
+
+/**
+ * @brief register the handler of a message type id
+ * @param type_id the message type id. Less than LOCAL_MESSENGER_MAX_MESSAGE_TYPES
+ * @param min_size the smallest message the handler accepts
+ * @param max_size the largest message the handler accepts
+ * @param cb the handler
+ * @param context passed to cb
+ */
+void messenger_register_handler(uint32_t type_id, long min_size, long max_size, messenger_on_context_rcv cb, void *context)
+{
+    messenger_channel_register_handler(init_if_needed(), type_id, min_size, max_size, cb, context);
+}
+
+/**
+ * Kill the messenger task and reset the module
+ */
+void messenger_kill(void)
+{
+    messenger_t *messenger = init_if_needed();
+    //The callback may still send while the channel drains so it stays the default until it is gone.
+    //A pollable channel has no master thread to park so it is always torn down.
+    //A journaled one is torn down so the next run replays what the park would have dropped
+    if(true == messenger_module_data.warm_restart && false == messenger->pollable && NULL == messenger->journal)
+    {
+        messenger_park(messenger);
+    }
+    else
+    {
+        messenger_destroy(messenger);
+        messenger = NULL;
+    }
+    assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
+    atomic_store_explicit(&messenger_module_data.default_messenger, NULL, memory_order_relaxed);
+    messenger_module_data.parked_messenger = messenger;
+    pthread_mutex_unlock(&messenger_module_data.init_mutex);
+}
+
+/**
+ * @brief keep the default channel's transport and master thread parked across messenger_kill
+ * so the next start reuses them. Turning it off tears down a parked channel.
+ * Must be called while the messenger is not running
+ * @param enabled true to park on kill
+ */
+void messenger_set_warm_restart(bool enabled)
+{
+    messenger_t *parked;
+    assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
+    assert(NULL == atomic_load_explicit(&messenger_module_data.default_messenger, memory_order_relaxed));
+    messenger_module_data.warm_restart = enabled;
+    parked = messenger_module_data.parked_messenger;
+    if(false == enabled)
+    {
+        messenger_module_data.parked_messenger = NULL;
+    }
+    pthread_mutex_unlock(&messenger_module_data.init_mutex);
+    if(false == enabled && NULL != parked)
+    {
+        messenger_destroy(parked);
+    }
+}
+
+/**
+ * @brief start the messenger now rather than on first use, so the first send does not pay for
+ * creating the transport and the dispatch thread
+ * @param config the settings to start with. They are kept for later starts. NULL for the current settings
+ */
+void messenger_init(const messenger_config_t *config)
+{
+    assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
+    assert(NULL == atomic_load_explicit(&messenger_module_data.default_messenger, memory_order_relaxed));
+    if(NULL != config)
+    {
+        assert(NULL == config->name); //The default channel is anonymous
+        messenger_module_data.default_config = *config;
+        if(NULL != config->journal_path)
+        {
+            //The caller's string only has to last for the call, the default channel may be started again later
+            assert(strlen(config->journal_path) < sizeof(messenger_module_data.default_journal_path));
+            strcpy(messenger_module_data.default_journal_path, config->journal_path);
+            messenger_module_data.default_config.journal_path = messenger_module_data.default_journal_path;
+        }
+    }
+    pthread_mutex_unlock(&messenger_module_data.init_mutex);
+    init_if_needed();
+}
+
+/**
+ * @brief select the transport the messenger uses the next time it starts.
+ * Must be called while the messenger is not running
+ * @param transport the transport to use
+ */
+void messenger_set_transport(enum messenger_transport_e transport)
+{
+    assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
+    assert(NULL == atomic_load_explicit(&messenger_module_data.default_messenger, memory_order_relaxed));
+    messenger_module_data.default_config.transport = transport;
+    pthread_mutex_unlock(&messenger_module_data.init_mutex);
+}
+
+/**
+ * @brief set the size of the ring used by MESSENGER_TRANSPORT_RING the next time the messenger starts.
+ * Must be called while the messenger is not running
+ * @param ring_size the ring size in bytes. Must be a power of two
+ */
+void messenger_set_ring_size(uint64_t ring_size)
+{
+    assert(0 != ring_size);
+    assert(0 == (ring_size & (ring_size - 1)));
+    assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
+    assert(NULL == atomic_load_explicit(&messenger_module_data.default_messenger, memory_order_relaxed));
+    messenger_module_data.default_config.ring_size = ring_size;
+    pthread_mutex_unlock(&messenger_module_data.init_mutex);
+}
+
+/**
+ * @brief set the most messages the messenger hands out per wakeup the next time it starts.
+ * Must be called while the messenger is not running
+ * @param max_batch the batch size. 1 dispatches messages one at a time
+ */
+void messenger_set_dispatch_batch(unsigned int max_batch)
+{
+    assert(0 < max_batch);
+    assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
+    assert(NULL == atomic_load_explicit(&messenger_module_data.default_messenger, memory_order_relaxed));
+    messenger_module_data.default_config.dispatch_batch = max_batch;
+    pthread_mutex_unlock(&messenger_module_data.init_mutex);
+}
+
+/**
+ * @brief set the number of worker threads running the callbacks the next time the messenger starts.
+ * Must be called while the messenger is not running
+ * @param workers the number of workers. 0 runs the callbacks on the dispatch thread
+ */
+void messenger_set_workers(unsigned int workers)
+{
+    assert(0 == pthread_mutex_lock(&messenger_module_data.init_mutex));
+    assert(NULL == atomic_load_explicit(&messenger_module_data.default_messenger, memory_order_relaxed));
+    messenger_module_data.default_config.workers = workers;
+    pthread_mutex_unlock(&messenger_module_data.init_mutex);
+}
+
+/**
+ * @brief get the largest message the running transport can carry
+ * @return the max message size in bytes
+ */
+long messenger_max_message_size(void)
+{
+    return messenger_channel_max_message_size(init_if_needed());
+}
+
+/**
+ * @brief send a message over the sender
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send(void *message, long message_size)
+{
+    return messenger_channel_send(init_if_needed(), message, message_size);
+}
+
+/**
+ * @brief send a message if there is room for it right now
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_WOULD_BLOCK if the transport is full
+ */
+enum messenger_send_result_e messenger_try_send(void *message, long message_size)
+{
+    return messenger_channel_try_send(init_if_needed(), message, message_size);
+}
+
+/**
+ * @brief send a message, sleeping while the transport is full
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param timeout_ms the longest to wait for room in milliseconds
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_timeout(void *message, long message_size, unsigned int timeout_ms)
+{
+    return messenger_channel_send_timeout(init_if_needed(), message, message_size, timeout_ms);
+}
+
+/**
+ * @brief set the fill levels the messenger reports to a callback
+ * @param high_percent the fill percentage that calls the callback with above_high set
+ * @param low_percent the fill percentage that calls the callback with above_high cleared
+ * @param cb the callback. NULL to stop reporting
+ */
+void messenger_set_watermarks(unsigned int high_percent, unsigned int low_percent, messenger_on_watermark cb)
+{
+    messenger_channel_set_watermarks(init_if_needed(), high_percent, low_percent, cb);
+}
+
+/**
+ * @brief take a snapshot of the statistics of the messenger
+ * @param stats filled with the snapshot
+ */
+void messenger_get_stats(messenger_stats_s *stats)
+{
+    messenger_channel_get_stats(init_if_needed(), stats);
+}
+
+/**
+ * @brief get the file descriptor of the messenger. It must have been started pollable with messenger_init
+ * @return an eventfd that is readable while messages are waiting
+ */
+int messenger_fd(void)
+{
+    return messenger_channel_fd(init_if_needed());
+}
+
+/**
+ * @brief hand out the messages waiting on the messenger on the calling thread.
+ * It must have been started pollable with messenger_init
+ * @param max_messages the most messages to take off the transport
+ * @return the number of messages taken off the transport
+ */
+unsigned int messenger_dispatch_pending(unsigned int max_messages)
+{
+    return messenger_channel_dispatch_pending(init_if_needed(), max_messages);
+}
+
+/**
+ * @brief get how long the owner of the messenger may wait on its file descriptor before a timer is due
+ * @return the time in milliseconds, -1 if nothing is due
+ */
+int messenger_next_timeout_ms(void)
+{
+    return messenger_channel_next_timeout_ms(init_if_needed());
+}
+
+/**
+ * @brief send the messages a previous run left unhandled in the journal of the messenger through it again
+ * @return the number of messages replayed
+ */
+unsigned int messenger_replay(void)
+{
+    return messenger_channel_replay(init_if_needed());
+}
+
+/**
+ * @brief wait until every message sent on the messenger so far is on disk
+ */
+void messenger_sync(void)
+{
+    messenger_channel_sync(init_if_needed());
+}
+
+/**
+ * @brief send a message on a priority lane. Higher lanes are handed out first
+ * @param priority the lane. LOCAL_MESSENGER_PRIORITY_HIGHEST is the highest
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_priority(unsigned int priority, void *message, long message_size)
+{
+    return messenger_channel_send_priority(init_if_needed(), priority, message, message_size);
+}
+
+/**
+ * @brief send a message that is handled in order with the other messages of the same key
+ * @param key the ordering key
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_keyed(uint32_t key, void *message, long message_size)
+{
+    return messenger_channel_send_keyed(init_if_needed(), key, message, message_size);
+}
+
+/**
+ * @brief send the newest value of a key, replacing a value of the same key still waiting to be handed out
+ * @param key the key
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if the key had nothing waiting and there was no room in time
+ */
+enum messenger_send_result_e messenger_send_conflated(uint32_t key, void *message, long message_size)
+{
+    return messenger_channel_send_conflated(init_if_needed(), key, message, message_size);
+}
+
+/**
+ * @brief send a buffer by handle
+ * @param buffer the payload ptr from messenger_buffer_alloc
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_buffer(void *buffer)
+{
+    return messenger_channel_send_buffer(init_if_needed(), buffer);
+}
+
+/**
+ * @brief send a message to the handler of its type id
+ * @param type_id the message type id. Less than LOCAL_MESSENGER_MAX_MESSAGE_TYPES
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_typed(uint32_t type_id, void *message, long message_size)
+{
+    return messenger_channel_send_typed(init_if_needed(), type_id, message, message_size);
+}
+
+/**
+ * @brief add a subscriber to a topic
+ * @param topic the topic. Less than LOCAL_MESSENGER_MAX_TOPICS
+ * @param cb the callback to call with the messages published on the topic
+ */
+void messenger_subscribe(uint32_t topic, messenger_on_messaage_rcv cb)
+{
+    messenger_channel_subscribe(init_if_needed(), topic, cb);
+}
+
+/**
+ * @brief remove a subscriber from a topic
+ * @param topic the topic
+ * @param cb the callback passed to messenger_subscribe
+ */
+void messenger_unsubscribe(uint32_t topic, messenger_on_messaage_rcv cb)
+{
+    messenger_channel_unsubscribe(init_if_needed(), topic, cb);
+}
+
+/**
+ * @brief publish a message to the subscribers of a topic
+ * @param topic the topic. Less than LOCAL_MESSENGER_MAX_TOPICS
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_publish(uint32_t topic, void *message, long message_size)
+{
+    return messenger_channel_publish(init_if_needed(), topic, message, message_size);
+}
+
+/**
+ * @brief send several messages in one call
+ * @param messages ptrs to the message data to send. They will be copied
+ * @param message_sizes The size of each message
+ * @param count The number of messages
+ * @return the number of messages sent, oldest first
+ */
+unsigned int messenger_send_batch(void **messages, const long *message_sizes, unsigned int count)
+{
+    return messenger_channel_send_batch(init_if_needed(), messages, message_sizes, count);
+}
+
+/**
+ * @brief get a buffer to build a message in place
+ * @param message_size The size of the message that will be written
+ * @return ptr to message_size bytes to write the message into. Pass it to messenger_commit once written. NULL if there was no room in time
+ */
+void *messenger_acquire(long message_size)
+{
+    return messenger_channel_acquire(init_if_needed(), message_size);
+}
+
+/**
+ * @brief send a message built in a buffer from messenger_acquire
+ * @param message the ptr returned by messenger_acquire. It must not be touched after this call
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_commit(void *message)
+{
+    return messenger_channel_commit(init_if_needed(), message);
+}
+
+/**
+ * @brief send a message once a delay has passed
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param delay_ms the delay in milliseconds
+ * @return MESSENGER_SEND_OK, or MESSENGER_SEND_TIMED_OUT if there was no room in time
+ */
+enum messenger_send_result_e messenger_send_delayed(void *message, long message_size, unsigned int delay_ms)
+{
+    return messenger_channel_send_delayed(init_if_needed(), message, message_size, delay_ms);
+}
+
+/**
+ * @brief send a message every period until it is cancelled
+ * @param message ptr to the message data to send. It will be copied
+ * @param message_size The size of the message to send.
+ * @param period_ms the period in milliseconds
+ * @return the periodic message. Pass it to messenger_cancel_periodic to stop it. NULL if there was no room in time
+ */
+messenger_timer_t *messenger_send_periodic(void *message, long message_size, unsigned int period_ms)
+{
+    return messenger_channel_send_periodic(init_if_needed(), message, message_size, period_ms);
+}
+
+/**
+ * @brief register a callback to call when a request is received
+ * @param cb The callback in question
+ */
+void messenger_register_request_handler(messenger_on_request cb)
+{
+    messenger_channel_register_request_handler(init_if_needed(), cb);
+}
+
+/**
+ * @brief send a request to the messenger and have its reply handed to a callback
+ * @param message ptr to the request data to send. It will be copied
+ * @param message_size The size of the request
+ * @param timeout_ms time to wait for the reply in milliseconds. 0 to wait until the messenger is killed
+ * @param cb called once with the reply or with why there was none
+ * @param context passed to cb
+ * @return MESSENGER_SEND_OK, MESSENGER_SEND_WOULD_BLOCK if too many requests are in flight, or MESSENGER_SEND_TIMED_OUT if there was no room in time.
+ * cb is not called for MESSENGER_SEND_WOULD_BLOCK, and is called with MESSENGER_REPLY_DROPPED for MESSENGER_SEND_TIMED_OUT
+ */
+enum messenger_send_result_e messenger_request(void *message, long message_size, unsigned int timeout_ms, messenger_on_reply cb, void *context)
+{
+    messenger_t *messenger = init_if_needed();
+    return messenger_channel_request(messenger, messenger, message, message_size, timeout_ms, cb, context);
+}
+
+/**
+ * @brief send a request to the messenger and get a future to wait on its reply with
+ * @param message ptr to the request data to send. It will be copied
+ * @param message_size The size of the request
+ * @param timeout_ms time to wait for the reply in milliseconds. 0 to wait until the messenger is killed
+ * @return the future, NULL if too many requests are in flight. A request there was no room for in time ends with MESSENGER_REPLY_DROPPED
+ */
+messenger_future_t *messenger_request_future(void *message, long message_size, unsigned int timeout_ms)
+{
+    messenger_t *messenger = init_if_needed();
+    return messenger_channel_request_future(messenger, messenger, message, message_size, timeout_ms);
+}
@@ -0,0 +1,82 @@
+/**
+ * @file local-messenger-buffers.h
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Reference counted payload buffers that are sent by handle, so one payload can go out on
+ * many channels without being copied. A buffer is laid out as a message so the dispatch
+ * thread hands it to the callbacks like any other. Buffers come from size classes. Each
+ * thread keeps a free list per class and trades buffers with a shared list in batches
+ * when its list runs dry or grows past LOCAL_MESSENGER_BUFFER_CACHE, so a buffer sent by
+ * one thread and released by another is reused without going back to malloc.
+ */
+
+#ifndef SRC_PRIV_INC_LOCAL_MESSENGER_BUFFERS_H_
+#define SRC_PRIV_INC_LOCAL_MESSENGER_BUFFERS_H_
+
+#include <local-messenger-message-types.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef LOCAL_MESSENGER_BUFFER_MIN_SIZE
+#define LOCAL_MESSENGER_BUFFER_MIN_SIZE 128 //!< Bytes of the smallest size class, headers included. Must be a power of two
+#endif //LOCAL_MESSENGER_BUFFER_MIN_SIZE
+
+#ifndef LOCAL_MESSENGER_BUFFER_CLASSES
+#define LOCAL_MESSENGER_BUFFER_CLASSES 10 //!< Size classes, each double the last. Larger buffers come straight from malloc
+#endif //LOCAL_MESSENGER_BUFFER_CLASSES
+
+#ifndef LOCAL_MESSENGER_BUFFER_CACHE
+#define LOCAL_MESSENGER_BUFFER_CACHE 64 //!< Free buffers of a class a thread keeps before handing half of them to the shared list
+#endif //LOCAL_MESSENGER_BUFFER_CACHE
+
+typedef struct local_messenger_buffer_s
+{
+    struct local_messenger_buffer_s *next; //!< The next buffer on a free list
+    _Atomic uint32_t refs; //!< References held by the sender, the channels it is queued on and the callbacks keeping it
+    uint32_t size_class; //!< The size class. LOCAL_MESSENGER_BUFFER_CLASSES for a buffer too large to pool
+    long frame[]; //!< The message header and payload
+} local_messenger_buffer_s; //!< A pooled payload buffer
+
+/**
+ * @brief get the message a buffer is laid out as
+ * @param buffer the buffer
+ * @return ptr to the message. Its type is LOCAL_MESSAGE_TYPE_BUFFER
+ */
+static inline struct local_messanger_internal_message_s *local_messenger_buffer_msg(local_messenger_buffer_s *buffer)
+{
+    return (struct local_messanger_internal_message_s *)buffer->frame;
+}
+
+/**
+ * @brief get the buffer a message is laid out in
+ * @param msg the message from local_messenger_buffer_msg
+ * @return the buffer
+ */
+static inline local_messenger_buffer_s *local_messenger_buffer_from_msg(struct local_messanger_internal_message_s *msg)
+{
+    return (local_messenger_buffer_s *)(((char *)msg) - offsetof(local_messenger_buffer_s, frame));
+}
+
+/**
+ * @brief get the buffer holding a payload handed out by messenger_buffer_alloc
+ * @param payload the payload ptr
+ * @return the buffer
+ */
+local_messenger_buffer_s *local_messenger_buffer_from_payload(void *payload);
+
+/**
+ * @brief add references to a buffer. The caller must already hold one
+ * @param buffer the buffer
+ * @param count the number of references to add
+ */
+void local_messenger_buffer_retain(local_messenger_buffer_s *buffer, uint32_t count);
+
+/**
+ * @brief drop a reference to a buffer. The last one puts it back on the free list of the calling thread
+ * @param buffer the buffer
+ */
+void local_messenger_buffer_release(local_messenger_buffer_s *buffer);
+
+#endif /* SRC_PRIV_INC_LOCAL_MESSENGER_BUFFERS_H_ */
@@ -0,0 +1,96 @@
+/**
+ * @file local-messenger-conflation.h
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Table of the newest value of each key sent on a conflating channel. A send stores its
+ * value in the slot of its key and only puts a marker on the transport when the key had
+ * nothing waiting, so a burst of updates to one key costs one marker and one callback.
+ * The dispatch thread copies the value out when the marker comes round. Keys keep their
+ * slot for the life of the channel, so the table suits a fixed set of state keys. Once every
+ * slot is taken, new keys are left for the caller to send unconflated.
+ */
+
+#ifndef SRC_PRIV_INC_LOCAL_MESSENGER_CONFLATION_H_
+#define SRC_PRIV_INC_LOCAL_MESSENGER_CONFLATION_H_
+
+#include <local-messenger-message-types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifndef LOCAL_MESSENGER_MAX_CONFLATION_KEYS
+#define LOCAL_MESSENGER_MAX_CONFLATION_KEYS 1024 //!< Most keys a channel conflates. Must be a power of two
+#endif //LOCAL_MESSENGER_MAX_CONFLATION_KEYS
+
+enum local_messenger_conflation_put_e
+{
+    LOCAL_MESSENGER_CONFLATION_MARK, //!< The key had nothing waiting, so the caller has to put a marker on the transport
+    LOCAL_MESSENGER_CONFLATION_REPLACED, //!< An older value of the key was replaced
+    LOCAL_MESSENGER_CONFLATION_FULL //!< Every slot has another key. Nothing was stored
+}; //!< What storing a value did
+
+typedef struct local_messenger_conflation_entry_s
+{
+    uint32_t key; //!< The key of the slot
+    bool used; //!< Set once a key has the slot
+    bool pending; //!< Set while a value waits to be handed out. Its marker is on the transport
+    size_t capacity; //!< Bytes msg can hold
+    struct local_messanger_internal_message_s *msg; //!< The newest value. NULL until the first one
+} local_messenger_conflation_entry_s; //!< The value of a key
+
+typedef struct local_messenger_conflation_s
+{
+    pthread_mutex_t mutex; //!< Protects the rest of the table
+    local_messenger_conflation_entry_s *entries; //!< The slots, found by hashing the key. NULL until the first conflated send
+    uint32_t used; //!< Number of slots with a key
+} local_messenger_conflation_s; //!< The conflated values of a channel
+
+/**
+ * @brief set up an empty table. The slots are only allocated once a value is put
+ * @param conflation the table
+ */
+void local_messenger_conflation_init(local_messenger_conflation_s *conflation);
+
+/**
+ * @brief free a table and the values in it
+ * @param conflation the table
+ */
+void local_messenger_conflation_destroy(local_messenger_conflation_s *conflation);
+
+/**
+ * @brief store the newest value of a key. Called by any thread
+ * @param conflation the table
+ * @param header the header of the value, built by local_messenger_build_keyed_user_msg
+ * @param payload the value. header->message_size bytes long
+ * @return what storing the value did
+ */
+enum local_messenger_conflation_put_e local_messenger_conflation_put(local_messenger_conflation_s *conflation, const struct local_messenger_message_header_s *header, const void *payload);
+
+/**
+ * @brief take the value of a key out of the table. Only called by the dispatch thread when the marker of the key arrives
+ * @param conflation the table
+ * @param key the key
+ * @param msg buffer the value is copied into, as a keyed user message. Grown with realloc when the value does not fit
+ * @param capacity the size of the buffer. Updated when it grows
+ * @return false if the key had nothing waiting
+ */
+bool local_messenger_conflation_take(local_messenger_conflation_s *conflation, uint32_t key, struct local_messanger_internal_message_s **msg, size_t *capacity);
+
+/**
+ * @brief forget that a key has a marker on the transport, because sending the marker failed. The value is
+ * kept and goes out with the marker of the next value put for the key
+ * @param conflation the table
+ * @param key the key
+ */
+void local_messenger_conflation_unmark(local_messenger_conflation_s *conflation, uint32_t key);
+
+/**
+ * @brief drop every value waiting to be handed out. Only called once the dispatch thread has
+ * parked and the markers on the transport are gone
+ * @param conflation the table
+ */
+void local_messenger_conflation_drop(local_messenger_conflation_s *conflation);
+
+#endif /* SRC_PRIV_INC_LOCAL_MESSENGER_CONFLATION_H_ */
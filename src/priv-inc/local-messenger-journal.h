@@ -0,0 +1,126 @@
+/**
+ * @file local-messenger-journal.h
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Write ahead log of the messages sent on a channel, kept in a directory of memory mapped
+ * segment files. Senders append a record for each message before it goes on the transport
+ * and the dispatch thread marks the record acknowledged once the message has been handed
+ * out. A sync thread flushes the appends in groups, so one msync covers every message sent
+ * since the last one, and checkpoints the position everything before has been acknowledged
+ * so the segments behind it can be removed. Records still unacknowledged when the process
+ * dies are replayed the next time the journal is opened.
+ */
+
+#ifndef SRC_PRIV_INC_LOCAL_MESSENGER_JOURNAL_H_
+#define SRC_PRIV_INC_LOCAL_MESSENGER_JOURNAL_H_
+
+#include <local-messenger-message-types.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifndef LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS
+#define LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS 64 //!< Most segments kept at once. Appends wait for the oldest to be acknowledged past this
+#endif //LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS
+
+#ifndef LOCAL_MESSENGER_JOURNAL_SYNC_MS
+#define LOCAL_MESSENGER_JOURNAL_SYNC_MS 10 //!< Longest an append waits for the sync thread to flush it
+#endif //LOCAL_MESSENGER_JOURNAL_SYNC_MS
+
+#define LOCAL_MESSENGER_JOURNAL_PATH_LENGTH 256 //!< Longest journal directory including the terminator
+
+typedef bool (*local_messenger_journal_replay_cb)(void *context, uint64_t position, const struct local_messanger_internal_message_s *msg); //!< Function each unacknowledged record is replayed through. Returns false to stop the replay at the record
+
+typedef struct local_messenger_journal_s
+{
+    char path[LOCAL_MESSENGER_JOURNAL_PATH_LENGTH]; //!< The directory holding the segments and the checkpoint
+    uint64_t segment_size; //!< Size of each segment file in bytes
+    pthread_mutex_t mutex; //!< Serializes appends and protects the rest of the journal
+    pthread_cond_t cond; //!< Signaled when a sync finishes or a segment is removed
+    pthread_cond_t sync_cond; //!< Signaled to have the sync thread run now
+    _Atomic(uint8_t *) segments[LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS]; //!< The mapped segments indexed by segment number modulo LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS
+    uint64_t first_segment; //!< The oldest segment still on disk
+    uint64_t tail; //!< Where the next record goes
+    uint64_t synced; //!< Every record before this position is on disk
+    uint64_t sync_requested; //!< Position a caller is waiting on being synced
+    uint64_t checkpoint; //!< Every record before this position is acknowledged
+    uint64_t replay_end; //!< End of the records found when the journal was opened. 0 once they have been replayed
+    uint64_t replay_next; //!< Where the replay carries on from
+    uint64_t pin; //!< The checkpoint does not move past this while a replay walks the records. UINT64_MAX when nothing is pinned
+    int checkpoint_fd; //!< The checkpoint file
+    pthread_t sync_thread; //!< Flushes appends and moves the checkpoint on
+    bool stop; //!< Set to have the sync thread exit
+} local_messenger_journal_s; //!< The journal of a channel
+
+/**
+ * @brief open the journal in a directory, creating it if needed, and find the records a previous
+ * run left unacknowledged
+ * @param journal the journal to open
+ * @param path the directory
+ * @param segment_size the size of each segment file. Must be a power of two of at least a page and match the segments already there
+ */
+void local_messenger_journal_open(local_messenger_journal_s *journal, const char *path, uint64_t segment_size);
+
+/**
+ * @brief flush the journal and close it. Unacknowledged records stay on disk for the next open
+ * @param journal the journal
+ */
+void local_messenger_journal_close(local_messenger_journal_s *journal);
+
+/**
+ * @brief tell if a message goes in the journal. Internal actions, requests and replies only make sense to the process that sent them
+ * @param header the message header
+ * @return true if the message is journaled
+ */
+static inline bool local_messenger_journal_wants(const struct local_messenger_message_header_s *header)
+{
+    return (LOCAL_MESSAGE_TYPE_USR == header->type || LOCAL_MESSAGE_TYPE_USR_KEYED == header->type ||
+            LOCAL_MESSAGE_TYPE_PUBLISH == header->type || LOCAL_MESSAGE_TYPE_TYPED == header->type);
+}
+
+/**
+ * @brief append a message. Called by any thread. Waits while LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS segments hold unacknowledged records
+ * @param journal the journal
+ * @param header the message header
+ * @param payload the message payload. header->message_size bytes long
+ * @return the position of the record. Never 0
+ */
+uint64_t local_messenger_journal_append(local_messenger_journal_s *journal, const struct local_messenger_message_header_s *header, const void *payload);
+
+/**
+ * @brief append a message without waiting. Called by any thread, including one holding room
+ * on a transport the dispatch thread is stuck behind
+ * @param journal the journal
+ * @param header the message header
+ * @param payload the message payload. header->message_size bytes long
+ * @return the position of the record. 0 if LOCAL_MESSENGER_JOURNAL_MAX_SEGMENTS segments hold unacknowledged records
+ */
+uint64_t local_messenger_journal_try_append(local_messenger_journal_s *journal, const struct local_messenger_message_header_s *header, const void *payload);
+
+/**
+ * @brief mark a record acknowledged so it is not replayed. Called by any thread
+ * @param journal the journal
+ * @param position the position from local_messenger_journal_append
+ */
+void local_messenger_journal_ack(local_messenger_journal_s *journal, uint64_t position);
+
+/**
+ * @brief wait until every record appended before the call is on disk. Callers share the
+ * sync thread's next flush
+ * @param journal the journal
+ */
+void local_messenger_journal_sync(local_messenger_journal_s *journal);
+
+/**
+ * @brief run the records left unacknowledged by a previous run through a callback, oldest first.
+ * Records are only replayed once. A replay the callback stops carries on from the record it stopped at on the next call
+ * @param journal the journal
+ * @param cb called with the position and the message of each record. Returns false to stop at that record
+ * @param context passed to cb
+ * @return the number of records replayed
+ */
+unsigned int local_messenger_journal_replay(local_messenger_journal_s *journal, local_messenger_journal_replay_cb cb, void *context);
+
+#endif /* SRC_PRIV_INC_LOCAL_MESSENGER_JOURNAL_H_ */
@@ -0,0 +1,133 @@
+/**
+ * @file local-messenger-requests.h
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Table of the requests a channel is waiting on replies for. A correlation id is the
+ * slot of its request in the low 32 bits and the generation of the slot in the high 32
+ * bits, so a reply finds its request with one index and a stale reply, for a request
+ * that already timed out, finds a newer generation and is dropped. Any thread may open
+ * a request. Only the dispatch thread of the channel finds and closes them.
+ */
+
+#ifndef SRC_PRIV_INC_LOCAL_MESSENGER_REQUESTS_H_
+#define SRC_PRIV_INC_LOCAL_MESSENGER_REQUESTS_H_
+
+#include <local-messenger.h>
+#include <time-out-helper.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#ifndef LOCAL_MESSENGER_MAX_PENDING_REQUESTS
+#define LOCAL_MESSENGER_MAX_PENDING_REQUESTS 4096 //!< Most requests a channel can wait on replies for at once
+#endif //LOCAL_MESSENGER_MAX_PENDING_REQUESTS
+
+typedef struct local_messenger_request_entry_s
+{
+    uint64_t id; //!< Correlation id of the request in the slot. The generation moves on when the slot is closed
+    messenger_on_reply callback; //!< Called with the reply. NULL while the slot is free
+    void *context; //!< Passed to the callback
+    uint64_t deadline_ns; //!< When the request times out on CLOCK_MONOTONIC. TIME_OUT_HELPER_NEVER for never
+    time_out_helper_timer_s timer; //!< The timeout on the dispatch thread's timer wheel
+    uint32_t next_free; //!< The next free slot while this one is free
+    uint64_t dropped; //!< Correlation id of a reply that could not be sent. 0 for none. Protected by the mutex
+} local_messenger_request_entry_s; //!< A request waiting on its reply
+
+typedef struct local_messenger_requests_s
+{
+    pthread_mutex_t mutex; //!< Protects the free list and the allocation of the table
+    local_messenger_request_entry_s *entries; //!< The slots. NULL until the first request
+    time_out_helper_timer_cb expired; //!< Called when the timer of a request expires
+    void *expired_context; //!< Passed to expired
+    uint32_t free_head; //!< The first free slot. LOCAL_MESSENGER_MAX_PENDING_REQUESTS when the table is full
+    uint32_t pending; //!< Number of requests waiting on replies
+    _Atomic uint32_t dropped; //!< Number of slots with a dropped reply. Lets the dispatch thread skip the mutex while there are none
+} local_messenger_requests_s; //!< The requests of a channel
+
+/**
+ * @brief set up an empty table. The slots are only allocated once a request is opened
+ * @param requests the table
+ * @param expired called when the timer of a request expires
+ * @param context passed to expired
+ */
+void local_messenger_requests_init(local_messenger_requests_s *requests, time_out_helper_timer_cb expired, void *context);
+
+/**
+ * @brief free a table. Every request must have been closed
+ * @param requests the table
+ */
+void local_messenger_requests_destroy(local_messenger_requests_s *requests);
+
+/**
+ * @brief take a slot for a request. Called by any thread
+ * @param requests the table
+ * @param callback called with the reply
+ * @param context passed to the callback
+ * @param deadline_ns when the request times out on CLOCK_MONOTONIC. TIME_OUT_HELPER_NEVER for never
+ * @return the correlation id, 0 if every slot is taken
+ */
+uint64_t local_messenger_requests_open(local_messenger_requests_s *requests, messenger_on_reply callback, void *context, uint64_t deadline_ns);
+
+/**
+ * @brief find the request a correlation id belongs to. Only called by the dispatch thread
+ * @param requests the table
+ * @param id the correlation id
+ * @return the request, NULL if it was already closed
+ */
+local_messenger_request_entry_s *local_messenger_requests_find(local_messenger_requests_s *requests, uint64_t id);
+
+/**
+ * @brief give the slot of a request back. Only called by the dispatch thread, or once it has stopped.
+ * The timer must not be pending
+ * @param requests the table
+ * @param entry the request
+ */
+void local_messenger_requests_close(local_messenger_requests_s *requests, local_messenger_request_entry_s *entry);
+
+/**
+ * @brief note that the reply to a request could not be sent. Called by any thread
+ * @param requests the table
+ * @param id the correlation id
+ */
+void local_messenger_requests_drop(local_messenger_requests_s *requests, uint64_t id);
+
+/**
+ * @brief take a correlation id noted by local_messenger_requests_drop. Only called by the dispatch thread
+ * @param requests the table
+ * @return the correlation id, 0 once there are none left. The request may have ended already
+ */
+uint64_t local_messenger_requests_take_dropped(local_messenger_requests_s *requests);
+
+/**
+ * @brief end every open request with MESSENGER_REPLY_CANCELLED. Only called once the dispatch
+ * thread has stopped or parked and the timers of the requests are off the wheel
+ * @param requests the table
+ */
+void local_messenger_requests_cancel_all(local_messenger_requests_s *requests);
+
+/**
+ * @brief get the request of a timer
+ * @param timer the timer of a request
+ * @return the request
+ */
+local_messenger_request_entry_s *local_messenger_requests_from_timer(time_out_helper_timer_s *timer);
+
+/**
+ * @brief get a future for a request. Pass local_messenger_future_complete and the future as the
+ * callback and context of the request
+ * @return the future
+ */
+messenger_future_t *local_messenger_future_create(void);
+
+/**
+ * @brief the reply callback of a future. Keeps a copy of the reply and wakes the waiter
+ * @param context the future
+ * @param status how the request ended
+ * @param reply the reply. NULL unless status is MESSENGER_REPLY_OK
+ * @param reply_size the size of the reply
+ */
+void local_messenger_future_complete(void *context, enum messenger_reply_status_e status, void *reply, long reply_size);
+
+#endif /* SRC_PRIV_INC_LOCAL_MESSENGER_REQUESTS_H_ */
@@ -0,0 +1,227 @@
+/**
+ * @file local-messenger-ring.h
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Bounded lock free multi producer single consumer ring used as a transport for
+ * the messenger. The ring normally lives in the process, but it can also be placed
+ * in shared memory so producers in other processes can write to it directly. Records are stored back to back in a byte buffer
+ * with an 8 byte header. Producers reserve space with a compare and swap on the
+ * tail and publish a record by storing its length. The single consumer reads
+ * records in order and zeroes them before releasing the space.
+ */
+
+#ifndef SRC_PRIV_INC_LOCAL_MESSENGER_RING_H_
+#define SRC_PRIV_INC_LOCAL_MESSENGER_RING_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#ifndef __linux__
+#include <pthread.h>
+#endif //__linux__
+
+#ifndef LOCAL_MESSENGER_CACHE_LINE
+#define LOCAL_MESSENGER_CACHE_LINE 64
+#endif //LOCAL_MESSENGER_CACHE_LINE
+
+#define LOCAL_MESSENGER_RING_WAIT_FOREVER UINT64_MAX //!< Timeout that never passes
+
+typedef struct local_messenger_ring_state_s
+{
+    _Alignas(LOCAL_MESSENGER_CACHE_LINE) _Atomic uint64_t tail; //!< Next byte to reserve. Shared by all producers
+    _Alignas(LOCAL_MESSENGER_CACHE_LINE) _Atomic uint64_t head; //!< Start of the records still in use. Only written by the consumer
+    _Alignas(LOCAL_MESSENGER_CACHE_LINE) _Atomic uint32_t wake_seq; //!< Bumped each time the consumer is woken
+    _Atomic uint32_t sleeping; //!< Set while the consumer is parked
+} local_messenger_ring_state_s; //!< The part of a ring both sides write. Sits in front of the buffer for process shared rings
+
+typedef struct local_messenger_ring_s
+{
+    local_messenger_ring_state_s *state; //!< The shared state. Points at own_state unless the ring is process shared
+    struct local_messenger_ring_s *wake; //!< Ring holding the parking state of the consumer. The ring itself unless it shares a consumer
+    bool process_shared; //!< The ring lives in memory mapped by several processes
+    int wake_fd; //!< File descriptor written to wake the consumer instead of the futex. -1 to use the futex
+#ifndef __linux__
+    pthread_mutex_t wake_mutex; //!< Protects the parking of the consumer
+    pthread_cond_t wake_cond; //!< Signaled to unpark the consumer
+#endif //__linux__
+    uint8_t *buffer; //!< The record storage
+    uint64_t capacity; //!< Size of the buffer in bytes. Power of two
+    uint64_t mask; //!< capacity - 1
+    _Alignas(LOCAL_MESSENGER_CACHE_LINE) uint64_t read; //!< Next byte to read. Only used by the consumer
+    local_messenger_ring_state_s own_state; //!< The shared state of a ring private to the process
+} local_messenger_ring_s;
+
+/**
+ * @brief initialize a ring
+ * @param ring the ring to initialize
+ * @param capacity the size of the ring buffer in bytes. Must be a power of two
+ */
+void local_messenger_ring_init(local_messenger_ring_s *ring, uint64_t capacity);
+
+/**
+ * @brief get the bytes of shared memory a process shared ring takes up
+ * @param capacity the size of the ring buffer in bytes
+ * @return the size of the shared state and the buffer
+ */
+uint64_t local_messenger_ring_shared_size(uint64_t capacity);
+
+/**
+ * @brief initialize a ring kept in memory mapped by several processes.
+ * Only one process may consume from it. Any process that maps it may produce
+ * @param ring the process local handle of the ring
+ * @param capacity the size of the ring buffer in bytes. Must be a power of two
+ * @param memory local_messenger_ring_shared_size(capacity) bytes of cache line aligned shared memory
+ * @param create true to set up a new ring in the memory, false to use the ring another process set up
+ */
+void local_messenger_ring_init_shared(local_messenger_ring_s *ring, uint64_t capacity, void *memory, bool create);
+
+/**
+ * @brief release the resources held by a ring
+ * @param ring
+ */
+void local_messenger_ring_destroy(local_messenger_ring_s *ring);
+
+/**
+ * @brief get the largest record the ring can carry
+ * @param ring
+ * @return the max size in bytes
+ */
+uint64_t local_messenger_ring_max_record(const local_messenger_ring_s *ring);
+
+/**
+ * @brief get the number of bytes in use, committed or not. Safe to call from any thread
+ * @param ring
+ * @return the bytes in use
+ */
+uint64_t local_messenger_ring_used(local_messenger_ring_s *ring);
+
+/**
+ * @brief get the number of ring bytes a record takes up
+ * @param size the record size in bytes
+ * @return the size of the record with its header and alignment
+ */
+uint64_t local_messenger_ring_footprint(uint64_t size);
+
+/**
+ * @brief write a record into the ring. Safe to call from any thread.
+ * The record is gathered from a header and a body so callers do not have to assemble it first
+ * @param ring
+ * @param header the leading bytes of the record
+ * @param header_size the size of header in bytes
+ * @param body the rest of the record. May be NULL if body_size is 0
+ * @param body_size the size of body in bytes
+ * @return false if the ring does not have room for the record
+ */
+bool local_messenger_ring_write(local_messenger_ring_s *ring, const void *header, uint64_t header_size, const void *body, uint64_t body_size);
+
+/**
+ * @brief reserve space for a record so it can be written in place. Safe to call from any thread.
+ * The consumer stops at the record until it is committed, so commit it promptly
+ * @param ring
+ * @param size the record size in bytes
+ * @return ptr to where the record data goes, NULL if the ring does not have room for the record
+ */
+void *local_messenger_ring_reserve(local_messenger_ring_s *ring, uint64_t size);
+
+/**
+ * @brief reserve space for a run of records so they can be written in place. Safe to call from any thread.
+ * The records are placed back to back and cost a single reservation.
+ * The consumer stops at the first record until it is committed, so commit them promptly
+ * @param ring
+ * @param sizes the size in bytes of each record
+ * @param count the number of records
+ * @return ptr to where the first record's data goes, NULL if the ring does not have room for the records.
+ * Use local_messenger_ring_next_reserved to step to the following records
+ */
+void *local_messenger_ring_reserve_many(local_messenger_ring_s *ring, const uint64_t *sizes, unsigned int count);
+
+/**
+ * @brief step to the next record of a run reserved with local_messenger_ring_reserve_many
+ * @param record a record in the run
+ * @return ptr to where the next record's data goes
+ */
+void *local_messenger_ring_next_reserved(void *record);
+
+/**
+ * @brief publish a run of records reserved with local_messenger_ring_reserve_many to the consumer
+ * @param ring
+ * @param record the ptr returned by local_messenger_ring_reserve_many
+ * @param count the number of records in the run
+ */
+void local_messenger_ring_commit_many(local_messenger_ring_s *ring, void *record, unsigned int count);
+
+/**
+ * @brief publish a record reserved with local_messenger_ring_reserve to the consumer
+ * @param ring
+ * @param record the ptr returned by local_messenger_ring_reserve
+ */
+void local_messenger_ring_commit(local_messenger_ring_s *ring, void *record);
+
+/**
+ * @brief take the next record in the ring without copying it. Only call from the consumer.
+ * Calling it again moves on to the following record
+ * @param ring
+ * @param size set to the size of the record
+ * @return ptr to the record in the ring, NULL if the ring is empty.
+ * The records taken stay valid until local_messenger_ring_release is called
+ */
+void *local_messenger_ring_peek(local_messenger_ring_s *ring, uint64_t *size);
+
+/**
+ * @brief hand the space of every record taken with local_messenger_ring_peek back to the producers
+ * @param ring
+ */
+void local_messenger_ring_release(local_messenger_ring_s *ring);
+
+/**
+ * @brief park the consumer until the ring has a record in it
+ * @param ring
+ */
+void local_messenger_ring_wait(local_messenger_ring_s *ring);
+
+/**
+ * @brief have commits to a ring wake the consumer parked on another ring.
+ * Used when one consumer reads several rings with local_messenger_ring_wait_any
+ * @param ring the ring
+ * @param wake the ring the consumer parks on
+ */
+void local_messenger_ring_share_wake(local_messenger_ring_s *ring, local_messenger_ring_s *wake);
+
+/**
+ * @brief have the consumer of a ring be woken by a write to a file descriptor, such as an eventfd,
+ * instead of the futex. The consumer does not park. It calls local_messenger_ring_arm_any when it runs
+ * out of records and the first commit after that writes a 1 to the descriptor. Linux only
+ * @param ring the ring the consumer would park on
+ * @param fd the file descriptor. -1 to go back to the futex
+ */
+void local_messenger_ring_set_wake_fd(local_messenger_ring_s *ring, int fd);
+
+/**
+ * @brief ask for the next commit to any of several rings to write the wake file descriptor.
+ * rings[1] and up must share the wake of rings[0]
+ * @param rings the rings
+ * @param count the number of rings
+ * @return false if a record is already waiting, so the consumer should carry on instead of waiting on the descriptor
+ */
+bool local_messenger_ring_arm_any(local_messenger_ring_s *rings, unsigned int count);
+
+/**
+ * @brief park the consumer until any of several rings has a record in it.
+ * rings[1] and up must share the wake of rings[0]
+ * @param rings the rings
+ * @param count the number of rings
+ */
+void local_messenger_ring_wait_any(local_messenger_ring_s *rings, unsigned int count);
+
+/**
+ * @brief park the consumer until any of several rings has a record in it or the timeout passes.
+ * May return early, so check the rings after it returns. rings[1] and up must share the wake of rings[0]
+ * @param rings the rings
+ * @param count the number of rings
+ * @param timeout_ns the longest to wait. LOCAL_MESSENGER_RING_WAIT_FOREVER to not time out
+ */
+void local_messenger_ring_wait_any_timeout(local_messenger_ring_s *rings, unsigned int count, uint64_t timeout_ns);
+
+#endif /* SRC_PRIV_INC_LOCAL_MESSENGER_RING_H_ */
@@ -0,0 +1,92 @@
+/**
+ * @file local-messenger-shm.h
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Named shared memory holding the rings of a cross process channel. The process that
+ * creates the channel consumes the rings. Other processes map the same object by name
+ * and write into the rings directly. Producers waiting for room sleep on a futex in the
+ * mapping so the consumer can wake them from its own process.
+ */
+
+#ifndef SRC_PRIV_INC_LOCAL_MESSENGER_SHM_H_
+#define SRC_PRIV_INC_LOCAL_MESSENGER_SHM_H_
+
+#include <local-messenger-ring.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LOCAL_MESSENGER_SHM_NAME_LENGTH 64 //!< Longest shared memory object name including the terminator
+
+typedef struct local_messenger_shm_header_s
+{
+    uint32_t magic; //!< Identifies the mapping as a messenger channel
+    uint32_t lanes; //!< Number of rings in the mapping
+    uint64_t ring_size; //!< Size of each ring buffer in bytes
+    _Atomic uint32_t ready; //!< Set once the creator has set up the rings
+    _Alignas(LOCAL_MESSENGER_CACHE_LINE) _Atomic uint32_t space_seq; //!< Bumped each time the consumer frees up room for waiting producers
+    _Atomic uint32_t space_waiters; //!< Number of producers waiting for room, in any process
+} local_messenger_shm_header_s; //!< Placed at the start of the mapping, in front of the rings
+
+typedef struct local_messenger_shm_s
+{
+    local_messenger_shm_header_s *header; //!< The start of the mapping
+    size_t size; //!< Size of the mapping in bytes
+    bool owner; //!< Set in the process that created the object. It removes the name on close
+    char name[LOCAL_MESSENGER_SHM_NAME_LENGTH]; //!< The shared memory object name
+} local_messenger_shm_s; //!< A process's mapping of a channel
+
+/**
+ * @brief create the shared memory of a channel and set up its rings.
+ * A stale object left behind by a process that did not close its channel is replaced
+ * @param shm the mapping to create
+ * @param name the channel name
+ * @param rings the process local ring handles to set up. One per lane
+ * @param lanes the number of rings
+ * @param ring_size the size of each ring buffer in bytes. Must be a power of two
+ */
+void local_messenger_shm_create(local_messenger_shm_s *shm, const char *name, local_messenger_ring_s *rings, unsigned int lanes, uint64_t ring_size);
+
+/**
+ * @brief map the shared memory of a channel created by another process
+ * @param shm the mapping
+ * @param name the channel name
+ * @param rings the process local ring handles to set up. One per lane
+ * @param lanes the number of rings. Must match the creator
+ * @return false if there is no ready channel with that name
+ */
+bool local_messenger_shm_attach(local_messenger_shm_s *shm, const char *name, local_messenger_ring_s *rings, unsigned int lanes);
+
+/**
+ * @brief unmap the shared memory. The creator also removes the name so no new process can attach
+ * @param shm the mapping
+ */
+void local_messenger_shm_close(local_messenger_shm_s *shm);
+
+/**
+ * @brief get the current room sequence. Read it after counting yourself in space_waiters
+ * and before retrying the send, then pass it to local_messenger_shm_space_wait
+ * @param shm the mapping
+ * @return the sequence
+ */
+uint32_t local_messenger_shm_space_seq(local_messenger_shm_s *shm);
+
+/**
+ * @brief sleep until the consumer frees up room or the deadline passes
+ * @param shm the mapping
+ * @param seq the sequence from local_messenger_shm_space_seq
+ * @param deadline the absolute deadline on CLOCK_MONOTONIC
+ * @return false if the deadline passed
+ */
+bool local_messenger_shm_space_wait(local_messenger_shm_s *shm, uint32_t seq, const struct timespec *deadline);
+
+/**
+ * @brief wake every producer waiting for room
+ * @param shm the mapping
+ */
+void local_messenger_shm_space_wake(local_messenger_shm_s *shm);
+
+#endif /* SRC_PRIV_INC_LOCAL_MESSENGER_SHM_H_ */
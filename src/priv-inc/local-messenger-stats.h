@@ -0,0 +1,148 @@
+/**
+ * @file local-messenger-stats.h
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Statistics kept by a channel while it runs. The producer counters are split into cache
+ * line sized shards and each thread bumps the shard it was given with relaxed atomics, so
+ * producers on different cores do not fight over one line. A snapshot adds the shards up.
+ * The receive side counters are only written by the dispatch thread so they are plain
+ * loads and stores on a line of their own. With LOCAL_MESSENGER_STATS set to 0 the
+ * STATS_ macros compile to nothing and their arguments are never evaluated.
+ */
+
+#ifndef SRC_PRIV_INC_LOCAL_MESSENGER_STATS_H_
+#define SRC_PRIV_INC_LOCAL_MESSENGER_STATS_H_
+
+#include <local-messenger.h>
+#include <local-messenger-ring.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef LOCAL_MESSENGER_STATS_SHARDS
+#define LOCAL_MESSENGER_STATS_SHARDS 8 //!< Number of counter shards per channel. Threads beyond this share shards
+#endif //LOCAL_MESSENGER_STATS_SHARDS
+
+enum local_messenger_stats_counter_e
+{
+    LOCAL_MESSENGER_STATS_SENT, //!< User messages put on the transport
+    LOCAL_MESSENGER_STATS_BYTES_SENT, //!< Payload bytes of the messages sent
+    LOCAL_MESSENGER_STATS_RETRIES, //!< Sends that found the transport full and tried again
+    LOCAL_MESSENGER_STATS_WOULD_BLOCK, //!< Sends that gave up without waiting
+    LOCAL_MESSENGER_STATS_TIMEOUTS, //!< Sends that gave up at their deadline
+    LOCAL_MESSENGER_STATS_CONFLATED, //!< Conflated sends that replaced a value still waiting to be handed out
+    LOCAL_MESSENGER_STATS_COUNTERS
+}; //!< The counters kept in each shard
+
+extern _Thread_local unsigned int local_messenger_stats_thread_shard; //!< The shard of the calling thread plus one. 0 until it first counts something
+
+typedef struct local_messenger_stats_histogram_s
+{
+    _Atomic uint64_t count; //!< Number of samples
+    _Atomic uint64_t sum_ns; //!< Sum of the samples
+    _Atomic uint64_t max_ns; //!< The largest sample
+    _Atomic uint64_t buckets[MESSENGER_HISTOGRAM_BUCKETS]; //!< Sample counts by bucket
+} local_messenger_stats_histogram_s; //!< A histogram that can be added to from many threads
+
+typedef struct local_messenger_stats_shard_s
+{
+    _Alignas(LOCAL_MESSENGER_CACHE_LINE) _Atomic uint64_t counters[LOCAL_MESSENGER_STATS_COUNTERS]; //!< Indexed by local_messenger_stats_counter_e
+} local_messenger_stats_shard_s; //!< One cache line of counters
+
+typedef struct local_messenger_stats_s
+{
+    local_messenger_stats_shard_s shards[LOCAL_MESSENGER_STATS_SHARDS]; //!< The producer counter shards
+    _Alignas(LOCAL_MESSENGER_CACHE_LINE) _Atomic uint64_t received; //!< User messages taken off the transport. Only written by the dispatch thread
+    _Atomic uint64_t bytes_received; //!< Payload bytes of the messages received. Only written by the dispatch thread
+    _Atomic uint64_t peak_queue_bytes; //!< The most bytes the dispatch thread has seen in the transport. Only written by the dispatch thread
+    _Atomic uint64_t rejected; //!< Typed messages dropped without a handler to take them. Only written by the dispatch thread
+    local_messenger_stats_histogram_s latency; //!< Send to callback latency. Written by the threads running callbacks
+    local_messenger_stats_histogram_s callback_duration; //!< Time spent in callbacks
+} local_messenger_stats_s; //!< The statistics of a channel. All zero is a valid empty state
+
+#if LOCAL_MESSENGER_STATS
+#define STATS_ADD(stats, counter, value) local_messenger_stats_add((stats), (counter), (value))
+#define STATS_RECEIVED(stats, bytes) local_messenger_stats_received((stats), (bytes))
+#define STATS_PEAK(stats, value) local_messenger_stats_peak((stats), (value))
+#define STATS_REJECTED(stats) local_messenger_stats_rejected((stats))
+#define STATS_RECORD(histogram, value, shared) local_messenger_stats_record((histogram), (value), (shared))
+#else
+#define STATS_ADD(stats, counter, value)
+#define STATS_RECEIVED(stats, bytes)
+#define STATS_PEAK(stats, value)
+#define STATS_REJECTED(stats)
+#define STATS_RECORD(histogram, value, shared)
+#endif //LOCAL_MESSENGER_STATS
+
+/**
+ * @brief give the calling thread a shard
+ * @return the shard index plus one
+ */
+unsigned int local_messenger_stats_assign_shard(void);
+
+/**
+ * @brief add to a counter in the shard of the calling thread
+ * @param stats the channel statistics
+ * @param counter the counter
+ * @param value the amount to add
+ */
+static inline void local_messenger_stats_add(local_messenger_stats_s *stats, enum local_messenger_stats_counter_e counter, uint64_t value)
+{
+    unsigned int shard = local_messenger_stats_thread_shard;
+    if(0 == shard)
+    {
+        shard = local_messenger_stats_assign_shard();
+    }
+    atomic_fetch_add_explicit(&stats->shards[shard - 1].counters[counter], value, memory_order_relaxed);
+}
+
+/**
+ * @brief count a message taken off the transport. Only called by the dispatch thread
+ * @param stats the channel statistics
+ * @param bytes the payload size
+ */
+static inline void local_messenger_stats_received(local_messenger_stats_s *stats, uint64_t bytes)
+{
+    atomic_store_explicit(&stats->received, atomic_load_explicit(&stats->received, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&stats->bytes_received, atomic_load_explicit(&stats->bytes_received, memory_order_relaxed) + bytes, memory_order_relaxed);
+}
+
+/**
+ * @brief raise the peak queue bytes if value is above it. Only called by the dispatch thread
+ * @param stats the channel statistics
+ * @param value the bytes in the transport now
+ */
+static inline void local_messenger_stats_peak(local_messenger_stats_s *stats, uint64_t value)
+{
+    if(value > atomic_load_explicit(&stats->peak_queue_bytes, memory_order_relaxed))
+    {
+        atomic_store_explicit(&stats->peak_queue_bytes, value, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief count a typed message dropped without a handler. Only called by the dispatch thread
+ * @param stats the channel statistics
+ */
+static inline void local_messenger_stats_rejected(local_messenger_stats_s *stats)
+{
+    atomic_store_explicit(&stats->rejected, atomic_load_explicit(&stats->rejected, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+/**
+ * @brief add a sample to a histogram
+ * @param histogram the histogram
+ * @param value_ns the sample in nanoseconds
+ * @param shared true if other threads may add samples at the same time. A single writer skips the locked instructions
+ */
+void local_messenger_stats_record(local_messenger_stats_histogram_s *histogram, uint64_t value_ns, bool shared);
+
+/**
+ * @brief add the shards of the statistics up into a snapshot. queue_bytes is left for the caller
+ * @param stats the channel statistics
+ * @param snapshot filled with the totals
+ */
+void local_messenger_stats_snapshot(local_messenger_stats_s *stats, messenger_stats_s *snapshot);
+
+#endif /* SRC_PRIV_INC_LOCAL_MESSENGER_STATS_H_ */
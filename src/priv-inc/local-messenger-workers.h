@@ -0,0 +1,80 @@
+/**
+ * @file local-messenger-workers.h
+ * @author Kade Cox
+ * @date Created: Mar 6, 2020
+ * @details
+ * Pool of worker threads the messenger hands received messages to. Each worker
+ * owns a pinned queue for keyed messages, which only that worker runs so messages
+ * with the same key stay in order, and a shared queue for unkeyed messages that
+ * idle workers steal from.
+ */
+
+#ifndef SRC_PRIV_INC_LOCAL_MESSENGER_WORKERS_H_
+#define SRC_PRIV_INC_LOCAL_MESSENGER_WORKERS_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <local-messenger-message-types.h>
+
+typedef void (*local_messenger_work_handler)(void *context, struct local_messanger_internal_message_s *msg); //!< Function the workers run each message through
+
+typedef struct local_messenger_work_s
+{
+    struct local_messenger_work_s *next; //!< The next message in the queue
+    long frame[]; //!< Copy of the message header and payload
+} local_messenger_work_s; //!< A message waiting on a worker
+
+typedef struct local_messenger_work_queue_s
+{
+    local_messenger_work_s *head; //!< Oldest message
+    local_messenger_work_s *tail; //!< Newest message
+} local_messenger_work_queue_s; //!< FIFO of messages
+
+typedef struct local_messenger_worker_s
+{
+    pthread_mutex_t mutex; //!< Protects the queues of this worker
+    pthread_cond_t cond; //!< Signaled when work is added to a sleeping worker
+    local_messenger_work_queue_s pinned; //!< Keyed messages. Only run by this worker
+    local_messenger_work_queue_s shared; //!< Unkeyed messages. Other workers may steal these
+    _Atomic bool sleeping; //!< Set while the worker waits for work
+    pthread_t thread; //!< The worker thread
+    struct local_messenger_workers_s *pool; //!< The pool the worker belongs to
+    unsigned int index; //!< Index of the worker in the pool
+} local_messenger_worker_s; //!< A worker thread and its queues
+
+typedef struct local_messenger_workers_s
+{
+    local_messenger_worker_s *workers; //!< The workers
+    unsigned int count; //!< Number of workers. 0 when the pool is not running
+    unsigned int next; //!< Worker the next unkeyed message goes to when none are idle
+    _Atomic bool stop; //!< Set to have the workers exit once their queues are empty
+    local_messenger_work_handler handler; //!< The function messages are run through
+    void *context; //!< Passed to the handler
+} local_messenger_workers_s; //!< A pool of workers
+
+/**
+ * @brief start a pool of workers
+ * @param pool the pool to start
+ * @param count the number of worker threads
+ * @param handler the function messages are run through
+ * @param context passed to the handler
+ */
+void local_messenger_workers_init(local_messenger_workers_s *pool, unsigned int count, local_messenger_work_handler handler, void *context);
+
+/**
+ * @brief run every queued message, then stop and join the workers
+ * @param pool the pool to stop
+ */
+void local_messenger_workers_destroy(local_messenger_workers_s *pool);
+
+/**
+ * @brief queue a copy of a message on the pool. Only one thread may submit to a pool.
+ * LOCAL_MESSAGE_TYPE_USR_KEYED messages run on the worker owning their key, after earlier messages with the same key
+ * @param pool the pool
+ * @param msg the message
+ */
+void local_messenger_workers_submit(local_messenger_workers_s *pool, const struct local_messanger_internal_message_s *msg);
+
+#endif /* SRC_PRIV_INC_LOCAL_MESSENGER_WORKERS_H_ */
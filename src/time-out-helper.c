@@ -6,10 +6,21 @@
  *
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif //__linux__
+
 #include <time-out-helper.h>
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#include <cpuid.h>
+#define TIME_OUT_HELPER_HAS_TSC
+#endif //__x86_64__
 
 /***********************************************************************************/
 /***************************** Defines and Macros **********************************/
@@ -18,10 +29,35 @@
 //Macro that gets the number of elements supported by the array
 #define ARRAY_MAX_COUNT(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
 
+#define NS_PER_SEC 1000000000ULL
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define COARSE_CLOCK_ID CLOCK_MONOTONIC_COARSE
+#else
+#define COARSE_CLOCK_ID CLOCK_MONOTONIC
+#endif //CLOCK_MONOTONIC_COARSE
+
+#ifndef TIME_OUT_HELPER_TSC_CALIBRATION_NS
+#define TIME_OUT_HELPER_TSC_CALIBRATION_NS (10 * TIME_OUT_HELPER_NS_PER_MS) //!< How long the TSC is measured against CLOCK_MONOTONIC
+#endif //TIME_OUT_HELPER_TSC_CALIBRATION_NS
+
+#define TSC_SCALE_SHIFT 32 //!< Fixed point shift of the TSC conversion factors
+
+#define WHEEL_SLOT_MASK ((uint64_t)TIME_OUT_HELPER_WHEEL_SLOTS - 1)
+#define WHEEL_LEVEL_SHIFT(level) ((level) * TIME_OUT_HELPER_WHEEL_SLOT_BITS)
+#define WHEEL_MAX_DELTA ((1ULL << WHEEL_LEVEL_SHIFT(TIME_OUT_HELPER_WHEEL_LEVELS)) - 1) //!< Furthest out a timer can be, in ticks
+
 /***********************************************************************************/
 /***************************** Type Defs *******************************************/
 /***********************************************************************************/
 
+struct time_out_helper_tsc_s
+{
+    bool usable; //!< The TSC is invariant and calibrated
+    uint64_t ns_per_tick; //!< Nanoseconds per tick, fixed point with TSC_SCALE_SHIFT fraction bits
+    uint64_t ticks_per_ns; //!< Ticks per nanosecond, fixed point with TSC_SCALE_SHIFT fraction bits
+}; //!< Calibration of the time stamp counter
+
 /***********************************************************************************/
 /***************************** Function Declarations *******************************/
 /***********************************************************************************/
@@ -30,21 +66,153 @@
 /***************************** Static Variables ************************************/
 /***********************************************************************************/
 
+static pthread_once_t tsc_once = PTHREAD_ONCE_INIT; //!< Calibrates the TSC on first use
+static struct time_out_helper_tsc_s tsc_data; //!< The TSC calibration
+
 /***********************************************************************************/
 /***************************** Function Definitions ********************************/
 /***********************************************************************************/
 
+/**
+ * @brief read a POSIX clock in nanoseconds
+ * @param clock_id the clock to read
+ * @return the time in nanoseconds
+ */
+static inline uint64_t read_clock_ns(clockid_t clock_id)
+{
+    struct timespec now;
+    int rv = clock_gettime(clock_id, &now);
+    assert(0 == rv);
+    (void)rv;
+    return ((uint64_t)now.tv_sec * NS_PER_SEC) + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief scale a value by a fixed point TSC conversion factor
+ * @param value the value to scale
+ * @param factor the factor with TSC_SCALE_SHIFT fraction bits
+ * @return the scaled value
+ */
+static inline uint64_t tsc_scale(uint64_t value, uint64_t factor)
+{
+#ifdef TIME_OUT_HELPER_HAS_TSC
+    return (uint64_t)(((unsigned __int128)value * factor) >> TSC_SCALE_SHIFT);
+#else
+    return value;
+#endif //TIME_OUT_HELPER_HAS_TSC
+}
+
+#ifdef TIME_OUT_HELPER_HAS_TSC
+/**
+ * @brief check if the TSC ticks at a constant rate in every power state
+ * @return true if the TSC is invariant
+ */
+static bool tsc_is_invariant(void)
+{
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+    if(0 == __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+    return (0 != (edx & (1U << 8)));
+}
+#endif //TIME_OUT_HELPER_HAS_TSC
+
+/**
+ * @brief measure the TSC rate against CLOCK_MONOTONIC
+ */
+static void tsc_calibrate(void)
+{
+    memset(&tsc_data, 0, sizeof(tsc_data));
+#ifdef TIME_OUT_HELPER_HAS_TSC
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t start_ticks;
+    uint64_t end_ticks;
+    if(false == tsc_is_invariant())
+    {
+        return;
+    }
+    start_ns = read_clock_ns(CLOCK_MONOTONIC);
+    start_ticks = __rdtsc();
+    do
+    {
+        end_ns = read_clock_ns(CLOCK_MONOTONIC);
+    } while(end_ns - start_ns < TIME_OUT_HELPER_TSC_CALIBRATION_NS);
+    end_ticks = __rdtsc();
+    if(end_ticks <= start_ticks)
+    {
+        return;
+    }
+    tsc_data.ns_per_tick = (uint64_t)(((unsigned __int128)(end_ns - start_ns) << TSC_SCALE_SHIFT) / (end_ticks - start_ticks));
+    tsc_data.ticks_per_ns = (uint64_t)(((unsigned __int128)(end_ticks - start_ticks) << TSC_SCALE_SHIFT) / (end_ns - start_ns));
+    tsc_data.usable = (0 != tsc_data.ns_per_tick && 0 != tsc_data.ticks_per_ns);
+#endif //TIME_OUT_HELPER_HAS_TSC
+}
+
+/**
+ * @brief get the TSC calibration, calibrating on first use
+ * @return true if the TSC can be used
+ */
+static inline bool tsc_usable(void)
+{
+    pthread_once(&tsc_once, tsc_calibrate);
+    return tsc_data.usable;
+}
 
 /**
- * @brief Function that initializes a timeout helper instance
+ * @brief read a clock in its own units
+ * @param clock the clock. TIME_OUT_HELPER_CLOCK_TSC must only be passed when the TSC is usable
+ * @return ticks for the TSC, nanoseconds otherwise
+ */
+static inline uint64_t read_clock_raw(enum time_out_helper_clock_e clock)
+{
+    switch(clock)
+    {
+#ifdef TIME_OUT_HELPER_HAS_TSC
+        case TIME_OUT_HELPER_CLOCK_TSC:
+            return __rdtsc();
+#endif //TIME_OUT_HELPER_HAS_TSC
+        case TIME_OUT_HELPER_CLOCK_COARSE:
+            return read_clock_ns(COARSE_CLOCK_ID);
+        default:
+            return read_clock_ns(CLOCK_MONOTONIC);
+    }
+}
+
+/**
+ * @brief Function that initializes a timeout helper instance on CLOCK_MONOTONIC
  * @param data the instance data to initialize
  * @param timeout_ms timeout occurs after this many milliseconds
  */
 void time_out_helper_init(time_out_helper_data_s *data, uint64_t timeout_ms)
+{
+    time_out_helper_init_ns(data, timeout_ms * TIME_OUT_HELPER_NS_PER_MS, TIME_OUT_HELPER_CLOCK_MONOTONIC);
+}
+
+/**
+ * @brief Function that initializes a timeout helper instance on a chosen clock
+ * @param data the instance data to initialize
+ * @param timeout_ns timeout occurs after this many nanoseconds
+ * @param clock the clock to measure the timeout on
+ */
+void time_out_helper_init_ns(time_out_helper_data_s *data, uint64_t timeout_ns, enum time_out_helper_clock_e clock)
 {
     assert(NULL != data);
-    assert(0 == gettimeofday(&data->init_time, NULL));
-    data->timeout_ms = timeout_ms;
+    if(TIME_OUT_HELPER_CLOCK_TSC == clock && false == tsc_usable())
+    {
+        clock = TIME_OUT_HELPER_CLOCK_MONOTONIC;
+    }
+    data->clock = clock;
+    if(TIME_OUT_HELPER_CLOCK_TSC == clock)
+    {
+        //Keep the deadline in ticks so the check does not have to convert
+        timeout_ns = tsc_scale(timeout_ns, tsc_data.ticks_per_ns);
+    }
+    data->deadline = read_clock_raw(clock) + timeout_ns;
 }
 
 /**
@@ -52,29 +220,332 @@ void time_out_helper_init(time_out_helper_data_s *data, uint64_t timeout_ms)
  * @param data the instance data
  * @return true if the time has elapsed, false otherwise
  */
-bool time_out_helper_check(time_out_helper_data_s *data)
+bool time_out_helper_check(const time_out_helper_data_s *data)
 {
-    int result;
-    static const uint64_t ms_per_sec = 1000;
-    static const uint64_t us_per_ms = 1000;
-    struct timeval current;
-    struct timeval diff;
-    uint64_t elapsed_ms;
-    uint64_t typed_s;
-    uint64_t typed_us;
     assert(NULL != data);
-    //Get the Current Time
-    assert(0 == gettimeofday(&current, NULL));
-    result = timercmp(&current, &data->init_time, >=);
-    assert(0 != result); //Check to make sure the current time is larger than the start time
-    timersub(&current, &data->init_time, &diff);
-    //Now convert to ms
-    typed_s = diff.tv_sec;
-    typed_us = diff.tv_usec;
-    elapsed_ms = (ms_per_sec * typed_s) + (typed_us / us_per_ms);
-    if(elapsed_ms >= data->timeout_ms)
-    {
-        return true;
-    }
-    return false;
+    return (read_clock_raw(data->clock) >= data->deadline);
+}
+
+/**
+ * @brief Function that gets the time left before the timeout elapses
+ * @param data the instance data
+ * @return the nanoseconds left, 0 once the time has elapsed
+ */
+uint64_t time_out_helper_remaining_ns(const time_out_helper_data_s *data)
+{
+    uint64_t now;
+    uint64_t remaining;
+    assert(NULL != data);
+    now = read_clock_raw(data->clock);
+    if(now >= data->deadline)
+    {
+        return 0;
+    }
+    remaining = data->deadline - now;
+    if(TIME_OUT_HELPER_CLOCK_TSC == data->clock)
+    {
+        remaining = tsc_scale(remaining, tsc_data.ns_per_tick);
+    }
+    return remaining;
+}
+
+/**
+ * @brief Function that reads a clock
+ * @param clock the clock to read
+ * @return the time in nanoseconds from an arbitrary start point
+ */
+uint64_t time_out_helper_now_ns(enum time_out_helper_clock_e clock)
+{
+    if(TIME_OUT_HELPER_CLOCK_TSC == clock)
+    {
+        if(false == tsc_usable())
+        {
+            return read_clock_ns(CLOCK_MONOTONIC);
+        }
+        return tsc_scale(read_clock_raw(clock), tsc_data.ns_per_tick);
+    }
+    return read_clock_raw(clock);
+}
+
+/**
+ * @brief hang a timer off the slot its expiry tick falls in
+ * @param wheel
+ * @param timer
+ */
+static void wheel_link(time_out_helper_wheel_s *wheel, time_out_helper_timer_s *timer)
+{
+    time_out_helper_timer_s **slot;
+    uint64_t delta;
+    unsigned int level;
+    if(timer->expires < wheel->current)
+    {
+        timer->expires = wheel->current;
+    }
+    delta = timer->expires - wheel->current;
+    if(delta > WHEEL_MAX_DELTA)
+    {
+        delta = WHEEL_MAX_DELTA;
+        timer->expires = wheel->current + delta;
+    }
+    for(level = 0; level < TIME_OUT_HELPER_WHEEL_LEVELS - 1; level++)
+    {
+        if(delta < (1ULL << WHEEL_LEVEL_SHIFT(level + 1)))
+        {
+            break;
+        }
+    }
+    slot = &wheel->slots[level][(timer->expires >> WHEEL_LEVEL_SHIFT(level)) & WHEEL_SLOT_MASK];
+    timer->next = slot[0];
+    if(NULL != timer->next)
+    {
+        timer->next->pprev = &timer->next;
+    }
+    slot[0] = timer;
+    timer->pprev = slot;
+}
+
+/**
+ * @brief take a timer out of the list it is in
+ * @param timer
+ */
+static inline void wheel_unlink(time_out_helper_timer_s *timer)
+{
+    timer->pprev[0] = timer->next;
+    if(NULL != timer->next)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * @brief move the timers of a slot down to the levels their expiry is now close enough for
+ * @param wheel
+ * @param level the level of the slot
+ * @param index the slot
+ */
+static void wheel_cascade(time_out_helper_wheel_s *wheel, unsigned int level, uint64_t index)
+{
+    time_out_helper_timer_s *timer = wheel->slots[level][index];
+    time_out_helper_timer_s *next;
+    wheel->slots[level][index] = NULL;
+    while(NULL != timer)
+    {
+        next = timer->next;
+        wheel_link(wheel, timer);
+        timer = next;
+    }
+}
+
+/**
+ * @brief get the next tick that has to be processed, either for a timer or to cascade the upper levels
+ * @param wheel
+ * @return the tick
+ */
+static uint64_t wheel_next_tick(const time_out_helper_wheel_s *wheel)
+{
+    uint64_t tick = wheel->current;
+    if(0 == (tick & WHEEL_SLOT_MASK))
+    {
+        return tick;
+    }
+    do
+    {
+        if(NULL != wheel->slots[0][tick & WHEEL_SLOT_MASK])
+        {
+            return tick;
+        }
+        tick++;
+    } while(0 != (tick & WHEEL_SLOT_MASK));
+    return tick;
+}
+
+/**
+ * @brief expire the current tick and move on to the next one
+ * @param wheel
+ * @return the number of timers that expired
+ */
+static unsigned int wheel_expire_tick(time_out_helper_wheel_s *wheel)
+{
+    time_out_helper_timer_s *expired;
+    time_out_helper_timer_s *timer;
+    uint64_t index = wheel->current & WHEEL_SLOT_MASK;
+    unsigned int count = 0;
+    //Each time a level wraps the next slot of the level above comes down
+    for(unsigned int level = 1; 0 == index && level < TIME_OUT_HELPER_WHEEL_LEVELS; level++)
+    {
+        index = (wheel->current >> WHEEL_LEVEL_SHIFT(level)) & WHEEL_SLOT_MASK;
+        wheel_cascade(wheel, level, index);
+    }
+    index = wheel->current & WHEEL_SLOT_MASK;
+    expired = wheel->slots[0][index];
+    wheel->slots[0][index] = NULL;
+    if(NULL != expired)
+    {
+        expired->pprev = &expired;
+    }
+    //Move on first so timers added again from a callback land on a later tick
+    wheel->current++;
+    while(NULL != expired)
+    {
+        timer = expired;
+        wheel_unlink(timer);
+        wheel->pending--;
+        count++;
+        timer->callback(timer, timer->context);
+    }
+    return count;
+}
+
+/**
+ * @brief Function that initializes a timer wheel
+ * @param wheel the wheel to initialize
+ * @param tick_ns the resolution of the wheel in nanoseconds. Timers expire on a tick boundary, never early
+ */
+void time_out_helper_wheel_init(time_out_helper_wheel_s *wheel, uint64_t tick_ns)
+{
+    assert(NULL != wheel);
+    assert(0 < tick_ns);
+    memset(wheel, 0, sizeof(time_out_helper_wheel_s));
+    wheel->tick_ns = tick_ns;
+    wheel->start_ns = time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC);
+}
+
+/**
+ * @brief Function that initializes a timer
+ * @param timer the timer to initialize
+ * @param callback called when the timer expires
+ * @param context passed to the callback
+ */
+void time_out_helper_timer_init(time_out_helper_timer_s *timer, time_out_helper_timer_cb callback, void *context)
+{
+    assert(NULL != timer);
+    assert(NULL != callback);
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->context = context;
+}
+
+/**
+ * @brief Function that adds a timer to a wheel. O(1)
+ * @param wheel the wheel
+ * @param timer the timer. Must not already be pending
+ * @param deadline_ns when the timer expires, on time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC)
+ */
+void time_out_helper_wheel_add(time_out_helper_wheel_s *wheel, time_out_helper_timer_s *timer, uint64_t deadline_ns)
+{
+    assert(NULL != wheel);
+    assert(NULL != timer);
+    assert(NULL == timer->pprev);
+    timer->expires = 0;
+    if(deadline_ns > wheel->start_ns)
+    {
+        //Round up so the timer never goes off before its deadline
+        timer->expires = (deadline_ns - wheel->start_ns + wheel->tick_ns - 1) / wheel->tick_ns;
+    }
+    wheel_link(wheel, timer);
+    wheel->pending++;
+}
+
+/**
+ * @brief Function that takes a pending timer off a wheel. O(1)
+ * @param wheel the wheel
+ * @param timer the timer. Does nothing if it is not pending
+ */
+void time_out_helper_wheel_cancel(time_out_helper_wheel_s *wheel, time_out_helper_timer_s *timer)
+{
+    assert(NULL != wheel);
+    assert(NULL != timer);
+    if(NULL != timer->pprev)
+    {
+        wheel_unlink(timer);
+        wheel->pending--;
+    }
+}
+
+/**
+ * @brief Function that checks if a timer is on a wheel
+ * @param timer the timer
+ * @return true if the timer is waiting to expire
+ */
+bool time_out_helper_timer_pending(const time_out_helper_timer_s *timer)
+{
+    assert(NULL != timer);
+    return (NULL != timer->pprev);
+}
+
+/**
+ * @brief Function that expires every timer due by a given time and calls their callbacks
+ * @param wheel the wheel
+ * @param now_ns the time on time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC)
+ * @return the number of timers that expired
+ */
+unsigned int time_out_helper_wheel_advance(time_out_helper_wheel_s *wheel, uint64_t now_ns)
+{
+    uint64_t target;
+    uint64_t next;
+    unsigned int count = 0;
+    assert(NULL != wheel);
+    if(now_ns < wheel->start_ns)
+    {
+        return 0;
+    }
+    target = (now_ns - wheel->start_ns) / wheel->tick_ns;
+    while(wheel->current <= target)
+    {
+        next = wheel_next_tick(wheel);
+        if(0 == wheel->pending || next > target)
+        {
+            //Nothing to do on the ticks in between
+            wheel->current = target + 1;
+            break;
+        }
+        wheel->current = next;
+        count += wheel_expire_tick(wheel);
+    }
+    return count;
+}
+
+/**
+ * @brief Function that gets when the wheel next needs advancing
+ * @param wheel the wheel
+ * @return the time on time_out_helper_now_ns(TIME_OUT_HELPER_CLOCK_MONOTONIC), TIME_OUT_HELPER_NEVER if no timers are pending.
+ * This is never later than the earliest timer but may be earlier when timers have to move down a level
+ */
+uint64_t time_out_helper_wheel_next_deadline(const time_out_helper_wheel_s *wheel)
+{
+    assert(NULL != wheel);
+    if(0 == wheel->pending)
+    {
+        return TIME_OUT_HELPER_NEVER;
+    }
+    return wheel->start_ns + (wheel_next_tick(wheel) * wheel->tick_ns);
+}
+
+/**
+ * @brief Function that takes any one timer off a wheel without expiring it. Used to tear a wheel down
+ * @param wheel the wheel
+ * @return the timer, NULL if no timers are pending
+ */
+time_out_helper_timer_s *time_out_helper_wheel_take_any(time_out_helper_wheel_s *wheel)
+{
+    time_out_helper_timer_s *timer;
+    assert(NULL != wheel);
+    for(unsigned int level = 0; level < TIME_OUT_HELPER_WHEEL_LEVELS && 0 < wheel->pending; level++)
+    {
+        for(unsigned int index = 0; index < TIME_OUT_HELPER_WHEEL_SLOTS; index++)
+        {
+            timer = wheel->slots[level][index];
+            if(NULL != timer)
+            {
+                wheel_unlink(timer);
+                wheel->pending--;
+                return timer;
+            }
+        }
+    }
+    return NULL;
 }